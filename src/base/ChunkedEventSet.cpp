@@ -0,0 +1,378 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "ChunkedEventSet.h"
+#include "Exception.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace Rosegarden
+{
+
+
+ChunkedEventSet::ChunkedEventSet() :
+    m_size(0),
+    m_epoch(0)
+{
+}
+
+ChunkedEventSet::ChunkedEventSet(const ChunkedEventSet &other) :
+    m_size(0),
+    m_epoch(0)
+{
+    copyFrom(other);
+}
+
+ChunkedEventSet &
+ChunkedEventSet::operator=(const ChunkedEventSet &other)
+{
+    if (&other != this) {
+        clear();
+        copyFrom(other);
+    }
+    return *this;
+}
+
+ChunkedEventSet::~ChunkedEventSet()
+{
+    clear();
+}
+
+void
+ChunkedEventSet::copyFrom(const ChunkedEventSet &other)
+{
+    m_chunks.reserve(other.m_chunks.size());
+    for (size_t c = 0; c < other.m_chunks.size(); ++c) {
+        m_chunks.push_back(new Chunk(*other.m_chunks[c]));
+    }
+    m_size = other.m_size;
+    ++m_epoch;
+}
+
+void
+ChunkedEventSet::clear()
+{
+    for (size_t c = 0; c < m_chunks.size(); ++c) delete m_chunks[c];
+    m_chunks.clear();
+    m_size = 0;
+    ++m_epoch;
+}
+
+void
+ChunkedEventSet::swap(ChunkedEventSet &other)
+{
+    m_chunks.swap(other.m_chunks);
+    std::swap(m_size, other.m_size);
+    ++m_epoch;
+    ++other.m_epoch;
+}
+
+void
+ChunkedEventSet::increment(iterator &i) const
+{
+    i.locate();
+
+    if (i.m_index + 1 < m_chunks[i.m_chunk]->count) {
+        ++i.m_index;
+    } else {
+        ++i.m_chunk;
+        i.m_index = 0;
+    }
+
+    i.m_event = (i.m_chunk < m_chunks.size() ?
+                 m_chunks[i.m_chunk]->items[i.m_index] : 0);
+}
+
+void
+ChunkedEventSet::decrement(iterator &i) const
+{
+    if (!i.m_event) {
+        // from end()
+        i.m_chunk = m_chunks.size() - 1;
+        i.m_index = m_chunks[i.m_chunk]->count - 1;
+        i.m_epoch = m_epoch;
+    } else {
+        i.locate();
+        if (i.m_index > 0) {
+            --i.m_index;
+        } else {
+            --i.m_chunk;
+            i.m_index = m_chunks[i.m_chunk]->count - 1;
+        }
+    }
+
+    i.m_event = m_chunks[i.m_chunk]->items[i.m_index];
+}
+
+void
+ChunkedEventSet::relocate(const iterator &i) const
+{
+    i.m_epoch = m_epoch;
+
+    if (!i.m_event) {
+        i.m_chunk = m_chunks.size();
+        i.m_index = 0;
+        return;
+    }
+
+    // Find the first element with the same key, then walk forward
+    // through the equivalent ones until we reach our own Event.
+
+    Event::EventCmp cmp;
+    size_t c;
+    int n;
+    findLower(i.m_event, c, n);
+
+    while (c < m_chunks.size()) {
+        const Chunk *chunk = m_chunks[c];
+        for ( ; n < chunk->count; ++n) {
+            if (chunk->items[n] == i.m_event) {
+                i.m_chunk = c;
+                i.m_index = n;
+                return;
+            }
+            if (cmp(i.m_event, chunk->items[n])) {
+                c = m_chunks.size();
+                break;
+            }
+        }
+        ++c;
+        n = 0;
+    }
+
+    // The Event is no longer in the set, so the iterator was invalid
+    // (erased, or from another set).  There's no position to give it.
+    std::cerr << "ERROR: ChunkedEventSet::relocate: iterator's Event "
+              << i.m_event << " is no longer in the set" << std::endl;
+    throw Exception("ChunkedEventSet::relocate: iterator no longer valid",
+                    __FILE__, __LINE__);
+}
+
+// Helpers for searching chunks by their last element
+
+static bool
+chunkLastLess(Event *last, Event *key)
+{
+    return *last < *key;
+}
+
+static bool
+keyLessChunkLast(Event *key, Event *last)
+{
+    return *key < *last;
+}
+
+void
+ChunkedEventSet::findLower(Event *key, size_t &chunk, int &index) const
+{
+    // First chunk whose last element is not less than key
+    size_t lo = 0, hi = m_chunks.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const Chunk *c = m_chunks[mid];
+        if (chunkLastLess(c->items[c->count - 1], key)) lo = mid + 1;
+        else hi = mid;
+    }
+
+    chunk = lo;
+    index = 0;
+    if (chunk == m_chunks.size()) return;
+
+    const Chunk *c = m_chunks[chunk];
+    index = std::lower_bound(c->items, c->items + c->count, key,
+                             Event::EventCmp()) - c->items;
+}
+
+void
+ChunkedEventSet::findUpper(Event *key, size_t &chunk, int &index) const
+{
+    // First chunk whose last element is greater than key
+    size_t lo = 0, hi = m_chunks.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        const Chunk *c = m_chunks[mid];
+        if (keyLessChunkLast(key, c->items[c->count - 1])) hi = mid;
+        else lo = mid + 1;
+    }
+
+    chunk = lo;
+    index = 0;
+    if (chunk == m_chunks.size()) return;
+
+    const Chunk *c = m_chunks[chunk];
+    index = std::upper_bound(c->items, c->items + c->count, key,
+                             Event::EventCmp()) - c->items;
+}
+
+ChunkedEventSet::iterator
+ChunkedEventSet::insertAt(size_t chunk, int index, Event *e)
+{
+    ++m_epoch;
+    ++m_size;
+
+    if (m_chunks.empty()) {
+        m_chunks.push_back(new Chunk);
+        chunk = 0;
+        index = 0;
+    } else if (chunk == m_chunks.size()) {
+        // Past the end: append to the last chunk
+        --chunk;
+        index = m_chunks[chunk]->count;
+    }
+
+    Chunk *c = m_chunks[chunk];
+
+    if (c->count == ChunkCapacity) {
+
+        // Split, moving the upper half into a new chunk after this one
+
+        const int half = ChunkCapacity / 2;
+        Chunk *upper = new Chunk;
+        std::copy(c->items + half, c->items + ChunkCapacity, upper->items);
+        upper->count = ChunkCapacity - half;
+        c->count = half;
+        m_chunks.insert(m_chunks.begin() + chunk + 1, upper);
+
+        if (index > half) {
+            ++chunk;
+            index -= half;
+            c = upper;
+        }
+    }
+
+    std::copy_backward(c->items + index, c->items + c->count,
+                       c->items + c->count + 1);
+    c->items[index] = e;
+    ++c->count;
+
+    return iterator(this, chunk, index);
+}
+
+ChunkedEventSet::iterator
+ChunkedEventSet::insert(Event *e)
+{
+    size_t chunk;
+    int index;
+    findUpper(e, chunk, index);
+    return insertAt(chunk, index, e);
+}
+
+ChunkedEventSet::iterator
+ChunkedEventSet::insert(iterator hint, Event *e)
+{
+    Event::EventCmp cmp;
+
+    // Use the hint only if e belongs immediately before it
+    if ((hint == end() || !cmp(*hint, e))) {
+        if (hint == begin()) {
+            return insertAt(0, 0, e);
+        }
+        iterator prev(hint);
+        --prev;
+        if (!cmp(e, *prev)) {
+            if (hint == end()) return insertAt(m_chunks.size(), 0, e);
+            hint.locate();
+            return insertAt(hint.m_chunk, hint.m_index, e);
+        }
+    }
+
+    return insert(e);
+}
+
+void
+ChunkedEventSet::erase(iterator i)
+{
+    i.locate();
+
+    Chunk *c = m_chunks[i.m_chunk];
+    std::copy(c->items + i.m_index + 1, c->items + c->count,
+              c->items + i.m_index);
+    --c->count;
+
+    if (c->count == 0) {
+        delete c;
+        m_chunks.erase(m_chunks.begin() + i.m_chunk);
+    }
+
+    --m_size;
+    ++m_epoch;
+}
+
+void
+ChunkedEventSet::erase(iterator first, iterator last)
+{
+    while (first != last) erase(first++);
+}
+
+ChunkedEventSet::size_type
+ChunkedEventSet::erase(Event *const &key)
+{
+    std::pair<iterator, iterator> range = equal_range(key);
+    size_type n = 0;
+    while (range.first != range.second) {
+        erase(range.first++);
+        ++n;
+    }
+    return n;
+}
+
+ChunkedEventSet::iterator
+ChunkedEventSet::lower_bound(Event *const &key) const
+{
+    size_t chunk;
+    int index;
+    findLower(key, chunk, index);
+    return iterator(this, chunk, index);
+}
+
+ChunkedEventSet::iterator
+ChunkedEventSet::upper_bound(Event *const &key) const
+{
+    size_t chunk;
+    int index;
+    findUpper(key, chunk, index);
+    return iterator(this, chunk, index);
+}
+
+std::pair<ChunkedEventSet::iterator, ChunkedEventSet::iterator>
+ChunkedEventSet::equal_range(Event *const &key) const
+{
+    return std::pair<iterator, iterator>(lower_bound(key), upper_bound(key));
+}
+
+ChunkedEventSet::iterator
+ChunkedEventSet::find(Event *const &key) const
+{
+    iterator i = lower_bound(key);
+    if (i == end() || Event::EventCmp()(key, *i)) return end();
+    return i;
+}
+
+ChunkedEventSet::size_type
+ChunkedEventSet::count(Event *const &key) const
+{
+    std::pair<iterator, iterator> range = equal_range(key);
+    return std::distance(range.first, range.second);
+}
+
+bool
+ChunkedEventSet::operator==(const ChunkedEventSet &other) const
+{
+    if (m_size != other.m_size) return false;
+    return std::equal(begin(), end(), other.begin());
+}
+
+}
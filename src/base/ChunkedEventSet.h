@@ -0,0 +1,227 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_CHUNKED_EVENT_SET_H
+#define RG_CHUNKED_EVENT_SET_H
+
+#include "Event.h"
+
+#include <rosegardenprivate_export.h>
+
+#include <vector>
+#include <iterator>
+#include <utility>
+#include <cstddef>
+
+namespace Rosegarden
+{
+
+/// A drop-in alternative to std::multiset<Event *, Event::EventCmp>.
+/**
+ * Events are held in a sequence of small sorted arrays ("chunks") of
+ * at most ChunkCapacity pointers each, so that a scan over a range of
+ * events walks contiguous memory rather than chasing red-black tree
+ * nodes, and a lookup is a binary search over the chunks followed by
+ * one within a chunk.
+ *
+ * Iterators behave as multiset iterators do: they stay valid across
+ * insertions and across erasure of other elements.  This is achieved
+ * by having an iterator remember the Event it points to as well as
+ * its cached chunk position.  If the set has been modified since the
+ * position was cached, the iterator finds its Event again by key.
+ * This relies on two things that Segment already guarantees: an Event
+ * appears in the container at most once, and its ordering key
+ * (absolute time and sub-ordering) does not change while it is in the
+ * container.
+ *
+ * EventContainer derives from this rather than from std::multiset if
+ * the build is configured with USE_CHUNKED_EVENT_CONTAINER.
+ */
+class ROSEGARDENPRIVATE_EXPORT ChunkedEventSet
+{
+public:
+    typedef Event *key_type;
+    typedef Event *value_type;
+    typedef Event::EventCmp key_compare;
+    typedef Event::EventCmp value_compare;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef Event *const &reference;
+    typedef Event *const &const_reference;
+    typedef Event *const *pointer;
+    typedef Event *const *const_pointer;
+
+    static const int ChunkCapacity = 64;
+
+private:
+    struct Chunk
+    {
+        Chunk() : count(0) { }
+        Event *items[ChunkCapacity];
+        int count;
+    };
+
+public:
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef Event *value_type;
+        typedef ptrdiff_t difference_type;
+        typedef Event *const *pointer;
+        typedef Event *const &reference;
+
+        iterator() :
+            m_set(0), m_chunk(0), m_index(0), m_epoch(0), m_event(0) { }
+
+        reference operator*() const {
+            locate();
+            return m_set->m_chunks[m_chunk]->items[m_index];
+        }
+        pointer operator->() const { return &operator*(); }
+
+        iterator &operator++() { m_set->increment(*this); return *this; }
+        iterator operator++(int) {
+            iterator i(*this); m_set->increment(*this); return i;
+        }
+        iterator &operator--() { m_set->decrement(*this); return *this; }
+        iterator operator--(int) {
+            iterator i(*this); m_set->decrement(*this); return i;
+        }
+
+        bool operator==(const iterator &i) const {
+            return m_event == i.m_event;
+        }
+        bool operator!=(const iterator &i) const {
+            return m_event != i.m_event;
+        }
+
+    protected:
+        friend class ChunkedEventSet;
+
+        iterator(const ChunkedEventSet *set, size_t chunk, int index) :
+            m_set(set), m_chunk(chunk), m_index(index), m_epoch(set->m_epoch),
+            m_event(chunk < set->m_chunks.size() ?
+                    set->m_chunks[chunk]->items[index] : 0) { }
+
+        void locate() const {
+            if (m_epoch != m_set->m_epoch) m_set->relocate(*this);
+        }
+
+        const ChunkedEventSet *m_set;
+
+        // Cached position, trusted only while m_epoch is current
+        mutable size_t m_chunk;
+        mutable int m_index;
+        mutable unsigned long m_epoch;
+
+        // The element itself; 0 for end()
+        Event *m_event;
+    };
+
+    /// As with the libstdc++ multiset, elements can't be modified in
+    /// place, so iterator and const_iterator are the same type.
+    typedef iterator const_iterator;
+
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef reverse_iterator const_reverse_iterator;
+
+    ChunkedEventSet();
+    ChunkedEventSet(const ChunkedEventSet &);
+
+    template <class InputIterator>
+    ChunkedEventSet(InputIterator first, InputIterator last) :
+        m_size(0), m_epoch(0) {
+        insert(first, last);
+    }
+
+    ChunkedEventSet &operator=(const ChunkedEventSet &);
+    ~ChunkedEventSet();
+
+    iterator begin() const { return iterator(this, 0, 0); }
+    iterator end() const { return iterator(this, m_chunks.size(), 0); }
+
+    reverse_iterator rbegin() const { return reverse_iterator(end()); }
+    reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+    size_type size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    key_compare key_comp() const { return key_compare(); }
+    value_compare value_comp() const { return value_compare(); }
+
+    /// Insert after any equivalent elements, as multiset does.
+    iterator insert(Event *e);
+
+    /// Insert just before hint if that keeps the set ordered.
+    iterator insert(iterator hint, Event *e);
+
+    template <class InputIterator>
+    void insert(InputIterator first, InputIterator last) {
+        for ( ; first != last; ++first) insert(*first);
+    }
+
+    void erase(iterator i);
+    void erase(iterator first, iterator last);
+    size_type erase(Event *const &key);
+
+    void clear();
+    void swap(ChunkedEventSet &other);
+
+    iterator find(Event *const &key) const;
+    size_type count(Event *const &key) const;
+
+    iterator lower_bound(Event *const &key) const;
+    iterator upper_bound(Event *const &key) const;
+    std::pair<iterator, iterator> equal_range(Event *const &key) const;
+
+    /// Compare elements (that is, Event pointers), as multiset does.
+    bool operator==(const ChunkedEventSet &other) const;
+    bool operator!=(const ChunkedEventSet &other) const {
+        return !operator==(other);
+    }
+
+private:
+    friend class iterator;
+
+    typedef std::vector<Chunk *> ChunkList;
+
+    ChunkList m_chunks;
+    size_type m_size;
+
+    /// Incremented by every modification, to invalidate cached positions.
+    unsigned long m_epoch;
+
+    void increment(iterator &i) const;
+    void decrement(iterator &i) const;
+    /// Find an iterator's Event again after the set has changed.
+    /// Throws Exception if the Event is no longer in the set.
+    void relocate(const iterator &i) const;
+
+    /// Chunk and index of the first element not less than key.
+    void findLower(Event *key, size_t &chunk, int &index) const;
+
+    /// Chunk and index of the first element greater than key.
+    void findUpper(Event *key, size_t &chunk, int &index) const;
+
+    /// Insert at the given position, splitting the chunk if full.
+    iterator insertAt(size_t chunk, int index, Event *e);
+
+    void copyFrom(const ChunkedEventSet &);
+};
+
+}
+
+#endif
@@ -48,13 +48,11 @@ using std::endl;
 namespace Rosegarden 
 {
 
-const PropertyName Composition::NoAbsoluteTimeProperty = "NoAbsoluteTime";
 const PropertyName Composition::BarNumberProperty = "BarNumber";
 
 const std::string Composition::TempoEventType = "tempo";
 const PropertyName Composition::TempoProperty = "Tempo";
 const PropertyName Composition::TargetTempoProperty = "TargetTempo";
-const PropertyName Composition::TempoTimestampProperty = "TimestampSec";
 
 
 
@@ -62,14 +60,7 @@ bool
 Composition::ReferenceSegmentEventCmp::operator()(const Event &e1,
                                                   const Event &e2) const
 {
-    if (e1.has(NoAbsoluteTimeProperty) ||
-        e2.has(NoAbsoluteTimeProperty)) {
-        RealTime r1 = getTempoTimestamp(&e1);
-        RealTime r2 = getTempoTimestamp(&e2);
-        return r1 < r2;
-    } else {
-        return e1 < e2;
-    }
+    return e1 < e2;
 }
 
 Composition::ReferenceSegment::ReferenceSegment(std::string eventType) :
@@ -143,15 +134,6 @@ Composition::ReferenceSegment::findTime(timeT t)
     return find(&dummy);
 }
 
-Composition::ReferenceSegment::iterator
-Composition::ReferenceSegment::findRealTime(RealTime t)
-{
-    Event dummy("dummy", 0, 0, MIN_SUBORDERING);
-    dummy.set<Bool>(NoAbsoluteTimeProperty, true);
-    setTempoTimestamp(&dummy, t);
-    return find(&dummy);
-}
-
 Composition::ReferenceSegment::iterator
 Composition::ReferenceSegment::findNearestTime(timeT t)
 {
@@ -163,17 +145,6 @@ Composition::ReferenceSegment::findNearestTime(timeT t)
     return i;
 }
 
-Composition::ReferenceSegment::iterator
-Composition::ReferenceSegment::findNearestRealTime(RealTime t)
-{
-    iterator i = findRealTime(t);
-    if (i == end() || (getTempoTimestamp(*i) > t)) {
-        if (i == begin()) return end();
-        else --i;
-    }
-    return i;
-}
-
 
 
 int Composition::m_defaultNbBars = 100;
@@ -184,7 +155,7 @@ Composition::Composition() :
     m_timeSigSegment(TimeSignature::EventType),
     m_tempoSegment(TempoEventType),
     m_barPositionsNeedCalculating(true),
-    m_tempoTimestampsNeedCalculating(true),
+    m_tempoMapValidCount(0),
     m_basicQuantizer(new BasicQuantizer()),
     m_notationQuantizer(new NotationQuantizer()),
     m_position(0),
@@ -634,6 +605,10 @@ Composition::setEndMarker(const timeT &eM)
 {
     bool shorten = (eM < m_endMarker);
     m_endMarker = eM;
+
+    // A ramp in the last tempo change runs to the end marker
+    if (!m_tempoSegment.empty()) invalidateTempoMap(m_tempoSegment.size());
+
     clearVoiceCaches();
     updateRefreshStatuses();
     notifyEndMarkerChange(shorten);
@@ -653,6 +628,7 @@ Composition::clear()
     m_timeSigSegment.clear();
     m_tempoSegment.clear();
     m_defaultTempo = getTempoForQpm(120.0);
+    invalidateTempoMap(0);
     m_minTempo = 0;
     m_maxTempo = 0;
     m_loopStart = 0;
@@ -1076,7 +1052,7 @@ Composition::addTempoAtTime(timeT time, tempoT tempo, tempoT targetTempo)
         if (targetTempo > 0 && targetTempo > m_maxTempo) m_maxTempo = targetTempo;
     }
 
-    m_tempoTimestampsNeedCalculating = true;
+    invalidateTempoMap(distance(m_tempoSegment.begin(), i));
     updateRefreshStatuses();
 
 #ifdef DEBUG_TEMPO_STUFF
@@ -1141,7 +1117,7 @@ Composition::removeTempoChange(int n)
     }
 
     m_tempoSegment.eraseEvent(m_tempoSegment[n]);
-    m_tempoTimestampsNeedCalculating = true;
+    invalidateTempoMap(n);
 
     if (oldTempo == m_minTempo ||
         oldTempo == m_maxTempo ||
@@ -1177,77 +1153,196 @@ Composition::updateExtremeTempos()
     }
 }
 
-RealTime
-Composition::getElapsedRealTime(timeT t) const
+void
+Composition::invalidateTempoMap(size_t from) const
 {
-    calculateTempoTimestamps();
+    // The change before the edited one may ramp towards it
+    if (from > 0) --from;
+    if (from < m_tempoMapValidCount) m_tempoMapValidCount = from;
+}
 
-    ReferenceSegment::iterator i = m_tempoSegment.findNearestTime(t);
-    if (i == m_tempoSegment.end()) {
-        i = m_tempoSegment.begin();
-        if (t >= 0 ||
-            (i == m_tempoSegment.end() || (*i)->getAbsoluteTime() > 0)) {
-            return time2RealTime(t, m_defaultTempo);
-        }
+void
+Composition::updateTempoMap() const
+{
+    const size_t count = m_tempoSegment.size();
+
+    if (m_tempoMapValidCount >= count) {
+        if (m_tempoMap.size() != count) m_tempoMap.resize(count);
+        return;
     }
 
-    RealTime elapsed;
+    m_tempoMap.resize(count);
+
+    // Start from the last valid point, or from the default tempo at
+    // time zero if there is none
 
+    size_t n = m_tempoMapValidCount;
+
+    timeT lastTimeT = 0;
+    RealTime lastRealTime;
+    tempoT tempo = m_defaultTempo;
     tempoT target = -1;
-    timeT nextTempoTime = t;
 
-    if (!getTempoTarget(i, target, nextTempoTime)) target = -1;
+    if (n > 0) {
+        const TempoPoint &prev = m_tempoMap[n-1];
+        lastTimeT = prev.time;
+        lastRealTime = prev.realTime;
+        tempo = prev.tempo;
+        target = prev.target;
+    }
+
+#ifdef DEBUG_TEMPO_STUFF
+    cerr << "Composition::updateTempoMap: Recalculating from tempo change "
+         << n << " of " << count << endl;
+#endif
+
+    for (ReferenceSegment::const_iterator i = m_tempoSegment.begin() + n;
+         i != m_tempoSegment.end(); ++i, ++n) {
 
-    if (target > 0) {
-        elapsed = getTempoTimestamp(*i) +
-            time2RealTime(t - (*i)->getAbsoluteTime(),
-                          tempoT((*i)->get<Int>(TempoProperty)),
-                          nextTempoTime - (*i)->getAbsoluteTime(),
-                          target);
+        TempoPoint &point = m_tempoMap[n];
+        point.time = (*i)->getAbsoluteTime();
+
+        // Each ramp runs to the following tempo change, so its whole
+        // length is the distance between the two
+        if (target > 0) {
+            point.realTime = lastRealTime +
+                time2RealTime(point.time - lastTimeT, tempo,
+                              point.time - lastTimeT, target);
+        } else {
+            point.realTime = lastRealTime +
+                time2RealTime(point.time - lastTimeT, tempo);
+        }
+
+        point.tempo = tempoT((*i)->get<Int>(TempoProperty));
+        if (!getTempoTarget(i, point.target, point.targetTime)) {
+            point.target = -1;
+        }
+
+        lastRealTime = point.realTime;
+        lastTimeT = point.time;
+        tempo = point.tempo;
+        target = point.target;
+    }
+
+    m_tempoMapValidCount = count;
+}
+
+int
+Composition::findTempoPoint(timeT t) const
+{
+    if (m_tempoMap.empty()) return -1;
+
+    TempoMap::const_iterator i = std::upper_bound
+        (m_tempoMap.begin(), m_tempoMap.end(), t, TempoPoint::timeLess);
+
+    if (i == m_tempoMap.begin()) {
+
+        // In negative time before the first tempo change, we use that
+        // change if it's no later than time zero, as getTempoAtTime
+        // does.  Otherwise the default tempo applies.
+
+        if (t >= 0 || i->time > 0) return -1;
+        return 0;
+    }
+
+    return int(i - m_tempoMap.begin()) - 1;
+}
+
+RealTime
+Composition::getElapsedRealTimeFrom(int n, timeT t) const
+{
+    if (n < 0) return time2RealTime(t, m_defaultTempo);
+
+    const TempoPoint &point = m_tempoMap[n];
+
+    if (point.target > 0) {
+        return point.realTime +
+            time2RealTime(t - point.time, point.tempo,
+                          point.targetTime - point.time, point.target);
     } else {
-        elapsed = getTempoTimestamp(*i) +
-            time2RealTime(t - (*i)->getAbsoluteTime(),
-                          tempoT((*i)->get<Int>(TempoProperty)));
+        return point.realTime + time2RealTime(t - point.time, point.tempo);
     }
+}
+
+RealTime
+Composition::getElapsedRealTime(timeT t) const
+{
+    updateTempoMap();
+
+    int n = findTempoPoint(t);
+    RealTime elapsed = getElapsedRealTimeFrom(n, t);
 
 #ifdef DEBUG_TEMPO_STUFF
     cerr << "Composition::getElapsedRealTime: " << t << " -> "
-         << elapsed << " (last tempo change at " << (*i)->getAbsoluteTime() << ")" << endl;
+         << elapsed << " (last tempo change at "
+         << (n < 0 ? 0 : m_tempoMap[n].time) << ")" << endl;
 #endif
 
     return elapsed;
 }
 
+void
+Composition::getElapsedRealTimes(const timeT *times, RealTime *results,
+                                 size_t count) const
+{
+    updateTempoMap();
+
+    const int points = int(m_tempoMap.size());
+
+    // Index of the tempo point for the previous time, which is
+    // usually also the right one for the next time, or the one just
+    // before it.  Anything further afield gets a fresh search.
+    int n = -2;
+
+    for (size_t k = 0; k < count; ++k) {
+
+        const timeT t = times[k];
+
+        if (n >= 0 && t >= m_tempoMap[n].time) {
+            int steps = 0;
+            while (n + 1 < points && m_tempoMap[n+1].time <= t && steps < 4) {
+                ++n;
+                ++steps;
+            }
+            if (n + 1 < points && m_tempoMap[n+1].time <= t) {
+                n = findTempoPoint(t);
+            }
+        } else {
+            n = findTempoPoint(t);
+        }
+
+        results[k] = getElapsedRealTimeFrom(n, t);
+    }
+}
+
 timeT
 Composition::getElapsedTimeForRealTime(RealTime t) const
 {
-    calculateTempoTimestamps();
+    updateTempoMap();
 
-    ReferenceSegment::iterator i = m_tempoSegment.findNearestRealTime(t);
-    if (i == m_tempoSegment.end()) {
-        i = m_tempoSegment.begin();
-        if (t >= RealTime::zeroTime ||
-            (i == m_tempoSegment.end() || (*i)->getAbsoluteTime() > 0)) {
-            return realTime2Time(t, m_defaultTempo);
+    int n = -1;
+
+    if (!m_tempoMap.empty()) {
+        TempoMap::const_iterator i = std::upper_bound
+            (m_tempoMap.begin(), m_tempoMap.end(), t, TempoPoint::realTimeLess);
+        if (i != m_tempoMap.begin()) {
+            n = int(i - m_tempoMap.begin()) - 1;
+        } else if (t < RealTime::zeroTime && i->time <= 0) {
+            n = 0;
         }
     }
 
+    if (n < 0) return realTime2Time(t, m_defaultTempo);
+
+    const TempoPoint &point = m_tempoMap[n];
     timeT elapsed;
 
-    tempoT target = -1;
-    timeT nextTempoTime = 0;
-    if (!getTempoTarget(i, target, nextTempoTime)) target = -1;
-
-    if (target > 0) {
-        elapsed = (*i)->getAbsoluteTime() +
-            realTime2Time(t - getTempoTimestamp(*i),
-                          (tempoT)((*i)->get<Int>(TempoProperty)),
-                          nextTempoTime - (*i)->getAbsoluteTime(),
-                          target);
+    if (point.target > 0) {
+        elapsed = point.time +
+            realTime2Time(t - point.realTime, point.tempo,
+                          point.targetTime - point.time, point.target);
     } else {
-        elapsed = (*i)->getAbsoluteTime() +
-            realTime2Time(t - getTempoTimestamp(*i),
-                          (tempoT)((*i)->get<Int>(TempoProperty)));
+        elapsed = point.time + realTime2Time(t - point.realTime, point.tempo);
     }
 
 #ifdef DEBUG_TEMPO_STUFF
@@ -1260,60 +1355,12 @@ Composition::getElapsedTimeForRealTime(RealTime t) const
         cerr << "getElapsedTimeForRealTime: " << t << " -> "
              << elapsed << " (error " << (cfReal - t)
              << " or " << (cfTimeT - elapsed) << ", tempo "
-             << (*i)->getAbsoluteTime() << ":"
-             << (tempoT)((*i)->get<Int>(TempoProperty)) << ")" << endl;
+             << point.time << ":" << point.tempo << ")" << endl;
     }
 #endif
     return elapsed;
 }
 
-void
-Composition::calculateTempoTimestamps() const
-{
-    if (!m_tempoTimestampsNeedCalculating) return;
-
-    timeT lastTimeT = 0;
-    RealTime lastRealTime;
-
-    tempoT tempo = m_defaultTempo;
-    tempoT target = -1;
-
-#ifdef DEBUG_TEMPO_STUFF
-    cerr << "Composition::calculateTempoTimestamps: Tempo events are:" << endl;
-#endif
-
-    for (ReferenceSegment::iterator i = m_tempoSegment.begin();
-         i != m_tempoSegment.end(); ++i) {
-
-        RealTime myTime;
-
-        if (target > 0) {
-            myTime = lastRealTime +
-                time2RealTime((*i)->getAbsoluteTime() - lastTimeT, tempo,
-                              (*i)->getAbsoluteTime() - lastTimeT, target);
-        } else {
-            myTime = lastRealTime +
-                time2RealTime((*i)->getAbsoluteTime() - lastTimeT, tempo);
-        }
-
-        setTempoTimestamp(*i, myTime);
-
-#ifdef DEBUG_TEMPO_STUFF
-        (*i)->dump(cerr);
-#endif
-
-        lastRealTime = myTime;
-        lastTimeT = (*i)->getAbsoluteTime();
-        tempo = tempoT((*i)->get<Int>(TempoProperty));
-
-        target = -1;
-        timeT nextTempoTime = 0;
-        if (!getTempoTarget(i, target, nextTempoTime)) target = -1;
-    }
-
-    m_tempoTimestampsNeedCalculating = false;
-}
-
 #ifdef DEBUG_TEMPO_STUFF
 static int DEBUG_silence_recursive_tempo_printout = 0;
 #endif
@@ -1536,20 +1583,6 @@ Composition::getTempoTarget(ReferenceSegment::const_iterator i,
     return have;
 }
 
-RealTime
-Composition::getTempoTimestamp(const Event *e) 
-{
-    RealTime res;
-    e->get<RealTimeT>(TempoTimestampProperty, res);
-    return res;
-}
-
-void
-Composition::setTempoTimestamp(Event *e, RealTime t)
-{
-    e->setMaybe<RealTimeT>(TempoTimestampProperty, t);
-}
-
 void
 Composition::getMusicalTimeForAbsoluteTime(timeT absTime,
                                            int &bar, int &beat,
@@ -1926,6 +1959,11 @@ Composition::isInstrumentRecording(InstrumentId instrumentID) const
 //
 //
 std::string Composition::toXmlString() const
+{
+    return toXmlString(true);
+}
+
+std::string Composition::toXmlString(bool withReferenceSegments) const
 {
     std::stringstream composition;
 
@@ -1983,7 +2021,7 @@ std::string Composition::toXmlString() const
     composition << endl;
 
     for (ReferenceSegment::iterator i = m_timeSigSegment.begin();
-         i != m_timeSigSegment.end(); ++i) {
+         withReferenceSegments && i != m_timeSigSegment.end(); ++i) {
 
         // Might be nice just to stream the events, but that's
         // normally done by XmlStorableEvent in gui/ at the
@@ -2014,7 +2052,7 @@ std::string Composition::toXmlString() const
     composition << endl;
 
     for (ReferenceSegment::iterator i = m_tempoSegment.begin();
-         i != m_tempoSegment.end(); ++i) {
+         withReferenceSegments && i != m_tempoSegment.end(); ++i) {
 
         tempoT tempo = tempoT((*i)->get<Int>(TempoProperty));
         tempoT target = -1;
@@ -35,6 +35,7 @@
 // System
 #include <set>
 #include <map>
+#include <vector>
 
 namespace Rosegarden 
 {
@@ -588,7 +589,10 @@ public:
      * Set a default tempo for the composition.  This will be
      * overridden by any tempo events encountered during playback.
      */
-    void setCompositionDefaultTempo(tempoT tempo) { m_defaultTempo = tempo; }
+    void setCompositionDefaultTempo(tempoT tempo) {
+        m_defaultTempo = tempo;
+        invalidateTempoMap(0);
+    }
     tempoT getCompositionDefaultTempo() const { return m_defaultTempo; }
 
     /**
@@ -683,6 +687,19 @@ public:
      */
     timeT getElapsedTimeForRealTime(RealTime t) const;
 
+    /**
+     * Convert count timeT values to real times, as getElapsedRealTime
+     * would, writing the results to the given array.
+     *
+     * This walks the tempo map alongside the input rather than
+     * searching it afresh for every time, so it is much cheaper than
+     * repeated calls to getElapsedRealTime when the times are mostly
+     * ascending, as they are when mapping a segment for playback.
+     * Out-of-order times are still handled correctly.
+     */
+    void getElapsedRealTimes(const timeT *times, RealTime *results,
+                             size_t count) const;
+
     /**
      * Return the number of microseconds elapsed between
      * the two given timeT indices into the composition, taking
@@ -785,6 +802,12 @@ public:
     //
     virtual std::string toXmlString() const;
 
+    /**
+     * As toXmlString(), but leaving out the time signature and tempo
+     * changes if \a withReferenceSegments is false.
+     */
+    std::string toXmlString(bool withReferenceSegments) const;
+
     // Who's making this racket?
     //
     Configuration &getMetadata() {
@@ -925,9 +948,7 @@ protected:
     static const PropertyName TempoProperty;
     static const PropertyName TargetTempoProperty;
 
-    static const PropertyName NoAbsoluteTimeProperty;
     static const PropertyName BarNumberProperty;
-    static const PropertyName TempoTimestampProperty;
 
 
     struct ReferenceSegmentEventCmp
@@ -1000,9 +1021,6 @@ protected:
         iterator findTime(timeT time);
         iterator findNearestTime(timeT time);
 
-        iterator findRealTime(RealTime time);
-        iterator findNearestRealTime(RealTime time);
-
         std::string getEventType() const { return m_eventType; }
 
     private:
@@ -1021,9 +1039,45 @@ protected:
     mutable bool m_barPositionsNeedCalculating;
     ReferenceSegment::iterator getTimeSignatureAtAux(timeT t) const;
 
-    /// affects m_tempoSegment
-    void calculateTempoTimestamps() const;
-    mutable bool m_tempoTimestampsNeedCalculating;
+    /// The real-time position and ramp of a tempo change, as cached
+    /// in m_tempoMap
+    struct TempoPoint
+    {
+        timeT time;
+        RealTime realTime;
+        tempoT tempo;
+        tempoT target;      // -1 if this tempo does not ramp
+        timeT targetTime;   // end of the ramp, if any
+
+        static bool timeLess(timeT t, const TempoPoint &p) {
+            return t < p.time;
+        }
+        static bool realTimeLess(const RealTime &t, const TempoPoint &p) {
+            return t < p.realTime;
+        }
+    };
+
+    typedef std::vector<TempoPoint> TempoMap;
+
+    /// One entry per event in m_tempoSegment, in the same order
+    mutable TempoMap m_tempoMap;
+
+    /// The number of leading entries in m_tempoMap that are up to date
+    mutable size_t m_tempoMapValidCount;
+
+    /// Ensure m_tempoMap is up to date, recalculating the invalid part
+    void updateTempoMap() const;
+
+    /// Mark the tempo map as needing recalculation from the given
+    /// index in m_tempoSegment onwards.  The tempo change before it is
+    /// included too, as a ramp depends on the one that follows it.
+    void invalidateTempoMap(size_t from) const;
+
+    /// Index of the last point at or before t, or -1 if we should
+    /// simply use the default tempo.  Call updateTempoMap first.
+    int findTempoPoint(timeT t) const;
+    RealTime getElapsedRealTimeFrom(int point, timeT t) const;
+
     RealTime time2RealTime(timeT time, tempoT tempo) const;
     RealTime time2RealTime(timeT time, tempoT tempo,
                            timeT targetTempoTime, tempoT targetTempo) const;
@@ -1034,9 +1088,6 @@ protected:
                         tempoT &target,
                         timeT &targetTime) const;
 
-    static RealTime getTempoTimestamp(const Event *e);
-    static void setTempoTimestamp(Event *e, RealTime r);
-
     /// No more than one armed track per instrument.
     void enforceArmRule(const Track *track);
 
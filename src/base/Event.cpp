@@ -20,6 +20,7 @@
 #include "XmlExportable.h"
 #include "NotationTypes.h"
 #include "BaseProperties.h"
+#include "ObjectPool.h"
 
 #include <sstream>
 
@@ -31,6 +32,52 @@ using std::ostream;
 PropertyName Event::EventData::NotationTime = "!notationtime";
 PropertyName Event::EventData::NotationDuration = "!notationduration";
 
+// Created on first use and never destroyed, as Events may be deleted
+// during static destruction.
+
+static ObjectPool *
+getEventPool()
+{
+    static ObjectPool *pool = new ObjectPool("Event", sizeof(Event));
+    return pool;
+}
+
+static ObjectPool *
+getEventDataPool(size_t objectSize)
+{
+    static ObjectPool *pool = new ObjectPool("EventData", objectSize);
+    return pool;
+}
+
+void *
+Event::operator new(size_t size)
+{
+    // A subclass with extra members can't use the pool's slots
+    if (size != sizeof(Event)) return ::operator new(size);
+    return getEventPool()->allocate();
+}
+
+void
+Event::operator delete(void *p, size_t size)
+{
+    if (size != sizeof(Event)) ::operator delete(p);
+    else getEventPool()->release(p);
+}
+
+void *
+Event::EventData::operator new(size_t size)
+{
+    if (size != sizeof(EventData)) return ::operator new(size);
+    return getEventDataPool(sizeof(EventData))->allocate();
+}
+
+void
+Event::EventData::operator delete(void *p, size_t size)
+{
+    if (size != sizeof(EventData)) ::operator delete(p);
+    else getEventDataPool(sizeof(EventData))->release(p);
+}
+
 
 Event::EventData::EventData(const std::string &type, timeT absoluteTime,
 			    timeT duration, short subOrdering) :
@@ -38,21 +85,20 @@ Event::EventData::EventData(const std::string &type, timeT absoluteTime,
     m_type(type),
     m_absoluteTime(absoluteTime),
     m_duration(duration),
-    m_subOrdering(subOrdering),
-    m_properties(0)
+    m_subOrdering(subOrdering)
 {
     // empty
 }
 
 Event::EventData::EventData(const std::string &type, timeT absoluteTime,
 			    timeT duration, short subOrdering,
-			    const PropertyMap *properties) :
+			    const PropertyVector &properties) :
     m_refCount(1),
     m_type(type),
     m_absoluteTime(absoluteTime),
     m_duration(duration),
     m_subOrdering(subOrdering),
-    m_properties(properties ? new PropertyMap(*properties) : 0)
+    m_properties(properties)
 {
     // empty
 }
@@ -69,25 +115,23 @@ Event::EventData *Event::EventData::unshare()
 
 Event::EventData::~EventData()
 {
-    if (m_properties) delete m_properties;
+    // empty
 }
 
 timeT
 Event::EventData::getNotationTime() const
 {
-    if (!m_properties) return m_absoluteTime;
-    PropertyMap::const_iterator i = m_properties->find(NotationTime);
-    if (i == m_properties->end()) return m_absoluteTime;
-    else return static_cast<PropertyStore<Int> *>(i->second)->getData();
+    PropertyVector::const_iterator i = m_properties.find(NotationTime);
+    if (i == m_properties.end()) return m_absoluteTime;
+    else return PropertySlotAccess<Int>::get(*i);
 }
 
 timeT
 Event::EventData::getNotationDuration() const
 {
-    if (!m_properties) return m_duration;
-    PropertyMap::const_iterator i = m_properties->find(NotationDuration);
-    if (i == m_properties->end()) return m_duration;
-    else return static_cast<PropertyStore<Int> *>(i->second)->getData();
+    PropertyVector::const_iterator i = m_properties.find(NotationDuration);
+    if (i == m_properties.end()) return m_duration;
+    else return PropertySlotAccess<Int>::get(*i);
 }
 
 timeT
@@ -102,27 +146,25 @@ Event::getGreaterDuration()
 void
 Event::EventData::setTime(const PropertyName &name, timeT t, timeT deft)
 {
-    if (!m_properties) m_properties = new PropertyMap();
-    PropertyMap::iterator i = m_properties->find(name);
+    PropertyVector::iterator i = m_properties.find(name);
 
     if (t != deft) {
-	if (i == m_properties->end()) {
-	    m_properties->insert(PropertyPair(name, new PropertyStore<Int>(t)));
+	if (i == m_properties.end()) {
+	    m_properties.insert<Int>(name, t);
 	} else {
-	    static_cast<PropertyStore<Int> *>(i->second)->setData(t);
+	    PropertySlotAccess<Int>::set(*i, t);
 	}
-    } else if (i != m_properties->end()) {
-	delete i->second;
-	m_properties->erase(i);
+    } else if (i != m_properties.end()) {
+	m_properties.erase(i);
     }
 }
 
-PropertyMap *
-Event::find(const PropertyName &name, PropertyMap::iterator &i)
+PropertyVector *
+Event::find(const PropertyName &name, PropertyVector::iterator &i)
 {
-    PropertyMap *map = m_data->m_properties;
+    PropertyVector *map = &m_data->m_properties;
 
-    if (!map || ((i = map->find(name)) == map->end())) {
+    if ((i = map->find(name)) == map->end()) {
 
 	map = m_nonPersistentProperties;
 	if (!map) return 0;
@@ -141,8 +183,8 @@ Event::has(const PropertyName &name) const
     ++m_hasCount;
 #endif
 
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    PropertyVector::const_iterator i;
+    const PropertyVector *map = find(name, i);
     if (map) return true;
     else return false;
 }
@@ -155,10 +197,9 @@ Event::unset(const PropertyName &name)
 #endif
 
     unshare();
-    PropertyMap::iterator i;
-    PropertyMap *map = find(name, i);
+    PropertyVector::iterator i;
+    PropertyVector *map = find(name, i);
     if (map) {
-	delete i->second;
 	map->erase(i);
     }
 }
@@ -168,10 +209,10 @@ PropertyType
 Event::getPropertyType(const PropertyName &name) const
     // throw (NoData)
 {
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    PropertyVector::const_iterator i;
+    const PropertyVector *map = find(name, i);
     if (map) {
-        return i->second->getType();
+        return i->getType();
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
     }
@@ -182,10 +223,10 @@ string
 Event::getPropertyTypeAsString(const PropertyName &name) const
     // throw (NoData)
 {
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    PropertyVector::const_iterator i;
+    const PropertyVector *map = find(name, i);
     if (map) {
-        return i->second->getTypeName();
+        return i->getTypeName();
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
     }
@@ -196,10 +237,10 @@ string
 Event::getAsString(const PropertyName &name) const
     // throw (NoData)
 {
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    PropertyVector::const_iterator i;
+    const PropertyVector *map = find(name, i);
     if (map) {
-        return i->second->unparse();
+        return i->unparse();
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
     }
@@ -314,19 +355,21 @@ Event::dump(ostream& out) const
         << "\n\tSub-ordering : " << m_data->m_subOrdering
         << "\n\tPersistent properties : \n";
 
-    if (m_data->m_properties) {
-	for (PropertyMap::const_iterator i = m_data->m_properties->begin();
-	     i != m_data->m_properties->end(); ++i) {
-	    out << "\t\t" << i->first.getName() << " [" << i->first.getValue() << "] \t" << *(i->second) << "\n";
-	}
+    for (PropertyVector::const_iterator i = m_data->m_properties.begin();
+         i != m_data->m_properties.end(); ++i) {
+	out << "\t\t" << i->getName().getName() << " [" << i->getName().getValue() << "] \t";
+        i->dump(out);
+        out << "\n";
     }
 
     if (m_nonPersistentProperties) {
 	out << "\n\tNon-persistent properties : \n";
 
-	for (PropertyMap::const_iterator i = m_nonPersistentProperties->begin();
+	for (PropertyVector::const_iterator i = m_nonPersistentProperties->begin();
 	     i != m_nonPersistentProperties->end(); ++i) {
-	    out << "\t\t" << i->first.getName() << " [" << i->first.getValue() << "] \t" << *(i->second) << '\n';
+	    out << "\t\t" << i->getName().getName() << " [" << i->getName().getValue() << "] \t";
+            i->dump(out);
+            out << '\n';
 	}
     }
 
@@ -357,14 +400,18 @@ Event::dumpStats(ostream& out)
 
     m_getCount = m_setCount = m_setMaybeCount = m_hasCount = m_unsetCount = 0;
     m_lastStats = clock();
+
+    getEventPool()->dumpStats(out);
+    getEventDataPool(sizeof(EventData))->dumpStats(out);
 }
 
 #else
 
 void
-Event::dumpStats(ostream&)
+Event::dumpStats(ostream& out)
 {
-    // nothing
+    getEventPool()->dumpStats(out);
+    getEventDataPool(sizeof(EventData))->dumpStats(out);
 }
 
 #endif
@@ -382,16 +429,14 @@ Event::PropertyNames
 Event::getPropertyNames() const
 {
     PropertyNames v;
-    if (m_data->m_properties) {
-	for (PropertyMap::const_iterator i = m_data->m_properties->begin();
-	     i != m_data->m_properties->end(); ++i) {
-	    v.push_back(i->first);
-	}
+    for (PropertyVector::const_iterator i = m_data->m_properties.begin();
+         i != m_data->m_properties.end(); ++i) {
+	v.push_back(i->getName());
     }
     if (m_nonPersistentProperties) {
-	for (PropertyMap::const_iterator i = m_nonPersistentProperties->begin();
+	for (PropertyVector::const_iterator i = m_nonPersistentProperties->begin();
 	     i != m_nonPersistentProperties->end(); ++i) {
-	    v.push_back(i->first);
+	    v.push_back(i->getName());
 	}
     }
     return v;
@@ -401,11 +446,9 @@ Event::PropertyNames
 Event::getPersistentPropertyNames() const
 {
     PropertyNames v;
-    if (m_data->m_properties) {
-	for (PropertyMap::const_iterator i = m_data->m_properties->begin();
-	     i != m_data->m_properties->end(); ++i) {
-	    v.push_back(i->first);
-	}
+    for (PropertyVector::const_iterator i = m_data->m_properties.begin();
+         i != m_data->m_properties.end(); ++i) {
+	v.push_back(i->getName());
     }
     return v;
 }
@@ -415,9 +458,9 @@ Event::getNonPersistentPropertyNames() const
 {
     PropertyNames v;
     if (m_nonPersistentProperties) {
-	for (PropertyMap::const_iterator i = m_nonPersistentProperties->begin();
+	for (PropertyVector::const_iterator i = m_nonPersistentProperties->begin();
 	     i != m_nonPersistentProperties->end(); ++i) {
-	    v.push_back(i->first);
+	    v.push_back(i->getName());
 	}
     }
     return v;
@@ -444,19 +487,10 @@ size_t
 Event::getStorageSize() const
 {
     size_t s = sizeof(Event) + sizeof(EventData) + m_data->m_type.size();
-    if (m_data->m_properties) {
-	for (PropertyMap::const_iterator i = m_data->m_properties->begin();
-	     i != m_data->m_properties->end(); ++i) {
-	    s += sizeof(i->first);
-	    s += i->second->getStorageSize();
-	}
-    }
+    s += m_data->m_properties.getStorageSize();
     if (m_nonPersistentProperties) {
-	for (PropertyMap::const_iterator i = m_nonPersistentProperties->begin();
-	     i != m_nonPersistentProperties->end(); ++i) {
-	    s += sizeof(i->first);
-	    s += i->second->getStorageSize();
-	}
+        s += sizeof(PropertyVector);
+        s += m_nonPersistentProperties->getStorageSize();
     }
     return s;
 }
@@ -17,7 +17,7 @@
 #ifndef RG_EVENT_H
 #define RG_EVENT_H
 
-#include "PropertyMap.h"
+#include "PropertyVector.h"
 #include "Exception.h"
 
 #include <string>
@@ -158,6 +158,14 @@ public:
 
     ~Event() { lose(); }
 
+    /**
+     * Events and their EventData are allocated from pools rather than
+     * the general heap, as they are created and destroyed in very
+     * large numbers.  See dumpStats() for the pool counters.
+     */
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+
     Event *copyMoving(timeT offset) const {
         return new Event(*this,
                          m_data->m_absoluteTime + offset,
@@ -167,6 +175,20 @@ public:
                          getNotationDuration());
     }
 
+    /**
+     * A copy that shares this event's data, like the copy constructor,
+     * but that also has copies of its non-persistent properties, which
+     * the copy constructor leaves out.
+     */
+    Event *copyWithNonPersistentProperties() const {
+        Event *e = new Event(*this);
+        if (m_nonPersistentProperties) {
+            e->m_nonPersistentProperties =
+                new PropertyVector(*m_nonPersistentProperties);
+        }
+        return e;
+    }
+
     Event &operator=(const Event &e) {
         if (&e != this) { lose(); share(e); }
         return *this;
@@ -415,9 +437,13 @@ private:
                   timeT absoluteTime, timeT duration, short subOrdering);
         EventData(const std::string &type,
                   timeT absoluteTime, timeT duration, short subOrdering,
-                  const PropertyMap *properties);
+                  const PropertyVector &properties);
         EventData *unshare();
         ~EventData();
+
+        static void *operator new(size_t size);
+        static void operator delete(void *p, size_t size);
+
         unsigned int m_refCount;
 
         std::string m_type;
@@ -425,10 +451,9 @@ private:
         timeT m_duration;
         short m_subOrdering;
 
-        PropertyMap *m_properties;
+        PropertyVector m_properties;
 
-        // These are properties because we don't care so much about
-        // raw speed in get/set, but we do care about storage size for
+        // These are properties because we care about storage size for
         // events that don't have them or that have zero values:
         timeT getNotationTime() const;
         timeT getNotationDuration() const;
@@ -448,7 +473,7 @@ private:
     };
 
     EventData *m_data;
-    PropertyMap *m_nonPersistentProperties; // Unique to an instance
+    PropertyVector *m_nonPersistentProperties; // Unique to an instance
 
     void share(const Event &e) {
         m_data = e.m_data;
@@ -471,21 +496,22 @@ private:
     }
 
     // returned iterator (in i) only valid if return map value is non-zero
-    PropertyMap *find(const PropertyName &name, PropertyMap::iterator &i);
+    PropertyVector *find(const PropertyName &name, PropertyVector::iterator &i);
 
-    const PropertyMap *find(const PropertyName &name,
-                            PropertyMap::const_iterator &i) const {
-        PropertyMap::iterator j;
-        PropertyMap *map = const_cast<Event *>(this)->find(name, j);
+    const PropertyVector *find(const PropertyName &name,
+                               PropertyVector::const_iterator &i) const {
+        PropertyVector::iterator j;
+        PropertyVector *map = const_cast<Event *>(this)->find(name, j);
         i = j;
         return map;
     }
 
-    PropertyMap::iterator insert(const PropertyPair &pair, bool persistent) {
-        PropertyMap **map =
-            (persistent ? &m_data->m_properties : &m_nonPersistentProperties);
-        if (!*map) *map = new PropertyMap();
-        return (*map)->insert(pair).first;
+    PropertyVector *getMap(bool persistent) {
+        if (persistent) return &m_data->m_properties;
+        if (!m_nonPersistentProperties) {
+            m_nonPersistentProperties = new PropertyVector();
+        }
+        return m_nonPersistentProperties;
     }
 
 #ifndef NDEBUG
@@ -507,21 +533,20 @@ Event::get(const PropertyName &name, typename PropertyDefn<P>::basic_type &val)
     ++m_getCount;
 #endif
 
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    PropertyVector::const_iterator i;
+    const PropertyVector *map = find(name, i);
 
     if (map) {
 
-        PropertyStoreBase *sb = i->second;
-        if (sb->getType() == P) {
-            val = (static_cast<PropertyStore<P> *>(sb))->getData();
+        if (i->getType() == P) {
+            val = PropertySlotAccess<P>::get(*i);
             return true;
         }
         else {
 #ifndef NDEBUG
             RG_DEBUG << "get() Error: Attempt to get property \"" << name.getName()
                  << "\" as" << PropertyDefn<P>::typeName() <<", actual type is"
-                 << sb->getTypeName();
+                 << i->getTypeName();
 #endif
             return false;
         }
@@ -541,17 +566,16 @@ Event::get(const PropertyName &name) const
     ++m_getCount;
 #endif
 
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    PropertyVector::const_iterator i;
+    const PropertyVector *map = find(name, i);
 
     if (map) {
 
-        PropertyStoreBase *sb = i->second;
-        if (sb->getType() == P)
-            return (static_cast<PropertyStore<P> *>(sb))->getData();
+        if (i->getType() == P)
+            return PropertySlotAccess<P>::get(*i);
         else {
             throw BadType(name.getName(),
-                          PropertyDefn<P>::typeName(), sb->getTypeName(),
+                          PropertyDefn<P>::typeName(), i->getTypeName(),
                           __FILE__, __LINE__);
         }
 
@@ -571,11 +595,11 @@ bool
 Event::isPersistent(const PropertyName &name) const
     // throw (NoData)
 {
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    PropertyVector::const_iterator i;
+    const PropertyVector *map = find(name, i);
 
     if (map) {
-        return (map == m_data->m_properties);
+        return (map == &m_data->m_properties);
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
     }
@@ -588,11 +612,13 @@ Event::setPersistence(const PropertyName &name, bool persistent)
     // throw (NoData)
 {
     unshare();
-    PropertyMap::iterator i;
-    PropertyMap *map = find(name, i);
+    PropertyVector::iterator i;
+    PropertyVector *map = find(name, i);
 
     if (map) {
-        insert(*i, persistent);
+        PropertyVector *target = getMap(persistent);
+        if (target == map) return;
+        target->insert(*i);
         map->erase(i);
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
@@ -610,31 +636,27 @@ Event::set(const PropertyName &name, typename PropertyDefn<P>::basic_type value,
     ++m_setCount;
 #endif
 
-    // this is a little slow, could bear improvement
-
     unshare();
-    PropertyMap::iterator i;
-    PropertyMap *map = find(name, i);
+    PropertyVector::iterator i;
+    PropertyVector *map = find(name, i);
 
     if (map) {
-        bool persistentBefore = (map == m_data->m_properties);
-        if (persistentBefore != persistent) {
-            i = insert(*i, persistent);
-            map->erase(name);
+        if (i->getType() != P) {
+            throw BadType(name.getName(),
+                          PropertyDefn<P>::typeName(), i->getTypeName(),
+                          __FILE__, __LINE__);
         }
 
-        PropertyStoreBase *sb = i->second;
-        if (sb->getType() == P) {
-            (static_cast<PropertyStore<P> *>(sb))->setData(value);
+        PropertyVector *target = getMap(persistent);
+        if (target == map) {
+            PropertySlotAccess<P>::set(*i, value);
         } else {
-            throw BadType(name.getName(),
-                          PropertyDefn<P>::typeName(), sb->getTypeName(),
-                          __FILE__, __LINE__);
+            map->erase(i);
+            target->insert<P>(name, value);
         }
 
     } else {
-        PropertyStoreBase *p = new PropertyStore<P>(value);
-        insert(PropertyPair(name, p), persistent);
+        getMap(persistent)->insert<P>(name, value);
     }
 }
 
@@ -654,24 +676,21 @@ Event::setMaybe(const PropertyName &name, typename PropertyDefn<P>::basic_type v
 #endif
 
     unshare();
-    PropertyMap::iterator i;
-    PropertyMap *map = find(name, i);
+    PropertyVector::iterator i;
+    PropertyVector *map = find(name, i);
 
     if (map) {
-        if (map == m_data->m_properties) return; // persistent, so ignore it
-
-        PropertyStoreBase *sb = i->second;
+        if (map == &m_data->m_properties) return; // persistent, so ignore it
 
-        if (sb->getType() == P) {
-            (static_cast<PropertyStore<P> *>(sb))->setData(value);
+        if (i->getType() == P) {
+            PropertySlotAccess<P>::set(*i, value);
         } else {
             throw BadType(name.getName(),
-                          PropertyDefn<P>::typeName(), sb->getTypeName(),
+                          PropertyDefn<P>::typeName(), i->getTypeName(),
                           __FILE__, __LINE__);
         }
     } else {
-        PropertyStoreBase *p = new PropertyStore<P>(value);
-        insert(PropertyPair(name, p), false);
+        getMap(false)->insert<P>(name, value);
     }
 }
 
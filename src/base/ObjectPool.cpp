@@ -0,0 +1,112 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "ObjectPool.h"
+
+#include <QMutexLocker>
+
+#include <new>
+
+namespace Rosegarden
+{
+
+
+ObjectPool::ObjectPool(const char *name, size_t objectSize,
+                       size_t objectsPerSlab) :
+    m_name(name),
+    m_objectSize(objectSize),
+    m_objectsPerSlab(objectsPerSlab),
+    m_freeList(0)
+{
+    // Every slot must be able to hold a free list link, and must
+    // stay suitably aligned for whatever is constructed in it.
+    const size_t align = sizeof(double) > sizeof(void *) ?
+        sizeof(double) : sizeof(void *);
+    if (m_objectSize < sizeof(FreeNode)) m_objectSize = sizeof(FreeNode);
+    m_objectSize = (m_objectSize + align - 1) / align * align;
+}
+
+void
+ObjectPool::addSlab()
+{
+    char *slab = static_cast<char *>
+        (::operator new(m_objectSize * m_objectsPerSlab));
+
+    m_slabs.push_back(slab);
+    ++m_stats.slabs;
+    m_stats.bytesReserved += m_objectSize * m_objectsPerSlab;
+
+    // Thread the new slab onto the free list back to front, so that
+    // allocation walks forward through memory
+    for (size_t i = m_objectsPerSlab; i > 0; --i) {
+        FreeNode *node =
+            reinterpret_cast<FreeNode *>(slab + (i - 1) * m_objectSize);
+        node->next = m_freeList;
+        m_freeList = node;
+    }
+}
+
+void *
+ObjectPool::allocate()
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (!m_freeList) addSlab();
+
+    FreeNode *node = m_freeList;
+    m_freeList = node->next;
+
+    ++m_stats.allocations;
+    if (++m_stats.live > m_stats.peakLive) m_stats.peakLive = m_stats.live;
+
+    return node;
+}
+
+void
+ObjectPool::release(void *p)
+{
+    if (!p) return;
+
+    QMutexLocker locker(&m_mutex);
+
+    FreeNode *node = static_cast<FreeNode *>(p);
+    node->next = m_freeList;
+    m_freeList = node;
+
+    ++m_stats.releases;
+    --m_stats.live;
+}
+
+ObjectPool::Stats
+ObjectPool::getStats() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_stats;
+}
+
+void
+ObjectPool::dumpStats(std::ostream &out) const
+{
+    Stats stats = getStats();
+
+    out << m_name << " pool (" << m_objectSize << " bytes each): "
+        << stats.live << " live, " << stats.peakLive << " peak, "
+        << stats.allocations << " allocations, "
+        << stats.releases << " releases, "
+        << stats.slabs << " slabs (" << stats.bytesReserved
+        << " bytes reserved)" << std::endl;
+}
+
+}
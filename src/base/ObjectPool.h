@@ -0,0 +1,94 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_OBJECT_POOL_H
+#define RG_OBJECT_POOL_H
+
+#include <QMutex>
+
+#include <vector>
+#include <iostream>
+#include <cstddef>
+
+namespace Rosegarden
+{
+
+/// Slab allocator for many small objects of a single fixed size.
+/**
+ * Memory is carved out of large slabs and recycled through an
+ * intrusive free list, so that creating and destroying millions of
+ * objects (as MIDI import, quantize, paste and undo/redo do with
+ * Events) costs a pointer swap rather than a trip through malloc.
+ *
+ * Slabs are never returned to the system; released objects are kept
+ * on the free list for reuse.  All operations are guarded by a mutex,
+ * which is uncontended in practice since Events are built on the GUI
+ * thread.
+ *
+ * Intended for use from class-specific operator new and delete, see
+ * Event for an example.  A pool should be created on first use and
+ * never destroyed, as objects may outlive static destruction.
+ */
+class ObjectPool
+{
+public:
+    ObjectPool(const char *name, size_t objectSize,
+               size_t objectsPerSlab = 4096);
+
+    size_t getObjectSize() const { return m_objectSize; }
+
+    void *allocate();
+    void release(void *p);
+
+    struct Stats
+    {
+        Stats() : allocations(0), releases(0), live(0), peakLive(0),
+                  slabs(0), bytesReserved(0) { }
+
+        unsigned long allocations;
+        unsigned long releases;
+        unsigned long live;
+        unsigned long peakLive;
+        unsigned long slabs;
+        unsigned long bytesReserved;
+    };
+
+    Stats getStats() const;
+    void dumpStats(std::ostream &) const;
+
+private:
+    ObjectPool(const ObjectPool &);
+    ObjectPool &operator=(const ObjectPool &);
+
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+
+    void addSlab();
+
+    const char *m_name;
+    size_t m_objectSize;
+    size_t m_objectsPerSlab;
+
+    mutable QMutex m_mutex;
+    FreeNode *m_freeList;
+    std::vector<char *> m_slabs;
+    Stats m_stats;
+};
+
+}
+
+#endif
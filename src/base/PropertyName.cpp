@@ -20,6 +20,10 @@
 #include "base/PropertyName.h"
 #include "base/Exception.h"
 
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QtGlobal>
 
 namespace Rosegarden 
@@ -27,14 +31,50 @@ namespace Rosegarden
 using std::string;
 
 PropertyName::intern_map *PropertyName::m_interns = 0;
-PropertyName::intern_reverse_map *PropertyName::m_internsReversed = 0;
-int PropertyName::m_nextValue = 0;
+
+namespace
+{
+// Names by value, in blocks that never move once made.  intern() only
+// ever fills in new entries.
+const int BlockSize = 1024;
+const int MaxBlocks = 4096;
+
+// The highest value interned so far.  Stored with release semantics
+// once its name is in place, and loaded with acquire semantics by
+// getName(), so a reader that sees a value also sees its name.  Like
+// the mutex in intern(), this and the blocks are constructed on first
+// use, because names are interned from static initialisers in other
+// files that may run before ours.
+QAtomicInt &highestValue()
+{
+    static QAtomicInt value(0);
+    return value;
+}
+
+QAtomicPointer<std::string> *nameBlocks()
+{
+    static QAtomicPointer<std::string> blocks[MaxBlocks];
+    return blocks;
+}
+
+const std::string &nameOf(int value)
+{
+    // The acquire load of highestValue() orders this read
+    std::string *block =
+        nameBlocks()[value / BlockSize].fetchAndAddRelaxed(0);
+    return block[value % BlockSize];
+}
+}
 
 int PropertyName::intern(const string &s)
 {
+    // (constructed on first use, as names are interned from static
+    // initialisers in other files)
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+
     if (!m_interns) {
         m_interns = new intern_map;
-        m_internsReversed = new intern_reverse_map;
     }
 
     intern_map::iterator i(m_interns->find(s));
@@ -42,31 +82,42 @@ int PropertyName::intern(const string &s)
     if (i != m_interns->end()) {
         return i->second;
     } else {
-        int nv = ++m_nextValue;
+        int nv = highestValue().fetchAndAddRelaxed(0) + 1;
+        int block = nv / BlockSize;
+        if (block >= MaxBlocks) {
+            throw Exception("Too many property names in PropertyName::intern()");
+        }
+        QAtomicPointer<std::string> &names = nameBlocks()[block];
+        if (!names.fetchAndAddRelaxed(0)) {
+            names.fetchAndStoreOrdered(new std::string[BlockSize]);
+        }
+        names.fetchAndAddRelaxed(0)[nv % BlockSize] = s;
         m_interns->insert(intern_pair(s, nv));
-        m_internsReversed->insert(intern_reverse_pair(nv, s));
+        // only once the name is there to be found
+        highestValue().fetchAndStoreRelease(nv);
         return nv;
     }
 }
 
 string PropertyName::getName() const
 {
-    intern_reverse_map::iterator i(m_internsReversed->find(m_value));
-    if (i != m_internsReversed->end()) return i->second;
+    int highest = highestValue().fetchAndAddAcquire(0);
+
+    if (m_value > 0 && m_value <= highest) {
+        return nameOf(m_value);
+    }
 
     // dump some informative data, even if we aren't in debug mode,
     // because this really shouldn't be happening
     std::cerr << "ERROR: PropertyName::getName: value corrupted!\n";
     std::cerr << "PropertyName's internal value is " << m_value << std::endl;
     std::cerr << "Reverse interns are ";
-    i = m_internsReversed->begin();
-    if (i == m_internsReversed->end()) std::cerr << "(none)";
-    else while (i != m_internsReversed->end()) {
-	if (i != m_internsReversed->begin()) {
+    if (highest == 0) std::cerr << "(none)";
+    else for (int v = 1; v <= highest; ++v) {
+	if (v > 1) {
 	    std::cerr << ", ";
 	}
-	std::cerr << i->first << "=" << i->second;
-	++i;
+	std::cerr << v << "=" << nameOf(v);
     }
     std::cerr << std::endl;
 
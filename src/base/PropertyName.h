@@ -107,12 +107,12 @@ private:
     typedef std::map<std::string, int> intern_map;
     typedef intern_map::value_type intern_pair;
 
-    typedef std::map<int, std::string> intern_reverse_map;
-    typedef intern_reverse_map::value_type intern_reverse_pair;
-
     static intern_map *m_interns;
-    static intern_reverse_map *m_internsReversed;
-    static int m_nextValue;
+
+    // Names are looked up by value without locking, so that getName()
+    // can run while another thread interns more (documents are saved
+    // on other threads than the one editing them).  The lookup table
+    // is kept in PropertyName.cpp.
 
     int m_value;
 
@@ -0,0 +1,235 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "PropertyVector.h"
+
+#include <iostream>
+
+namespace Rosegarden
+{
+using std::string;
+
+
+string
+PropertySlot::getTypeName() const
+{
+    switch (m_type) {
+    case Int:       return PropertyDefn<Int>::typeName();
+    case String:    return PropertyDefn<String>::typeName();
+    case Bool:      return PropertyDefn<Bool>::typeName();
+    case RealTimeT: return PropertyDefn<RealTimeT>::typeName();
+    }
+    return "Undefined";
+}
+
+string
+PropertySlot::unparse() const
+{
+    switch (m_type) {
+    case Int:
+        return PropertyDefn<Int>::unparse(PropertySlotAccess<Int>::get(*this));
+    case String:
+        return PropertyDefn<String>::unparse(PropertySlotAccess<String>::get(*this));
+    case Bool:
+        return PropertyDefn<Bool>::unparse(PropertySlotAccess<Bool>::get(*this));
+    case RealTimeT:
+        return PropertyDefn<RealTimeT>::unparse(PropertySlotAccess<RealTimeT>::get(*this));
+    }
+    return "";
+}
+
+#ifndef NDEBUG
+void
+PropertySlot::dump(std::ostream &out) const
+{
+    out << getTypeName() << " - " << unparse();
+}
+#endif
+
+bool
+PropertySlot::operator==(const PropertySlot &other) const
+{
+    if (!(m_name == other.m_name) || m_type != other.m_type) return false;
+
+    switch (m_type) {
+    case Int:       return m_value.i == other.m_value.i;
+    case String:    return *m_value.s == *other.m_value.s;
+    case Bool:      return m_value.b == other.m_value.b;
+    case RealTimeT: return m_value.rt.sec == other.m_value.rt.sec &&
+                           m_value.rt.nsec == other.m_value.rt.nsec;
+    }
+    return false;
+}
+
+
+PropertyVector::PropertyVector() :
+    m_slots(m_inline),
+    m_size(0),
+    m_capacity(InlineCapacity)
+{
+}
+
+PropertyVector::PropertyVector(const PropertyVector &pv) :
+    m_slots(m_inline),
+    m_size(0),
+    m_capacity(InlineCapacity)
+{
+    copyFrom(pv);
+}
+
+PropertyVector &
+PropertyVector::operator=(const PropertyVector &pv)
+{
+    if (&pv != this) {
+        clear();
+        copyFrom(pv);
+    }
+    return *this;
+}
+
+PropertyVector::~PropertyVector()
+{
+    releaseStrings();
+    if (m_slots != m_inline) delete[] m_slots;
+}
+
+void
+PropertyVector::copyFrom(const PropertyVector &pv)
+{
+    while (m_capacity < pv.m_size) grow();
+
+    for (unsigned int i = 0; i < pv.m_size; ++i) {
+        m_slots[i] = pv.m_slots[i];
+        if (m_slots[i].m_type == String) {
+            m_slots[i].m_value.s = new string(*pv.m_slots[i].m_value.s);
+        }
+    }
+    m_size = pv.m_size;
+}
+
+void
+PropertyVector::releaseStrings()
+{
+    for (unsigned int i = 0; i < m_size; ++i) {
+        if (m_slots[i].m_type == String) delete m_slots[i].m_value.s;
+    }
+}
+
+PropertyVector::const_iterator
+PropertyVector::find(const PropertyName &name) const
+{
+    // Property counts are small, so a hand-rolled binary search on
+    // the interned value beats anything cleverer.
+
+    const int value = name.getValue();
+    unsigned int lo = 0, hi = m_size;
+
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        int midValue = m_slots[mid].m_name.getValue();
+        if (midValue < value) lo = mid + 1;
+        else if (value < midValue) hi = mid;
+        else return m_slots + mid;
+    }
+
+    return end();
+}
+
+void
+PropertyVector::grow()
+{
+    unsigned int capacity = m_capacity * 2;
+    PropertySlot *slots = new PropertySlot[capacity];
+
+    for (unsigned int i = 0; i < m_size; ++i) slots[i] = m_slots[i];
+
+    if (m_slots != m_inline) delete[] m_slots;
+    m_slots = slots;
+    m_capacity = capacity;
+}
+
+PropertyVector::iterator
+PropertyVector::makeSlot(const PropertyName &name, PropertyType type)
+{
+    if (m_size == m_capacity) grow();
+
+    unsigned int pos = m_size;
+    while (pos > 0 && name < m_slots[pos - 1].m_name) {
+        m_slots[pos] = m_slots[pos - 1];
+        --pos;
+    }
+
+    ++m_size;
+
+    PropertySlot &slot = m_slots[pos];
+    slot.m_name = name;
+    slot.m_type = type;
+    slot.m_value.i = 0;
+    return &slot;
+}
+
+PropertyVector::iterator
+PropertyVector::insert(const PropertySlot &source)
+{
+    iterator i = makeSlot(source.m_name, source.m_type);
+    i->m_value = source.m_value;
+    if (source.m_type == String) {
+        i->m_value.s = new string(*source.m_value.s);
+    }
+    return i;
+}
+
+void
+PropertyVector::erase(iterator i)
+{
+    if (i->m_type == String) delete i->m_value.s;
+
+    iterator last = end() - 1;
+    for ( ; i != last; ++i) *i = *(i + 1);
+    --m_size;
+}
+
+void
+PropertyVector::clear()
+{
+    releaseStrings();
+    m_size = 0;
+}
+
+bool
+PropertyVector::operator==(const PropertyVector &other) const
+{
+    if (m_size != other.m_size) return false;
+
+    for (unsigned int i = 0; i < m_size; ++i) {
+        if (!(m_slots[i] == other.m_slots[i])) return false;
+    }
+    return true;
+}
+
+size_t
+PropertyVector::getStorageSize() const
+{
+    size_t s = 0;
+    if (m_slots != m_inline) s += m_capacity * sizeof(PropertySlot);
+    for (unsigned int i = 0; i < m_size; ++i) {
+        if (m_slots[i].m_type == String) {
+            s += sizeof(string) + m_slots[i].m_value.s->size();
+        }
+    }
+    return s;
+}
+
+}
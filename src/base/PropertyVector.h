@@ -0,0 +1,212 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_PROPERTY_VECTOR_H
+#define RG_PROPERTY_VECTOR_H
+
+#include "Property.h"
+#include "base/PropertyName.h"
+
+#include <string>
+
+namespace Rosegarden
+{
+
+class PropertySlot;
+
+/// Typed access to the value held in a PropertySlot.
+/**
+ * Specialised below for each PropertyType, so that Event::get<> and
+ * Event::set<> compile down to a direct load or store with no virtual
+ * call and no heap indirection (except for strings).
+ */
+template <PropertyType P>
+struct PropertySlotAccess
+{
+};
+
+/// A single named, typed property value, stored inline.
+/**
+ * Int, Bool and RealTimeT values live directly in the slot.  Only
+ * String values are kept out of line, as a pointer to a heap string
+ * owned by the PropertyVector that holds the slot.
+ *
+ * Slots are plain values as far as copying goes: copying a slot copies
+ * the string pointer, not the string.  Ownership is managed entirely
+ * by PropertyVector.
+ */
+class PropertySlot
+{
+public:
+    PropertySlot() : m_type(Int) { m_value.i = 0; }
+
+    const PropertyName &getName() const { return m_name; }
+    PropertyType getType() const { return m_type; }
+
+    std::string getTypeName() const;
+    std::string unparse() const;
+
+#ifndef NDEBUG
+    void dump(std::ostream &) const;
+#endif
+
+    /// Compare name, type and value (not string pointer identity).
+    bool operator==(const PropertySlot &other) const;
+
+private:
+    friend class PropertyVector;
+    template <PropertyType P> friend struct PropertySlotAccess;
+
+    PropertyName m_name;
+    PropertyType m_type;
+
+    union {
+        long i;
+        bool b;
+        struct { int sec; int nsec; } rt;
+        std::string *s;
+    } m_value;
+};
+
+template <>
+struct PropertySlotAccess<Int>
+{
+    static long get(const PropertySlot &s) { return s.m_value.i; }
+    static void set(PropertySlot &s, long v) { s.m_value.i = v; }
+};
+
+template <>
+struct PropertySlotAccess<Bool>
+{
+    static bool get(const PropertySlot &s) { return s.m_value.b; }
+    static void set(PropertySlot &s, bool v) { s.m_value.b = v; }
+};
+
+template <>
+struct PropertySlotAccess<RealTimeT>
+{
+    static RealTime get(const PropertySlot &s) {
+        RealTime rt;
+        rt.sec = s.m_value.rt.sec;
+        rt.nsec = s.m_value.rt.nsec;
+        return rt;
+    }
+    static void set(PropertySlot &s, const RealTime &v) {
+        s.m_value.rt.sec = v.sec;
+        s.m_value.rt.nsec = v.nsec;
+    }
+};
+
+template <>
+struct PropertySlotAccess<String>
+{
+    static std::string get(const PropertySlot &s) { return *s.m_value.s; }
+    static void set(PropertySlot &s, const std::string &v) { *s.m_value.s = v; }
+};
+
+
+/// Compact property storage for Event.
+/**
+ * A PropertyVector is a vector of PropertySlots kept sorted by the
+ * interned integer value of the PropertyName, so lookups are a binary
+ * search over a contiguous array and iteration order matches that of
+ * the std::map-based PropertyMap it replaces for Event.
+ *
+ * The first few slots are stored inside the PropertyVector object
+ * itself, so an event with a handful of properties costs no heap
+ * allocations at all for its properties (beyond string values).
+ *
+ * PropertyMap is still used by Configuration, where the generic
+ * PropertyStoreBase interface is more convenient than raw speed.
+ */
+class PropertyVector
+{
+public:
+    typedef PropertySlot *iterator;
+    typedef const PropertySlot *const_iterator;
+
+    PropertyVector();
+    PropertyVector(const PropertyVector &);
+    PropertyVector &operator=(const PropertyVector &);
+    ~PropertyVector();
+
+    iterator begin() { return m_slots; }
+    iterator end() { return m_slots + m_size; }
+    const_iterator begin() const { return m_slots; }
+    const_iterator end() const { return m_slots + m_size; }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    /// Return the slot for name, or end() if there is none.
+    iterator find(const PropertyName &name) {
+        return const_cast<iterator>
+            (static_cast<const PropertyVector *>(this)->find(name));
+    }
+    const_iterator find(const PropertyName &name) const;
+
+    /// Insert a new property.  The name must not already be present.
+    template <PropertyType P>
+    iterator insert(const PropertyName &name,
+                    const typename PropertyDefn<P>::basic_type &value);
+
+    /// Insert a deep copy of a slot from another PropertyVector.
+    /**
+     * The name must not already be present.
+     */
+    iterator insert(const PropertySlot &slot);
+
+    void erase(iterator i);
+    void clear();
+
+    bool operator==(const PropertyVector &other) const;
+    bool operator!=(const PropertyVector &other) const {
+        return !operator==(other);
+    }
+
+    // approximate, for debugging and inspection purposes
+    size_t getStorageSize() const;
+
+    /// Number of slots held without any heap allocation.
+    static const unsigned int InlineCapacity = 4;
+
+private:
+    PropertySlot *m_slots;
+    unsigned int m_size;
+    unsigned int m_capacity;
+    PropertySlot m_inline[InlineCapacity];
+
+    /// Open up an uninitialised slot at the sorted position for name.
+    iterator makeSlot(const PropertyName &name, PropertyType type);
+
+    void grow();
+    void releaseStrings();
+    void copyFrom(const PropertyVector &);
+};
+
+template <PropertyType P>
+PropertyVector::iterator
+PropertyVector::insert(const PropertyName &name,
+                       const typename PropertyDefn<P>::basic_type &value)
+{
+    iterator i = makeSlot(name, P);
+    if (P == String) i->m_value.s = new std::string;
+    PropertySlotAccess<P>::set(*i, value);
+    return i;
+}
+
+}
+
+#endif
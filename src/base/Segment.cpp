@@ -1178,6 +1178,20 @@ Segment::setStretchRatio(float ratio)
     m_stretchRatio = ratio;
 }
 
+bool
+Segment::isStretchedLive() const
+{
+    return m_stretchRatio != 1.f && m_stretchRatio != 0.f &&
+        m_audioFileId == m_unstretchedFileId;
+}
+
+RealTime
+Segment::stretchedToFileTime(const RealTime &time) const
+{
+    if (!isStretchedLive()) return time;
+    return time * (1.0 / m_stretchRatio);
+}
+
 void
 Segment::setAudioStartTime(const RealTime &time)
 {
@@ -28,6 +28,10 @@
 #include "RealTime.h"
 #include "MidiProgram.h"
 
+#ifdef RG_CHUNKED_EVENT_CONTAINER
+#include "ChunkedEventSet.h"
+#endif
+
 #include <QColor>
 
 namespace Rosegarden
@@ -56,6 +60,19 @@ class Composition;
 class SegmentLinker;
 class BasicCommand;
 
+/// Storage backend for EventContainer, chosen at build time.
+/**
+ * std::multiset by default.  Configure with USE_CHUNKED_EVENT_CONTAINER
+ * to use ChunkedEventSet, which scans faster and uses less memory for
+ * large segments.  The two have the same interface and iterator
+ * validity rules as far as EventContainer's users are concerned.
+ */
+#ifdef RG_CHUNKED_EVENT_CONTAINER
+typedef ChunkedEventSet EventContainerBase;
+#else
+typedef std::multiset<Event*, Event::EventCmp> EventContainerBase;
+#endif
+
 /// Container of Event objects.
 /**
  * EventContainer is a precursor to Segment, used in code that needs
@@ -66,7 +83,7 @@ class BasicCommand;
  *     They provide no virtual dtor.  EventContainer should instead
  *     have a std::multiset member object.
  */
-class ROSEGARDENPRIVATE_EXPORT EventContainer : public std::multiset<Event*, Event::EventCmp>
+class ROSEGARDENPRIVATE_EXPORT EventContainer : public EventContainerBase
 {
  public:
     iterator findEventOfType(iterator i, const std::string &type);
@@ -678,6 +695,15 @@ public:
     float getStretchRatio() const { return m_stretchRatio; }
     void setStretchRatio(float ratio);
 
+    // Is this segment stretched as it plays, from its unstretched
+    // file, rather than playing a file rendered at its stretch ratio?
+    // If so, its audio start and end times are in the stretched time
+    // of that file, and the file time for one is stretchedToFileTime
+    // of it.
+    //
+    bool isStretchedLive() const;
+    RealTime stretchedToFileTime(const RealTime &time) const;
+
     // The audio start and end times tell us how far into
     // audio file "m_audioFileId" this Segment starts and
     // how far into the sample the Segment finishes.
@@ -20,24 +20,16 @@
 namespace Rosegarden
 {
 
-static std::string s1;
-static std::string multibyte;
-
 std::string XmlExportable::encode(const std::string &s0)
 {
-    static char *buffer = 0;
-    static size_t bufsiz = 0;
-    size_t buflen = 0;
-
-    static char multibyte[20];
+    // (no static buffers: segments may be encoded on several threads
+    // at once while saving)
+    std::string buffer;
+    char multibyte[20];
     size_t mblen = 0;
 
     size_t len = s0.length();
-
-    if (bufsiz < len * 2 + 10) {
-	bufsiz = len * 2 + 10;
-	buffer = (char *)malloc(bufsiz);
-    }
+    buffer.reserve(len + 10);
 
     // Escape any xml special characters, and also make sure we have
     // valid utf8 -- otherwise we won't be able to re-read the xml.
@@ -63,12 +55,7 @@ std::string XmlExportable::encode(const std::string &s0)
 		    (!(multibyte[0] & 0x04)) ? 5 : 0;
 
 		if (length == 0 || mblen == length) {
-		    if (bufsiz < buflen + mblen + 1) {
-			bufsiz = 2 * buflen + mblen + 1;
-			buffer = (char *)realloc(buffer, bufsiz);
-		    }
-		    strncpy(buffer + buflen, multibyte, mblen);
-		    buflen += mblen;
+		    buffer.append(multibyte, mblen);
 		} else {
 		    if (!warned) {
 			std::cerr
@@ -87,25 +74,20 @@ std::string XmlExportable::encode(const std::string &s0)
 
 	    if (!(c & 0x80)) { // ascii
 
-		if (bufsiz < buflen + 10) {
-		    bufsiz = 2 * buflen + 10;
-		    buffer = (char *)realloc(buffer, bufsiz);
-		}
-		
 		switch (c) {
-		case '&' :  strncpy(buffer + buflen, "&amp;", 5); buflen += 5;  break;
-		case '<' :  strncpy(buffer + buflen, "&lt;", 4); buflen += 4;  break;
-		case '>' :  strncpy(buffer + buflen, "&gt;", 4); buflen += 4;  break;
-		case '"' :  strncpy(buffer + buflen, "&quot;", 6); buflen += 6;  break;
-		case '\'' : strncpy(buffer + buflen, "&apos;", 6); buflen += 6;  break;
+		case '&' :  buffer.append("&amp;", 5);  break;
+		case '<' :  buffer.append("&lt;", 4);  break;
+		case '>' :  buffer.append("&gt;", 4);  break;
+		case '"' :  buffer.append("&quot;", 6);  break;
+		case '\'' : buffer.append("&apos;", 6);  break;
 		case 0x9:
 		case 0xa:
 		case 0xd:
 		    // convert these special cases to plain whitespace:
-		    buffer[buflen++] = ' ';
+		    buffer += ' ';
 		    break;
 		default:
-		    if (c >= 32) buffer[buflen++] = c;
+		    if (c >= 32) buffer += char(c);
 		    else {
 			if (!warned) {
 			    std::cerr
@@ -163,12 +145,7 @@ std::string XmlExportable::encode(const std::string &s0)
 	    (!(multibyte[0] & 0x04)) ? 5 : 0;
 
 	if (length == 0 || mblen == length) {
-	    if (bufsiz < buflen + mblen + 1) {
-		bufsiz = 2 * buflen + mblen + 1;
-		buffer = (char *)realloc(buffer, bufsiz);
-	    }
-	    strncpy(buffer + buflen, multibyte, mblen);
-	    buflen += mblen;
+	    buffer.append(multibyte, mblen);
 	} else {
 	    if (!warned) {
 		std::cerr
@@ -182,7 +159,6 @@ std::string XmlExportable::encode(const std::string &s0)
 	    // and drop the character
 	}
     }
-    buffer[buflen] = '\0';
 
     return buffer;
 }
@@ -88,8 +88,10 @@ AudioSegmentAutoSplitCommand::execute()
             rtSplitPoints =
                 m_audioFileManager->
                 getSplitPoints(m_segment->getAudioFileId(),
-                               m_segment->getAudioStartTime(),
-                               m_segment->getAudioEndTime(),
+                               m_segment->stretchedToFileTime
+                                   (m_segment->getAudioStartTime()),
+                               m_segment->stretchedToFileTime
+                                   (m_segment->getAudioEndTime()),
                                m_threshold,
                                RealTime(0, 200000000));
         } catch (AudioFileManager::BadAudioPathException e) {
@@ -98,6 +100,16 @@ AudioSegmentAutoSplitCommand::execute()
             RG_WARNING << "ERROR: AudioSegmentAutoSplitCommand: Bad peak file: " << e.getMessage();
         }
 
+        // The split points are in the file, which for a segment
+        // stretched as it plays is not where they are in the segment
+        if (m_segment->isStretchedLive()) {
+            double ratio = m_segment->getStretchRatio();
+            for (size_t i = 0; i < rtSplitPoints.size(); ++i) {
+                rtSplitPoints[i].first = rtSplitPoints[i].first * ratio;
+                rtSplitPoints[i].second = rtSplitPoints[i].second * ratio;
+            }
+        }
+
         std::vector<SplitPointPair>::iterator it;
         timeT absStartTime, absEndTime;
 
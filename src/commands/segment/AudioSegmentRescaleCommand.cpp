@@ -25,47 +25,37 @@
 #include "base/Composition.h"
 #include "base/NotationTypes.h"
 #include "base/Segment.h"
-#include "document/RosegardenDocument.h"
-#include "sound/AudioFileTimeStretcher.h"
-#include "sound/AudioFileManager.h"
+#include "sound/AudioFile.h"
 #include <QString>
 
 
 namespace Rosegarden
 {
 
-AudioSegmentRescaleCommand::AudioSegmentRescaleCommand(RosegardenDocument *doc,
-                                                       Segment *s,
+AudioSegmentRescaleCommand::AudioSegmentRescaleCommand(Segment *s,
 						       float ratio) :
     NamedCommand(getGlobalName()),
-    m_afm(&doc->getAudioFileManager()),
-    m_stretcher(new AudioFileTimeStretcher(m_afm)),
     m_segment(s),
     m_newSegment(0),
     m_timesGiven(false),
     m_startTime(0),
     m_endMarkerTime(0),
-    m_fid(-1),
     m_ratio(ratio),
     m_detached(false)
 {
     // nothing
 }
 
-AudioSegmentRescaleCommand::AudioSegmentRescaleCommand(RosegardenDocument *doc,
-                                                       Segment *s,
+AudioSegmentRescaleCommand::AudioSegmentRescaleCommand(Segment *s,
 						       float ratio,
                                                        timeT st,
                                                        timeT emt) :
     NamedCommand(getGlobalName()),
-    m_afm(&doc->getAudioFileManager()),
-    m_stretcher(new AudioFileTimeStretcher(m_afm)),
     m_segment(s),
     m_newSegment(0),
     m_timesGiven(true),
     m_startTime(st),
     m_endMarkerTime(emt),
-    m_fid(-1),
     m_ratio(ratio),
     m_detached(false)
 {
@@ -74,8 +64,6 @@ AudioSegmentRescaleCommand::AudioSegmentRescaleCommand(RosegardenDocument *doc,
 
 AudioSegmentRescaleCommand::~AudioSegmentRescaleCommand()
 {
-    delete m_stretcher;
-
     if (m_detached) {
         delete m_segment;
     } else {
@@ -83,14 +71,6 @@ AudioSegmentRescaleCommand::~AudioSegmentRescaleCommand()
     }
 }
 
-void
-AudioSegmentRescaleCommand::setProgressDialog(
-        QPointer<QProgressDialog> progressDialog)
-{
-    if (m_stretcher)
-        m_stretcher->setProgressDialog(progressDialog);
-}
-
 void
 AudioSegmentRescaleCommand::execute()
 {
@@ -103,8 +83,6 @@ AudioSegmentRescaleCommand::execute()
     // If we don't have the rescaled segment yet, create it.
     if (!m_newSegment) {
 
-        // Rescale the audio file.
-
         AudioFileId sourceFileId = m_segment->getAudioFileId();
         float absoluteRatio = m_ratio;
 
@@ -122,20 +100,16 @@ AudioSegmentRescaleCommand::execute()
                 (m_segment->getEndMarkerTime() - m_segment->getStartTime()) * m_ratio;
         }
 
-        m_fid = m_stretcher->getStretchedAudioFile(sourceFileId,
-                                                   absoluteRatio);
-        // If the stretch failed, bail.
-        if (m_fid < 0)
-            return;
-
-        // Audio file was rescaled successfully.  Create the new Segment.
+        // Create the new Segment.
 
         m_newSegment = m_segment->clone(false);
 
         std::string label = m_newSegment->getLabel();
         m_newSegment->setLabel(appendLabel(label, qstrtostr(tr("(rescaled)"))));
 
-        m_newSegment->setAudioFileId(m_fid);
+        // The new segment plays the unstretched file, and the
+        // sequencer stretches it as it goes.  Nothing is rendered.
+        m_newSegment->setAudioFileId(sourceFileId);
         m_newSegment->setUnstretchedFileId(sourceFileId);
         m_newSegment->setStretchRatio(absoluteRatio);
         m_newSegment->setAudioStartTime(m_segment->getAudioStartTime() *
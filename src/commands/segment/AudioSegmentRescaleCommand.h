@@ -23,27 +23,18 @@
 #include "base/Event.h"
 #include <QCoreApplication>
 
-#include <QPointer>
-
-class QProgressDialog;
-
 namespace Rosegarden
 {
 
 class Segment;
-class AudioFileManager;
-class AudioFileTimeStretcher;
-class RosegardenDocument;
 
 class AudioSegmentRescaleCommand : public NamedCommand
 {
     Q_DECLARE_TR_FUNCTIONS(Rosegarden::AudioSegmentRescaleCommand)
 
 public:
-    AudioSegmentRescaleCommand(RosegardenDocument *doc,
-                               Segment *segment, float ratio);
-    AudioSegmentRescaleCommand(RosegardenDocument *doc,
-                               Segment *segment, float ratio,
+    AudioSegmentRescaleCommand(Segment *segment, float ratio);
+    AudioSegmentRescaleCommand(Segment *segment, float ratio,
                                timeT newStartTime,
                                timeT newEndMarkerTime);
     virtual ~AudioSegmentRescaleCommand();
@@ -51,23 +42,14 @@ public:
     virtual void execute();
     virtual void unexecute();
 
-    AudioFileTimeStretcher *getStretcher() { return m_stretcher; }
-    int getNewAudioFileId() const { return m_fid; }
-
-    /// Used by m_stretcher during execute().
-    void setProgressDialog(QPointer<QProgressDialog> progressDialog);
-    
     static QString getGlobalName() { return tr("Stretch or S&quash..."); }
 
 private:
-    AudioFileManager *m_afm;
-    AudioFileTimeStretcher *m_stretcher;
     Segment *m_segment;
     Segment *m_newSegment;
     bool m_timesGiven;
     timeT m_startTime;
     timeT m_endMarkerTime;
-    int m_fid;
     float m_ratio;
     bool m_detached;
 };
@@ -0,0 +1,625 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#define RG_MODULE_STRING "[DocumentSnapshot]"
+
+#include "DocumentSnapshot.h"
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/NotationTypes.h"
+#include "base/Profiler.h"
+#include "base/Segment.h"
+#include "gui/general/ResourceFinder.h"
+#include "misc/Debug.h"
+
+#include <QCryptographicHash>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <zlib.h>
+
+namespace Rosegarden
+{
+
+const unsigned int DocumentSnapshot::Version = 1;
+
+// The file starts with this header, in the byte order of the machine
+// that wrote it.  Offsets are from the start of the file.
+//
+// After it come the skeleton XML, the tempo and time signature
+// changes, each segment's events, the property name and string
+// tables, and an index of where each segment starts.
+
+static const char magic[8] = { 'R', 'G', 'S', 'N', 'A', 'P', 'S', 'H' };
+static const quint32 byteOrderMark = 0x01020304;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    quint64 sourceSize;         // of the .rg file
+    quint32 sourceCrc;
+    quint32 dataCrc;            // of everything after the header
+    quint64 dataSize;
+    quint64 skeletonOffset;
+    quint64 referenceOffset;
+    quint64 namesOffset;
+    quint64 stringsOffset;
+    quint64 indexOffset;
+};
+
+// Events are written as
+//
+//   quint32 type (index into the strings)
+//   qint64 absolute time, qint64 duration, qint32 suborder
+//   quint32 property count, and for each property
+//     quint32 name (index into the names), quint8 type, quint8 persistent
+//     and a value: qint64 for Int, quint8 for Bool, quint32 (index into
+//     the strings) for String
+
+static const int chunkSize = 1024 * 1024;
+
+static quint32
+crcOf(const char *data, size_t size, quint32 crc = 0)
+{
+    while (size > 0) {
+        uInt n = uInt(std::min(size, size_t(chunkSize)));
+        crc = quint32(crc32(crc, (const Bytef *)data, n));
+        data += n;
+        size -= n;
+    }
+    return crc;
+}
+
+// Size and CRC of a whole file, mapped
+static bool
+checkFile(const QString &path, quint64 &size, quint32 &crc)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    size = file.size();
+    crc = 0;
+    if (size == 0) return true;
+
+    uchar *data = file.map(0, size);
+    if (!data) return false;
+    crc = crcOf((const char *)data, size_t(size));
+    file.unmap(data);
+    return true;
+}
+
+namespace
+{
+
+// Writes the snapshot through a buffer, keeping the CRC as it goes
+class SnapshotWriter
+{
+public:
+    SnapshotWriter(QFile &file) :
+        m_file(file), m_crc(0), m_written(0), m_ok(true) { }
+
+    template <typename T>
+    void put(T value) { append((const char *)&value, sizeof(T)); }
+
+    void putBytes(const std::string &s) {
+        put(quint32(s.size()));
+        append(s.data(), s.size());
+    }
+
+    void append(const char *data, size_t size) {
+        m_buffer.append(data, int(size));
+        if (m_buffer.size() >= chunkSize) flush();
+    }
+
+    /// Offset from the start of the file of the next thing written
+    quint64 getOffset() const {
+        return sizeof(SnapshotHeader) + m_written + m_buffer.size();
+    }
+
+    bool flush() {
+        if (m_buffer.isEmpty()) return m_ok;
+        m_crc = crcOf(m_buffer.constData(), m_buffer.size(), m_crc);
+        if (m_file.write(m_buffer) != m_buffer.size()) m_ok = false;
+        m_written += m_buffer.size();
+        m_buffer.clear();
+        return m_ok;
+    }
+
+    quint32 getCrc() const { return m_crc; }
+    quint64 getWritten() const { return m_written; }
+
+private:
+    QFile &m_file;
+    QByteArray m_buffer;
+    quint32 m_crc;
+    quint64 m_written;
+    bool m_ok;
+};
+
+// Reads from the mapped snapshot, never past its end
+class SnapshotReader
+{
+public:
+    SnapshotReader(const char *data, size_t size, size_t offset) :
+        m_p(data + std::min(offset, size)), m_end(data + size),
+        m_ok(offset <= size) { }
+
+    template <typename T>
+    T get() {
+        T value = T();
+        if (size_t(m_end - m_p) < sizeof(T)) {
+            m_ok = false;
+            return value;
+        }
+        memcpy(&value, m_p, sizeof(T));
+        m_p += sizeof(T);
+        return value;
+    }
+
+    const char *getBytes(size_t &size) {
+        size = get<quint32>();
+        if (!m_ok || size_t(m_end - m_p) < size) {
+            m_ok = false;
+            size = 0;
+            return 0;
+        }
+        const char *bytes = m_p;
+        m_p += size;
+        return bytes;
+    }
+
+    bool isOk() const { return m_ok; }
+
+private:
+    const char *m_p;
+    const char *m_end;
+    bool m_ok;
+};
+
+// Gives each property name and string an index, once
+class SnapshotTables
+{
+public:
+    quint32 name(const PropertyName &name) {
+        std::map<int, quint32>::iterator i = m_nameMap.find(name.getValue());
+        if (i != m_nameMap.end()) return i->second;
+        quint32 index = quint32(m_names.size());
+        m_names.push_back(name.getName());
+        m_nameMap[name.getValue()] = index;
+        return index;
+    }
+
+    quint32 string(const std::string &s) {
+        std::map<std::string, quint32>::iterator i = m_stringMap.find(s);
+        if (i != m_stringMap.end()) return i->second;
+        quint32 index = quint32(m_strings.size());
+        m_strings.push_back(s);
+        m_stringMap[s] = index;
+        return index;
+    }
+
+    const std::vector<std::string> &getNames() const { return m_names; }
+    const std::vector<std::string> &getStrings() const { return m_strings; }
+
+private:
+    std::map<int, quint32> m_nameMap;
+    std::vector<std::string> m_names;
+    std::map<std::string, quint32> m_stringMap;
+    std::vector<std::string> m_strings;
+};
+
+struct SnapshotProperty
+{
+    PropertyName name;
+    PropertyType type;
+    bool persistent;
+};
+
+}
+
+// Write the properties of an event that its XML would carry, so that
+// a document opened from the snapshot is the one the .rg file gives:
+// no view-local properties, and none of the RealTime ones, which the
+// XML reader ignores
+static void
+writeEvent(SnapshotWriter &writer, SnapshotTables &tables, const Event *e)
+{
+    std::vector<SnapshotProperty> properties;
+
+    for (int persistent = 1; persistent >= 0; --persistent) {
+        Event::PropertyNames names = persistent ?
+            e->getPersistentPropertyNames() :
+            e->getNonPersistentPropertyNames();
+        for (Event::PropertyNames::const_iterator i = names.begin();
+             i != names.end(); ++i) {
+            if (!persistent &&
+                i->getName().find("::") != std::string::npos) continue;
+            SnapshotProperty p;
+            p.name = *i;
+            p.type = e->getPropertyType(*i);
+            p.persistent = persistent;
+            if (p.type == RealTimeT) continue;
+            properties.push_back(p);
+        }
+    }
+
+    // As Event::toXmlString does
+    timeT duration = e->getDuration();
+    if (e->isa(Note::EventType) && duration < 1 &&
+        !e->has(BaseProperties::IS_GRACE_NOTE)) {
+        duration = 1;
+    }
+
+    writer.put(tables.string(e->getType()));
+    writer.put(qint64(e->getAbsoluteTime()));
+    writer.put(qint64(duration));
+    writer.put(qint32(e->getSubOrdering()));
+    writer.put(quint32(properties.size()));
+
+    for (size_t i = 0; i < properties.size(); ++i) {
+        const SnapshotProperty &p = properties[i];
+        writer.put(tables.name(p.name));
+        writer.put(quint8(p.type));
+        writer.put(quint8(p.persistent));
+        switch (p.type) {
+        case Int:
+            writer.put(qint64(e->get<Int>(p.name)));
+            break;
+        case Bool:
+            writer.put(quint8(e->get<Bool>(p.name)));
+            break;
+        case String:
+            writer.put(tables.string(e->get<String>(p.name)));
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+DocumentSnapshot::DocumentSnapshot(const QString &path) :
+    m_file(path),
+    m_data(0),
+    m_size(0),
+    m_skeleton(0),
+    m_skeletonSize(0),
+    m_referenceOffset(0)
+{
+}
+
+DocumentSnapshot::~DocumentSnapshot()
+{
+    if (m_data) m_file.unmap((uchar *)m_data);
+}
+
+QString
+DocumentSnapshot::getSnapshotPath(const QString &file)
+{
+    QString dir = ResourceFinder().getResourceSaveDir("snapshots");
+    if (dir == "") return "";
+
+    // Named as AutoSaveFinder names auto-save files
+    QString hashed = QString::fromLocal8Bit
+        (QCryptographicHash::hash
+         (QFileInfo(file).absoluteFilePath().toLocal8Bit(),
+          QCryptographicHash::Sha1).toHex());
+
+    return dir + "/" + hashed + ".snapshot";
+}
+
+bool
+DocumentSnapshot::write(const QString &file,
+                        const QByteArray &skeleton,
+                        const Composition &composition,
+                        const std::vector<const Segment *> &segments)
+{
+    Profiler profiler("DocumentSnapshot::write");
+
+    QString path = getSnapshotPath(file);
+    if (path.isEmpty()) return false;
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = Version;
+    header.byteOrder = byteOrderMark;
+
+    if (!checkFile(file, header.sourceSize, header.sourceCrc)) {
+        RG_WARNING << "write(): Could not read" << file;
+        return false;
+    }
+
+    // Write to a temporary file, and only put it in place once it is
+    // whole
+    QString tempPath = path + ".tmp";
+    QFile out(tempPath);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        RG_WARNING << "write(): Could not open" << tempPath;
+        return false;
+    }
+    out.write((const char *)&header, sizeof(header));
+
+    SnapshotWriter writer(out);
+    SnapshotTables tables;
+
+    header.skeletonOffset = writer.getOffset();
+    writer.put(quint32(skeleton.size()));
+    writer.append(skeleton.constData(), skeleton.size());
+
+    header.referenceOffset = writer.getOffset();
+    writer.put(quint32(composition.getTempoChangeCount()));
+    for (int i = 0; i < composition.getTempoChangeCount(); ++i) {
+        std::pair<timeT, tempoT> tempo = composition.getTempoChange(i);
+        std::pair<bool, tempoT> ramp = composition.getTempoRamping(i, false);
+        writer.put(qint64(tempo.first));
+        writer.put(qint32(tempo.second));
+        writer.put(qint32(ramp.first ? ramp.second : -1));
+    }
+    writer.put(quint32(composition.getTimeSignatureCount()));
+    for (int i = 0; i < composition.getTimeSignatureCount(); ++i) {
+        std::pair<timeT, TimeSignature> sig =
+            composition.getTimeSignatureChange(i);
+        writer.put(qint64(sig.first));
+        writer.put(qint32(sig.second.getNumerator()));
+        writer.put(qint32(sig.second.getDenominator()));
+        writer.put(quint8(sig.second.isCommon()));
+        writer.put(quint8(sig.second.isHidden()));
+        writer.put(quint8(sig.second.hasHiddenBars()));
+    }
+
+    std::vector<quint64> segmentOffsets;
+    for (size_t s = 0; s < segments.size(); ++s) {
+        const Segment *segment = segments[s];
+        segmentOffsets.push_back(writer.getOffset());
+        writer.put(quint32(segment->size()));
+        for (Segment::const_iterator i = segment->begin();
+             i != segment->end(); ++i) {
+            writeEvent(writer, tables, *i);
+        }
+    }
+
+    header.namesOffset = writer.getOffset();
+    writer.put(quint32(tables.getNames().size()));
+    for (size_t i = 0; i < tables.getNames().size(); ++i) {
+        writer.putBytes(tables.getNames()[i]);
+    }
+
+    header.stringsOffset = writer.getOffset();
+    writer.put(quint32(tables.getStrings().size()));
+    for (size_t i = 0; i < tables.getStrings().size(); ++i) {
+        writer.putBytes(tables.getStrings()[i]);
+    }
+
+    header.indexOffset = writer.getOffset();
+    writer.put(quint32(segmentOffsets.size()));
+    for (size_t i = 0; i < segmentOffsets.size(); ++i) {
+        writer.put(segmentOffsets[i]);
+    }
+
+    bool ok = writer.flush();
+
+    header.dataCrc = writer.getCrc();
+    header.dataSize = writer.getWritten();
+
+    ok = ok && out.seek(0) &&
+        out.write((const char *)&header, sizeof(header)) == qint64(sizeof(header));
+    out.close();
+    ok = ok && out.error() == QFile::NoError;
+
+    if (!ok) {
+        RG_WARNING << "write(): Could not write" << tempPath;
+        QFile::remove(tempPath);
+        return false;
+    }
+
+    QFile::remove(path);
+    if (!QFile::rename(tempPath, path)) {
+        RG_WARNING << "write(): Could not rename" << tempPath << "to" << path;
+        QFile::remove(tempPath);
+        return false;
+    }
+
+    return true;
+}
+
+DocumentSnapshot *
+DocumentSnapshot::open(const QString &file)
+{
+    QString path = getSnapshotPath(file);
+    if (path.isEmpty() || !QFileInfo(path).exists()) return 0;
+
+    Profiler profiler("DocumentSnapshot::open");
+
+    DocumentSnapshot *snapshot = new DocumentSnapshot(path);
+    if (!snapshot->map() || !snapshot->matches(file)) {
+        RG_DEBUG << "open(): Snapshot" << path << "does not match" << file;
+        delete snapshot;
+        return 0;
+    }
+
+    return snapshot;
+}
+
+bool
+DocumentSnapshot::map()
+{
+    if (!m_file.open(QIODevice::ReadOnly)) return false;
+
+    m_size = size_t(m_file.size());
+    if (m_size < sizeof(SnapshotHeader)) return false;
+
+    m_data = (const char *)m_file.map(0, m_size);
+    return m_data != 0;
+}
+
+bool
+DocumentSnapshot::matches(const QString &file)
+{
+    SnapshotHeader header;
+    memcpy(&header, m_data, sizeof(header));
+
+    if (memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+        header.version != Version ||
+        header.byteOrder != byteOrderMark ||
+        header.dataSize != m_size - sizeof(header)) {
+        return false;
+    }
+
+    // The .rg file it was made from
+    quint64 sourceSize = 0;
+    quint32 sourceCrc = 0;
+    if (!checkFile(file, sourceSize, sourceCrc) ||
+        sourceSize != header.sourceSize ||
+        sourceCrc != header.sourceCrc) {
+        return false;
+    }
+
+    // and itself
+    if (crcOf(m_data + sizeof(header), m_size - sizeof(header)) !=
+        header.dataCrc) {
+        return false;
+    }
+
+    SnapshotReader skeleton(m_data, m_size, size_t(header.skeletonOffset));
+    m_skeleton = skeleton.getBytes(m_skeletonSize);
+    m_referenceOffset = size_t(header.referenceOffset);
+
+    SnapshotReader names(m_data, m_size, size_t(header.namesOffset));
+    quint32 count = names.get<quint32>();
+    for (quint32 i = 0; i < count && names.isOk(); ++i) {
+        size_t size = 0;
+        const char *bytes = names.getBytes(size);
+        m_names.push_back(PropertyName(std::string(bytes, size)));
+    }
+
+    SnapshotReader strings(m_data, m_size, size_t(header.stringsOffset));
+    count = strings.get<quint32>();
+    for (quint32 i = 0; i < count && strings.isOk(); ++i) {
+        size_t size = 0;
+        const char *bytes = strings.getBytes(size);
+        m_strings.push_back(std::string(bytes, size));
+    }
+
+    SnapshotReader index(m_data, m_size, size_t(header.indexOffset));
+    count = index.get<quint32>();
+    for (quint32 i = 0; i < count && index.isOk(); ++i) {
+        m_segmentOffsets.push_back(size_t(index.get<quint64>()));
+    }
+
+    return skeleton.isOk() && names.isOk() && strings.isOk() && index.isOk();
+}
+
+QByteArray
+DocumentSnapshot::getSkeleton() const
+{
+    return QByteArray::fromRawData(m_skeleton, int(m_skeletonSize));
+}
+
+bool
+DocumentSnapshot::readReferenceSegments(Composition &composition) const
+{
+    SnapshotReader reader(m_data, m_size, m_referenceOffset);
+
+    quint32 count = reader.get<quint32>();
+    for (quint32 i = 0; i < count && reader.isOk(); ++i) {
+        timeT time = reader.get<qint64>();
+        tempoT tempo = reader.get<qint32>();
+        tempoT target = reader.get<qint32>();
+        if (reader.isOk()) composition.addTempoAtTime(time, tempo, target);
+    }
+
+    count = reader.get<quint32>();
+    for (quint32 i = 0; i < count && reader.isOk(); ++i) {
+        timeT time = reader.get<qint64>();
+        int numerator = reader.get<qint32>();
+        int denominator = reader.get<qint32>();
+        bool common = reader.get<quint8>();
+        bool hidden = reader.get<quint8>();
+        bool hiddenBars = reader.get<quint8>();
+        if (reader.isOk()) {
+            composition.addTimeSignature
+                (time, TimeSignature(numerator, denominator,
+                                     common, hidden, hiddenBars));
+        }
+    }
+
+    return reader.isOk();
+}
+
+bool
+DocumentSnapshot::readSegment(size_t n, std::vector<Event *> &events) const
+{
+    if (n >= m_segmentOffsets.size()) return false;
+
+    SnapshotReader reader(m_data, m_size, m_segmentOffsets[n]);
+
+    quint32 count = reader.get<quint32>();
+    if (!reader.isOk()) return false;
+    events.reserve(events.size() + count);
+
+    for (quint32 i = 0; i < count; ++i) {
+
+        quint32 type = reader.get<quint32>();
+        timeT absoluteTime = reader.get<qint64>();
+        timeT duration = reader.get<qint64>();
+        short subOrdering = short(reader.get<qint32>());
+        quint32 properties = reader.get<quint32>();
+        if (!reader.isOk() || type >= m_strings.size()) return false;
+
+        Event *e = new Event(m_strings[type], absoluteTime, duration,
+                             subOrdering);
+        events.push_back(e);
+
+        for (quint32 p = 0; p < properties; ++p) {
+            quint32 name = reader.get<quint32>();
+            quint8 propertyType = reader.get<quint8>();
+            bool persistent = reader.get<quint8>();
+            if (!reader.isOk() || name >= m_names.size()) return false;
+
+            switch (propertyType) {
+            case Int:
+                e->set<Int>(m_names[name], long(reader.get<qint64>()),
+                            persistent);
+                break;
+            case Bool:
+                e->set<Bool>(m_names[name], reader.get<quint8>() != 0,
+                             persistent);
+                break;
+            case String: {
+                quint32 s = reader.get<quint32>();
+                if (s >= m_strings.size()) return false;
+                e->set<String>(m_names[name], m_strings[s], persistent);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+
+        if (!reader.isOk()) return false;
+    }
+
+    return true;
+}
+
+}
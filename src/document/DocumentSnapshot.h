@@ -0,0 +1,136 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_DOCUMENTSNAPSHOT_H
+#define RG_DOCUMENTSNAPSHOT_H
+
+#include "base/PropertyName.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include <string>
+#include <vector>
+
+
+namespace Rosegarden
+{
+
+class Composition;
+class Event;
+class Segment;
+
+
+/**
+ * A compact binary copy of a saved .rg file, kept alongside it so that
+ * it can be opened again without parsing and rebuilding every event
+ * from XML.
+ *
+ * A snapshot holds the document's XML with the events left out of its
+ * segments and the tempo and time signature changes left out of its
+ * composition, and those in binary form instead: the events of each
+ * segment in the order the segments appear in the XML, with their
+ * property names and strings in tables shared by all of them.  The
+ * file is mapped rather than read, and events are made straight from
+ * the mapping.
+ *
+ * Snapshots live in the user's snapshot directory, named after the
+ * file they belong to.  Each records the size and CRC of the .rg file
+ * it was made from, and of its own contents, and is only used while
+ * both still match.
+ */
+class DocumentSnapshot
+{
+public:
+    ~DocumentSnapshot();
+
+    /**
+     * Where the snapshot for the .rg file \a file is kept, or an
+     * empty string if there is nowhere to keep it.
+     */
+    static QString getSnapshotPath(const QString &file);
+
+    /**
+     * Write a snapshot for the .rg file \a file, which has just been
+     * saved from a document.  \a skeleton is the document's XML
+     * without events, tempos or time signatures (see
+     * RosegardenDocument::saveSnapshot), and \a segments its segments
+     * in the order they appear in it.
+     */
+    static bool write(const QString &file,
+                      const QByteArray &skeleton,
+                      const Composition &composition,
+                      const std::vector<const Segment *> &segments);
+
+    /**
+     * Open the snapshot for the .rg file \a file, if there is one and
+     * it still matches the file.  Otherwise return 0.
+     */
+    static DocumentSnapshot *open(const QString &file);
+
+    /**
+     * The document's XML, without events, tempos or time signatures.
+     * This points into the mapped file, so it goes when the snapshot
+     * does.
+     */
+    QByteArray getSkeleton() const;
+
+    /**
+     * Add the tempo and time signature changes to \a composition.
+     */
+    bool readReferenceSegments(Composition &composition) const;
+
+    size_t getSegmentCount() const { return m_segmentOffsets.size(); }
+
+    /**
+     * Make the events of the nth segment in the XML, adding them to
+     * \a events.  The caller takes ownership of them, including any
+     * made before a failure.
+     */
+    bool readSegment(size_t n, std::vector<Event *> &events) const;
+
+    /// The current format version
+    static const unsigned int Version;
+
+private:
+    DocumentSnapshot(const QString &path);
+
+    bool map();
+    bool matches(const QString &file);
+
+    QFile m_file;
+    const char *m_data;
+    size_t m_size;
+
+    const char *m_skeleton;
+    size_t m_skeletonSize;
+    size_t m_referenceOffset;
+    std::vector<size_t> m_segmentOffsets;
+
+    std::vector<PropertyName> m_names;
+    std::vector<std::string> m_strings;
+
+private:
+    DocumentSnapshot(const DocumentSnapshot &); // not provided
+    DocumentSnapshot &operator=(const DocumentSnapshot &); // not provided
+};
+
+
+}
+
+#endif
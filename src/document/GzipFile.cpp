@@ -16,50 +16,197 @@
 */
 
 #include "GzipFile.h"
+#include <QFileInfo>
 #include <QString>
-#include <string>
+#include <algorithm>
 #include <zlib.h>
 
 namespace Rosegarden
 {
 
+// Uncompressed bytes passed to or from zlib at a time, and the size
+// of its own buffer
+static const int chunkSize = 128 * 1024;
+
 bool
 GzipFile::writeToFile(QString file, QString text)
 {
-    std::string stext = std::string(text.toUtf8().data());
-    const char *ctext = stext.c_str();
-    size_t csize = stext.length();
-
-    gzFile fd = gzopen(file.toLocal8Bit().data(), "wb");
-    if (!fd) return false;
+    GzipWriter writer(file);
+    if (!writer.open(QIODevice::WriteOnly)) return false;
 
-    int actual = gzwrite(fd, (void *)ctext, csize);
-    gzclose(fd);
+    QByteArray utf8 = text.toUtf8();
+    writer.write(utf8.constData(), utf8.size());
+    writer.close();
 
-    return ((size_t)actual == csize);
+    return !writer.hasFailed();
 }
 
 bool
 GzipFile::readFromFile(QString file, QString &text)
 {
     text = "";
-    gzFile fd = gzopen(file.toLocal8Bit().data(), "rb");
-    if (!fd) return false;
 
-    QByteArray ba;
-    char buffer[100000];
-    int got = 0;
+    GzipReader reader(file);
+    if (!reader.open(QIODevice::ReadOnly)) return false;
 
-    while ((got = gzread(fd, buffer, 100000)) > 0) {
-        ba.append(QByteArray(buffer, got));
-    }
+    QByteArray ba = reader.readAll();
+    bool ok = !reader.hasFailed();
+    reader.close();
 
-    bool ok = gzeof(fd);
-    gzclose(fd);
     text = QString::fromUtf8(ba);
     return ok;
 }    
 
+GzipWriter::GzipWriter(QString file) :
+    m_fileName(file),
+    m_file(0),
+    m_failed(false)
+{
+}
+
+GzipWriter::~GzipWriter()
+{
+    close();
+}
+
+bool
+GzipWriter::open(OpenMode mode)
+{
+    if (m_file || (mode & QIODevice::ReadOnly)) return false;
+
+    gzFile fd = gzopen(m_fileName.toLocal8Bit().data(), "wb");
+    if (!fd) {
+        m_failed = true;
+        setErrorString(QString("Could not open %1").arg(m_fileName));
+        return false;
+    }
+    gzbuffer(fd, chunkSize);
+
+    m_file = fd;
+    m_failed = false;
+    return QIODevice::open(mode | QIODevice::Unbuffered);
+}
+
+void
+GzipWriter::close()
+{
+    if (!m_file) return;
+
+    QIODevice::close();
+
+    if (gzclose((gzFile)m_file) != Z_OK) {
+        m_failed = true;
+        setErrorString(QString("Could not finish writing %1").arg(m_fileName));
+    }
+    m_file = 0;
+}
+
+qint64
+GzipWriter::writeData(const char *data, qint64 len)
+{
+    if (!m_file) return -1;
+
+    // gzwrite takes an unsigned int length
+    qint64 written = 0;
+    while (written < len) {
+        unsigned int n = (unsigned int)std::min(len - written, qint64(chunkSize));
+        int actual = gzwrite((gzFile)m_file, data + written, n);
+        if (actual <= 0 || (unsigned int)actual != n) {
+            m_failed = true;
+            setErrorString(QString("Could not write to %1").arg(m_fileName));
+            return -1;
+        }
+        written += actual;
+    }
+
+    return written;
+}
+
+GzipReader::GzipReader(QString file) :
+    m_fileName(file),
+    m_file(0),
+    m_compressedSize(0),
+    m_ended(false),
+    m_failed(false)
+{
+}
+
+GzipReader::~GzipReader()
+{
+    close();
+}
+
+bool
+GzipReader::open(OpenMode mode)
+{
+    if (m_file || (mode & QIODevice::WriteOnly)) return false;
+
+    gzFile fd = gzopen(m_fileName.toLocal8Bit().data(), "rb");
+    if (!fd) {
+        m_failed = true;
+        setErrorString(QString("Could not open %1").arg(m_fileName));
+        return false;
+    }
+    gzbuffer(fd, chunkSize);
+
+    m_file = fd;
+    m_compressedSize = QFileInfo(m_fileName).size();
+    m_ended = false;
+    m_failed = false;
+    return QIODevice::open(mode);
+}
+
+void
+GzipReader::close()
+{
+    if (!m_file) return;
+
+    QIODevice::close();
+
+    gzclose((gzFile)m_file);
+    m_file = 0;
+}
+
+bool
+GzipReader::atEnd() const
+{
+    return !m_file || (m_ended && QIODevice::bytesAvailable() == 0);
+}
+
+qint64
+GzipReader::getCompressedPosition() const
+{
+    if (!m_file) return 0;
+    return gzoffset((gzFile)m_file);
 }
 
+qint64
+GzipReader::readData(char *data, qint64 maxlen)
+{
+    if (!m_file || m_ended) return m_failed ? -1 : 0;
+
+    unsigned int n = (unsigned int)std::min(maxlen, qint64(chunkSize));
+    int got = gzread((gzFile)m_file, data, n);
 
+    if (got < 0) {
+        m_failed = true;
+        m_ended = true;
+        setErrorString(QString("Could not read %1").arg(m_fileName));
+        return -1;
+    }
+
+    // A truncated file reads short and ends without reaching the
+    // end of the gzip stream
+    if (got == 0) {
+        m_ended = true;
+        if (!gzeof((gzFile)m_file)) {
+            m_failed = true;
+            setErrorString(QString("Could not read %1").arg(m_fileName));
+            return -1;
+        }
+    }
+
+    return got;
+}
+
+}
@@ -15,6 +15,10 @@
     COPYING included with this distribution for more information.
 */
 
+#ifndef RG_GZIPFILE_H
+#define RG_GZIPFILE_H
+
+#include <QIODevice>
 #include <QString>
 
 namespace Rosegarden
@@ -27,6 +31,89 @@ public:
     static bool readFromFile(QString file, QString &text);
 };
 
-}
+/**
+ * A write-only device that compresses whatever is written to it
+ * straight into a gzip file, so that a document can be saved through a
+ * QTextStream without first being built up in memory.  Memory use is
+ * bounded by the stream's and zlib's own buffers.
+ *
+ * Check hasFailed() after close(), which is where the last of the
+ * data is written out.
+ */
+class GzipWriter : public QIODevice
+{
+public:
+    GzipWriter(QString file);
+    virtual ~GzipWriter();
+
+    /// Opens the file.  Only QIODevice::WriteOnly is supported.
+    virtual bool open(OpenMode mode);
+
+    /// Writes out the last of the data and closes the file
+    virtual void close();
+
+    virtual bool isSequential() const { return true; }
+
+    /// True if opening, a write, or the close has failed
+    bool hasFailed() const { return m_failed; }
+
+protected:
+    virtual qint64 readData(char *, qint64) { return -1; }
+    virtual qint64 writeData(const char *data, qint64 len);
+
+private:
+    QString m_fileName;
+    void *m_file; // gzFile
+    bool m_failed;
+
+    GzipWriter(const GzipWriter &); // not provided
+    GzipWriter &operator=(const GzipWriter &); // not provided
+};
+
+/**
+ * A read-only device that decompresses a gzip file as it is read, so
+ * that a document can be parsed without first being read whole into
+ * memory.  It also reports how far through the compressed file it has
+ * got, for progress.
+ */
+class GzipReader : public QIODevice
+{
+public:
+    GzipReader(QString file);
+    virtual ~GzipReader();
+
+    /// Opens the file.  Only QIODevice::ReadOnly is supported.
+    virtual bool open(OpenMode mode);
+
+    virtual void close();
+
+    virtual bool isSequential() const { return true; }
+    virtual bool atEnd() const;
+
+    /// The size of the compressed file in bytes
+    qint64 getCompressedSize() const { return m_compressedSize; }
+
+    /// How much of the compressed file has been read, in bytes
+    qint64 getCompressedPosition() const;
 
+    /// True if opening or a read has failed
+    bool hasFailed() const { return m_failed; }
+
+protected:
+    virtual qint64 readData(char *data, qint64 maxlen);
+    virtual qint64 writeData(const char *, qint64) { return -1; }
+
+private:
+    QString m_fileName;
+    void *m_file; // gzFile
+    qint64 m_compressedSize;
+    bool m_ended;
+    bool m_failed;
+
+    GzipReader(const GzipReader &); // not provided
+    GzipReader &operator=(const GzipReader &); // not provided
+};
+
+}
 
+#endif
@@ -50,6 +50,8 @@
 #include "gui/widgets/StartupLogo.h"
 #include "gui/studio/AudioPlugin.h"
 #include "gui/studio/AudioPluginManager.h"
+#include "DocumentSnapshot.h"
+#include "GzipFile.h"
 #include "RosegardenDocument.h"
 #include "sound/AudioFileManager.h"
 #include "XmlStorableEvent.h"
@@ -62,6 +64,7 @@
 #include <QFileInfo>
 #include <QString>
 #include <QStringList>
+#include <QXmlStreamReader>
 
 namespace Rosegarden
 {
@@ -201,7 +204,6 @@ ConfigurationXmlSubHandler::endElement(const QString&,
 
 
 RoseXmlHandler::RoseXmlHandler(RosegardenDocument *doc,
-                               unsigned int elementCount,
                                QPointer<QProgressDialog> progressDialog,
                                bool createNewDevicesWhenNeeded) :
     m_doc(doc),
@@ -235,8 +237,6 @@ RoseXmlHandler::RoseXmlHandler(RosegardenDocument *doc,
     m_colourMap(0),
     m_keyMapping(0),
     m_pluginId(0),
-    m_totalElements(elementCount),
-    m_elementsSoFar(0),
     m_subHandler(0),
     m_deprecation(false),
     m_createDevices(createNewDevicesWhenNeeded),
@@ -244,7 +244,9 @@ RoseXmlHandler::RoseXmlHandler(RosegardenDocument *doc,
     m_skipAllAudio(false),
     m_hasActiveAudio(false),
     m_oldSolo(false),
-    m_progressDialog(progressDialog)
+    m_progressDialog(progressDialog),
+    m_snapshot(0),
+    m_snapshotSegments(0)
 {}
 
 RoseXmlHandler::~RoseXmlHandler()
@@ -276,6 +278,146 @@ RoseXmlHandler::getAudioPluginManager()
     return m_doc->getPluginManager();
 }
 
+// Attributes for the handlers that still take them the old way
+static QXmlAttributes
+toXmlAttributes(const QXmlStreamAttributes &attributes)
+{
+    QXmlAttributes result;
+    for (int i = 0; i < attributes.size(); ++i) {
+        const QXmlStreamAttribute &a = attributes[i];
+        result.append(a.qualifiedName().toString(),
+                      a.namespaceUri().toString(),
+                      a.name().toString(),
+                      a.value().toString());
+    }
+    return result;
+}
+
+// How far through the file parse() has got, from 0 to 1
+static double
+progressThrough(QIODevice &file)
+{
+    GzipReader *gzip = dynamic_cast<GzipReader *>(&file);
+    if (gzip) {
+        if (gzip->getCompressedSize() <= 0) return 0.0;
+        return static_cast<double>(gzip->getCompressedPosition()) /
+               static_cast<double>(gzip->getCompressedSize());
+    }
+    if (file.isSequential() || file.size() <= 0) return 0.0;
+    return static_cast<double>(file.pos()) /
+           static_cast<double>(file.size());
+}
+
+bool
+RoseXmlHandler::parse(QIODevice &file)
+{
+    Profiler profiler("RoseXmlHandler::parse");
+
+    QXmlStreamReader reader(&file);
+    GzipReader *gzip = dynamic_cast<GzipReader *>(&file);
+
+    // Text may come in several pieces: gather it up to hand on in
+    // one, as QXmlSimpleReader did
+    QString text;
+
+    unsigned int elements = 0;
+    bool ok = startDocument();
+
+    while (ok && !reader.atEnd()) {
+
+        QXmlStreamReader::TokenType token = reader.readNext();
+
+        if (token == QXmlStreamReader::Characters) {
+            text.append(reader.text());
+            continue;
+        }
+
+        if (!text.isEmpty()) {
+            ok = characters(text);
+            text.clear();
+            if (!ok) break;
+        }
+
+        if (token == QXmlStreamReader::StartElement) {
+
+            QStringRef name = reader.qualifiedName();
+
+            // Events and their properties make up nearly all of a
+            // large file: make them straight from the reader
+            if (!getSubHandler()) {
+                if (name.compare(QLatin1String("event"),
+                                 Qt::CaseInsensitive) == 0) {
+                    ok = startEvent(new XmlStorableEvent
+                                    (reader.attributes(), m_currentTime));
+                    continue;
+                }
+                if (m_currentEvent &&
+                    name.compare(QLatin1String("property"),
+                                 Qt::CaseInsensitive) == 0) {
+                    m_currentEvent->setPropertyFromAttributes
+                        (reader.attributes(), true);
+                    continue;
+                }
+                if (m_currentEvent &&
+                    name.compare(QLatin1String("nproperty"),
+                                 Qt::CaseInsensitive) == 0) {
+                    m_currentEvent->setPropertyFromAttributes
+                        (reader.attributes(), false);
+                    continue;
+                }
+            }
+
+            ok = startElement(reader.namespaceUri().toString(),
+                              reader.name().toString(),
+                              name.toString(),
+                              toXmlAttributes(reader.attributes()));
+
+        } else if (token == QXmlStreamReader::EndElement) {
+
+            ok = endElement(reader.namespaceUri().toString(),
+                            reader.name().toString(),
+                            reader.qualifiedName().toString());
+
+            // Set percentage done
+            //
+            if (ok && ++elements % 300 == 0) {
+
+                if (m_progressDialog) {
+                    // If the user cancelled, bail.
+                    if (m_progressDialog->wasCanceled())
+                        return false;
+
+                    m_progressDialog->setValue(static_cast<int>(
+                            progressThrough(file) * 100.0));
+                }
+
+                // Kick the event loop so that we don't appear to be in
+                // an endless loop.
+                qApp->processEvents(QEventLoop::AllEvents, 100);
+            }
+        }
+    }
+
+    bool readFailed = (gzip && gzip->hasFailed());
+
+    if (reader.hasError()) {
+        m_errorString = reader.errorString();
+    } else if (readFailed) {
+        m_errorString = file.errorString();
+    }
+
+    if (!ok || reader.hasError() || readFailed) {
+        if (m_errorString.isEmpty()) m_errorString = "Error";
+        m_errorString = QString("%1 at line %2, column %3")
+            .arg(m_errorString)
+            .arg(reader.lineNumber())
+            .arg(reader.columnNumber());
+        return false;
+    }
+
+    return endDocument();
+}
+
 bool
 RoseXmlHandler::startDocument()
 {
@@ -320,70 +462,7 @@ RoseXmlHandler::startElement(const QString& namespaceURI,
 
         //        RG_DEBUG << "RoseXmlHandler::startElement: found event, current time is " << m_currentTime;
 
-        if (m_currentEvent) {
-            RG_DEBUG << "RoseXmlHandler::startElement: Warning: new event found at time " << m_currentTime << " before previous event has ended; previous event will be lost";
-            delete m_currentEvent;
-        }
-
-        m_currentEvent = new XmlStorableEvent(atts, m_currentTime);
-
-        if (m_currentEvent->has(BEAMED_GROUP_ID)) {
-
-            // remap -- we want to ensure that the segment's nextId
-            // is always used (and incremented) in preference to the
-            // stored id
-
-            if (!m_currentSegment) {
-                m_errorString = "Got grouped event outside of a segment";
-                return false;
-            }
-
-            long storedId = m_currentEvent->get
-                            <Int>(BEAMED_GROUP_ID);
-
-            if (m_groupIdMap.find(storedId) == m_groupIdMap.end()) {
-                m_groupIdMap[storedId] = m_currentSegment->getNextId();
-            }
-
-            m_currentEvent->set
-            <Int>(BEAMED_GROUP_ID, m_groupIdMap[storedId]);
-
-        } else if (m_inGroup) {
-            m_currentEvent->set
-            <Int>(BEAMED_GROUP_ID, m_groupId);
-            m_currentEvent->set
-            <String>(BEAMED_GROUP_TYPE, m_groupType);
-            if (m_groupType == GROUP_TYPE_TUPLED) {
-                m_currentEvent->set
-                <Int>
-                (BEAMED_GROUP_TUPLET_BASE, m_groupTupletBase);
-                m_currentEvent->set
-                <Int>
-                (BEAMED_GROUP_TUPLED_COUNT, m_groupTupledCount);
-                m_currentEvent->set
-                <Int>
-                (BEAMED_GROUP_UNTUPLED_COUNT, m_groupUntupledCount);
-            }
-        }
-
-        timeT duration = m_currentEvent->getDuration();
-
-        if (!m_inChord) {
-
-            m_currentTime = m_currentEvent->getAbsoluteTime() + duration;
-
-            //            RG_DEBUG << "RoseXmlHandler::startElement: (we're not in a chord) ";
-
-        } else if (duration != 0) {
-
-            // set chord duration to the duration of the shortest
-            // element with a non-null duration (if no such elements,
-            // leave it as 0).
-
-            if (m_chordDuration == 0 || duration < m_chordDuration) {
-                m_chordDuration = duration;
-            }
-        }
+        return startEvent(new XmlStorableEvent(atts, m_currentTime));
 
     } else if (lcName == "property") {
 
@@ -925,6 +1004,16 @@ RoseXmlHandler::startElement(const QString& namespaceURI,
                 m_currentSegment = new Segment(Segment::Audio);
                 m_currentSegment->setAudioFileId(audioFileId);
                 m_currentSegment->setStartTime(startTime);
+
+                // and whether it is stretched, as it plays or from a
+                // file rendered for it
+                QString stretchStr = atts.value("stretch");
+                if (!stretchStr.isEmpty()) {
+                    m_currentSegment->setUnstretchedFileId
+                        (atts.value("unstretched").toInt());
+                    m_currentSegment->setStretchRatio
+                        (float(qstrtodouble(stretchStr)));
+                }
             } else {
                 // Create a (normal) internal Segment
                 m_currentSegment = new Segment(Segment::Internal);
@@ -2264,6 +2353,107 @@ RoseXmlHandler::startElement(const QString& namespaceURI,
     return true;
 }
 
+bool
+RoseXmlHandler::startEvent(XmlStorableEvent *event)
+{
+    if (m_currentEvent) {
+        RG_DEBUG << "RoseXmlHandler::startEvent: Warning: new event found at time " << m_currentTime << " before previous event has ended; previous event will be lost";
+        delete m_currentEvent;
+    }
+
+    m_currentEvent = event;
+
+    if (m_currentEvent->has(BEAMED_GROUP_ID)) {
+
+        if (!m_currentSegment) {
+            m_errorString = "Got grouped event outside of a segment";
+            return false;
+        }
+
+        remapGroupId(m_currentEvent);
+
+    } else if (m_inGroup) {
+        m_currentEvent->set
+        <Int>(BEAMED_GROUP_ID, m_groupId);
+        m_currentEvent->set
+        <String>(BEAMED_GROUP_TYPE, m_groupType);
+        if (m_groupType == GROUP_TYPE_TUPLED) {
+            m_currentEvent->set
+            <Int>
+            (BEAMED_GROUP_TUPLET_BASE, m_groupTupletBase);
+            m_currentEvent->set
+            <Int>
+            (BEAMED_GROUP_TUPLED_COUNT, m_groupTupledCount);
+            m_currentEvent->set
+            <Int>
+            (BEAMED_GROUP_UNTUPLED_COUNT, m_groupUntupledCount);
+        }
+    }
+
+    timeT duration = m_currentEvent->getDuration();
+
+    if (!m_inChord) {
+
+        m_currentTime = m_currentEvent->getAbsoluteTime() + duration;
+
+        //            RG_DEBUG << "RoseXmlHandler::startElement: (we're not in a chord) ";
+
+    } else if (duration != 0) {
+
+        // set chord duration to the duration of the shortest
+        // element with a non-null duration (if no such elements,
+        // leave it as 0).
+
+        if (m_chordDuration == 0 || duration < m_chordDuration) {
+            m_chordDuration = duration;
+        }
+    }
+
+    return true;
+}
+
+void
+RoseXmlHandler::remapGroupId(Event *event)
+{
+    // remap -- we want to ensure that the segment's nextId
+    // is always used (and incremented) in preference to the
+    // stored id
+
+    long storedId = event->get<Int>(BEAMED_GROUP_ID);
+
+    if (m_groupIdMap.find(storedId) == m_groupIdMap.end()) {
+        m_groupIdMap[storedId] = m_currentSegment->getNextId();
+    }
+
+    event->set<Int>(BEAMED_GROUP_ID, m_groupIdMap[storedId]);
+}
+
+bool
+RoseXmlHandler::readSnapshotSegment()
+{
+    std::vector<Event *> events;
+
+    if (!m_snapshot->readSegment(m_snapshotSegments++, events)) {
+        for (size_t i = 0; i < events.size(); ++i) delete events[i];
+        m_errorString = "Segment missing from snapshot";
+        return false;
+    }
+
+    // A segment the XML skipped (one whose audio file is missing, say)
+    // still has its place in the snapshot, but nothing to go into
+    if (!m_currentSegment) {
+        for (size_t i = 0; i < events.size(); ++i) delete events[i];
+        return true;
+    }
+
+    for (size_t i = 0; i < events.size(); ++i) {
+        if (events[i]->has(BEAMED_GROUP_ID)) remapGroupId(events[i]);
+        m_currentSegment->insert(events[i]);
+    }
+
+    return true;
+}
+
 bool
 RoseXmlHandler::endElement(const QString& namespaceURI,
                            const QString& localName,
@@ -2277,30 +2467,16 @@ RoseXmlHandler::endElement(const QString& namespaceURI,
         return res;
     }
 
-    // Set percentage done
-    //
-    if ((m_totalElements > m_elementsSoFar) &&
-        (++m_elementsSoFar % 300 == 0)) {
-
-        if (m_progressDialog) {
-            // If the user cancelled, bail.
-            if (m_progressDialog->wasCanceled())
-                return false;
-
-            m_progressDialog->setValue(static_cast<int>(
-                    static_cast<double>(m_elementsSoFar) /
-                    static_cast<double>(m_totalElements) * 100.0));
-        }
-
-        // Kick the event loop so that we don't appear to be in
-        // an endless loop.
-        qApp->processEvents(QEventLoop::AllEvents, 100);
-    }
-
     QString lcName = qName.toLower();
 
     if (lcName == "rosegarden-data") {
 
+        if (m_snapshot &&
+            m_snapshotSegments != m_snapshot->getSegmentCount()) {
+            m_errorString = "Snapshot does not match file";
+            return false;
+        }
+
         Composition &comp = getComposition();
 
         // Remap all the instrument IDs in track and metronome objects
@@ -2357,6 +2533,10 @@ RoseXmlHandler::endElement(const QString& namespaceURI,
 
     } else if (lcName == "segment") {
 
+        if (m_snapshot) {
+            if (!readSnapshotSegment()) return false;
+        }
+
         if (m_currentSegment && m_segmentEndMarkerTime) {
             m_currentSegment->setEndMarkerTime(*m_segmentEndMarkerTime);
 
@@ -2384,6 +2564,12 @@ RoseXmlHandler::endElement(const QString& namespaceURI,
         m_inComposition = false;
         m_section = NoSection;
 
+        if (m_snapshot &&
+            !m_snapshot->readReferenceSegments(getComposition())) {
+            m_errorString = "Tempo and time signatures missing from snapshot";
+            return false;
+        }
+
     } else if (lcName == "studio") {
 
         m_section = NoSection;
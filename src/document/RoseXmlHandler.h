@@ -35,11 +35,13 @@
 
 class QXmlParseException;
 class QXmlAttributes;
+class QIODevice;
 
 
 namespace Rosegarden
 {
 
+class DocumentSnapshot;
 class XmlStorableEvent;
 class XmlSubHandler;
 class Studio;
@@ -82,12 +84,31 @@ public:
      * from the XML file into the specified composition
      */
     RoseXmlHandler(RosegardenDocument *doc,
-                   unsigned int elementCount,
                    QPointer<QProgressDialog> progressDialog,
                    bool createNewDevicesWhenNeeded);
 
     virtual ~RoseXmlHandler();
 
+    /**
+     * Read a whole file from \a file in a single pass, as it is
+     * decompressed, calling the handler functions below as
+     * QXmlSimpleReader would.  Events and their properties are made
+     * straight from the reader's attributes.  Progress is shown as the
+     * proportion of the file (for a GzipReader, the compressed file)
+     * read so far.
+     *
+     * Returns false if the file could not be parsed (see errorString())
+     * or the load was cancelled.
+     */
+    bool parse(QIODevice &file);
+
+    /**
+     * Take the events of each segment, and the tempo and time
+     * signature changes, from \a snapshot, whose skeleton XML is what
+     * is being parsed.  The snapshot must outlive the parse.
+     */
+    void setSnapshot(DocumentSnapshot *snapshot) { m_snapshot = snapshot; }
+
     /// overloaded handler functions
     virtual bool startDocument();
     virtual bool startElement(const QString& namespaceURI,
@@ -124,6 +145,17 @@ protected:
     AudioFileManager& getAudioFileManager();
     AudioPluginManager* getAudioPluginManager();
 
+    /// Take on a newly read event, placing it in its group or chord
+    bool startEvent(XmlStorableEvent *event);
+
+    /// Give an event of the current segment a group id of the
+    /// segment's own, in place of the one it was stored with
+    void remapGroupId(Event *event);
+
+    /// Fill the current segment with its events from the snapshot, or
+    /// skip them if the XML made no segment for them
+    bool readSnapshotSegment();
+
     void setSubHandler(XmlSubHandler* sh);
     XmlSubHandler* getSubHandler() { return m_subHandler; }
 
@@ -180,8 +212,6 @@ protected:
     MidiKeyMapping                   *m_keyMapping;
     MidiKeyMapping::KeyNameMap        m_keyNameMap;
     unsigned int                      m_pluginId;
-    unsigned int                      m_totalElements;
-    unsigned int                      m_elementsSoFar;
 
     XmlSubHandler                    *m_subHandler;
     bool                              m_deprecation;
@@ -195,6 +225,9 @@ protected:
     bool m_oldSolo;
 
     QPointer<QProgressDialog> m_progressDialog;
+
+    DocumentSnapshot *m_snapshot;
+    size_t m_snapshotSegments;
 };
 
 
@@ -20,6 +20,7 @@
 
 #include "CommandHistory.h"
 #include "RoseXmlHandler.h"
+#include "DocumentSnapshot.h"
 #include "GzipFile.h"
 
 #include "base/AudioDevice.h"
@@ -81,12 +82,14 @@
 #include "misc/AppendLabel.h"
 #include "misc/Debug.h"
 #include "misc/Strings.h"
+#include "misc/JobPool.h"
 #include "document/Command.h"
 #include "misc/ConfigGroups.h"
 
 #include "rosegarden-version.h"
 
 #include <QApplication>
+#include <QBuffer>
 #include <QSettings>
 #include <QMessageBox>
 #include <QProcess>
@@ -103,6 +106,12 @@
 #include <QTextStream>
 #include <QWidget>
 #include <QHostInfo>
+#include <QElapsedTimer>
+#include <QThread>
+
+#include <algorithm>
+#include <set>
+#include <vector>
 
 
 namespace Rosegarden
@@ -125,6 +134,9 @@ RosegardenDocument::RosegardenDocument(
     m_audioRecordLatency(0, 0),
     m_quickMarkerTime(-1),
     m_autoSavePeriod(0),
+    m_autoSaver(0),
+    m_autoSaveCopyTime(0),
+    m_lastAutoSaveGuiTime(0),
     m_beingDestroyed(false),
     m_clearCommandHistory(clearCommandHistory),
     m_soundEnabled(enableSound),
@@ -154,6 +166,8 @@ RosegardenDocument::~RosegardenDocument()
     m_audioPeaksThread.finish();
     m_audioPeaksThread.wait();
 
+    waitForAutoSave();
+
     deleteEditViews();
 
     //     ControlRulerCanvasRepository::clear();
@@ -223,7 +237,13 @@ const QString &RosegardenDocument::getAbsFilePath() const
 
 void RosegardenDocument::deleteAutoSaveFile()
 {
+    // (or it could write the file again just after)
+    waitForAutoSave();
+
     QFile::remove(getAutoSaveFileName());
+
+    QString path = DocumentSnapshot::getSnapshotPath(getAutoSaveFileName());
+    if (!path.isEmpty()) QFile::remove(path);
 }
 
 const QString& RosegardenDocument::getTitle() const
@@ -319,25 +339,6 @@ QString RosegardenDocument::getAutoSaveFileName()
     return autoSaveFileName;
 }
 
-void RosegardenDocument::slotAutoSave()
-{
-    //     RG_DEBUG << "RosegardenDocument::slotAutoSave()";
-
-    if (isAutoSaved() || !isModified())
-        return ;
-
-    QString autoSaveFileName = getAutoSaveFileName();
-
-    RG_DEBUG << "RosegardenDocument::slotAutoSave() - doc modified - saving '"
-    << getAbsFilePath() << "' as"
-    << autoSaveFileName;
-
-    QString errMsg;
-
-    saveDocument(autoSaveFileName, errMsg, true);
-
-}
-
 bool RosegardenDocument::isRegularDotRGFile() const
 {
     return getAbsFilePath().right(3).toLower() == ".rg";
@@ -591,23 +592,14 @@ bool RosegardenDocument::openDocument(const QString &filename,
 
     // Load.
 
-    QString fileContents;
-
-    // Unzip
-    bool okay = GzipFile::readFromFile(filename, fileContents);
-    
     QString errMsg;
     bool cancelled = false;
 
-    if (!okay) {
-        errMsg = tr("Could not open Rosegarden file");
-    } else {
-        // Parse the XML
-        okay = xmlParse(fileContents,
-                        errMsg,
-                        permanent,
-                        cancelled);
-    }
+    // Unzip and parse the XML as it is read
+    bool okay = xmlParse(filename,
+                         errMsg,
+                         permanent,
+                         cancelled);
 
     if (!okay) {
         StartupLogo::hideIfStillThere();
@@ -1163,6 +1155,9 @@ int RosegardenDocument::FILE_FORMAT_VERSION_MAJOR = 1;
 int RosegardenDocument::FILE_FORMAT_VERSION_MINOR = 6;
 int RosegardenDocument::FILE_FORMAT_VERSION_POINT = 4;
 
+const int RosegardenDocument::MaxSaveThreads;
+int RosegardenDocument::m_saveThreadCount = 0;
+
 bool RosegardenDocument::saveDocument(const QString& filename,
                                     QString& errMsg,
                                     bool autosave)
@@ -1170,7 +1165,9 @@ bool RosegardenDocument::saveDocument(const QString& filename,
     QFileInfo fileInfo(filename);
 
     if (!fileInfo.exists()) { // safe to write directly
-        return saveDocumentActual(filename, errMsg, autosave);
+        if (!saveDocumentActual(filename, errMsg, autosave)) return false;
+        updateSnapshot(filename);
+        return true;
     }
 
     if (fileInfo.exists()  &&  !fileInfo.isWritable()) {
@@ -1219,9 +1216,58 @@ bool RosegardenDocument::saveDocument(const QString& filename,
         return false;
     }
 
+    updateSnapshot(filename);
+
     return true;
 }
 
+void RosegardenDocument::updateSnapshot(const QString &filename)
+{
+    QSettings settings;
+    settings.beginGroup(GeneralOptionsConfigGroup);
+    bool wanted = qStrToBool(settings.value("savesnapshots", "false"));
+    settings.endGroup();
+
+    if (wanted) {
+        if (!saveSnapshot(filename)) {
+            RG_WARNING << "updateSnapshot(): Could not write snapshot for" << filename;
+        }
+    } else {
+        // Don't leave an old one about
+        QString path = DocumentSnapshot::getSnapshotPath(filename);
+        if (!path.isEmpty()) QFile::remove(path);
+    }
+}
+
+bool RosegardenDocument::saveSnapshot(const QString &filename)
+{
+    Profiler profiler("RosegardenDocument::saveSnapshot");
+
+    QByteArray skeleton;
+    QBuffer buffer(&skeleton);
+    buffer.open(QIODevice::WriteOnly);
+
+    QTextStream outStream(&buffer);
+    outStream.setCodec("UTF-8");
+    writeXml(outStream, false);
+    outStream.flush();
+    buffer.close();
+
+    // In the order writeXml wrote them
+    std::vector<const Segment *> segments;
+    for (Composition::iterator i = m_composition.begin();
+         i != m_composition.end(); ++i) {
+        segments.push_back(*i);
+    }
+    for (Composition::triggersegmentcontaineriterator i =
+             m_composition.getTriggerSegments().begin();
+         i != m_composition.getTriggerSegments().end(); ++i) {
+        segments.push_back((*i)->getSegment());
+    }
+
+    return DocumentSnapshot::write(filename, skeleton, m_composition, segments);
+}
+
 
 bool RosegardenDocument::saveDocumentActual(const QString& filename,
                                           QString& errMsg,
@@ -1230,11 +1276,120 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
     Profiler profiler("RosegardenDocument::saveDocumentActual");
     RG_DEBUG << "RosegardenDocument::saveDocumentActual(" << filename << ")";
 
-    QString outText;
-    QTextStream outStream(&outText, QIODevice::WriteOnly);
-//    outStream.setEncoding(QTextStream::UnicodeUTF8); qt3
+    // Write straight through to the compressed file, rather than
+    // building the whole document up in memory first
+    GzipWriter writer(filename);
+    if (!writer.open(QIODevice::WriteOnly)) {
+        errMsg = tr("Could not open file '%1' for writing").arg(filename);
+        return false;
+    }
+
+    QTextStream outStream(&writer);
     outStream.setCodec("UTF-8");
 
+    writeXml(outStream, true);
+
+    outStream.flush();
+    writer.close();
+    if (outStream.status() != QTextStream::Ok || writer.hasFailed()) {
+        errMsg = tr("Error while writing on '%1'").arg(filename);
+        return false;
+    }
+
+    RG_DEBUG << "RosegardenDocument::saveDocument() finished";
+
+    if (!autosave) {
+        emit documentModified(false);
+        m_modified = false;
+        CommandHistory::getInstance()->documentSaved();
+    }
+
+    setAutoSaved(true);
+
+    return true;
+}
+
+namespace
+{
+
+/// Save the events of a segment, from begin to end, grouping those at
+/// the same time into chords.
+template <typename Iterator>
+void
+saveEvents(QTextStream &outStream, Iterator begin, Iterator end,
+           timeT startTime)
+{
+    bool inChord = false;
+    timeT chordStart = 0, chordDuration = 0;
+    timeT expectedTime = startTime;
+
+    for (Iterator i = begin; i != end; ++i) {
+
+        timeT absTime = (*i)->getAbsoluteTime();
+
+        Iterator nextEl = i;
+        ++nextEl;
+
+        if (nextEl != end &&
+                (*nextEl)->getAbsoluteTime() == absTime &&
+                (*i)->getDuration() != 0 &&
+                !inChord) {
+            outStream << "<chord>\n";
+            inChord = true;
+            chordStart = absTime;
+            chordDuration = 0;
+        }
+
+        if (inChord && (*i)->getDuration() > 0)
+            if (chordDuration == 0 || (*i)->getDuration() < chordDuration)
+                chordDuration = (*i)->getDuration();
+
+        outStream << '\t'
+        << strtoqstr((*i)->toXmlString(expectedTime)) << '\n';
+
+        if (nextEl != end &&
+                (*nextEl)->getAbsoluteTime() != absTime &&
+                inChord) {
+            outStream << "</chord>\n";
+            inChord = false;
+            expectedTime = chordStart + chordDuration;
+        } else if (inChord) {
+            expectedTime = absTime;
+        } else {
+            expectedTime = absTime + (*i)->getDuration();
+        }
+    }
+
+    if (inChord) {
+        outStream << "</chord>\n";
+    }
+}
+
+}
+
+/// Formats the segments writeXml() saves, each into a string of its
+/// own, on JobPool workers
+class RosegardenDocument::SegmentWriter : public JobPool::Jobs
+{
+public:
+    virtual void run(size_t n);
+
+    std::vector<Segment *> segments;
+    std::vector<QString> attributes;
+    std::vector<QString> results;
+};
+
+void
+RosegardenDocument::SegmentWriter::run(size_t n)
+{
+    QTextStream stream(&results[n], QIODevice::WriteOnly);
+    long count = 0;
+    saveSegment(stream, segments[n], 0, count, attributes[n]);
+}
+
+void RosegardenDocument::writeXmlStart(QTextStream &outStream,
+                                       bool withEvents)
+{
     // output XML header
     //
     outStream << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
@@ -1252,7 +1407,7 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
     // Send out Composition (this includes Tracks, Instruments, Tempo
     // and Time Signature changes and any other sub-objects)
     //
-    outStream << strtoqstr(getComposition().toXmlString())
+    outStream << strtoqstr(getComposition().toXmlString(withEvents))
               << endl << endl;
 
     outStream << strtoqstr(getAudioFileManager().toXmlString())
@@ -1260,28 +1415,11 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
 
     outStream << strtoqstr(getConfiguration().toXmlString())
               << endl << endl;
+}
 
-    long totalEvents = 0;
-    for (Composition::iterator segitr = m_composition.begin();
-         segitr != m_composition.end(); ++segitr) {
-        totalEvents += (long)(*segitr)->size();
-    }
-
-    for (Composition::triggersegmentcontaineriterator ci =
-             m_composition.getTriggerSegments().begin();
-         ci != m_composition.getTriggerSegments().end(); ++ci) {
-        totalEvents += (long)(*ci)->getSegment()->size();
-    }
-
-    // output all elements
-    //
-    // Iterate on segments
-    long eventCount = 0;
-
-    // Put a break in the file
-    //
-    outStream << endl << endl;
-
+size_t RosegardenDocument::getSegmentsToSave(std::vector<Segment *> &segments,
+                                             std::vector<QString> &attributes)
+{
     for (Composition::iterator segitr = m_composition.begin();
          segitr != m_composition.end(); ++segitr) {
 
@@ -1305,17 +1443,15 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
               .arg(segment->getLinkTransposeParams().m_transposeSegmentBack
                                                          ? "true" : "false");
 
-            saveSegment(outStream, segment, totalEvents,
-                                            eventCount, linkedSegAtts);
+            segments.push_back(segment);
+            attributes.push_back(linkedSegAtts);
         } else {
-            saveSegment(outStream, segment, totalEvents, eventCount);
+            segments.push_back(segment);
+            attributes.push_back(QString::null);
         }
-
     }
 
-    // Put a break in the file
-    //
-    outStream << endl << endl;
+    const size_t compositionSegments = segments.size();
 
     for (Composition::triggersegmentcontaineriterator ci =
                 m_composition.getTriggerSegments().begin();
@@ -1329,14 +1465,82 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
                               .arg((*ci)->getDefaultRetune())
                               .arg(strtoqstr((*ci)->getDefaultTimeAdjust()));
 
-        Segment *segment = (*ci)->getSegment();
-        saveSegment(outStream, segment, totalEvents, eventCount, triggerAtts);
+        segments.push_back((*ci)->getSegment());
+        attributes.push_back(triggerAtts);
+    }
+
+    return compositionSegments;
+}
+
+void RosegardenDocument::writeXml(QTextStream &outStream, bool withEvents)
+{
+    writeXmlStart(outStream, withEvents);
+
+    SegmentWriter writer;
+    const size_t compositionSegments =
+        getSegmentsToSave(writer.segments, writer.attributes);
+    writer.results.resize(writer.segments.size());
+
+    // With events, segments are formatted on worker threads, into
+    // strings that are written out here in order as they are done.  A
+    // worker only runs a few segments ahead of the writing, so the
+    // whole document is never held in memory at once.
+    //
+    const int threads = withEvents ?
+        std::min(getSaveThreadCount(), int(writer.segments.size())) : 1;
+
+    JobPool *pool = 0;
+    if (threads > 1) {
+        pool = new JobPool(writer, writer.segments.size(), threads,
+                           4 * threads);
+    }
+
+    // Put a break in the file
+    //
+    outStream << endl << endl;
+
+    long eventCount = 0;
+
+    for (size_t i = 0; i < writer.segments.size(); ++i) {
+
+        if (i == compositionSegments) {
+            // Put a break in the file
+            //
+            outStream << endl << endl;
+        }
+
+        if (!pool) {
+            saveSegment(outStream, writer.segments[i], 0,
+                        eventCount, writer.attributes[i], withEvents);
+            continue;
+        }
+
+        pool->waitFor(i, i + 1);
+        QString text = writer.results[i];
+        writer.results[i] = QString();
+        pool->setUsed(i + 1);
+
+        outStream << text;
     }
 
+    if (writer.segments.size() == compositionSegments) {
+        // Put a break in the file (there were no trigger segments to
+        // put it before)
+        //
+        outStream << endl << endl;
+    }
+
+    delete pool;
+
     // Put a break in the file
     //
     outStream << endl << endl;
 
+    writeXmlEnd(outStream);
+}
+
+void RosegardenDocument::writeXmlEnd(QTextStream &outStream)
+{
     // Send out the studio - a self contained command
     //
     outStream << strtoqstr(m_studio.toXmlString()) << endl << endl;
@@ -1350,24 +1554,6 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
     // close the top-level XML tag
     //
     outStream << "</rosegarden-data>\n";
-
-    bool okay = GzipFile::writeToFile(filename, outText);
-    if (!okay) {
-        errMsg = tr("Error while writing on '%1'").arg(filename);
-        return false;
-    }
-
-    RG_DEBUG << "RosegardenDocument::saveDocument() finished";
-
-    if (!autosave) {
-        emit documentModified(false);
-        m_modified = false;
-        CommandHistory::getInstance()->documentSaved();
-    }
-
-    setAutoSaved(true);
-
-    return true;
 }
 
 bool RosegardenDocument::exportStudio(const QString& filename,
@@ -1377,9 +1563,13 @@ bool RosegardenDocument::exportStudio(const QString& filename,
     Profiler profiler("RosegardenDocument::exportStudio");
     RG_DEBUG << "RosegardenDocument::exportStudio(" << filename << ")";
 
-    QString outText;
-    QTextStream outStream(&outText, QIODevice::WriteOnly);
-//    outStream.setEncoding(QTextStream::UnicodeUTF8); qt3
+    GzipWriter writer(filename);
+    if (!writer.open(QIODevice::WriteOnly)) {
+        errMsg = tr("Could not open file '%1' for writing").arg(filename);
+        return false;
+    }
+
+    QTextStream outStream(&writer);
     outStream.setCodec("UTF-8");
 
     // output XML header
@@ -1396,9 +1586,10 @@ bool RosegardenDocument::exportStudio(const QString& filename,
     //
     outStream << "</rosegarden-data>\n";
 
-    bool okay = GzipFile::writeToFile(filename, outText);
-    if (!okay) {
-        errMsg = tr("Could not open file '%1' for writing").arg(filename);
+    outStream.flush();
+    writer.close();
+    if (outStream.status() != QTextStream::Ok || writer.hasFailed()) {
+        errMsg = tr("Error while writing on '%1'").arg(filename);
         return false;
     }
 
@@ -1406,9 +1597,31 @@ bool RosegardenDocument::exportStudio(const QString& filename,
     return true;
 }
 
+int
+RosegardenDocument::getSaveThreadCount()
+{
+    return JobPool::getThreadCount(m_saveThreadCount, MaxSaveThreads);
+}
+
 void RosegardenDocument::saveSegment(QTextStream& outStream, Segment *segment,
                                    long /*totalEvents*/, long &/*count*/,
-                                   QString extraAttributes)
+                                   QString extraAttributes,
+                                   bool withEvents)
+{
+    saveSegmentStart(outStream, segment, extraAttributes);
+
+    // (a snapshot keeps the events itself)
+    if (withEvents && segment->getType() != Segment::Audio) {
+        saveEvents(outStream, segment->begin(), segment->end(),
+                   segment->getStartTime());
+    }
+
+    saveSegmentEnd(outStream, segment);
+}
+
+void RosegardenDocument::saveSegmentStart(QTextStream& outStream,
+                                          Segment *segment,
+                                          const QString &extraAttributes)
 {
     QString time;
 
@@ -1510,56 +1723,13 @@ void RosegardenDocument::saveSegment(QTextStream& outStream, Segment *segment,
     } else // Internal type
     {
         outStream << "\">\n";
+    }
+}
 
-        bool inChord = false;
-        timeT chordStart = 0, chordDuration = 0;
-        timeT expectedTime = segment->getStartTime();
-
-        for (Segment::iterator i = segment->begin();
-                i != segment->end(); ++i) {
-
-            timeT absTime = (*i)->getAbsoluteTime();
-
-            Segment::iterator nextEl = i;
-            ++nextEl;
-
-            if (nextEl != segment->end() &&
-                    (*nextEl)->getAbsoluteTime() == absTime &&
-                    (*i)->getDuration() != 0 &&
-                    !inChord) {
-                outStream << "<chord>" << endl;
-                inChord = true;
-                chordStart = absTime;
-                chordDuration = 0;
-            }
-
-            if (inChord && (*i)->getDuration() > 0)
-                if (chordDuration == 0 || (*i)->getDuration() < chordDuration)
-                    chordDuration = (*i)->getDuration();
-
-            outStream << '\t'
-            << strtoqstr((*i)->toXmlString(expectedTime)) << endl;
-
-            if (nextEl != segment->end() &&
-                    (*nextEl)->getAbsoluteTime() != absTime &&
-                    inChord) {
-                outStream << "</chord>\n";
-                inChord = false;
-                expectedTime = chordStart + chordDuration;
-            } else if (inChord) {
-                expectedTime = absTime;
-            } else {
-                expectedTime = absTime + (*i)->getDuration();
-            }
-
-//            if ((++count % 500 == 0) && progress) {
-//                progress->setValue(count * 100 / totalEvents);
-//            }
-        }
-
-        if (inChord) {
-            outStream << "</chord>\n";
-        }
+void RosegardenDocument::saveSegmentEnd(QTextStream& outStream,
+                                        Segment *segment)
+{
+    if (segment->getType() != Segment::Audio) {
 
         // Add EventRulers to segment - we call them controllers because of
         // a historical mistake in naming them.  My bad.  RWB.
@@ -1580,12 +1750,248 @@ void RosegardenDocument::saveSegment(QTextStream& outStream, Segment *segment,
             }
             outStream << "</gui>\n";
         }
+    }
+
+    outStream << QString("</%1>\n").arg(segment->getXmlElementName()); //-------------------------
+
+}
+
+/// Writes out a copy of the document, made by slotAutoSave() on the GUI
+/// thread, and then renames it over the autosave file.
+class RosegardenDocument::AutoSaver : public QThread
+{
+public:
+    AutoSaver(const QString &filename) :
+        m_filename(filename), m_succeeded(false), m_elapsed(0) { }
+
+    /// Deletes the copied events.  This must happen on the GUI thread,
+    /// as they share data with the document's events, and the counts
+    /// of those sharing it aren't atomic.
+    virtual ~AutoSaver();
+
+    /// A segment, as saveSegmentStart(), the events and saveSegmentEnd()
+    struct SavedSegment {
+        SavedSegment() : startTime(0) { }
+        QString start;
+        std::vector<Event *> events;
+        timeT startTime;
+        QString end;
+    };
+
+    QString start;
+    std::vector<SavedSegment> segments;
+    QString end;
+
+    bool succeeded() const { return m_succeeded; }
+
+    /// How long run() took, in ms
+    int getElapsed() const { return m_elapsed; }
+
+protected:
+    virtual void run();
+
+private:
+    QString m_filename;
+    bool m_succeeded;
+    int m_elapsed;
+};
+
+RosegardenDocument::AutoSaver::~AutoSaver()
+{
+    for (size_t i = 0; i < segments.size(); ++i) {
+        for (size_t j = 0; j < segments[i].events.size(); ++j) {
+            delete segments[i].events[j];
+        }
+    }
+}
 
+void
+RosegardenDocument::AutoSaver::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // Write it alongside, so that the last autosave is still there if
+    // this one fails
+    QString tempFileName = m_filename + ".tmp";
+
+    GzipWriter writer(tempFileName);
+    if (!writer.open(QIODevice::WriteOnly)) {
+        m_elapsed = timer.elapsed();
+        return;
     }
 
+    QTextStream outStream(&writer);
+    outStream.setCodec("UTF-8");
 
-    outStream << QString("</%1>\n").arg(segment->getXmlElementName()); //-------------------------
+    outStream << start;
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const SavedSegment &segment = segments[i];
+        outStream << segment.start;
+        saveEvents(outStream, segment.events.begin(), segment.events.end(),
+                   segment.startTime);
+        outStream << segment.end;
+    }
+
+    outStream << end;
+
+    outStream.flush();
+    writer.close();
+
+    m_succeeded = (outStream.status() == QTextStream::Ok &&
+                   !writer.hasFailed());
+
+    if (m_succeeded) {
+        QFile::remove(m_filename);
+        m_succeeded = QFile::rename(tempFileName, m_filename);
+    } else {
+        QFile::remove(tempFileName);
+    }
+
+    m_elapsed = timer.elapsed();
+}
+
+void RosegardenDocument::slotAutoSave()
+{
+    //     RG_DEBUG << "RosegardenDocument::slotAutoSave()";
+
+    if (isAutoSaved() || !isModified())
+        return ;
+
+    // Still writing the last one
+    if (m_autoSaver)
+        return ;
+
+    Profiler profiler("RosegardenDocument::slotAutoSave");
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QString autoSaveFileName = getAutoSaveFileName();
+
+    RG_DEBUG << "RosegardenDocument::slotAutoSave() - doc modified - saving '"
+    << getAbsFilePath() << "' as"
+    << autoSaveFileName;
+
+    // Copy everything writeXml() would write.  All but the events is
+    // formatted here; the events are copied, sharing their data with
+    // the document's until either is changed, and formatted by the
+    // AutoSaver.
+    //
+    AutoSaver *saver = new AutoSaver(autoSaveFileName);
+
+    {
+        QTextStream outStream(&saver->start);
+        writeXmlStart(outStream, true);
+
+        // Put a break in the file
+        //
+        outStream << endl << endl;
+    }
+
+    std::vector<Segment *> segments;
+    std::vector<QString> attributes;
+    const size_t compositionSegments =
+        getSegmentsToSave(segments, attributes);
+
+    saver->segments.resize(segments.size());
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+
+        Segment *segment = segments[i];
+        AutoSaver::SavedSegment &saved = saver->segments[i];
+
+        QTextStream startStream(&saved.start);
+        if (i == compositionSegments) {
+            // Put a break in the file
+            //
+            startStream << endl << endl;
+        }
+        saveSegmentStart(startStream, segment, attributes[i]);
+
+        if (segment->getType() != Segment::Audio) {
+            saved.startTime = segment->getStartTime();
+            saved.events.reserve(segment->size());
+            for (Segment::iterator j = segment->begin();
+                 j != segment->end(); ++j) {
+                saved.events.push_back
+                    ((*j)->copyWithNonPersistentProperties());
+            }
+        }
+
+        QTextStream endStream(&saved.end);
+        saveSegmentEnd(endStream, segment);
+    }
+
+    {
+        QTextStream outStream(&saver->end);
+
+        if (segments.size() == compositionSegments) {
+            // Put a break in the file (there were no trigger segments
+            // to put it before)
+            //
+            outStream << endl << endl;
+        }
+
+        // Put a break in the file
+        //
+        outStream << endl << endl;
+
+        writeXmlEnd(outStream);
+    }
 
+    // Any change made while the copy is being written clears this again
+    setAutoSaved(true);
+
+    m_autoSaver = saver;
+    connect(saver, SIGNAL(finished()), this, SLOT(slotAutoSaveFinished()));
+    saver->start();
+
+    m_autoSaveCopyTime = timer.elapsed();
+}
+
+void RosegardenDocument::slotAutoSaveFinished()
+{
+    // (unless waitForAutoSave() has been there first)
+    if (m_autoSaver && m_autoSaver->isFinished())
+        waitForAutoSave();
+}
+
+void RosegardenDocument::waitForAutoSave()
+{
+    if (!m_autoSaver)
+        return;
+
+    m_autoSaver->wait();
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool succeeded = m_autoSaver->succeeded();
+    const int elapsed = m_autoSaver->getElapsed();
+
+    delete m_autoSaver;
+    m_autoSaver = 0;
+
+    if (!succeeded) {
+        RG_WARNING << "waitForAutoSave(): Could not write autosave file" << getAutoSaveFileName();
+        setAutoSaved(false);
+    }
+
+    // The autosave file's snapshot can only be made from the document
+    // while it is still as the autosave copied it.  Otherwise remove
+    // any old one, which no longer matches.
+    if (succeeded && isAutoSaved() && !m_beingDestroyed) {
+        updateSnapshot(getAutoSaveFileName());
+    } else {
+        QString path = DocumentSnapshot::getSnapshotPath(getAutoSaveFileName());
+        if (!path.isEmpty()) QFile::remove(path);
+    }
+
+    m_lastAutoSaveGuiTime = m_autoSaveCopyTime + int(timer.elapsed());
+
+    RG_DEBUG << "waitForAutoSave(): autosave took" << m_lastAutoSaveGuiTime << "ms on the GUI thread (" << m_autoSaveCopyTime << "ms copying, the rest cleaning up) and" << elapsed << "ms writing in the background";
 }
 
 bool RosegardenDocument::saveAs(const QString &newName, QString &errMsg)
@@ -1638,32 +2044,55 @@ bool RosegardenDocument::isSoundEnabled() const
 }
 
 bool
-RosegardenDocument::xmlParse(QString fileContents, QString &errMsg,
+RosegardenDocument::xmlParse(const QString &filename, QString &errMsg,
                            bool permanent,
-                           bool &cancelled)
+                           bool &cancelled,
+                           bool useSnapshot)
 {
     Profiler profiler("RosegardenDocument::xmlParse");
 
     cancelled = false;
 
-    unsigned int elementCount = 0;
-    for (int i = 0; i < fileContents.length() - 1; ++i) {
-        if (fileContents[i] == '<' && fileContents[i+1] != '/') {
-            ++elementCount;
-        }
+    // If there's an up-to-date snapshot of the file, read its XML
+    // without the events, and take those from the snapshot instead
+    DocumentSnapshot *snapshot =
+        (useSnapshot ? DocumentSnapshot::open(filename) : 0);
+    QByteArray skeleton;
+    QBuffer skeletonBuffer;
+
+    GzipReader file(filename);
+    QIODevice *device = &file;
+
+    if (snapshot) {
+        RG_DEBUG << "xmlParse(): Reading events from snapshot";
+        skeleton = snapshot->getSkeleton();
+        skeletonBuffer.setBuffer(&skeleton);
+        device = &skeletonBuffer;
+    }
+
+    if (!device->open(QIODevice::ReadOnly)) {
+        errMsg = tr("Could not open Rosegarden file");
+        delete snapshot;
+        return false;
     }
 
     if (permanent && m_soundEnabled) RosegardenSequencer::getInstance()->removeAllDevices();
 
-    RoseXmlHandler handler(this, elementCount, m_progressDialog, permanent);
+    // (the devices there were before, in case the parse has to be
+    // undone)
+    std::set<DeviceId> devices;
+    for (DeviceListIterator i = m_studio.getDevices()->begin();
+         i != m_studio.getDevices()->end(); ++i) {
+        devices.insert((*i)->getId());
+    }
+
+    RoseXmlHandler handler(this, m_progressDialog, permanent);
+    handler.setSnapshot(snapshot);
 
-    QXmlInputSource source;
-    source.setData(fileContents);
-    QXmlSimpleReader reader;
-    reader.setContentHandler(&handler);
-    reader.setErrorHandler(&handler);
+    bool ok = handler.parse(*device);
 
-    bool ok = reader.parse(source);
+    bool fromSnapshot = (snapshot != 0);
+    delete snapshot;
 
     if (m_progressDialog  &&  m_progressDialog->wasCanceled()) {
         QMessageBox::information(dynamic_cast<QWidget *>(parent()), tr("Rosegarden"), tr("File load cancelled"));
@@ -1671,6 +2100,32 @@ RosegardenDocument::xmlParse(QString fileContents, QString &errMsg,
         return true;
     }
 
+    if (!ok && fromSnapshot) {
+
+        // The snapshot matched the file but couldn't be read.  Throw
+        // away what was made from it, and parse the file itself.
+        RG_WARNING << "xmlParse(): Could not read snapshot for" << filename
+                   << ":" << handler.errorString() << "- parsing the file instead";
+
+        QFile::remove(DocumentSnapshot::getSnapshotPath(filename));
+
+        m_composition.clear();
+        m_audioFileManager.clear();
+
+        std::vector<DeviceId> added;
+        for (DeviceListIterator i = m_studio.getDevices()->begin();
+             i != m_studio.getDevices()->end(); ++i) {
+            if (devices.find((*i)->getId()) == devices.end()) {
+                added.push_back((*i)->getId());
+            }
+        }
+        for (size_t i = 0; i < added.size(); ++i) {
+            m_studio.removeDevice(added[i]);
+        }
+
+        return xmlParse(filename, errMsg, permanent, cancelled, false);
+    }
+
     if (!ok) {
 
 #if 0
@@ -207,6 +207,28 @@ public:
     bool saveDocument(const QString &filename, QString& errMsg,
                       bool autosave = false);
 
+    /**
+     * Write a snapshot of the document for the file it has just been
+     * saved to, so that opening that file again needn't parse all its
+     * events.  saveDocument() does this itself if the user has asked
+     * for snapshots.
+     *
+     * @see DocumentSnapshot
+     */
+    bool saveSnapshot(const QString &filename);
+
+    /// Number of worker threads saveDocument() formats segments on.
+    /**
+     * One formats them on the calling thread, as older versions did.
+     * If not set, it's the number of cores, up to MaxSaveThreads.  For
+     * tests and benchmarks.
+     */
+    static void setSaveThreadCount(int threads)  { m_saveThreadCount = threads; }
+    static int getSaveThreadCount();
+
+    /// The most threads saveDocument() uses by default.
+    static const int MaxSaveThreads = 8;
+
     /// Save under a new name.
     bool saveAs(const QString &newName, QString &errMsg);
 
@@ -234,6 +256,19 @@ public:
      */
     void deleteAutoSaveFile();
 
+    /**
+     * If slotAutoSave() is still writing in the background, wait for
+     * it to finish.
+     */
+    void waitForAutoSave();
+
+    /**
+     * How long the last autosave kept the GUI thread busy, in ms: the
+     * time slotAutoSave() took to copy the document, and the time
+     * taken to clean up after it was written.
+     */
+    int getLastAutoSaveGuiTime() const { return m_lastAutoSaveGuiTime; }
+
     /**
      * sets the filename of the document
      */
@@ -490,6 +525,10 @@ public slots:
 
     /**
      * saves the document to a suitably-named backup file
+     *
+     * Only a copy of the document is made here, sharing its events'
+     * data.  The copy is written out on another thread, so editing
+     * can carry on meanwhile.
      */
     void slotAutoSave();
 
@@ -499,6 +538,10 @@ public slots:
 
     void slotDocColoursChanged();
 
+private slots:
+    /// The background autosave started by slotAutoSave() has finished.
+    void slotAutoSaveFinished();
+
 signals:
     /// Emitted when the document is modified.
     /**
@@ -570,17 +613,23 @@ private:
     void performAutoload();
 
     /**
-     * Parse the Rosegarden file in \a file
+     * Parse the Rosegarden file \a filename, decompressing it as it
+     * is read
      *
      * \a errMsg will contains the error messages
      * if parsing failed.
      *
+     * The events are taken from the file's snapshot if it has an
+     * up-to-date one, unless \a useSnapshot is false.  If the snapshot
+     * turns out not to be readable, the file is parsed again in full.
+     *
      * @return false if parsing failed
      * @see RoseXmlHandler
      */
-    bool xmlParse(QString fileContents, QString &errMsg,
+    bool xmlParse(const QString &filename, QString &errMsg,
                   bool permanent,
-                  bool &cancelled);
+                  bool &cancelled,
+                  bool useSnapshot = true);
 
     /**
      * Set the "auto saved" status of the document
@@ -610,11 +659,55 @@ private:
                             bool autosave = false);
 
     /**
-     * Save one segment to the given text stream
+     * Write the whole document as XML.  If \a withEvents is false,
+     * leave out the events of the segments and the composition's
+     * tempo and time signature changes, as for a snapshot.
      */
-    void saveSegment(QTextStream&, Segment*,
-                     long totalNbOfEvents, long &count,
-                     QString extraAttributes = QString::null);
+    void writeXml(QTextStream &outStream, bool withEvents);
+
+    /// The part of writeXml() before the segments.
+    void writeXmlStart(QTextStream &outStream, bool withEvents);
+
+    /// The part of writeXml() after the segments.
+    void writeXmlEnd(QTextStream &outStream);
+
+    /**
+     * The segments writeXml() saves, in order, with the extra
+     * attributes each is saved with (for linked and trigger segments).
+     * Returns how many of them are the composition's, rather than
+     * trigger segments.
+     */
+    size_t getSegmentsToSave(std::vector<Segment *> &segments,
+                             std::vector<QString> &attributes);
+
+    /**
+     * Write or remove the snapshot for a file just saved, according
+     * to the user's settings.
+     */
+    void updateSnapshot(const QString &filename);
+
+    /**
+     * Save one segment to the given text stream.  This reads nothing
+     * but the segment, so segments can be saved on several threads at
+     * once (see writeXml()).
+     */
+    static void saveSegment(QTextStream&, Segment*,
+                            long totalNbOfEvents, long &count,
+                            QString extraAttributes = QString::null,
+                            bool withEvents = true);
+
+    /// The parts of saveSegment() before and after the events.
+    static void saveSegmentStart(QTextStream&, Segment*,
+                                 const QString &extraAttributes);
+    static void saveSegmentEnd(QTextStream&, Segment*);
+
+    /// Formats segments for writeXml() on worker threads
+    class SegmentWriter;
+
+    static int m_saveThreadCount;
+
+    /// Writes a copy of the document out for slotAutoSave()
+    class AutoSaver;
 
     /// Identifies a specific event within a specific segment.
     /**
@@ -781,6 +874,15 @@ private:
      */
     int m_autoSavePeriod;
 
+    /// The background autosave in progress, if any
+    AutoSaver *m_autoSaver;
+
+    /// Time the GUI thread spent making the copy for m_autoSaver (ms)
+    int m_autoSaveCopyTime;
+
+    /// Time the GUI thread spent on the last autosave, all told (ms)
+    int m_lastAutoSaveGuiTime;
+
     // Set to true when the dtor starts
     bool m_beingDestroyed;
 
@@ -32,102 +32,146 @@
 namespace Rosegarden
 {
 
+// Attribute names and values are looked at where they lie, to save
+// copying them out for every event of a large file
+
+static int
+toInt(const QStringRef &s, bool *ok)
+{
+#if QT_VERSION >= 0x050100
+    return s.toInt(ok);
+#else
+    return s.toString().toInt(ok);
+#endif
+}
+
+static std::string
+reftostr(const QStringRef &s)
+{
+    return qstrtostr(QString::fromRawData(s.unicode(), s.size()));
+}
+
 XmlStorableEvent::XmlStorableEvent(const QXmlAttributes &attributes,
                                    timeT &absoluteTime)
 {
     setDuration(0);
 
     for (int i = 0; i < attributes.length(); ++i) {
-
         QString attrName(attributes.qName(i)),
         attrVal(attributes.value(i));
+        setFromAttribute(QStringRef(&attrName), QStringRef(&attrVal),
+                         absoluteTime);
+    }
 
-        if (attrName == "package") {
+    setAbsoluteTime(absoluteTime);
+}
 
-            RG_DEBUG << "XmlStorableEvent::XmlStorableEvent: Warning: XML still uses deprecated \"package\" attribute";
+XmlStorableEvent::XmlStorableEvent(const QXmlStreamAttributes &attributes,
+                                   timeT &absoluteTime)
+{
+    setDuration(0);
 
-        } else if (attrName == "type") {
+    for (int i = 0; i < attributes.size(); ++i) {
+        setFromAttribute(attributes[i].qualifiedName(),
+                         attributes[i].value(),
+                         absoluteTime);
+    }
+
+    setAbsoluteTime(absoluteTime);
+}
 
-            setType(qstrtostr(attrVal));
+void
+XmlStorableEvent::setFromAttribute(const QStringRef &attrName,
+                                   const QStringRef &attrVal,
+                                   timeT &absoluteTime)
+{
+    if (attrName == QLatin1String("package")) {
 
-        } else if (attrName == "subordering") {
+        RG_DEBUG << "XmlStorableEvent::XmlStorableEvent: Warning: XML still uses deprecated \"package\" attribute";
 
-            bool isNumeric = true;
-            int o = attrVal.toInt(&isNumeric);
+    } else if (attrName == QLatin1String("type")) {
 
-            if (!isNumeric) {
-                RG_DEBUG << "XmlStorableEvent::XmlStorableEvent: Bad subordering: " << attrVal;
-            } else {
-                if (o != 0)
-                    setSubOrdering(o);
-            }
+        setType(reftostr(attrVal));
 
-        } else if (attrName == "duration") {
+    } else if (attrName == QLatin1String("subordering")) {
 
-            bool isNumeric = true;
-            timeT d = attrVal.toInt(&isNumeric);
+        bool isNumeric = true;
+        int o = toInt(attrVal, &isNumeric);
 
-            if (!isNumeric) {
-                try {
-                    Note n(NotationStrings::getNoteForName(attrVal));
-                    setDuration(n.getDuration());
-                } catch (NotationStrings::MalformedNoteName m) {
-                    RG_DEBUG << "XmlStorableEvent::XmlStorableEvent: Bad duration: " << attrVal << " (" << m.getMessage() << ")";
-                }
-            } else {
-                setDuration(d);
-            }
+        if (!isNumeric) {
+            RG_DEBUG << "XmlStorableEvent::XmlStorableEvent: Bad subordering: " << attrVal.toString();
+        } else {
+            if (o != 0)
+                setSubOrdering(o);
+        }
 
-        } else if (attrName == "absoluteTime") {
+    } else if (attrName == QLatin1String("duration")) {
 
-            bool isNumeric = true;
-            timeT t = attrVal.toInt(&isNumeric);
+        bool isNumeric = true;
+        timeT d = toInt(attrVal, &isNumeric);
 
-            if (!isNumeric) {
-                RG_DEBUG << "XmlStorableEvent::XmlStorableEvent: Bad absolute time: " << attrVal;
-            } else {
-                absoluteTime = t;
+        if (!isNumeric) {
+            try {
+                Note n(NotationStrings::getNoteForName(attrVal.toString()));
+                setDuration(n.getDuration());
+            } catch (NotationStrings::MalformedNoteName m) {
+                RG_DEBUG << "XmlStorableEvent::XmlStorableEvent: Bad duration: " << attrVal.toString() << " (" << m.getMessage() << ")";
             }
+        } else {
+            setDuration(d);
+        }
 
-        } else if (attrName == "timeOffset") {
+    } else if (attrName == QLatin1String("absoluteTime")) {
 
-            bool isNumeric = true;
-            timeT t = attrVal.toInt(&isNumeric);
+        bool isNumeric = true;
+        timeT t = toInt(attrVal, &isNumeric);
 
-            if (!isNumeric) {
-                RG_DEBUG << "XmlStorableEvent::XmlStorableEvent: Bad time offset: " << attrVal;
-            } else {
-                absoluteTime += t;
-            }
+        if (!isNumeric) {
+            RG_DEBUG << "XmlStorableEvent::XmlStorableEvent: Bad absolute time: " << attrVal.toString();
+        } else {
+            absoluteTime = t;
+        }
+
+    } else if (attrName == QLatin1String("timeOffset")) {
+
+        bool isNumeric = true;
+        timeT t = toInt(attrVal, &isNumeric);
 
+        if (!isNumeric) {
+            RG_DEBUG << "XmlStorableEvent::XmlStorableEvent: Bad time offset: " << attrVal.toString();
         } else {
+            absoluteTime += t;
+        }
 
-            // set generic property
-            //
-            QString val(attrVal);
+    } else {
 
-            // Check if boolean val
-            QString valLowerCase(val.toLower());
-            bool isNumeric;
-            int numVal;
+        // set generic property
+        //
+        bool isNumeric;
+        int numVal;
 
-            if (valLowerCase == "true" || valLowerCase == "false") {
+        // Check if boolean val
+        if (attrVal.compare(QLatin1String("true"), Qt::CaseInsensitive) == 0) {
 
-                set
-                    <Bool>(qstrtostr(attrName), valLowerCase == "true");
+            set
+                <Bool>(reftostr(attrName), true);
 
-            } else {
+        } else if (attrVal.compare(QLatin1String("false"), Qt::CaseInsensitive) == 0) {
 
-                // Not a bool, check if integer val
-                numVal = val.toInt(&isNumeric);
-                if (isNumeric) {
-                    set
-                        <Int>(qstrtostr(attrName), numVal);
-                } else {
-                    // not an int either, default to string
-                    set
-                        <String>(qstrtostr(attrName), qstrtostr(attrVal));
-                }
+            set
+                <Bool>(reftostr(attrName), false);
+
+        } else {
+
+            // Not a bool, check if integer val
+            numVal = toInt(attrVal, &isNumeric);
+            if (isNumeric) {
+                set
+                    <Int>(reftostr(attrName), numVal);
+            } else {
+                // not an int either, default to string
+                set
+                    <String>(reftostr(attrName), reftostr(attrVal));
             }
         }
     }
@@ -139,7 +183,6 @@ XmlStorableEvent::XmlStorableEvent(const QXmlAttributes &attributes,
         setDuration(1);
     }
 */
-    setAbsoluteTime(absoluteTime);
 }
 
 XmlStorableEvent::XmlStorableEvent(Event &e) :
@@ -157,6 +200,8 @@ XmlStorableEvent::setPropertyFromAttributes(const QXmlAttributes &attributes,
         return ;
     }
 
+    std::string property = qstrtostr(name);
+
     for (int i = 0; i < attributes.length(); ++i) {
         QString attrName(attributes.qName(i)),
         attrVal(attributes.value(i));
@@ -166,17 +211,9 @@ XmlStorableEvent::setPropertyFromAttributes(const QXmlAttributes &attributes,
         } else if (have) {
             RG_DEBUG << "XmlStorableEvent::setProperty: multiple values found, ignoring all but the first";
             continue;
-        } else if (attrName == "bool") {
-            set<Bool>(qstrtostr(name), attrVal.toLower() == "true", persistent);
-            have = true;
-        } else if (attrName == "int") {
-            set<Int>(qstrtostr(name), attrVal.toInt(), persistent);
-            have = true;
-        } else if (attrName == "string") {
-            set<String>(qstrtostr(name), qstrtostr(attrVal), persistent);
-            have = true;
         } else {
-            RG_DEBUG << "XmlStorableEvent::setProperty: unknown attribute name \"" << name << "\", ignoring";
+            have = setPropertyFromAttribute(property, QStringRef(&attrName),
+                                            QStringRef(&attrVal), persistent);
         }
     }
 
@@ -184,4 +221,56 @@ XmlStorableEvent::setPropertyFromAttributes(const QXmlAttributes &attributes,
         RG_DEBUG << "XmlStorableEvent::setProperty: Warning: no property value found for property " << name;
 }
 
+void
+XmlStorableEvent::setPropertyFromAttributes(const QXmlStreamAttributes &attributes,
+        bool persistent)
+{
+    bool have = false;
+    QStringRef name = attributes.value(QLatin1String("name"));
+    if (name.isEmpty()) {
+        RG_DEBUG << "XmlStorableEvent::setProperty: no property name found, ignoring";
+        return ;
+    }
+
+    std::string property = reftostr(name);
+
+    for (int i = 0; i < attributes.size(); ++i) {
+        QStringRef attrName(attributes[i].qualifiedName());
+
+        if (attrName == QLatin1String("name")) {
+            continue;
+        } else if (have) {
+            RG_DEBUG << "XmlStorableEvent::setProperty: multiple values found, ignoring all but the first";
+            continue;
+        } else {
+            have = setPropertyFromAttribute(property, attrName,
+                                            attributes[i].value(), persistent);
+        }
+    }
+
+    if (!have)
+        RG_DEBUG << "XmlStorableEvent::setProperty: Warning: no property value found for property " << name.toString();
+}
+
+bool
+XmlStorableEvent::setPropertyFromAttribute(const std::string &property,
+                                           const QStringRef &attrName,
+                                           const QStringRef &attrVal,
+                                           bool persistent)
+{
+    if (attrName == QLatin1String("bool")) {
+        set<Bool>(property,
+                  attrVal.compare(QLatin1String("true"), Qt::CaseInsensitive) == 0,
+                  persistent);
+    } else if (attrName == QLatin1String("int")) {
+        set<Int>(property, toInt(attrVal, 0), persistent);
+    } else if (attrName == QLatin1String("string")) {
+        set<String>(property, reftostr(attrVal), persistent);
+    } else {
+        RG_DEBUG << "XmlStorableEvent::setProperty: unknown attribute name \"" << strtoqstr(property) << "\", ignoring";
+        return false;
+    }
+    return true;
+}
+
 }
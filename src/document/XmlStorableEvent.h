@@ -21,6 +21,7 @@
 
 #include "base/Event.h"
 #include <qxml.h>
+#include <QXmlStreamAttributes>
 
 
 class QXmlAttributes;
@@ -50,6 +51,13 @@ public:
     XmlStorableEvent(const QXmlAttributes& atts,
                      timeT &absoluteTime);
 
+    /**
+     * As above, from attributes as QXmlStreamReader finds them.  The
+     * values are read in place, without being copied out first.
+     */
+    XmlStorableEvent(const QXmlStreamAttributes& atts,
+                     timeT &absoluteTime);
+
     /**
      * Construct an XmlStorableEvent from the specified Event.
      */
@@ -60,6 +68,17 @@ public:
      */
     void setPropertyFromAttributes(const QXmlAttributes& atts,
                                    bool persistent);
+
+    void setPropertyFromAttributes(const QXmlStreamAttributes& atts,
+                                   bool persistent);
+
+private:
+    void setFromAttribute(const QStringRef &name, const QStringRef &value,
+                          timeT &absoluteTime);
+    bool setPropertyFromAttribute(const std::string &property,
+                                  const QStringRef &name,
+                                  const QStringRef &value,
+                                  bool persistent);
 };
 
 
@@ -2524,7 +2524,6 @@ RosegardenMainWindow::slotRescaleSelection()
 
     timeT startTime = LONG_MAX;
     timeT endTime = 0;
-    bool haveAudioSegment = false;
 
     // For each segment
     for (SegmentSelection::const_iterator i = selection.begin();
@@ -2536,15 +2535,8 @@ RosegardenMainWindow::slotRescaleSelection()
 
         if (segment->getEndMarkerTime() > endTime)
             endTime = segment->getEndMarkerTime();
-
-        if (segment->getType() == Segment::Audio)
-            haveAudioSegment = true;
     }
 
-    // If there's an audio segment, make sure the audio path is ok.
-    if (haveAudioSegment)
-        testAudioPath(tr("rescaling an audio file"));
-
     RescaleDialog dialog(
             m_view,  // parent
             &m_doc->getComposition(),  // composition
@@ -2557,9 +2549,6 @@ RosegardenMainWindow::slotRescaleSelection()
     if (dialog.exec() != QDialog::Accepted)
         return;
 
-    // Just the audio rescale commands for various housekeeping.
-    std::vector<AudioSegmentRescaleCommand *> audioRescaleCommands;
-
     int multiplier = dialog.getNewDuration();
     int divisor = endTime - startTime;
     double ratio = static_cast<double>(multiplier) / divisor;
@@ -2577,68 +2566,17 @@ RosegardenMainWindow::slotRescaleSelection()
         Segment *segment = *i;
 
         if (segment->getType() == Segment::Audio) {
-            AudioSegmentRescaleCommand *asrc =
-                    new AudioSegmentRescaleCommand(m_doc, segment, ratio);
-            command->addCommand(asrc);
-
-            audioRescaleCommands.push_back(asrc);
+            // The sequencer stretches the audio as it plays, so there
+            // is no file to render here.
+            command->addCommand(
+                    new AudioSegmentRescaleCommand(segment, ratio));
         } else {
             command->addCommand(
                     new SegmentRescaleCommand(segment, multiplier, divisor));
         }
     }
 
-    // Progress Dialog
-    // Note: The label text and range will be set later as needed.
-    // ??? We should make the label text the more generic
-    //     "Rescaling segment...".  Then this is OK for audio or MIDI
-    //     segments.
-    QProgressDialog progressDialog(
-            tr("Rescaling audio file..."),  // labelText
-            tr("Cancel"),  // cancelButtonText
-            0, 0,  // min, max
-            this);  // parent
-    progressDialog.setWindowTitle(tr("Rosegarden"));
-    progressDialog.setWindowModality(Qt::WindowModal);
-    // Don't want to auto close since this is a multi-step
-    // process.  Any of the steps may set progress to 100.  We
-    // will close anyway when this object goes out of scope.
-    progressDialog.setAutoClose(false);
-    // Just force the progress dialog up.
-    // Both Qt4 and Qt5 have bugs related to delayed showing of progress
-    // dialogs.  In Qt4, the dialog sometimes won't show.  In Qt5, KDE
-    // based distros might lock up.  See Bug #1546.
-    progressDialog.show();
-
-    // For each AudioSegmentRescaleCommand, pass on the progress dialog.
-    for (size_t i = 0; i < audioRescaleCommands.size(); ++i) {
-        audioRescaleCommands[i]->setProgressDialog(&progressDialog);
-    }
-
     m_view->slotAddCommandToHistory(command);
-
-    if (progressDialog.wasCanceled())
-        return;
-
-    if (!audioRescaleCommands.empty()) {
-        m_doc->getAudioFileManager().setProgressDialog(&progressDialog);
-
-        // For each AudioSegmentRescaleCommand
-        for (size_t i = 0; i < audioRescaleCommands.size(); ++i) {
-            int fileId = audioRescaleCommands[i]->getNewAudioFileId();
-            if (fileId < 0)
-                continue;
-
-            // Add to the sequencer
-            slotAddAudioFile(fileId);
-
-            // Generate a preview
-            m_doc->getAudioFileManager().generatePreview(fileId);
-
-            if (progressDialog.wasCanceled())
-                return;
-        }
-    }
 }
 
 bool
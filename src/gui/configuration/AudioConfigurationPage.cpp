@@ -143,6 +143,23 @@ AudioConfigurationPage::AudioConfigurationPage(
 
     settings.endGroup();
 
+    settings.beginGroup( SequencerOptionsConfigGroup );
+
+    layout->addWidget(new QLabel(tr("Memory for caching short audio files"),
+                                 frame), row, 0);
+
+    m_audioCacheSize = new QSpinBox(frame);
+    connect(m_audioCacheSize, SIGNAL(valueChanged(int)), this, SLOT(slotModified()));
+    m_audioCacheSize->setMinimum(0);
+    m_audioCacheSize->setMaximum(4096);
+    m_audioCacheSize->setSuffix(tr(" MB"));
+    m_audioCacheSize->setToolTip(tr("<qt>Short audio files, such as drum loops, are kept in memory while they play.  This is how much memory may be used to keep them after they stop, so that they are ready when they next play.</qt>"));
+    m_audioCacheSize->setValue(settings.value("audiocachesize", 128).toInt());
+    layout->addWidget(m_audioCacheSize, row, 1, row- row+1, 2);
+    ++row;
+
+    settings.endGroup();
+
     layout->addWidget(new QLabel(tr("Create JACK outputs"), frame),
                       row, 0);
 //    ++row;
@@ -228,6 +245,9 @@ AudioConfigurationPage::apply()
     settings.setValue("autostartjack", m_autoStartJackServer->isChecked());
 #endif
 
+    // Applied by the sequencer when it next plays
+    settings.setValue("audiocachesize", m_audioCacheSize->value());
+
     settings.endGroup();
     settings.beginGroup( GeneralOptionsConfigGroup );
 
@@ -93,6 +93,7 @@ protected:
 
     LineEdit*  m_externalAudioEditorPath;
     QComboBox* m_previewStyle;
+    QSpinBox*  m_audioCacheSize;
 
 };
  
@@ -184,6 +184,25 @@ GeneralConfigurationPage::GeneralConfigurationPage(RosegardenDocument *doc,
 
     ++row;
 
+    // Option to keep a binary snapshot of each saved file for fast reopening.
+    label = new QLabel(tr("Keep snapshots for faster loading"), frame);
+    layout->addWidget(label, row, 0);
+
+    m_saveSnapshots = new QCheckBox(frame);
+    QString saveSnapshotsTip(tr(
+            "<qt><p>If checked, a binary copy of each file is kept in your "
+            "settings directory when it is saved, and used to open it again "
+            "more quickly while it is unchanged.</p></qt>"));
+    label->setToolTip(saveSnapshotsTip);
+    m_saveSnapshots->setToolTip(saveSnapshotsTip);
+
+    connect(m_saveSnapshots, SIGNAL(stateChanged(int)), this, SLOT(slotModified()));
+
+    m_saveSnapshots->setChecked(settings.value("savesnapshots", false).toBool());
+    layout->addWidget(m_saveSnapshots, row, 1, 1, 2);
+
+    ++row;
+
     settings.endGroup();
 
     // JACK Transport
@@ -517,6 +536,8 @@ void GeneralConfigurationPage::apply()
     bool useTrackName = getUseTrackName();
     settings.setValue("usetrackname", useTrackName);
 
+    settings.setValue("savesnapshots", m_saveSnapshots->isChecked());
+
     settings.endGroup();
 
 #ifdef HAVE_LIBJACK
@@ -123,6 +123,7 @@ protected:
     QComboBox *m_globalStyle;
     QCheckBox *m_appendLabel;
     QCheckBox *m_useTrackName;
+    QCheckBox *m_saveSnapshots;
     QCheckBox *m_jackTransport;
     QCheckBox *m_Thorn;
     QCheckBox *m_longTitles;
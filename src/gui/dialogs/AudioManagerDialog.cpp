@@ -37,6 +37,7 @@
 #include "document/CommandHistory.h"
 #include "document/RosegardenDocument.h"
 #include "misc/ConfigGroups.h"
+#include "misc/TempDir.h"
 #include "gui/application/RosegardenMainViewWidget.h"
 #include "sequencer/RosegardenSequencer.h"
 #include "gui/widgets/AudioListItem.h"
@@ -49,6 +50,7 @@
 #include "gui/dialogs/AboutDialog.h"
 #include "sound/AudioFile.h"
 #include "sound/AudioFileManager.h"
+#include "sound/AudioFileTimeStretcher.h"
 #include "sound/WAVAudioFile.h"
 #include "UnusedAudioSelectionDialog.h"
 #include "document/Command.h"
@@ -401,10 +403,16 @@ AudioManagerDialog::slotPopulateFileList()
                 segmentDuration = (*iit)->getAudioEndTime() -
                                   (*iit)->getAudioStartTime();
 
-                // store the start time
+                // store the start time and duration in the file, which
+                // for a segment stretched as it plays is unstretched
                 //
-                childItem->setStartTime((*iit)->getAudioStartTime());
-                childItem->setDuration(segmentDuration);
+                RealTime fileStartTime =
+                    (*iit)->stretchedToFileTime((*iit)->getAudioStartTime());
+                RealTime fileEndTime =
+                    (*iit)->stretchedToFileTime((*iit)->getAudioEndTime());
+
+                childItem->setStartTime(fileStartTime);
+                childItem->setDuration(fileEndTime - fileStartTime);
 
                 // Write segment duration
                 //
@@ -418,8 +426,8 @@ AudioManagerDialog::slotPopulateFileList()
                     drawHighlightedPreview((*it)->getId(),
                                            RealTime::zeroTime,
                                            (*it)->getLength(),
-                                           (*iit)->getAudioStartTime(),
-                                           (*iit)->getAudioEndTime(),
+                                           fileStartTime,
+                                           fileEndTime,
                                            audioPixmap);
                 } catch (Exception e) {
                     // should already be set to "no file"
@@ -558,6 +566,38 @@ AudioManagerDialog::slotExportAudio()
         clipDuration = segment->getAudioEndTime() - clipStartTime;
     }
 
+    // A segment stretched as it plays refers to the unstretched file,
+    // and its times are in stretched time.  Render the stretch to a
+    // temporary file, and export the clip from that.
+    QString stretchedFileName;
+    WAVAudioFile *stretchedFile = 0;
+
+    if (segment && segment->isStretchedLive()) {
+        stretchedFileName =
+            TempDir::path() + QString("/rosegarden_export_%1.wav")
+                                  .arg(sourceFile->getId());
+
+        AudioFileTimeStretcher stretcher(&m_doc->getAudioFileManager());
+        stretcher.setProgressDialog(&progressDialog);
+
+        if (!stretcher.stretch(sourceFile, stretchedFileName,
+                               segment->getStretchRatio())) {
+            QFile::remove(stretchedFileName);
+            QMessageBox::critical(this, tr("Rosegarden"),
+                    tr("Failed to stretch the audio file for export"));
+            return;
+        }
+
+        // (opened now, as its format comes from its header)
+        stretchedFile = new WAVAudioFile(0, "", stretchedFileName);
+        if (!stretchedFile->open()) {
+            delete stretchedFile;
+            QFile::remove(stretchedFileName);
+            return;
+        }
+        sourceFile = stretchedFile;
+    }
+
     WAVAudioFile destFile(
             destFileName,
             sourceFile->getChannels(),
@@ -579,6 +619,11 @@ AudioManagerDialog::slotExportAudio()
 
     destFile.close();
     sourceFile->close();
+
+    if (stretchedFile) {
+        delete stretchedFile;
+        QFile::remove(stretchedFileName);
+    }
 }
 
 void
@@ -180,8 +180,10 @@ AudioSplitDialog::drawPreview()
 
     try {
         values = aFM.getPreview(m_segment->getAudioFileId(),
-                                m_segment->getAudioStartTime(),
-                                m_segment->getAudioEndTime(),
+                                m_segment->stretchedToFileTime
+                                    (m_segment->getAudioStartTime()),
+                                m_segment->stretchedToFileTime
+                                    (m_segment->getAudioEndTime()),
                                 m_previewWidth,
                                 false);
     } catch (Exception e) {
@@ -284,8 +286,12 @@ AudioSplitDialog::drawSplits(int threshold)
 {
     // Now get the current split points and paint them
     //
-    RealTime startTime = m_segment->getAudioStartTime();
-    RealTime endTime = m_segment->getAudioEndTime();
+    // (in the file: the positions drawn are in proportion, so this
+    // is right for a segment stretched as it plays too)
+    RealTime startTime =
+        m_segment->stretchedToFileTime(m_segment->getAudioStartTime());
+    RealTime endTime =
+        m_segment->stretchedToFileTime(m_segment->getAudioEndTime());
 
     AudioFileManager &aFM = m_doc->getAudioFileManager();
     std::vector<SplitPointPair> splitPoints =
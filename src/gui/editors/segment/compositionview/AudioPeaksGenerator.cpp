@@ -81,8 +81,10 @@ void AudioPeaksGenerator::generateAsync()
 
     AudioPeaksThread::Request request;
     request.audioFileId = m_segment->getAudioFileId();
-    request.audioStartTime = audioStartTime;
-    request.audioEndTime = audioEndTime;
+    // (a segment stretched as it plays shows its unstretched file,
+    // squeezed or spread to fit)
+    request.audioStartTime = m_segment->stretchedToFileTime(audioStartTime);
+    request.audioEndTime = m_segment->stretchedToFileTime(audioEndTime);
     request.width = m_rect.width();
     request.showMinima = m_showMinima;
     request.notify = this;
@@ -171,6 +171,10 @@ AudioPeaksThread::process()
             // If there's an audio file to work with
             if (audioFile != NULL) {
                 unsigned int channels = audioFile->getChannels();
+                // A file still being recorded hasn't been read, but
+                // its peaks have: one value per channel per pixel
+                if (channels == 0  &&  req.width > 0)
+                    channels = results.size() / req.width;
                 m_results[token] = ResultsPair(channels, results);
                 QObject *notify = req.notify;
                 QApplication::postEvent(notify, new AudioPeaksReadyEvent(token));
@@ -1106,6 +1106,31 @@ void CompositionModelImpl::slotAudioPeaksComplete(
         emit needUpdate(previewPainter.getSegmentRect().rect);
 }
 
+void CompositionModelImpl::slotAudioPeaksGenerated(AudioFileId audioFileId)
+{
+    bool found = false;
+
+    SegmentMultiSet &segments = m_composition.getSegments();
+
+    // For each audio segment playing this file
+    for (SegmentMultiSet::iterator i = segments.begin();
+         i != segments.end();
+         ++i) {
+        if ((*i)->getType() != Segment::Audio)
+            continue;
+        if ((*i)->getAudioFileId() != audioFileId)
+            continue;
+
+        // Drop the preview so that it is generated again, this time
+        // from the peaks.
+        deleteCachedPreview(*i);
+        found = true;
+    }
+
+    if (found)
+        emit needUpdate();
+}
+
 // --- Previews -----------------------------------------------------
 
 void
@@ -1113,6 +1138,9 @@ CompositionModelImpl::slotNewDocument(RosegardenDocument *doc)
 {
     connect(doc, SIGNAL(documentModified(bool)),
             SLOT(slotDocumentModified(bool)));
+    connect(&doc->getAudioFileManager(),
+                SIGNAL(peaksGenerated(AudioFileId)),
+            SLOT(slotAudioPeaksGenerated(AudioFileId)));
 }
 
 void
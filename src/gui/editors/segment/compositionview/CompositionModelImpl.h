@@ -23,6 +23,7 @@
 #include "ChangingSegment.h"
 #include "SegmentOrderer.h"
 #include "base/TimeT.h"  // timeT
+#include "sound/AudioFile.h"  // AudioFileId
 
 #include <QColor>
 #include <QPoint>
@@ -355,6 +356,13 @@ private slots:
     /// Connected to AudioPeaksGenerator::audioPeaksComplete()
     void slotAudioPeaksComplete(AudioPeaksGenerator *);
 
+    /// Connected to AudioFileManager::peaksGenerated()
+    /**
+     * Redraws the previews of the segments playing the audio file,
+     * which were empty while its peaks were being generated.
+     */
+    void slotAudioPeaksGenerated(AudioFileId);
+
     /// Handler for m_updateTimer.
     void slotUpdateTimer();
 
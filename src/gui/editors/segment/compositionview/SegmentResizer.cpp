@@ -36,7 +36,6 @@
 #include "CompositionView.h"
 #include "document/RosegardenDocument.h"
 #include "gui/general/BaseTool.h"
-#include "gui/application/RosegardenMainWindow.h"
 #include "gui/general/RosegardenScrollView.h"
 #include "SegmentTool.h"
 #include "document/Command.h"
@@ -113,65 +112,6 @@ void SegmentResizer::mousePressEvent(QMouseEvent *e)
     setContextHelp2(e->modifiers());
 }
 
-void SegmentResizer::resizeAudioSegment(
-        Segment *segment,
-        double ratio,
-        timeT newStartTime,
-        timeT newEndTime)
-{
-    try {
-        m_doc->getAudioFileManager().testAudioPath();
-    } catch (AudioFileManager::BadAudioPathException) {
-        if (QMessageBox::warning(0, tr("Warning"), //tr("Set audio file path"),
-                tr("The audio file path does not exist or is not writable.\nYou must set the audio file path to a valid directory in Document Properties before rescaling an audio file.\nWould you like to set it now?"),
-                QMessageBox::Yes | QMessageBox::Cancel, QMessageBox::Cancel) ==
-                    QMessageBox::Yes) {
-            RosegardenMainWindow::self()->slotOpenAudioPathSettings();
-        }
-    }
-
-    AudioSegmentRescaleCommand *command =
-        new AudioSegmentRescaleCommand(m_doc, segment, ratio,
-                                       newStartTime, newEndTime);
-
-    // Progress Dialog
-    // Note: The label text and range will be set later as needed.
-    QProgressDialog progressDialog(
-            tr("Rescaling audio file..."),  // labelText
-            tr("Cancel"),  // cancelButtonText
-            0, 100,  // min, max
-            RosegardenMainWindow::self());  // parent
-
-    progressDialog.setWindowTitle(tr("Rosegarden"));
-    progressDialog.setWindowModality(Qt::WindowModal);
-    // Don't want to auto close since this is a multi-step
-    // process.  Any of the steps may set progress to 100.  We
-    // will close anyway when this object goes out of scope.
-    progressDialog.setAutoClose(false);
-    // Just force the progress dialog up.
-    // Both Qt4 and Qt5 have bugs related to delayed showing of progress
-    // dialogs.  In Qt4, the dialog sometimes won't show.  In Qt5, KDE
-    // based distros might lock up.  See Bug #1546.
-    progressDialog.show();
-
-    command->setProgressDialog(&progressDialog);
-
-    CommandHistory::getInstance()->addCommand(command);
-
-    if (progressDialog.wasCanceled())
-        return;
-
-    int fileId = command->getNewAudioFileId();
-    if (fileId < 0)
-        return;
-
-    // Add to sequencer
-    RosegardenMainWindow::self()->slotAddAudioFile(fileId);
-
-    m_doc->getAudioFileManager().setProgressDialog(&progressDialog);
-    m_doc->getAudioFileManager().generatePreview(fileId);
-}
-
 void SegmentResizer::mouseReleaseEvent(QMouseEvent *e)
 {
     //RG_DEBUG << "mouseReleaseEvent()";
@@ -219,7 +159,13 @@ void SegmentResizer::mouseReleaseEvent(QMouseEvent *e)
                             static_cast<double>(newEndTime - newStartTime) /
                             (oldEndTime - oldStartTime);
 
-                    resizeAudioSegment(segment, ratio, newStartTime, newEndTime);
+                    // Only the segment changes.  The sequencer
+                    // stretches its file as it plays.
+                    AudioSegmentRescaleCommand *command =
+                        new AudioSegmentRescaleCommand(segment, ratio,
+                                                       newStartTime,
+                                                       newEndTime);
+                    CommandHistory::getInstance()->addCommand(command);
 
                 } else {
                     
@@ -91,6 +91,12 @@ AudioSegmentMapper::fillBuffer()
         e.setTrackId(track->getId());
         e.setRuntimeSegmentId(m_segment->getRuntimeId());
 
+        // A segment with no stretched file rendered for it is
+        // stretched by the sequencer as it plays
+        if (m_segment->isStretchedLive()) {
+            e.setStretchRatio(m_segment->getStretchRatio());
+        }
+
         // Send the autofade if required
         //
         if (m_segment->isAutoFading()) {
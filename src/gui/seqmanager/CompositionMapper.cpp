@@ -72,6 +72,20 @@ CompositionMapper::segmentModified(Segment *segment)
     return mapper->refresh();
 }
 
+bool
+CompositionMapper::segmentModified(Segment *segment, timeT from, timeT to)
+{
+    if (m_segmentMappers.find(segment) == m_segmentMappers.end()) return false;
+
+    QSharedPointer<SegmentMapper> mapper = m_segmentMappers[segment];
+    if (!mapper) return false;
+
+    SEQMAN_DEBUG << "CompositionMapper::segmentModified(" << segment << ", "
+                 << from << ", " << to << ") - mapper = " << mapper << endl;
+
+    return mapper->refreshRange(from, to);
+}
+
 void
 CompositionMapper::segmentAdded(Segment *segment)
 {
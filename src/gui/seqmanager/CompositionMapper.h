@@ -18,6 +18,8 @@
 #ifndef RG_COMPOSITIONMAPPER_H
 #define RG_COMPOSITIONMAPPER_H
 
+#include "base/TimeT.h"
+
 #include <QSharedPointer>
 
 #include <map>
@@ -49,6 +51,8 @@ public:
     QSharedPointer<MappedEventBuffer> getMappedEventBuffer(Segment *);
 
     bool segmentModified(Segment *);
+    /// As above, for a change between the given times only
+    bool segmentModified(Segment *, timeT from, timeT to);
     void segmentAdded(Segment *);
     void segmentDeleted(Segment *);
 
@@ -48,7 +48,9 @@ InternalSegmentMapper::InternalSegmentMapper(RosegardenDocument *doc,
                                              Segment *segment)
     : SegmentMapper(doc, segment),
       m_channelManager(doc->getInstrument(segment)),
-      m_triggeredEvents(new Segment)
+      m_triggeredEvents(new Segment),
+      m_endMarkerTime(0),
+      m_rangeRefreshable(false)
 {}
 
 InternalSegmentMapper::
@@ -57,15 +59,6 @@ InternalSegmentMapper::
     if(m_triggeredEvents) { delete m_triggeredEvents; }
 }
 
-RealTime
-InternalSegmentMapper::
-toRealTime(Composition &comp, timeT t)
-{
-    return 
-        comp.getElapsedRealTime(t) + m_segment->getRealTimeDelay();
-}
-
-
 void InternalSegmentMapper::fillBuffer()
 {
     Composition &comp = m_doc->getComposition();
@@ -87,7 +80,11 @@ void InternalSegmentMapper::fillBuffer()
     if (repeatCount > 0)
         repeatEndTime = m_segment->getRepeatEndTime();
 
-    resize(0);
+    // The events are built here and only replace the buffer once they
+    // have their real times, so the sequencer never sees a partly
+    // built buffer or an event at time zero.
+    std::vector<MappedEvent> events;
+    events.reserve(calculateSize());
 
 #ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
     SEQMAN_DEBUG
@@ -104,6 +101,12 @@ void InternalSegmentMapper::fillBuffer()
     m_triggeredEvents->clear(); 
     m_controllerCache.clear();
     m_noteOffs = NoteoffContainer();
+    m_eventTimes.clear();
+
+    // Ties, grace notes and triggered segments make the mapping of one
+    // event depend on others, as do repeats.  We only patch ranges of
+    // the buffer (see refreshRange()) if there are none of those.
+    m_rangeRefreshable = (repeatCount == 0);
 
     for (int repeatNo = 0; repeatNo <= repeatCount; ++repeatNo) {
 
@@ -152,7 +155,7 @@ void InternalSegmentMapper::fillBuffer()
             // compare to the performance time since noteoffs already
             // take repeat-times into count.
             if (haveEarlierNoteoff(bestBaseTime + timeForRepeats)) {
-                popInsertNoteoff(track->getId(), comp);
+                popInsertNoteoff(track->getId(), events);
                 continue;
             }
 
@@ -163,6 +166,10 @@ void InternalSegmentMapper::fillBuffer()
                 long triggerId = -1;
                 (**k)->get<Int>(BaseProperties::TRIGGER_SEGMENT_ID, triggerId);
 
+                if (m_rangeRefreshable && !isIndependent(**k)) {
+                    m_rangeRefreshable = false;
+                }
+
                 if (triggerId >= 0) {
 
                     TriggerSegmentRec *rec =
@@ -194,8 +201,8 @@ void InternalSegmentMapper::fillBuffer()
                         int spaceNeeded =
                             addSize(calculateSize(), rec->getSegment());
                         // Reserve more space if we will need it.
-                        if (spaceNeeded > capacity()) {
-                            reserve(spaceNeeded);
+                        if (spaceNeeded > int(events.capacity())) {
+                            events.reserve(spaceNeeded);
                         }
                     }
                         
@@ -208,73 +215,25 @@ void InternalSegmentMapper::fillBuffer()
                 }
             }
 
-            // Ignore rests
-            //
-            if (!(**k)->isa(Note::EventRestType)) {
-
-                SegmentPerformanceHelper helper
-                (usingImplied ? *m_triggeredEvents : *m_segment);
-
-                timeT playTime =
-                    helper.getSoundingAbsoluteTime(*k) + timeForRepeats;
-                if (playTime >= repeatEndTime) break;
-
-                timeT playDuration = helper.getSoundingDuration(*k);
-
-                // Ignore notes without duration -- they're probably in a tied
-                // series but not as first note
-                //
-                if (playDuration > 0 || !(**k)->isa(Note::EventType)) {
-
-                    if (playTime + playDuration > repeatEndTime)
-                        playDuration = repeatEndTime - playTime;
-
-                    playTime = playTime + m_segment->getDelay();
-                    const RealTime eventTime = toRealTime(comp, playTime);
-
-                    // slightly quicker than calling helper.getRealSoundingDuration()
-                    RealTime endTime =
-                        toRealTime(comp, playTime + playDuration);
-                    const RealTime duration = endTime - eventTime;
-
-                    try {
-                        // Create mapped event and put it in buffer.
-                        // The instrument will be set later by
-                        // ChannelManager, so we set it to zero here.
-                        MappedEvent e(0,
-                                      ***k,  // three stars! what an accolade
-                                      eventTime,
-                                      duration);
-
-                        // Somewhat hacky: The MappedEvent ctor makes
-                        // events that needn't be inserted invalid.
-                        if (e.isValid()) {
-                            e.setTrackId(track->getId());
-
-                            if ((**k)->isa(Controller::EventType) ||
-                                (**k)->isa(PitchBend::EventType)) {
-                                m_controllerCache.storeLatestValue((**k));
-                            }
-                            
-                            if ((**k)->isa(Note::EventType)) {
-                                if (m_segment->getTranspose() != 0) {
-                                    e.setPitch(e.getPitch() +
-                                               m_segment->getTranspose());
-                                }
-                                if (e.getType() != MappedEvent::MidiNoteOneShot) {
-                                    enqueueNoteoff(playTime + playDuration,
-                                                   e.getPitch());
-                                }
-                            }
-                            mapAnEvent(&e); 
-                        } else {}
-                        
-                    } catch (...) {
-#ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
-                        SEQMAN_DEBUG << "SegmentMapper::fillBuffer - caught exception while trying to create MappedEvent\n";
-#endif
-                    }
+            MappedEvent e;
+            EventTimes times;
+            MapResult result = mapEvent(usingImplied ? *m_triggeredEvents :
+                                                       *m_segment,
+                                        *k, timeForRepeats, repeatEndTime,
+                                        track->getId(), e, times);
+            if (result == PastRepeatEnd) break;
+
+            if (result == Mapped) {
+                if ((**k)->isa(Controller::EventType) ||
+                    (**k)->isa(PitchBend::EventType)) {
+                    m_controllerCache.storeLatestValue((**k));
                 }
+                if ((**k)->isa(Note::EventType) &&
+                    e.getType() != MappedEvent::MidiNoteOneShot) {
+                    enqueueNoteoff(times.end, e.getPitch(), times.source);
+                }
+                events.push_back(e);
+                m_eventTimes.push_back(times);
             }
 
             ++*k; // increment either i or j, whichever one we just used
@@ -283,9 +242,26 @@ void InternalSegmentMapper::fillBuffer()
 
     // After all the other events, there may still be Noteoffs.
     while (!m_noteOffs.empty()) {
-        popInsertNoteoff(track->getId(), comp);
+        popInsertNoteoff(track->getId(), events);
+    }
+
+    if (!events.empty()) {
+        convertEventTimes(comp, &events[0], &m_eventTimes[0], events.size());
     }
 
+    publish(events.empty() ? 0 : &events[0], events.size());
+
+    m_endMarkerTime = segmentEndTime;
+
+    finishBuffer();
+}
+
+void
+InternalSegmentMapper::finishBuffer()
+{
+    Track *track =
+        m_doc->getComposition().getTrackById(m_segment->getTrack());
+
     bool anything = (size() != 0);
 
     RealTime minRealTime;
@@ -338,16 +314,16 @@ haveEarlierNoteoff(timeT t)
 {
     return
         (!m_noteOffs.empty()) &&
-        (m_noteOffs.begin()->first <= t);
+        (m_noteOffs.begin()->time <= t);
 }
 
 void
 InternalSegmentMapper::
-enqueueNoteoff(timeT time, int pitch)
+enqueueNoteoff(timeT time, int pitch, timeT source)
 {
     for (NoteoffContainer::iterator i = m_noteOffs.begin();
          i != m_noteOffs.end(); ++i) {
-        if (i->second == pitch) {
+        if (i->pitch == pitch) {
 #ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
             SEQMAN_DEBUG << "duplicated NOTE OFF  pitch: " << pitch
                          << " at " << time << std::endl;
@@ -357,28 +333,380 @@ enqueueNoteoff(timeT time, int pitch)
     }
 
     // Enqueue this noteoff
-    m_noteOffs.insert(Noteoff(time, pitch));
+    m_noteOffs.insert(Noteoff(time, pitch, source));
 }
 
 
 void
 InternalSegmentMapper::
-popInsertNoteoff(int trackid, Composition &comp)
+popInsertNoteoff(int trackid, std::vector<MappedEvent> &events)
+{
+    EventTimes times;
+    events.push_back(popNoteoff(trackid, times));
+    m_eventTimes.push_back(times);
+}
+
+MappedEvent
+InternalSegmentMapper::
+popNoteoff(int trackid, EventTimes &times)
 {
     // Look at top element
-    timeT internalTime = m_noteOffs.begin()->first;
-    int pitch          = m_noteOffs.begin()->second;
+    const Noteoff &noteoff = *m_noteOffs.begin();
 
     // A noteoff looks like a note with velocity = 0.
     // Our noteoffs already have performance pitch, so
     // don't add segment's transpose.
-    MappedEvent event(0, MappedEvent::MidiNote, pitch, 0);
-    event.setEventTime(toRealTime(comp, internalTime));
+    MappedEvent event(0, MappedEvent::MidiNote, noteoff.pitch, 0);
     event.setTrackId(trackid);
-    mapAnEvent(&event);
+
+    // Zero duration, as for the MappedEvent itself
+    times.start = noteoff.time;
+    times.end = noteoff.time;
+    times.source = noteoff.source;
+    times.noteOff = true;
 
     // pop
     m_noteOffs.erase(m_noteOffs.begin());
+
+    return event;
+}
+
+    /** Functions for mapping single events **/
+
+bool
+InternalSegmentMapper::
+isIndependent(const Event *e)
+{
+    return !(e->has(BaseProperties::TRIGGER_SEGMENT_ID) ||
+             e->has(BaseProperties::TIED_FORWARD) ||
+             e->has(BaseProperties::TIED_BACKWARD) ||
+             e->has(BaseProperties::IS_GRACE_NOTE) ||
+             e->has(BaseProperties::MAY_HAVE_GRACE_NOTES));
+}
+
+InternalSegmentMapper::MapResult
+InternalSegmentMapper::
+mapEvent(Segment &segment, Segment::iterator i,
+         timeT timeForRepeats, timeT repeatEndTime, TrackId trackId,
+         MappedEvent &e, EventTimes &times)
+{
+    // Ignore rests
+    //
+    if ((*i)->isa(Note::EventRestType)) return NotMapped;
+
+    SegmentPerformanceHelper helper(segment);
+
+    timeT playTime =
+        helper.getSoundingAbsoluteTime(i) + timeForRepeats;
+    if (playTime >= repeatEndTime) return PastRepeatEnd;
+
+    timeT playDuration = helper.getSoundingDuration(i);
+
+    // Ignore notes without duration -- they're probably in a tied
+    // series but not as first note
+    //
+    if (playDuration <= 0 && (*i)->isa(Note::EventType)) return NotMapped;
+
+    if (playTime + playDuration > repeatEndTime)
+        playDuration = repeatEndTime - playTime;
+
+    playTime = playTime + m_segment->getDelay();
+
+    try {
+        // Create mapped event.  The instrument will be set later by
+        // ChannelManager, so we set it to zero here.  The real time
+        // and duration are filled in by convertEventTimes().
+        e = MappedEvent(0,
+                        **i,
+                        RealTime::zeroTime,
+                        RealTime::zeroTime);
+    } catch (...) {
+#ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
+        SEQMAN_DEBUG << "SegmentMapper::mapEvent - caught exception while trying to create MappedEvent\n";
+#endif
+        return NotMapped;
+    }
+
+    // Somewhat hacky: The MappedEvent ctor makes
+    // events that needn't be inserted invalid.
+    if (!e.isValid()) return NotMapped;
+
+    e.setTrackId(trackId);
+
+    if ((*i)->isa(Note::EventType) && m_segment->getTranspose() != 0) {
+        e.setPitch(e.getPitch() + m_segment->getTranspose());
+    }
+
+    times.start = playTime;
+    times.end = playTime + playDuration;
+    times.source = (*i)->getAbsoluteTime() + timeForRepeats;
+    times.noteOff = false;
+
+    return Mapped;
+}
+
+void
+InternalSegmentMapper::
+convertEventTimes(Composition &comp, MappedEvent *events,
+                  const EventTimes *times, int count)
+{
+    if (count == 0) return;
+
+    // One batch conversion is much cheaper than looking up the tempo
+    // map separately for each event
+    std::vector<timeT> musicalTimes(count * 2);
+    for (int i = 0; i < count; ++i) {
+        musicalTimes[i * 2] = times[i].start;
+        musicalTimes[i * 2 + 1] = times[i].end;
+    }
+
+    std::vector<RealTime> realTimes(musicalTimes.size());
+    comp.getElapsedRealTimes(&musicalTimes[0], &realTimes[0],
+                             musicalTimes.size());
+
+    const RealTime delay = m_segment->getRealTimeDelay();
+
+    for (int i = 0; i < count; ++i) {
+        const RealTime &start = realTimes[i * 2];
+        const RealTime &end = realTimes[i * 2 + 1];
+        events[i].setEventTime(start + delay);
+        events[i].setDuration(end - start);
+    }
+}
+
+    /** Range refresh **/
+
+namespace
+{
+    // Buffer order: by source time for ordinary events, by their own
+    // time for noteoffs, with noteoffs first where those are equal and
+    // simultaneous noteoffs in the order of their notes.  This is the
+    // order in which fillBuffer() writes them.
+    struct EventOrderCmp
+    {
+        template <typename T>
+        bool operator()(const T &a, const T &b) const {
+            timeT ta = (a.noteOff ? a.start : a.source);
+            timeT tb = (b.noteOff ? b.start : b.source);
+            if (ta != tb) return ta < tb;
+            if (a.noteOff != b.noteOff) return a.noteOff;
+            return a.noteOff && a.source < b.source;
+        }
+    };
+
+    // The same, for indices into a vector of times
+    template <typename T>
+    struct IndexOrderCmp
+    {
+        IndexOrderCmp(const std::vector<T> &times) : m_times(times) { }
+        bool operator()(int a, int b) const {
+            return EventOrderCmp()(m_times[a], m_times[b]);
+        }
+        const std::vector<T> &m_times;
+    };
+}
+
+bool
+InternalSegmentMapper::
+refreshRange(timeT from, timeT to)
+{
+    Composition &comp = m_doc->getComposition();
+    Track *track = comp.getTrackById(m_segment->getTrack());
+
+    const int oldSize = size();
+
+    // Refill the whole buffer if the last fill found events whose
+    // mapping depends on others, if a negative delay could move
+    // noteoffs ahead of the range, if the end marker has moved (which
+    // may cut notes short or bring others in), or if the range is the
+    // whole segment anyway
+    if (!m_rangeRefreshable || !track || oldSize == 0 ||
+        !m_noteOffs.empty() ||
+        m_eventTimes.size() != size_t(oldSize) ||
+        getSegmentRepeatCount() != 0 ||
+        m_segment->getDelay() < 0 ||
+        m_segment->getEndMarkerTime() != m_endMarkerTime ||
+        (from <= m_segment->getStartTime() &&
+         to >= m_segment->getEndMarkerTime())) {
+        return refresh();
+    }
+
+    // A note that starts before the range but sounds into it, before
+    // or after the edit, may be the one that changed, and its noteoff
+    // lies outside what we would replace.  Refill in that case too.
+
+    for (int i = 0; i < oldSize && m_eventTimes[i].source < from; ++i) {
+        const EventTimes &times = m_eventTimes[i];
+        if (!times.noteOff && times.end - m_segment->getDelay() > from) {
+            return refresh();
+        }
+    }
+
+    for (Segment::iterator i = m_segment->begin();
+         m_segment->isBeforeEndMarker(i) && (*i)->getAbsoluteTime() < from;
+         ++i) {
+        if ((*i)->isa(Note::EventType) &&
+            (*i)->getAbsoluteTime() + (*i)->getDuration() > from) {
+            return refresh();
+        }
+    }
+
+#ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
+    SEQMAN_DEBUG << "InternalSegmentMapper::refreshRange" << from << to;
+#endif
+
+    // Map the events now in the range.  Anything that can't be mapped
+    // in isolation sends us back to a full refill.
+
+    const timeT repeatEndTime = m_segment->getEndMarkerTime();
+
+    std::vector<MappedEvent> newEvents;
+    std::vector<EventTimes> newTimes;
+    bool controllersChanged = false;
+
+    for (Segment::iterator i = m_segment->findTime(from);
+         m_segment->isBeforeEndMarker(i) && (*i)->getAbsoluteTime() <= to;
+         ++i) {
+
+        if (!isIndependent(*i)) return refresh();
+
+        MappedEvent e;
+        EventTimes times;
+        MapResult result = mapEvent(*m_segment, i, 0, repeatEndTime,
+                                    track->getId(), e, times);
+        if (result == PastRepeatEnd) break;
+        if (result != Mapped) continue;
+
+        if ((*i)->isa(Controller::EventType) ||
+            (*i)->isa(PitchBend::EventType)) {
+            controllersChanged = true;
+        }
+        if ((*i)->isa(Note::EventType) &&
+            e.getType() != MappedEvent::MidiNoteOneShot) {
+            enqueueNoteoff(times.end, e.getPitch(), times.source);
+        }
+        newEvents.push_back(e);
+        newTimes.push_back(times);
+    }
+
+    while (!m_noteOffs.empty()) {
+        EventTimes times;
+        newEvents.push_back(popNoteoff(track->getId(), times));
+        newTimes.push_back(times);
+    }
+
+    const int newCount = int(newEvents.size());
+
+    if (newCount > 0) {
+        convertEventTimes(comp, &newEvents[0], &newTimes[0], newCount);
+    }
+
+    // Put the new events into buffer order, keeping the two vectors
+    // in step
+
+    std::vector<int> order(newCount);
+    for (int i = 0; i < newCount; ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     IndexOrderCmp<EventTimes>(newTimes));
+
+    // Find the part of the buffer affected: from the first event at
+    // or after the start of the range, to the last event that came
+    // from the range or must be merged with the new ones
+
+    const MappedEvent *buffer = getBuffer();
+
+    EventTimes rangeStart;
+    rangeStart.start = rangeStart.source = rangeStart.end = from;
+    rangeStart.noteOff = true;
+    const int first = std::lower_bound(m_eventTimes.begin(),
+                                       m_eventTimes.end(),
+                                       rangeStart, EventOrderCmp()) -
+        m_eventTimes.begin();
+
+    int last = first;
+    int removed = 0;
+    for (int i = first; i < oldSize; ++i) {
+        const EventTimes &times = m_eventTimes[i];
+        if (times.source >= from && times.source <= to) {
+            last = i + 1;
+            ++removed;
+            if (!times.noteOff &&
+                (buffer[i].getType() == MappedEvent::MidiController ||
+                 buffer[i].getType() == MappedEvent::MidiPitchBend)) {
+                controllersChanged = true;
+            }
+        }
+    }
+    if (newCount > 0) {
+        const EventTimes &lastNew = newTimes[order[newCount - 1]];
+        last = std::max(last,
+                        int(std::upper_bound(m_eventTimes.begin() + first,
+                                             m_eventTimes.end(),
+                                             lastNew, EventOrderCmp()) -
+                            m_eventTimes.begin()));
+    }
+
+    // Build the whole new contents: the old events before the range,
+    // the surviving old events in [first, last) merged with the new
+    // ones, then the old events after.  The buffer itself is replaced
+    // in one go, as fillBuffer() does, so that the sequencer never
+    // sees it half rewritten.
+
+    const int newSize = oldSize - removed + newCount;
+
+    std::vector<MappedEvent> mergedEvents;
+    std::vector<EventTimes> mergedTimes;
+    mergedEvents.reserve(newSize);
+    mergedTimes.reserve(newSize);
+
+    mergedEvents.insert(mergedEvents.end(), buffer, buffer + first);
+    mergedTimes.insert(mergedTimes.end(), m_eventTimes.begin(),
+                       m_eventTimes.begin() + first);
+
+    int n = 0;
+    for (int i = first; i < last; ++i) {
+        const EventTimes &times = m_eventTimes[i];
+        if (times.source >= from && times.source <= to) continue;
+        while (n < newCount &&
+               EventOrderCmp()(newTimes[order[n]], times)) {
+            mergedEvents.push_back(newEvents[order[n]]);
+            mergedTimes.push_back(newTimes[order[n]]);
+            ++n;
+        }
+        mergedEvents.push_back(buffer[i]);
+        mergedTimes.push_back(times);
+    }
+    for ( ; n < newCount; ++n) {
+        mergedEvents.push_back(newEvents[order[n]]);
+        mergedTimes.push_back(newTimes[order[n]]);
+    }
+
+    mergedEvents.insert(mergedEvents.end(), buffer + last, buffer + oldSize);
+    mergedTimes.insert(mergedTimes.end(), m_eventTimes.begin() + last,
+                       m_eventTimes.end());
+
+    const bool resized = (newSize > capacity());
+
+    publish(mergedEvents.empty() ? 0 : &mergedEvents[0], newSize);
+    m_eventTimes.swap(mergedTimes);
+
+    // The latest value of each controller is cached for jumps in
+    // playback.  If controllers came or went, rebuild it.
+
+    if (controllersChanged) {
+        m_controllerCache.clear();
+        for (Segment::iterator i = m_segment->begin();
+             m_segment->isBeforeEndMarker(i); ++i) {
+            if ((*i)->isa(Controller::EventType) ||
+                (*i)->isa(PitchBend::EventType)) {
+                m_controllerCache.storeLatestValue(*i);
+            }
+        }
+    }
+
+    finishBuffer();
+
+    return resized;
 }
 
 int
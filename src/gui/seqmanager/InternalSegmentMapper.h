@@ -19,11 +19,13 @@
 #define RG_INTERNALSEGMENTMAPPER_H
 
 #include "base/ControllerContext.h"
+#include "base/Segment.h"
 #include "gui/seqmanager/MappedEventBuffer.h"
 #include "gui/seqmanager/SegmentMapper.h"
 #include "gui/seqmanager/ChannelManager.h"
 
 #include <set>
+#include <vector>
 
 namespace Rosegarden
 {
@@ -61,6 +63,21 @@ public:
     InternalSegmentMapper(RosegardenDocument *doc, Segment *segment);
     ~InternalSegmentMapper();
 
+    /// Re-map only the events between from and to.
+    /**
+     * The old events from that range are removed from the buffer and
+     * the range is mapped afresh and merged in, leaving the rest of
+     * the buffer alone.  This is much quicker than refresh() for a
+     * small edit to a long segment.
+     *
+     * Falls back to refresh() if the segment repeats or contains any
+     * events whose mapping depends on other events (ties, grace notes
+     * or triggered segments).
+     *
+     * Returns true if the buffer capacity changed.
+     */
+    virtual bool refreshRange(timeT from, timeT to);
+
 private:
     // Hide copy ctor and op= since dtor is non-trivial.
     InternalSegmentMapper(const InternalSegmentMapper &);
@@ -76,12 +93,19 @@ private:
      */
     ControllerAndPBList getControllers(Instrument *instrument, RealTime start);
 
-    typedef std::pair<timeT, int> Noteoff;
+    /// A pending noteoff, with the source time of the note it ends.
+    struct Noteoff
+    {
+        Noteoff(timeT t, int p, timeT s) : time(t), pitch(p), source(s) { }
+        timeT time;
+        int pitch;
+        timeT source;
+    };
     struct NoteoffCmp
     {
         typedef InternalSegmentMapper::Noteoff Noteoff;
         bool operator()(const Noteoff &e1, const Noteoff &e2) const {
-            return e1.first < e2.first;
+            return e1.time < e2.time;
         }
         bool operator()(const Noteoff *e1, const Noteoff *e2) const {
             return operator()(*e1, *e2);
@@ -115,11 +139,44 @@ private:
     Instrument *getInstrument(void) const
     { return m_channelManager.getInstrument(); }
 
-    void popInsertNoteoff(int trackid, Composition &comp);
-    void enqueueNoteoff(timeT time, int pitch);
+    /// Musical times of a mapped event, kept alongside the buffer.
+    struct EventTimes
+    {
+        /// Performance time, including the segment's delay.
+        timeT start;
+        /// Performance time of the end.  The same as start for noteoffs.
+        timeT end;
+        /// Time of the source Event (plus repeats).  For a noteoff,
+        /// that of the note it ends.
+        timeT source;
+        bool noteOff;
+    };
+
+    void popInsertNoteoff(int trackid, std::vector<MappedEvent> &events);
+    MappedEvent popNoteoff(int trackid, EventTimes &times);
+    void enqueueNoteoff(timeT time, int pitch, timeT source);
 
     bool haveEarlierNoteoff(timeT t);
-    RealTime toRealTime(Composition &comp, timeT t);
+
+    /// Whether an event can be mapped without looking at any others.
+    static bool isIndependent(const Event *e);
+
+    enum MapResult { Mapped, NotMapped, PastRepeatEnd };
+
+    /// Map a single event from segment (which is either m_segment or
+    /// m_triggeredEvents), but don't add it to the buffer.
+    MapResult mapEvent(Segment &segment, Segment::iterator i,
+                       timeT timeForRepeats, timeT repeatEndTime,
+                       TrackId trackId, MappedEvent &e, EventTimes &times);
+
+    /// Set the real times of count events from their musical times.
+    void convertEventTimes(Composition &comp, MappedEvent *events,
+                           const EventTimes *times, int count);
+
+    /// Update the channel interval and start and end times once the
+    /// buffer has been filled or patched.
+    void finishBuffer();
+
     int getControllerValue(timeT searchTime,
                            const std::string eventType,
                            int controllerId);
@@ -137,6 +194,18 @@ private:
 
     // Queue of noteoffs.
     NoteoffContainer       m_noteOffs;
+
+    // Musical times of each event in the buffer, in buffer order.
+    // fillBuffer() converts them to real time all at once when it's
+    // done, and refreshRange() uses them to find the events to replace.
+    std::vector<EventTimes> m_eventTimes;
+
+    // The segment's end marker as of the last fillBuffer().
+    timeT                  m_endMarkerTime;
+
+    // Whether refreshRange() can patch the buffer, as found by the
+    // last fillBuffer().
+    bool                   m_rangeRefreshable;
 };
   
 }
@@ -24,11 +24,29 @@
 #include "sound/MappedEvent.h"
 #include "sound/MappedInserterBase.h"
 
+#include <QThread>
+#include <algorithm>
+
+#include <ostream>
+#include <sys/time.h>
+
 // #define DEBUG_MAPPED_EVENT_BUFFER 1
 
 namespace Rosegarden
 {
 
+// Written by the writer thread, apart from s_readerRetries
+static MappedEventBuffer::ReadStats s_readStats;
+static QAtomicInt s_readerRetries;
+
+static RealTime
+now()
+{
+    struct timeval tv;
+    (void)gettimeofday(&tv, 0);
+    return RealTime::fromTimeval(tv);
+}
+
 MappedEventBuffer::MappedEventBuffer(RosegardenDocument *doc) :
     m_buffer(0),
     m_capacity(0),
@@ -42,8 +60,9 @@ MappedEventBuffer::MappedEventBuffer(RosegardenDocument *doc) :
 
 MappedEventBuffer::~MappedEventBuffer()
 {
-    // Safe even if NULL.
-    delete[] m_buffer;
+    // Safe even if NULL.  No reader can be left, as they share
+    // ownership of us.
+    delete[] getBuffer();
 }
 
 void
@@ -109,20 +128,22 @@ MappedEventBuffer::reserve(int newSize)
 {
     if (newSize <= capacity())  return;
 
-    MappedEvent *oldBuffer = m_buffer;
+    MappedEvent *oldBuffer = getBuffer();
     MappedEvent *newBuffer = new MappedEvent[newSize];
 
     if (oldBuffer) {
         for (int i = 0; i < m_size.fetchAndAddRelaxed(0); ++i) {
-            newBuffer[i] = m_buffer[i];
+            newBuffer[i] = oldBuffer[i];
         }
     }
 
-    {
-        QWriteLocker locker(&m_lock);
-        m_buffer = newBuffer;
-        m_capacity.fetchAndStoreRelease(newSize);
-    }
+    // Publish the new buffer.  Readers entering from now on use it,
+    // but those already in a read section may be holding pointers
+    // into the old one, so wait for them before freeing it.
+    m_buffer.fetchAndStoreOrdered(newBuffer);
+    m_capacity.fetchAndStoreRelease(newSize);
+
+    if (oldBuffer) waitForReaders();
 
 #ifdef DEBUG_MAPPED_EVENT_BUFFER
     SEQUENCER_DEBUG << "MappedEventBuffer::reserve: Resized to " << newSize << " events";
@@ -131,12 +152,104 @@ MappedEventBuffer::reserve(int newSize)
     delete[] oldBuffer;
 }
 
+int
+MappedEventBuffer::enterRead() const
+{
+    // Count ourselves into the current generation.  If reserve()
+    // moved the generation on while we did so, it may already have
+    // checked our slot and not seen us, so try again.
+    for (;;) {
+        int generation = m_generation.fetchAndAddOrdered(0);
+        int slot = generation & 1;
+        m_readers[slot].ref();
+        if (m_generation.fetchAndAddOrdered(0) == generation) return slot;
+        m_readers[slot].deref();
+        s_readerRetries.ref();
+    }
+}
+
+void
+MappedEventBuffer::leaveRead(int slot) const
+{
+    m_readers[slot].deref();
+}
+
+void
+MappedEventBuffer::waitForReaders()
+{
+    ++s_readStats.publications;
+
+    int generation = m_generation.fetchAndAddOrdered(1);
+    QAtomicInt &readers = m_readers[generation & 1];
+
+    if (readers.fetchAndAddOrdered(0) == 0) return;
+
+    // A sequencer read section lasts for one event, so this is short
+    RealTime start = now();
+    while (readers.fetchAndAddOrdered(0) != 0) {
+        QThread::yieldCurrentThread();
+    }
+    RealTime waited = now() - start;
+
+    ++s_readStats.writerWaits;
+    s_readStats.writerWaitTime = s_readStats.writerWaitTime + waited;
+    if (waited > s_readStats.maxWriterWait) {
+        s_readStats.maxWriterWait = waited;
+    }
+
+#ifdef DEBUG_MAPPED_EVENT_BUFFER
+    SEQMAN_DEBUG << "MappedEventBuffer::waitForReaders: waited " << waited;
+#endif
+}
+
+MappedEventBuffer::ReadStats
+MappedEventBuffer::getReadStats()
+{
+    ReadStats stats = s_readStats;
+    stats.readerRetries = s_readerRetries.fetchAndAddRelaxed(0);
+    return stats;
+}
+
+void
+MappedEventBuffer::dumpReadStats(std::ostream &out)
+{
+    ReadStats stats = getReadStats();
+
+    out << "MappedEventBuffer: " << stats.publications
+        << " buffer replacements, " << stats.readerRetries
+        << " reader retries, " << stats.writerWaits
+        << " writer waits (total " << stats.writerWaitTime
+        << ", max " << stats.maxWriterWait << ")" << std::endl;
+}
+
 void
 MappedEventBuffer::resize(int newFill)
 {
     m_size.fetchAndStoreRelaxed(newFill);
 }
 
+void
+MappedEventBuffer::publish(const MappedEvent *events, int count)
+{
+    MappedEvent *oldBuffer = getBuffer();
+    const int newCapacity = std::max(count, capacity());
+    MappedEvent *newBuffer = new MappedEvent[newCapacity];
+
+    for (int i = 0; i < count; ++i) {
+        newBuffer[i] = events[i];
+    }
+
+    // As in reserve().  Readers that still see the old size index the
+    // new buffer safely, as it is at least as big as the old one.
+    m_buffer.fetchAndStoreOrdered(newBuffer);
+    m_capacity.fetchAndStoreRelease(newCapacity);
+    m_size.fetchAndStoreRelease(count);
+
+    if (oldBuffer) waitForReaders();
+
+    delete[] oldBuffer;
+}
+
 void
 MappedEventBuffer::
 mapAnEvent(MappedEvent *e)
@@ -169,6 +282,19 @@ void
 MappedEventBuffer::
 makeReady(MappedInserterBase &/*inserter*/, RealTime /*time*/) {}
 
+    /*** MappedEventBuffer::ReadSection ***/
+
+MappedEventBuffer::ReadSection::ReadSection(const iterator &i) :
+    m_buffer(i.getSegment().data()),
+    m_slot(m_buffer->enterRead())
+{
+}
+
+MappedEventBuffer::ReadSection::~ReadSection()
+{
+    m_buffer->leaveRead(m_slot);
+}
+
     /*** MappedEventBuffer::iterator ***/
 
 MappedEventBuffer::iterator::iterator(QSharedPointer<MappedEventBuffer> s) :
@@ -255,7 +381,7 @@ MappedEventBuffer::iterator::peek() const
         return 0;
 
     // Otherwise return a pointer into the buffer.
-    return &m_s->m_buffer[m_index];
+    return &m_s->m_buffer.fetchAndAddAcquire(0)[m_index];
 }
 
 bool
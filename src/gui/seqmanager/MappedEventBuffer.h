@@ -21,8 +21,10 @@
 #include "base/RealTime.h"
 #include "base/Track.h"
 
-#include <QReadWriteLock>
 #include <QAtomicInt>
+#include <QAtomicPointer>
+
+#include <iosfwd>
 
 namespace Rosegarden
 {
@@ -48,11 +50,12 @@ class RosegardenDocument;
  *
  * Reading and writing may take place simultaneously without locks (we are
  * prepared to accept the lossage from individual mangled MappedEvent
- * reads) but a read/write lock (m_lock) on the buffer space guards
- * against bad
- * access caused by resizes.  [Actually, it doesn't at all since the
- * caller of peek() has a pointer they can access after the lock has
- * been released.  See comments on m_lock below and in iterator::peek().]
+ * reads).  There is one writer, the GUI thread, and the sequencer
+ * reads.  When reserve() replaces the buffer, it publishes the new one
+ * and frees the old one only once every reader that might have seen it
+ * has left its read section, so a reader holding a pointer from
+ * iterator::peek() within a ReadSection never blocks and never sees
+ * the buffer freed under it.  See ReadSection and reserve().
  *
  * MappedEventBuffer only concerns itself with the state of the
  * composition, as opposed to the state of performance.  No matter how
@@ -91,7 +94,7 @@ public:
      *     sort of range checking.  Recommend adding an operator[] and/or an
      *     at() that asserts on range problems.
      */
-    MappedEvent *getBuffer() { return m_buffer; }
+    MappedEvent *getBuffer() { return m_buffer.fetchAndAddRelaxed(0); }
 
     /// Capacity of the buffer in MappedEvent's.  (STL's capacity().)
     /* Was getBufferSize() */
@@ -118,6 +121,17 @@ public:
      */
     void resize(int newFill);
 
+    /// Replaces the contents of the buffer with count events.
+    /**
+     * The events are copied into a new buffer, which is published as
+     * reserve() publishes one, so readers see either the old contents
+     * or the new, never a mixture.  The capacity never shrinks, so a
+     * reader that read the old size can still index the new buffer.
+     *
+     * @see reserve()
+     */
+    void publish(const MappedEvent *events, int count);
+
     /// Refresh the buffer
     /**
      * Called after the segment has been modified.  Resizes the buffer if
@@ -261,8 +275,8 @@ public:
          *
          * Returns 0 if atEnd().
          *
-         * Callers should lock getLock() with QReadLocker for as long
-         * as they are holding the pointer.
+         * Callers should hold a ReadSection for as long as they are
+         * holding the pointer.
          *
          * @see operator*()
          */
@@ -347,10 +361,6 @@ public:
         bool shouldPlay(MappedEvent *evt, RealTime startTime)
         { return m_s->shouldPlay(evt, startTime); }
 
-        // Get a pointer to the MappedEventBuffer's lock.
-        QReadWriteLock* getLock(void) const
-        { return &m_s->m_lock; }
-
     protected:
         /// The buffer this iterator points into.
         QSharedPointer<MappedEventBuffer> m_s;
@@ -385,12 +395,58 @@ public:
         // !!! WARNING !!!
     };
 
-        
+    /// Scope in which a reader may hold pointers into the buffer.
+    /**
+     * Construct one around any use of iterator::peek() from the
+     * sequencer thread.  Entering and leaving are each an atomic
+     * increment or decrement, and never wait for the writer.
+     *
+     * @see reserve()
+     */
+    class ReadSection
+    {
+    public:
+        ReadSection(const iterator &i);
+        ~ReadSection();
+
+    private:
+        const MappedEventBuffer *m_buffer;
+        int m_slot;
+
+        ReadSection(const ReadSection &);
+        ReadSection &operator=(const ReadSection &);
+    };
+
+    /// Counters for the interaction of readers with reserve().
+    struct ReadStats
+    {
+        ReadStats() : publications(0), readerRetries(0), writerWaits(0) { }
+
+        /// Buffers replaced by reserve()
+        int publications;
+        /// Read sections that had to re-enter because a replacement
+        /// happened as they entered
+        int readerRetries;
+        /// Replacements that had to wait for readers before freeing
+        /// the old buffer, and how long they waited
+        int writerWaits;
+        RealTime writerWaitTime;
+        RealTime maxWriterWait;
+    };
+
+    /// Totals across all buffers.
+    static ReadStats getReadStats();
+    static void dumpReadStats(std::ostream &);
+
 protected:
     friend class iterator;
 
     /// The Mapped Event Buffer
-    MappedEvent *m_buffer;
+    /**
+     * Written only by the writer thread.  Readers load it within a
+     * ReadSection.
+     */
+    QAtomicPointer<MappedEvent> m_buffer;
 
     /// Capacity of the buffer.
     mutable QAtomicInt m_capacity;
@@ -398,18 +454,17 @@ protected:
     /// Number of events in the buffer.
     mutable QAtomicInt m_size;
 
-    /// Lock for reserve() and callers to iterator::peek()
+    /// Grace period tracking for reserve() and ReadSection.
     /**
-     * Used by reserve() to lock the swapping of the old for the new
-     * and the changing of the buffer capacity.
-     *
-     * Used by callers to MappedEventBuffer::iterator::peek() to
-     * ensure that buffer isn't reallocated while the caller is
-     * holding the current item.  Doing so avoids the scenario where
-     * peek() gets a pointer to the element and then reserve() swaps
-     * the entire buffer out from under it.
+     * A reader counts itself into m_readers[m_generation & 1].  To
+     * replace the buffer, reserve() publishes the new one, moves
+     * m_generation on, and waits for the count of the previous
+     * generation to drain.  Readers that entered after that only see
+     * the new buffer, so the writer waits for at most the read
+     * sections that were already under way.
      */
-    QReadWriteLock m_lock;
+    mutable QAtomicInt m_generation;
+    mutable QAtomicInt m_readers[2];
 
     /// Not used here.  Convenience for derivers.
     /**
@@ -458,6 +513,13 @@ protected:
     }
 
 private:
+    /// Enter a read section, returning the slot to leave with.
+    int enterRead() const;
+    void leaveRead(int slot) const;
+
+    /// Wait until no reader can still hold the previous buffer.
+    void waitForReaders();
+
     /// Hidden and not implemented as dtor is non-trivial.
     MappedEventBuffer(const MappedEventBuffer &);
     /// Hidden and not implemented as dtor is non-trivial.
@@ -180,6 +180,20 @@ void MetronomeMapper::fillBuffer()
 
     const RealTime tickDuration(0, 100000000);
 
+    // Convert all the tick times to real time in one pass
+    std::vector<timeT> tickTimes;
+    tickTimes.reserve(m_ticks.size());
+    for (TickContainer::const_iterator tick = m_ticks.begin();
+         tick != m_ticks.end();
+         ++tick) {
+        tickTimes.push_back(tick->first);
+    }
+    std::vector<RealTime> tickRealTimes(tickTimes.size());
+    if (!tickTimes.empty()) {
+        composition.getElapsedRealTimes(&tickTimes[0], &tickRealTimes[0],
+                                        tickTimes.size());
+    }
+
     int index = 0;
 
     // For each tick
@@ -189,7 +203,7 @@ void MetronomeMapper::fillBuffer()
 
         //RG_DEBUG << "fillBuffer(): velocity = " << int(velocity);
 
-        RealTime eventTime = composition.getElapsedRealTime(tick->first);
+        const RealTime &eventTime = tickRealTimes[index];
 
         MappedEvent e;
 
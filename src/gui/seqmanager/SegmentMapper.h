@@ -42,6 +42,14 @@ public:
 
     virtual void initSpecial(void);
 
+    /// Refresh after a change to the segment between from and to.
+    /**
+     * By default this refreshes the whole buffer.  Mappers that can
+     * do better override it.  Returns true if the buffer size changed.
+     */
+    virtual bool refreshRange(timeT /*from*/, timeT /*to*/)
+        { return refresh(); }
+
 protected:
     SegmentMapper(RosegardenDocument *, Segment *);
 
@@ -1450,11 +1450,16 @@ void SequenceManager::refresh()
 
     for (SegmentRefreshMap::iterator i = m_segments.begin();
             i != m_segments.end(); ++i) {
-        // If this Segment needs a refresh
-        if (i->first->getRefreshStatus(i->second).needsRefresh() ||
-                ridset.find(i->first->getRuntimeId()) != ridset.end()) {
+        SegmentRefreshStatus &status = i->first->getRefreshStatus(i->second);
+
+        // If a trigger Segment it uses has changed, remap all of it
+        if (ridset.find(i->first->getRuntimeId()) != ridset.end()) {
             segmentModified(i->first);
-            i->first->getRefreshStatus(i->second).setNeedsRefresh(false);
+            status.setNeedsRefresh(false);
+        } else if (status.needsRefresh()) {
+            // Otherwise just the part that has changed
+            segmentModified(i->first, status.from(), status.to());
+            status.setNeedsRefresh(false);
         }
     }
 
@@ -1480,6 +1485,21 @@ SequenceManager::segmentModified(Segment* s)
         (m_compositionMapper->getMappedEventBuffer(s));
 }
 
+void
+SequenceManager::segmentModified(Segment *s, timeT from, timeT to)
+{
+    SEQMAN_DEBUG << "SequenceManager::segmentModified(" << s << ", "
+                 << from << ", " << to << ")";
+
+    bool sizeChanged = m_compositionMapper->segmentModified(s, from, to);
+
+    SEQMAN_DEBUG << "SequenceManager::segmentModified() : size changed = "
+                 << sizeChanged;
+
+    RosegardenSequencer::getInstance()->segmentModified
+        (m_compositionMapper->getMappedEventBuffer(s));
+}
+
 void SequenceManager::segmentAdded(const Composition*, Segment* s)
 {
     SEQMAN_DEBUG << "SequenceManager::segmentAdded(" << s
@@ -382,6 +382,8 @@ private:
     void segmentAdded(Segment *);
     /// Inform CompositionMapper and RosegardenSequencer that a Segment has changed.
     void segmentModified(Segment *);
+    /// As above, for a change between the given times only.
+    void segmentModified(Segment *, timeT from, timeT to);
     /**
      * Remove Segment from CompositionMapper, RosegardenSequencer, and the
      * SegmentRefreshMap (m_segments).
@@ -0,0 +1,158 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#define RG_MODULE_STRING "[JobPool]"
+
+#include "JobPool.h"
+
+#include <QMutexLocker>
+#include <QThread>
+
+#include <algorithm>
+
+namespace Rosegarden
+{
+
+
+/// Does the pool's jobs until there are none left.
+class JobPool::Worker : public QThread
+{
+public:
+    Worker(JobPool &pool) : m_pool(pool) { }
+
+protected:
+    virtual void run() { m_pool.runWorker(); }
+
+private:
+    JobPool &m_pool;
+};
+
+JobPool::JobPool(Jobs &jobs, size_t count, int threads, size_t window) :
+    m_jobs(jobs),
+    m_count(count),
+    m_window(window),
+    m_next(0),
+    m_used(0),
+    m_finishedCount(0),
+    m_finished(count, false)
+{
+    for (int i = 0; i < threads; ++i) {
+        m_workers.push_back(new Worker(*this));
+        m_workers.back()->start();
+    }
+}
+
+JobPool::~JobPool()
+{
+    // Let any workers held back by the window go on to the end
+    setUsed(m_count);
+
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        m_workers[i]->wait();
+        delete m_workers[i];
+    }
+}
+
+void
+JobPool::runWorker()
+{
+    while (true) {
+        size_t n = 0;
+
+        {
+            QMutexLocker locker(&m_mutex);
+            while (m_window > 0 && m_next < m_count &&
+                   m_next >= m_used + m_window) {
+                m_jobUsed.wait(&m_mutex);
+            }
+            if (m_next == m_count)
+                return;
+            n = m_next++;
+        }
+
+        m_jobs.run(n);
+
+        QMutexLocker locker(&m_mutex);
+
+        m_finished[n] = true;
+        ++m_finishedCount;
+
+        m_jobFinished.wakeAll();
+    }
+}
+
+size_t
+JobPool::getFinishedCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_finishedCount;
+}
+
+bool
+JobPool::isFinished(size_t n) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_finished[n];
+}
+
+size_t
+JobPool::waitForFinished(size_t count, unsigned long ms)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_finishedCount <= count) {
+        m_jobFinished.wait(&m_mutex, ms);
+    }
+    return m_finishedCount;
+}
+
+bool
+JobPool::waitFor(size_t from, size_t to, unsigned long ms)
+{
+    QMutexLocker locker(&m_mutex);
+
+    while (true) {
+        bool finished = true;
+        for (size_t n = from; n < to; ++n) {
+            if (!m_finished[n]) finished = false;
+        }
+        if (finished)
+            return true;
+        if (!m_jobFinished.wait(&m_mutex, ms))
+            return false;
+    }
+}
+
+void
+JobPool::setUsed(size_t n)
+{
+    QMutexLocker locker(&m_mutex);
+    m_used = std::max(m_used, n);
+    m_jobUsed.wakeAll();
+}
+
+int
+JobPool::getThreadCount(int requested, int most)
+{
+    if (requested > 0)
+        return requested;
+
+    // idealThreadCount() is -1 if it can't tell
+    return std::max(1, std::min(QThread::idealThreadCount(), most));
+}
+
+
+}
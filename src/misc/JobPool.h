@@ -0,0 +1,116 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_JOBPOOL_H
+#define RG_JOBPOOL_H
+
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <climits>
+#include <vector>
+#include <stddef.h>
+
+namespace Rosegarden
+{
+
+
+/// Runs numbered jobs on worker threads for the thread that made it.
+/**
+ * For work that the calling thread shares out while it keeps a
+ * progress dialog going, or writes out the results in order.  Workers
+ * take the jobs in order of number.  The jobs keep their own results,
+ * one per job number, which the calling thread may read once
+ * isFinished() or waitFor() says the job is done.
+ *
+ * Cancelling is up to the jobs: the pool runs every one of them.
+ */
+class JobPool
+{
+public:
+    /// The work to share out.
+    class Jobs
+    {
+    public:
+        virtual ~Jobs() { }
+
+        /// Do job n.  Called once for each n, on a worker thread.
+        virtual void run(size_t n) = 0;
+    };
+
+    /// Start threads workers on jobs 0 to count - 1.
+    /**
+     * If window is nonzero, no job is started window or more jobs
+     * beyond the first that setUsed() hasn't been told of, so that
+     * no more than that many results are held at once.
+     */
+    JobPool(Jobs &jobs, size_t count, int threads, size_t window = 0);
+
+    /// Waits for the workers to finish all the jobs.
+    ~JobPool();
+
+    /// How many jobs are finished.
+    size_t getFinishedCount() const;
+
+    bool isFinished(size_t n) const;
+
+    /// Wait until more than count jobs are finished, or until ms
+    /// milliseconds pass without one finishing.  Returns how many are.
+    size_t waitForFinished(size_t count, unsigned long ms);
+
+    /// Wait until jobs from to to - 1 are finished, or until ms
+    /// milliseconds pass without one finishing.  Returns whether they
+    /// are.
+    bool waitFor(size_t from, size_t to, unsigned long ms = ULONG_MAX);
+
+    /// Tell the workers the results of jobs before n have been used.
+    void setUsed(size_t n);
+
+    /// The number of worker threads to use: requested if it is set
+    /// (nonzero), or else one per core, but no more than most.
+    static int getThreadCount(int requested, int most);
+
+private:
+    class Worker;
+    friend class Worker;
+
+    void runWorker();
+
+    Jobs &m_jobs;
+    const size_t m_count;
+    const size_t m_window;
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_jobFinished;
+    QWaitCondition m_jobUsed;
+
+    // All below are guarded by m_mutex
+    size_t m_next;
+    size_t m_used;
+    size_t m_finishedCount;
+    std::vector<bool> m_finished;
+
+    std::vector<Worker *> m_workers;
+
+    JobPool(const JobPool &); // not provided
+    JobPool &operator=(const JobPool &); // not provided
+};
+
+
+}
+
+#endif
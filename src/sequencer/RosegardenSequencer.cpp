@@ -26,8 +26,10 @@
 //#include <unistd.h>
 //#include <errno.h>
 
+#include <QSettings>
 #include <QVector>
 
+#include "misc/ConfigGroups.h"
 #include "misc/Debug.h"
 #include "misc/Strings.h"
 #include "sound/ControlBlock.h"
@@ -35,6 +37,7 @@
 #include "sound/SoundDriverFactory.h"
 #include "sound/MappedInstrument.h"
 #include "sound/MappedEventInserter.h"
+#include "sound/PlayableAudioFile.h"
 #include "base/Profiler.h"
 #include "sound/PluginFactory.h"
 #include "base/Instrument.h"
@@ -43,9 +46,12 @@
 
 #include "gui/application/RosegardenApplication.h"
 #include "gui/application/RosegardenMainWindow.h"
+#include "gui/seqmanager/MappedEventBuffer.h"
 
 #include "rosegarden-version.h"
 
+#include <iostream>
+
 // #define DEBUG_ROSEGARDEN_SEQUENCER
 
 namespace Rosegarden
@@ -74,7 +80,9 @@ RosegardenSequencer::RosegardenSequencer() :
     m_audioMix(0, 60000000),
     m_audioRead(2, 500000000),  // 2.5 secs
     m_audioWrite(4, 0),  // 4.0 secs
-    m_smallFileSize(256),  // 256 kbytes
+    // Decoded small files are kept in a cache of bounded size (see
+    // updateAudioCacheSize()), so this can be large enough for loops
+    m_smallFileSize(2048),  // 2 Mbytes
     m_loopStart(0, 0),
     m_loopEnd(0, 0),
     m_studio(new MappedStudio()),
@@ -102,6 +110,7 @@ RosegardenSequencer::RosegardenSequencer() :
 
     m_driver->setAudioBufferSizes(m_audioMix, m_audioRead, m_audioWrite,
                                   m_smallFileSize);
+    updateAudioCacheSize();
 
     m_driver->setExternalTransportControl(this);
 
@@ -216,6 +225,7 @@ RosegardenSequencer::play(const RealTime &time)
 
     m_driver->setAudioBufferSizes(m_audioMix, m_audioRead, m_audioWrite,
                                   m_smallFileSize);
+    updateAudioCacheSize();
 
     // report
     //
@@ -365,6 +375,9 @@ RosegardenSequencer::stop()
 //    cleanupMmapData();
 
     Profiles::getInstance()->dump();
+#ifndef NO_TIMING
+    MappedEventBuffer::dumpReadStats(std::cerr);
+#endif
 
     incrementTransportToken();
 }
@@ -411,13 +424,13 @@ RosegardenSequencer::jumpTo(const RealTime &pos)
 
         // Now prebuffer as in startPlaying:
 
-        MappedEventList c;
-        fetchEvents(c, m_songPosition, m_songPosition + m_readAhead, true);
+        m_slice.clear();
+        fetchEvents(m_slice, m_songPosition, m_songPosition + m_readAhead, true);
 
         // process whether we need to or not as this also processes
         // the audio queue for us
         //
-        m_driver->processEventsOut(c, m_songPosition, m_songPosition + m_readAhead);
+        m_driver->processEventsOut(m_slice, m_songPosition, m_songPosition + m_readAhead);
     }
 
     incrementTransportToken();
@@ -1144,9 +1157,9 @@ RosegardenSequencer::pullAsynchronousMidiQueue()
 
 
 
-// Get a slice of events from the composition into a MappedEventList.
+// Get a slice of events from the composition into a MappedEventBatch.
 void
-RosegardenSequencer::fetchEvents(MappedEventList &mappedEventList,
+RosegardenSequencer::fetchEvents(MappedEventBatch &mappedEventBatch,
                                     const RealTime &start,
                                     const RealTime &end,
                                     bool firstFetch)
@@ -1156,13 +1169,13 @@ RosegardenSequencer::fetchEvents(MappedEventList &mappedEventList,
     if ( m_transportStatus == STOPPED || m_transportStatus == STOPPING )
         return ;
 
-    getSlice(mappedEventList, start, end, firstFetch);
-    applyLatencyCompensation(mappedEventList);
+    getSlice(mappedEventBatch, start, end, firstFetch);
+    applyLatencyCompensation(mappedEventBatch);
 }
 
 
 void
-RosegardenSequencer::getSlice(MappedEventList &mappedEventList,
+RosegardenSequencer::getSlice(MappedEventBatch &mappedEventBatch,
                                  const RealTime &start,
                                  const RealTime &end,
                                  bool firstFetch)
@@ -1176,7 +1189,7 @@ RosegardenSequencer::getSlice(MappedEventList &mappedEventList,
         m_metaIterator.jumpToTime(start);
     }
 
-    MappedEventInserter inserter(mappedEventList);
+    MappedEventInserter inserter(mappedEventBatch);
 
     m_metaIterator.fetchEvents(inserter, start, end);
 
@@ -1189,14 +1202,14 @@ RosegardenSequencer::getSlice(MappedEventList &mappedEventList,
 
 
 void
-RosegardenSequencer::applyLatencyCompensation(MappedEventList &mappedEventList)
+RosegardenSequencer::applyLatencyCompensation(MappedEventBatch &mappedEventBatch)
 {
     RealTime maxLatency = m_driver->getMaximumPlayLatency();
     if (maxLatency == RealTime::zeroTime)
         return ;
 
-    for (MappedEventList::iterator i = mappedEventList.begin();
-            i != mappedEventList.end(); ++i) {
+    for (MappedEventBatch::iterator i = mappedEventBatch.begin();
+            i != mappedEventBatch.end(); ++i) {
 
         RealTime instrumentLatency =
             m_driver->getInstrumentPlayLatency((*i)->getInstrument());
@@ -1223,12 +1236,12 @@ RosegardenSequencer::startPlaying()
     // ready for new playback
     m_driver->initialisePlayback(m_songPosition);
 
-    MappedEventList c;
-    fetchEvents(c, m_songPosition, m_songPosition + m_readAhead, true);
+    m_slice.clear();
+    fetchEvents(m_slice, m_songPosition, m_songPosition + m_readAhead, true);
 
     // process whether we need to or not as this also processes
     // the audio queue for us
-    m_driver->processEventsOut(c, m_songPosition, m_songPosition + m_readAhead);
+    m_driver->processEventsOut(m_slice, m_songPosition, m_songPosition + m_readAhead);
 
     std::vector<MappedEvent> audioEvents;
     m_metaIterator.getAudioEvents(audioEvents);
@@ -1250,20 +1263,20 @@ RosegardenSequencer::keepPlaying()
 {
     Profiler profiler("RosegardenSequencer::keepPlaying");
 
-    MappedEventList c;
+    m_slice.clear();
 
     RealTime fetchEnd = m_songPosition + m_readAhead;
     if (isLooping() && fetchEnd >= m_loopEnd) {
         fetchEnd = m_loopEnd - RealTime(0, 1);
     }
     if (fetchEnd > m_lastFetchSongPosition) {
-        fetchEvents(c, m_lastFetchSongPosition, fetchEnd, false);
+        fetchEvents(m_slice, m_lastFetchSongPosition, fetchEnd, false);
     }
 
     // Again, process whether we need to or not to keep
     // the Sequencer up-to-date with audio events
     //
-    m_driver->processEventsOut(c, m_lastFetchSongPosition, fetchEnd);
+    m_driver->processEventsOut(m_slice, m_lastFetchSongPosition, fetchEnd);
 
     if (fetchEnd > m_lastFetchSongPosition) {
         m_lastFetchSongPosition = fetchEnd;
@@ -1308,10 +1321,10 @@ RosegardenSequencer::updateClocks()
         //
         m_driver->resetPlayback(oldPosition, m_songPosition);
 
-        MappedEventList c;
-        fetchEvents(c, m_songPosition, m_songPosition + m_readAhead, true);
+        m_slice.clear();
+        fetchEvents(m_slice, m_songPosition, m_songPosition + m_readAhead, true);
 
-        m_driver->processEventsOut(c, m_songPosition, m_songPosition + m_readAhead);
+        m_driver->processEventsOut(m_slice, m_songPosition, m_songPosition + m_readAhead);
 
         m_driver->startClocks();
     } else {
@@ -1569,6 +1582,24 @@ RosegardenSequencer::incrementTransportToken()
 #endif
 }
 
+void
+RosegardenSequencer::updateAudioCacheSize()
+{
+    QSettings settings;
+    settings.beginGroup(SequencerOptionsConfigGroup);
+    // In Mbytes
+    int cacheSize = settings.value("audiocachesize", 128).toInt();
+    settings.endGroup();
+
+    if (cacheSize < 0) cacheSize = 0;
+
+    PlayableAudioFile::setSmallFileCacheBudget(size_t(cacheSize) * 1024 * 1024);
+
+#ifdef DEBUG_ROSEGARDEN_SEQUENCER
+    PlayableAudioFile::getSmallFileCache().dumpStats(std::cerr);
+#endif
+}
+
 void
 RosegardenSequencer::slotControlChange(Instrument *instrument, int cc)
 {
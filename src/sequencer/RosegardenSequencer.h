@@ -18,6 +18,7 @@
 #include "gui/application/TransportStatus.h"
 
 #include "sound/MappedEventList.h"
+#include "sound/MappedEventBatch.h"
 #include "sound/MappedStudio.h"
 #include "sound/ExternalTransport.h"
 #include "sound/MappedBufMetaIterator.h"
@@ -450,23 +451,26 @@ private:
     RosegardenSequencer();
 
     /// get events whilst handling loop
-    void fetchEvents(MappedEventList &mappedEventList,
+    void fetchEvents(MappedEventBatch &mappedEventBatch,
                      const RealTime &start,
                      const RealTime &end,
                      bool firstFetch);
 
     /// just get a slice of events between markers
-    void getSlice(MappedEventList &mappedEventList,
+    void getSlice(MappedEventBatch &mappedEventBatch,
                   const RealTime &start,
                   const RealTime &end,
                   bool firstFetch);
 
     /// adjust event times according to relative instrument latencies
-    void applyLatencyCompensation(MappedEventList &);
+    void applyLatencyCompensation(MappedEventBatch &);
 
     void rationalisePlayingAudio();
     void incrementTransportToken();
 
+    /// Apply the audio cache size from the audio settings.
+    void updateAudioCacheSize();
+
     //--------------- Data members ---------------------------------
 
     SoundDriver *m_driver;
@@ -504,6 +508,13 @@ private:
     MappedBufMetaIterator m_metaIterator;
     RealTime m_lastStartTime;
 
+    /// The events of the slice being played.
+    /**
+     * Reused from slice to slice so that fetching and sending out
+     * events doesn't allocate.
+     */
+    MappedEventBatch m_slice;
+
     /**
      * m_asyncOutQueue is not a MappedEventList: order of receipt
      * matters in ordering, timestamp doesn't
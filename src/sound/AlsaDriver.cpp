@@ -3501,6 +3501,15 @@ void
 AlsaDriver::processMidiOut(const MappedEventList &mC,
                            const RealTime &sliceStart,
                            const RealTime &sliceEnd)
+{
+    processMidiOutImpl(mC, sliceStart, sliceEnd);
+}
+
+template <class EventContainer>
+void
+AlsaDriver::processMidiOutImpl(const EventContainer &mC,
+                               const RealTime &sliceStart,
+                               const RealTime &sliceEnd)
 {
     LOCKED;
 
@@ -3532,14 +3541,16 @@ AlsaDriver::processMidiOut(const MappedEventList &mC,
     // hard to follow.
     std::string sysExData;
 
-    // NB the MappedEventList is implicitly ordered by time (std::multiset)
+    // NB the events are ordered by time (see MappedEventList and
+    // MappedEventBatch)
 
     // For each incoming mapped event
     // ??? "i" is a bit hard to follow in this huge 400-line loop.  How about
     //     we dereference it at the top and never use "(*i)" again:
     //       const MappedEvent *mappedEvent = (*i);
     //     Might shave off a CPU cycle or two as a bonus.
-    for (MappedEventList::const_iterator i = mC.begin(); i != mC.end(); ++i) {
+    for (typename EventContainer::const_iterator i = mC.begin();
+         i != mC.end(); ++i) {
         // Skip all non-MIDI events.
         if ((*i)->getType() >= MappedEvent::Audio)
             continue;
@@ -3800,7 +3811,8 @@ AlsaDriver::processMidiOut(const MappedEventList &mC,
                 sprintf(out, "%c", MIDI_SYSTEM_EXCLUSIVE);
                 sysExData = out;
 
-                sysExData += DataBlockRepository::getDataBlockForEvent((*i));
+                DataBlock block = DataBlockRepository::getBlockForEvent(*i);
+                sysExData.append(block.data(), block.size());
 
                 sprintf(out, "%c", MIDI_END_OF_EXCLUSIVE);
                 sysExData += out;
@@ -4157,6 +4169,23 @@ void
 AlsaDriver::processEventsOut(const MappedEventList &mC,
                              const RealTime &sliceStart,
                              const RealTime &sliceEnd)
+{
+    processEventsOutImpl(mC, sliceStart, sliceEnd);
+}
+
+void
+AlsaDriver::processEventsOut(const MappedEventBatch &batch,
+                             const RealTime &sliceStart,
+                             const RealTime &sliceEnd)
+{
+    processEventsOutImpl(batch, sliceStart, sliceEnd);
+}
+
+template <class EventContainer>
+void
+AlsaDriver::processEventsOutImpl(const EventContainer &mC,
+                                 const RealTime &sliceStart,
+                                 const RealTime &sliceEnd)
 {
     // special case for unqueued events
     bool now = (sliceStart == RealTime::zeroTime && sliceEnd == RealTime::zeroTime);
@@ -4180,7 +4209,8 @@ AlsaDriver::processEventsOut(const MappedEventList &mC,
     bool haveNewAudio = false;
 
     // For each incoming event, insert audio events if we find them
-    for (MappedEventList::const_iterator i = mC.begin(); i != mC.end(); ++i) {
+    for (typename EventContainer::const_iterator i = mC.begin();
+         i != mC.end(); ++i) {
 #ifdef HAVE_LIBJACK
 
         // Play an audio file
@@ -4245,7 +4275,8 @@ AlsaDriver::processEventsOut(const MappedEventList &mC,
                                                 bufferFrames,
                                                 getSmallFileSize() * 1024,
                                                 channels,
-                                                m_jackDriver->getSampleRate());
+                                                m_jackDriver->getSampleRate(),
+                                                (*i)->getStretchRatio());
                 } catch (...) {
                     continue;
                 }
@@ -4509,7 +4540,7 @@ AlsaDriver::processEventsOut(const MappedEventList &mC,
 
     // Process Midi and Audio
     //
-    processMidiOut(mC, sliceStart, sliceEnd);
+    processMidiOutImpl(mC, sliceStart, sliceEnd);
 
 #ifdef HAVE_LIBJACK
     if (m_jackDriver) {
@@ -94,6 +94,14 @@ public:
     virtual void processEventsOut(const MappedEventList &mC,
                                   const RealTime &sliceStart,
                                   const RealTime &sliceEnd);
+    /// Send a playback slice out, queued
+    /**
+     * The same as the above, for the MappedEventBatch that
+     * RosegardenSequencer fills for each slice.
+     */
+    virtual void processEventsOut(const MappedEventBatch &batch,
+                                  const RealTime &sliceStart,
+                                  const RealTime &sliceEnd);
 
     // Return the sample rate
     //
@@ -441,6 +449,20 @@ protected:
                                 const RealTime &sliceStart,
                                 const RealTime &sliceEnd);
 
+    /// The bodies of processEventsOut() and processMidiOut().
+    /**
+     * EventContainer is MappedEventList or MappedEventBatch.  Both
+     * iterate over MappedEvent pointers in time order.
+     */
+    template <class EventContainer>
+    void processEventsOutImpl(const EventContainer &mC,
+                              const RealTime &sliceStart,
+                              const RealTime &sliceEnd);
+    template <class EventContainer>
+    void processMidiOutImpl(const EventContainer &mC,
+                            const RealTime &sliceStart,
+                            const RealTime &sliceEnd);
+
     virtual void processSoftSynthEventOut(InstrumentId id,
                                           const snd_seq_event_t *event,
                                           bool now);
@@ -18,91 +18,306 @@
 #include "AudioCache.h"
 #include "misc/Debug.h"
 
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <vector>
+
+#include <sys/stat.h>
+
 //#define DEBUG_AUDIO_CACHE 1
 
 namespace Rosegarden
 {
 
+const size_t AudioCache::DefaultBudget = 128 * 1024 * 1024;
+
+struct AudioCache::CacheRec
+{
+    CacheRec(float **d, size_t c, size_t n) :
+        data(d), channels(c), nframes(n), refCount(1), lastUsed(0) { }
+    ~CacheRec();
+
+    float **data;
+    size_t channels;
+    size_t nframes;
+
+    /// Only taken up from zero with m_mutex held, so evict() can
+    /// delete data it finds at zero
+    QAtomicInt refCount;
+
+    /// m_clock when last released
+    QAtomicInt lastUsed;
+
+    size_t getBytes() const { return channels * nframes * sizeof(float); }
+};
+
+bool
+AudioCache::Key::operator<(const Key &other) const
+{
+    if (fileId != other.fileId) return fileId < other.fileId;
+    if (sampleRate != other.sampleRate) return sampleRate < other.sampleRate;
+    if (fileSize != other.fileSize) return fileSize < other.fileSize;
+    if (modified != other.modified) return modified < other.modified;
+    return fileName < other.fileName;
+}
+
+AudioCache::Key
+AudioCache::Key::forFile(unsigned int id, unsigned int rate,
+                         const QString &name)
+{
+    struct stat st;
+    if (stat(name.toLocal8Bit().data(), &st) != 0) {
+        return Key(id, rate, name);
+    }
+    return Key(id, rate, name, st.st_size, st.st_mtime);
+}
+
+AudioCache::AudioCache(size_t budget) :
+    m_clock(0),
+    m_budget(budget),
+    m_bytes(0),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0),
+    m_evictedBytes(0)
+{
+}
+
 AudioCache::~AudioCache()
 {
     clear();
 }
 
 bool
-AudioCache::has(void *index)
+AudioCache::has(const Key &key)
 {
-    return m_cache.find(index) != m_cache.end();
+    QMutexLocker locker(&m_mutex);
+    return m_cache.find(key) != m_cache.end();
 }
 
 float **
-AudioCache::getData(void *index, size_t &channels, size_t &frames)
+AudioCache::getData(const Key &key, size_t &channels, size_t &frames)
 {
-    if (m_cache.find(index) == m_cache.end())
+    QMutexLocker locker(&m_mutex);
+
+    CacheMap::iterator i = m_cache.find(key);
+    if (i == m_cache.end())
         return 0;
-    CacheRec *rec = m_cache[index];
+    CacheRec *rec = i->second;
     channels = rec->channels;
     frames = rec->nframes;
     return rec->data;
 }
 
-void
-AudioCache::addData(void *index, size_t channels, size_t nframes, float **data)
+AudioCache::Reference
+AudioCache::addData(const Key &key, size_t channels, size_t nframes,
+                    float **data)
 {
 #ifdef DEBUG_AUDIO_CACHE
-    RG_DEBUG << "AudioCache::addData(" << index << ")";
+    RG_DEBUG << "AudioCache::addData(" << key.fileId << ", " << key.sampleRate << ")";
 #endif
 
-    if (m_cache.find(index) != m_cache.end()) {
-        RG_WARNING << "WARNING: AudioCache::addData(" << index << ", "
-        << channels << ", " << nframes
-        << ": already cached";
-        return ;
+    QMutexLocker locker(&m_mutex);
+
+    dropStale(key);
+
+    CacheMap::iterator i = m_cache.find(key);
+
+    if (i != m_cache.end()) {
+#ifdef DEBUG_AUDIO_CACHE
+        RG_DEBUG << "AudioCache::addData(" << key.fileId << ", "
+                 << key.sampleRate << "): already cached, sharing it";
+#endif
+        // We own the duplicate: this frees it on return
+        CacheRec duplicate(data, channels, nframes);
+        i->second->refCount.ref();
+        return i->second;
     }
 
-    m_cache[index] = new CacheRec(data, channels, nframes);
+    CacheRec *rec = new CacheRec(data, channels, nframes);
+    m_cache[key] = rec;
+    m_bytes += rec->getBytes();
+
+    evict();
+
+    return rec;
 }
 
 void
-AudioCache::incrementReference(void *index)
+AudioCache::dropStale(const Key &key)
 {
-    if (m_cache.find(index) == m_cache.end()) {
-        RG_WARNING << "WARNING: AudioCache::incrementReference(" << index
-        << "): not found";
-        return ;
-    }
-    ++m_cache[index]->refCount;
+    // Called with m_mutex held
+
+    // Entries for the same id and rate are together, ordered by size
+    // and modification time
+    CacheMap::iterator i = m_cache.lower_bound
+        (Key(key.fileId, key.sampleRate, QString()));
+
+    while (i != m_cache.end() &&
+           i->first.fileId == key.fileId &&
+           i->first.sampleRate == key.sampleRate) {
+
+        CacheMap::iterator j = i++;
+
+        // Data still playing stays until it is released, and is then
+        // left for evict()
+        if (j->first.fileName != key.fileName ||
+            (j->first.fileSize == key.fileSize &&
+             j->first.modified == key.modified) ||
+            j->second->refCount.fetchAndAddAcquire(0) > 0) continue;
 
 #ifdef DEBUG_AUDIO_CACHE
-    RG_DEBUG << "AudioCache::incrementReference(" << index << ") [to " << (m_cache[index]->refCount) << "]";
+        RG_DEBUG << "AudioCache::dropStale: dropping old data for"
+                 << key.fileName;
 #endif
+
+        m_bytes -= j->second->getBytes();
+        delete j->second;
+        m_cache.erase(j);
+    }
 }
 
-void
-AudioCache::decrementReference(void *index)
+AudioCache::Reference
+AudioCache::incrementReference(const Key &key)
 {
-    std::map<void *, CacheRec *>::iterator i = m_cache.find(index);
+    QMutexLocker locker(&m_mutex);
+
+    CacheMap::iterator i = m_cache.find(key);
 
     if (i == m_cache.end()) {
-        RG_WARNING << "WARNING: AudioCache::decrementReference(" << index
-        << "): not found";
-        return ;
+        ++m_misses;
+        return 0;
     }
-    if (i->second->refCount <= 1) {
-        delete i->second;
-        m_cache.erase(i);
+
+    ++m_hits;
+
+    CacheRec *rec = i->second;
+    rec->refCount.ref();
+
 #ifdef DEBUG_AUDIO_CACHE
-        RG_DEBUG << "AudioCache::decrementReference(" << index << ") [deleting]";
+    RG_DEBUG << "AudioCache::incrementReference(" << key.fileId << ") [to " << rec->refCount.fetchAndAddRelaxed(0) << "]";
 #endif
 
-    } else {
-        --i->second->refCount;
+    return rec;
+}
+
+void
+AudioCache::decrementReference(Reference rec)
+{
+    if (!rec) return;
+
+    if (rec->refCount.fetchAndAddRelaxed(0) <= 0) {
+        RG_WARNING << "WARNING: AudioCache::decrementReference: not referenced";
+        return ;
+    }
+
+    // Stamp it as the most recently used before letting go, as once
+    // the count is zero evict() may delete it
+    rec->lastUsed.fetchAndStoreRelaxed(m_clock.fetchAndAddRelaxed(1) + 1);
+    rec->refCount.deref();
+}
+
+void
+AudioCache::setBudget(size_t bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_budget = bytes;
+    evict();
+}
+
+size_t
+AudioCache::getBudget() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_budget;
+}
+
+void
+AudioCache::purge()
+{
+    QMutexLocker locker(&m_mutex);
+    evict();
+}
+
+namespace
+{
+typedef std::pair<int, std::map<AudioCache::Key, AudioCache::CacheRec *>
+                  ::iterator> Candidate;
+
+bool earlier(const Candidate &a, const Candidate &b)
+{
+    return a.first < b.first;
+}
+}
+
+void
+AudioCache::evict()
+{
+    // Called with m_mutex held
+
+    if (m_bytes <= m_budget) return;
+
+    // Unreferenced data, least recently used first
+    std::vector<Candidate> candidates;
+    for (CacheMap::iterator i = m_cache.begin(); i != m_cache.end(); ++i) {
+        if (i->second->refCount.fetchAndAddAcquire(0) == 0) {
+            candidates.push_back
+                (Candidate(i->second->lastUsed.fetchAndAddRelaxed(0), i));
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), earlier);
+
+    for (size_t c = 0; c < candidates.size() && m_bytes > m_budget; ++c) {
+
+        CacheMap::iterator i = candidates[c].second;
+
+        size_t bytes = i->second->getBytes();
+
 #ifdef DEBUG_AUDIO_CACHE
-        RG_DEBUG << "AudioCache::decrementReference(" << index << ") [to " << (m_cache[index]->refCount) << "]";
+        RG_DEBUG << "AudioCache::evict: evicting" << i->first.fileName
+                 << "(" << bytes << "bytes)";
 #endif
 
+        m_bytes -= bytes;
+        ++m_evictions;
+        m_evictedBytes += bytes;
+
+        delete i->second;
+        m_cache.erase(i);
     }
 }
 
+AudioCache::Stats
+AudioCache::getStats() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    Stats stats;
+    stats.entries = m_cache.size();
+    for (CacheMap::const_iterator i = m_cache.begin();
+         i != m_cache.end(); ++i) {
+        if (i->second->refCount.fetchAndAddRelaxed(0) > 0) ++stats.pinned;
+    }
+    stats.bytes = m_bytes;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.evictions = m_evictions;
+    stats.evictedBytes = m_evictedBytes;
+    return stats;
+}
+
+void
+AudioCache::dumpStats(std::ostream &out) const
+{
+    Stats stats = getStats();
+    out << "AudioCache: " << stats.entries << " files ("
+        << stats.pinned << " playing), " << stats.bytes << " of "
+        << getBudget() << " bytes; " << stats.hits << " hits, "
+        << stats.misses << " misses, " << stats.evictions
+        << " evictions (" << stats.evictedBytes << " bytes)" << std::endl;
+}
+
 void
 AudioCache::clear()
 {
@@ -110,13 +325,17 @@ AudioCache::clear()
     RG_DEBUG << "AudioCache::clear()";
 #endif
 
-    for (std::map<void *, CacheRec *>::iterator i = m_cache.begin();
-            i != m_cache.end(); ++i) {
-        if (i->second->refCount > 0) {
-            RG_WARNING << "WARNING: AudioCache::clear: deleting cached data with refCount " << i->second->refCount;
+    QMutexLocker locker(&m_mutex);
+
+    for (CacheMap::iterator i = m_cache.begin(); i != m_cache.end(); ++i) {
+        int refCount = i->second->refCount.fetchAndAddRelaxed(0);
+        if (refCount > 0) {
+            RG_WARNING << "WARNING: AudioCache::clear: deleting cached data with refCount " << refCount;
         }
+        delete i->second;
     }
     m_cache.clear();
+    m_bytes = 0;
 }
 
 AudioCache::CacheRec::~CacheRec()
@@ -127,5 +346,3 @@ AudioCache::CacheRec::~CacheRec()
 }
 
 }
-
-
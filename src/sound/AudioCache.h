@@ -16,29 +16,82 @@
 #ifndef RG_AUDIO_CACHE_H
 #define RG_AUDIO_CACHE_H
 
+#include <QAtomicInt>
+#include <QMutex>
+#include <QString>
+
 #include <map>
+#include <ostream>
 #include <stddef.h>
 
 namespace Rosegarden
 {
 
 /**
- * A simple cache for smallish bits of audio data, indexed by some
- * opaque pointer type.  (The PlayableAudioFile uses this with an
- * AudioFile* index type, for example.)  With reference counting.
+ * A cache for smallish bits of decoded audio data, indexed by the
+ * file the audio came from and the sample rate it was decoded at.
+ * (The PlayableAudioFile uses this to hold small files in memory.)
+ *
+ * Data is reference counted, and referenced data is pinned: it stays
+ * in the cache for as long as anything is playing it.  Unreferenced
+ * data is kept too, so that files played over and over (drum loops,
+ * say) needn't be read and decoded again each time, but only while
+ * the total size of the cache is within its budget.  Beyond that,
+ * the least recently used unreferenced data is evicted first.
+ *
+ * All functions are thread safe.  All but decrementReference take a
+ * lock: callers on an RT thread should keep the pointer returned from
+ * getData rather than looking it up again, which is safe for as long
+ * as they hold their reference.  decrementReference never locks or
+ * frees anything, so that a file can stop playing on any thread;
+ * data it leaves unreferenced is evicted later, by addData, setBudget
+ * or purge, as needed to keep within the budget.
  */
 
 class AudioCache
 {
 public:
-    AudioCache() { }
+    /**
+     * What cached data is indexed by.  The file name is there as well
+     * as the id, as ids are only unique within a document, and the
+     * file's size and modification time so that a file rewritten
+     * since it was cached (a take recorded again, say) misses.
+     */
+    struct Key {
+        Key() : fileId(0), sampleRate(0), fileSize(0), modified(0) { }
+        Key(unsigned int id, unsigned int rate, const QString &name,
+            unsigned long long size = 0, long long mtime = 0) :
+            fileId(id), sampleRate(rate), fileName(name),
+            fileSize(size), modified(mtime) { }
+
+        /// The key for a file as it is on disk now.
+        static Key forFile(unsigned int id, unsigned int rate,
+                           const QString &name);
+
+        unsigned int fileId;
+        unsigned int sampleRate;
+        QString fileName;
+        unsigned long long fileSize;
+        long long modified;
+        bool operator<(const Key &other) const;
+    };
+
+    struct CacheRec;
+
+    /// A reference to cached data, as returned by incrementReference
+    /// and addData, to give back to decrementReference.
+    typedef CacheRec *Reference;
+
+    static const size_t DefaultBudget; // bytes
+
+    AudioCache(size_t budget = DefaultBudget);
     virtual ~AudioCache();
 
     /**
      * Look some audio data up in the cache and report whether it
      * exists.
      */
-    bool has(void *index);
+    bool has(const Key &key);
 
     /**
      * Look some audio data up in the cache and return it if it
@@ -50,42 +103,97 @@ public:
      * you have already called incrementReference (or addData) to
      * register your interest.
      */
-    float **getData(void *index, size_t &channels, size_t &frames);
+    float **getData(const Key &key, size_t &channels, size_t &frames);
 
     /**
      * Add a piece of data to the cache, and increment the reference
-     * count for that data (to 1).  Ownership of the data is passed
-     * to the cache, which will delete it with delete[] when done.
+     * count for that data (to 1), returning the reference.  Ownership
+     * of the data is passed to the cache, which will delete it with
+     * delete[] when done.  If the same data has been added meanwhile
+     * (by another reader that missed the cache at the same time) the
+     * given data is deleted at once and a reference to the existing
+     * data taken instead, so use getData for the pointer to play
+     * from.  Evicts unreferenced data if the cache is over budget.
+     */
+    Reference addData(const Key &key, size_t channels, size_t nframes,
+                      float **data);
+
+    /**
+     * Increment the reference count for a given piece of data, if it
+     * is in the cache, returning the reference.  Returns 0 (and
+     * counts a miss) if not.
      */
-    void addData(void *index, size_t channels, size_t nframes, float **data);
+    Reference incrementReference(const Key &key);
 
     /**
-     * Increment the reference count for a given piece of data.
+     * Decrement the reference count for a piece of data.  Data whose
+     * reference count reaches zero remains in the cache until it is
+     * evicted to keep the cache within its budget, by a later call
+     * to addData, setBudget or purge.  Lock-free.
      */
-    void incrementReference(void *index);
+    void decrementReference(Reference reference);
 
     /**
-     * Decrement the reference count for a given piece of data,
-     * and delete the data from the cache if the reference count has
-     * reached zero.
+     * Set the number of bytes of sample data the cache may hold,
+     * evicting unreferenced data at once if it is now over.
+     * Referenced data is never evicted, so the cache may exceed its
+     * budget while files are playing.
      */
-    void decrementReference(void *index);
+    void setBudget(size_t bytes);
+    size_t getBudget() const;
+
+    /**
+     * Evict unreferenced data, least recently used first, until the
+     * cache is within its budget.  Call from a non-RT thread from
+     * time to time, as data released since the last addData or
+     * setBudget may have left it over.
+     */
+    void purge();
+
+    struct Stats {
+        Stats() : entries(0), pinned(0), bytes(0), hits(0), misses(0),
+                  evictions(0), evictedBytes(0) { }
+        size_t entries;         // pieces of data in the cache
+        size_t pinned;          // of which referenced
+        size_t bytes;           // total size of the sample data
+        size_t hits;            // incrementReference calls that found data
+        size_t misses;          // and that didn't
+        size_t evictions;       // unreferenced data evicted for the budget
+        size_t evictedBytes;
+    };
+
+    Stats getStats() const;
+    void dumpStats(std::ostream &) const;
 
 protected:
     void clear();
 
-    struct CacheRec {
-        CacheRec() : data(0), channels(0), nframes(0), refCount(0) { }
-        CacheRec(float **d, size_t c, size_t n) :
-            data(d), channels(c), nframes(n), refCount(1) { }
-        ~CacheRec();
-        float **data;
-        size_t channels;
-        size_t nframes;
-        int refCount;
-    };
+    /// Evict as purge().  Call with m_mutex held.
+    void evict();
+
+    /// Drop unreferenced data for earlier versions of key's file.
+    void dropStale(const Key &key);
+
+    typedef std::map<Key, CacheRec *> CacheMap;
+
+    CacheMap m_cache;
+
+    /// Counts releases, to stamp each piece of data with when it was
+    /// last used
+    QAtomicInt m_clock;
+
+    size_t m_budget;
+    size_t m_bytes;
+    size_t m_hits;
+    size_t m_misses;
+    size_t m_evictions;
+    size_t m_evictedBytes;
+
+    mutable QMutex m_mutex;
 
-    std::map<void *, CacheRec *> m_cache;
+private:
+    AudioCache(const AudioCache &); // not provided
+    AudioCache &operator=(const AudioCache &); // not provided
 };
 
 }
@@ -91,6 +91,9 @@ AudioFileManager::AudioFileManager() :
 
     pthread_mutex_init(&audioFileManagerLock, &attr);
 
+    connect(&m_peakManager, SIGNAL(peaksGenerated(AudioFileId)),
+            this, SIGNAL(peaksGenerated(AudioFileId)));
+
     // Set this through the set method so that the tilde gets
     // shaken out.
     //
@@ -880,35 +883,45 @@ AudioFileManager::toXmlString() const
 void
 AudioFileManager::generatePreviews()
 {
-    MutexLock lock (&audioFileManagerLock)
-        ;
+    std::vector<AudioFile *> needPeaks;
+    std::vector<PeakFile *> peakFiles;
 
-    if (m_progressDialog) {
-        // Or should we push this all the way down into PeakFile?
-        m_progressDialog->setLabelText(tr("Generating audio previews..."));
-        m_progressDialog->setRange(0, 100);
-    }
+    {
+        MutexLock lock (&audioFileManagerLock)
+            ;
 
-    m_peakManager.setProgressDialog(m_progressDialog);
+        if (m_progressDialog) {
+            // Or should we push this all the way down into PeakFile?
+            m_progressDialog->setLabelText(tr("Generating audio previews..."));
+            m_progressDialog->setRange(0, 100);
+        }
+
+        m_peakManager.setProgressDialog(m_progressDialog);
 
 #ifdef DEBUG_AUDIOFILEMANAGER
-    RG_DEBUG << "generatePreviews() - for " << m_audioFiles.size() << " files";
+        RG_DEBUG << "generatePreviews() - for " << m_audioFiles.size() << " files";
 #endif
 
+        // Generate peaks if we need to
 
-    // Generate peaks if we need to
-
-    // For each AudioFile
-    for (std::vector<AudioFile *>::const_iterator it = m_audioFiles.begin();
-         it != m_audioFiles.end();
-         ++it) {
-        if (!m_peakManager.hasValidPeaks(*it))
-            m_peakManager.generatePeaks(*it);
+        // For each AudioFile
+        for (std::vector<AudioFile *>::const_iterator it = m_audioFiles.begin();
+             it != m_audioFiles.end();
+             ++it) {
+            if (!m_peakManager.hasValidPeaks(*it))
+                needPeaks.push_back(*it);
+        }
 
-        if (m_progressDialog  &&  m_progressDialog->wasCanceled())
-            break;
+        // Finding the peak files may add to PeakFileManager's list of
+        // them, which getPreview() reads with the lock held
+        peakFiles = m_peakManager.preparePeaks(needPeaks);
     }
 
+    // Without the lock, so that previews of the files that are done
+    // can be read (by AudioPeaksThread) while the rest are generated.
+    // Until then, PeakFileManager treats them as having no peaks.
+    m_peakManager.writePeaks(peakFiles);
+
     // Even if we didn't do anything, reset the progress dialog.
     if (m_progressDialog)
         m_progressDialog->setValue(100);
@@ -934,6 +947,11 @@ AudioFileManager::generatePreview(AudioFileId id)
     if (audioFile == 0)
         return false;
 
+    // A file that has just been recorded has its peaks already, but
+    // hasn't been read yet.
+    if (audioFile->getChannels() == 0)
+        audioFile->open();
+
     if (!m_peakManager.hasValidPeaks(audioFile))
         m_peakManager.generatePeaks(audioFile);
 
@@ -972,6 +990,19 @@ AudioFileManager::getPreview(AudioFileId id,
         return std::vector<float>();
     }
 
+    // A file that is being recorded can't be read yet, but its peaks
+    // are written as it is.
+    if (audioFile->getChannels() == 0  &&
+        m_recordedAudioFiles.find(audioFile) != m_recordedAudioFiles.end()) {
+        return m_peakManager.getRecordingPreview(
+                audioFile,
+                RosegardenSequencer::getInstance()->getSampleRate(),
+                startTime,
+                endTime,
+                width,
+                withMinima);
+    }
+
     if (!m_peakManager.hasValidPeaks(audioFile)) {
         RG_WARNING << "getPreview(): No peaks for audio file " << audioFile->getFilename();
         throw PeakFileManager::BadPeakFileException(
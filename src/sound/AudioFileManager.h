@@ -181,6 +181,9 @@ public:
     /// Generate previews for all audio files.
     /**
      * Generates preview peak files or peak chunks according to file type.
+     * Files without valid peaks are generated together, on as many
+     * threads as PeakFileManager::generatePeaks() allows, and
+     * peaksGenerated() is emitted as each one is done.
      *
      * throw BadSoundFileException, BadPeakFileException
      */
@@ -278,6 +281,14 @@ public:
     /// Get the last file in the vector - the last created.
     //AudioFile *getLastAudioFile();
 
+signals:
+    /// Emitted when the preview peaks for an audio file have been made.
+    /**
+     * Previews already drawn for the file (e.g. empty ones requested
+     * while its peaks were being generated) are out of date.
+     */
+    void peaksGenerated(AudioFileId);
+
 private:
     /// The audio files we are managing.
     std::vector<AudioFile *> m_audioFiles;
@@ -0,0 +1,229 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#define RG_MODULE_STRING "[AudioFileMapping]"
+
+#include "AudioFileMapping.h"
+
+#include "misc/Debug.h"
+
+#include <QMutexLocker>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+
+//#define DEBUG_AUDIO_FILE_MAPPING 1
+
+namespace Rosegarden
+{
+
+AudioFileMapping::MappingMap AudioFileMapping::m_mappings;
+std::vector<AudioFileMapping *> AudioFileMapping::m_stale;
+QMutex AudioFileMapping::m_mutex;
+
+AudioFileMapping::AudioFileMapping(const QString &fileName) :
+    m_fileName(fileName),
+    m_base(0),
+    m_length(0),
+    m_modified(0),
+    m_data(0),
+    m_dataSize(0),
+    m_refCount(0)
+{
+}
+
+AudioFileMapping::~AudioFileMapping()
+{
+    if (m_base) munmap(m_base, m_length);
+}
+
+AudioFileMapping *
+AudioFileMapping::acquire(const QString &fileName)
+{
+    QMutexLocker locker(&m_mutex);
+
+    MappingMap::iterator i = m_mappings.find(fileName);
+    if (i != m_mappings.end()) {
+        if (i->second->isCurrent()) {
+            i->second->m_refCount.ref();
+            return i->second;
+        }
+        // The file has been rewritten.  Anything still playing the
+        // old mapping keeps it until it lets go.
+#ifdef DEBUG_AUDIO_FILE_MAPPING
+        RG_DEBUG << "acquire():" << fileName << "has changed, remapping";
+#endif
+        m_stale.push_back(i->second);
+        m_mappings.erase(i);
+    }
+
+    purge();
+
+    AudioFileMapping *mapping = new AudioFileMapping(fileName);
+    if (!mapping->map()) {
+        delete mapping;
+        return 0;
+    }
+
+    mapping->m_refCount.fetchAndStoreRelease(1);
+    m_mappings[fileName] = mapping;
+    return mapping;
+}
+
+void
+AudioFileMapping::release(AudioFileMapping *mapping)
+{
+    if (!mapping) return;
+
+    // Only acquire() can take the count back up from zero, and it
+    // holds the mutex while it purges, so we needn't
+    mapping->m_refCount.deref();
+}
+
+void
+AudioFileMapping::purge()
+{
+    for (MappingMap::iterator i = m_mappings.begin();
+         i != m_mappings.end(); ) {
+        MappingMap::iterator j = i++;
+        if (j->second->m_refCount.fetchAndAddAcquire(0) == 0) {
+            delete j->second;
+            m_mappings.erase(j);
+        }
+    }
+
+    for (size_t i = 0; i < m_stale.size(); ) {
+        if (m_stale[i]->m_refCount.fetchAndAddAcquire(0) == 0) {
+            delete m_stale[i];
+            m_stale[i] = m_stale.back();
+            m_stale.pop_back();
+        } else {
+            ++i;
+        }
+    }
+}
+
+bool
+AudioFileMapping::isCurrent() const
+{
+    struct stat st;
+    if (stat(m_fileName.toLocal8Bit().data(), &st) != 0) return false;
+    return (size_t)st.st_size == m_length && st.st_mtime == m_modified;
+}
+
+bool
+AudioFileMapping::map()
+{
+    int fd = ::open(m_fileName.toLocal8Bit().data(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 ||
+        (unsigned long long)st.st_size > (size_t)-1) {
+        ::close(fd);
+        return false;
+    }
+    m_length = st.st_size;
+    m_modified = st.st_mtime;
+
+    m_base = mmap(0, m_length, PROT_READ, MAP_SHARED, fd, 0);
+
+    // The mapping holds its own reference to the file
+    ::close(fd);
+
+    if (m_base == MAP_FAILED) {
+        RG_WARNING << "map(): mmap failed for" << m_fileName;
+        m_base = 0;
+        return false;
+    }
+
+    if (!findDataChunk()) {
+        RG_WARNING << "map(): no data chunk in" << m_fileName;
+        return false;
+    }
+
+    madvise(m_base, m_length, MADV_SEQUENTIAL);
+
+#ifdef DEBUG_AUDIO_FILE_MAPPING
+    RG_DEBUG << "map():" << m_fileName << "mapped," << m_dataSize
+             << "bytes of data at offset"
+             << (m_data - (const unsigned char *)m_base);
+#endif
+
+    return true;
+}
+
+static unsigned int
+getLittleEndian32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+bool
+AudioFileMapping::findDataChunk()
+{
+    const unsigned char *base = (const unsigned char *)m_base;
+
+    if (m_length < 12 ||
+        memcmp(base, "RIFF", 4) != 0 ||
+        memcmp(base + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+
+    size_t pos = 12;
+
+    while (pos + 8 <= m_length) {
+
+        size_t chunkLength = getLittleEndian32(base + pos + 4);
+
+        if (memcmp(base + pos, "data", 4) == 0) {
+            m_data = base + pos + 8;
+            m_dataSize = m_length - (pos + 8);
+            // A file whose header wasn't finished may have a zero or
+            // oversized length: play what is there, as the stream
+            // reader does
+            if (chunkLength > 0 && chunkLength < m_dataSize) {
+                m_dataSize = chunkLength;
+            }
+            return true;
+        }
+
+        // Chunks are padded to an even length
+        pos += 8 + chunkLength + (chunkLength & 1);
+    }
+
+    return false;
+}
+
+void
+AudioFileMapping::willNeed(size_t offset, size_t bytes) const
+{
+    if (offset >= m_dataSize) return;
+    if (bytes > m_dataSize - offset) bytes = m_dataSize - offset;
+
+    // madvise wants a page-aligned start
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+
+    size_t start = (m_data - (const unsigned char *)m_base) + offset;
+    size_t aligned = start - (start % pageSize);
+
+    madvise((char *)m_base + aligned, bytes + (start - aligned),
+            MADV_WILLNEED);
+}
+
+}
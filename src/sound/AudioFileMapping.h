@@ -0,0 +1,108 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_AUDIO_FILE_MAPPING_H
+#define RG_AUDIO_FILE_MAPPING_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QString>
+
+#include <map>
+#include <vector>
+#include <stddef.h>
+#include <time.h>
+
+namespace Rosegarden
+{
+
+/**
+ * A read-only memory mapping of the sample data of a RIFF (WAV or
+ * BWF) audio file, for PlayableAudioFile to decode from directly.
+ *
+ * There is one mapping per file, shared by reference count between
+ * everything playing it.  The file descriptor is closed once the file
+ * is mapped, so playing many takes doesn't hold many files open.  A
+ * file whose size or modification time has changed since it was
+ * mapped gets a new mapping; users of the old one keep it until they
+ * release it.
+ *
+ * release() takes no lock and makes no system calls, so it may be
+ * called from the audio threads.  Mappings nothing is using are
+ * unmapped by the next acquire().
+ *
+ * The mapping is advised for sequential access, and readers call
+ * willNeed() to have the kernel read ahead of the play position.
+ */
+class AudioFileMapping
+{
+public:
+    /**
+     * Map the named file, or share its existing mapping.  Returns 0
+     * if the file can't be mapped or has no data chunk.
+     */
+    static AudioFileMapping *acquire(const QString &fileName);
+
+    /**
+     * Give up a mapping returned by acquire().  The file is unmapped
+     * by a later acquire() once nothing is using it.
+     */
+    static void release(AudioFileMapping *mapping);
+
+    /// The start of the data chunk.
+    const unsigned char *getData() const  { return m_data; }
+
+    /// The size of the data chunk, in bytes.
+    size_t getDataSize() const  { return m_dataSize; }
+
+    /**
+     * Advise the kernel that the given range of the data chunk will be
+     * read soon, so that it can start reading it in.
+     */
+    void willNeed(size_t offset, size_t bytes) const;
+
+private:
+    AudioFileMapping(const QString &fileName);
+    ~AudioFileMapping();
+
+    bool map();
+    bool findDataChunk();
+
+    /// Whether the file on disk is still the one we mapped.
+    bool isCurrent() const;
+
+    /// Unmap everything nothing is using.  Call with m_mutex held.
+    static void purge();
+
+    QString m_fileName;
+    void *m_base;
+    size_t m_length;
+    time_t m_modified;
+    const unsigned char *m_data;
+    size_t m_dataSize;
+    QAtomicInt m_refCount;
+
+    typedef std::map<QString, AudioFileMapping *> MappingMap;
+    static MappingMap m_mappings;
+    /// Mappings of files that have changed, still in use
+    static std::vector<AudioFileMapping *> m_stale;
+    static QMutex m_mutex;
+
+    AudioFileMapping(const AudioFileMapping &); // not provided
+    AudioFileMapping &operator=(const AudioFileMapping &); // not provided
+};
+
+}
+
+#endif
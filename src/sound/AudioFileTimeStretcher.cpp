@@ -21,24 +21,229 @@
 
 #include "AudioTimeStretcher.h"
 #include "AudioFileManager.h"
+#include "AudioFileMapping.h"
+#include "RIFFAudioFile.h"
 #include "WAVAudioFile.h"
-#include "base/RealTime.h"
 #include "misc/Debug.h"
+#include "misc/JobPool.h"
 
 #include <QApplication>
+#include <QAtomicInt>
 #include <QProgressDialog>
 
+#include <algorithm>
+#include <cmath>
 #include <fstream>
-
-#ifdef __FreeBSD__
-#include <stdlib.h>
-#else
-#include <alloca.h>
-#endif
+#include <vector>
 
 namespace Rosegarden {
 
 
+namespace
+{
+
+/// What stretch()'s worker threads share: the source, the decisions
+/// made in the first pass, and the chunks, one job per channel of each.
+struct StretchJobs : public JobPool::Jobs
+{
+    StretchJobs() :
+        data(0), dataStart(0), bits(0), channels(0), bytesPerFrame(0),
+        fileFrames(0), padding(0), end(0), sampleRate(0), ratio(1.f), n1(0),
+        inputBlock(0), outputBlock(0), cancelled(0)
+    { }
+
+    /// Stretch channel n % channels of chunk n / channels.
+    virtual void run(size_t n);
+
+    // The source's sample data, in the mapping.  Or if the source
+    // couldn't be mapped, 0, and each thread reads from its own stream
+    // of the file, from dataStart.
+    const unsigned char *data;
+    QByteArray fileName;
+    std::streamoff dataStart;
+    int bits;
+    int channels;
+    size_t bytesPerFrame;
+    size_t fileFrames;
+
+    // The stretcher's input is the file after this many frames of
+    // silence, and silence after it.  Its output from padding to end
+    // is what's wanted.
+    size_t padding;
+    size_t end;
+
+    int sampleRate;
+    float ratio;
+    size_t n1;
+    size_t inputBlock;
+    size_t outputBlock;
+
+    AudioTimeStretcher::Schedule schedule;
+    /// Where in the output each hop starts: one more than the schedule.
+    std::vector<size_t> hopOutput;
+
+    /// The first hop of each chunk, and where its output is picked up.
+    std::vector<size_t> chunkHops;
+    std::vector<size_t> chunkStarts;
+
+    /// The result of each job.
+    std::vector<std::vector<float> > results;
+
+    QAtomicInt cancelled;
+
+    size_t getChunkEnd(size_t chunk) const {
+        return chunk + 1 < chunkStarts.size() ? chunkStarts[chunk + 1] : end;
+    }
+};
+
+/// Reads the source's sample data for one thread, from the mapping if
+/// there is one, or else as PlayableAudioFile does when it can't map
+/// a file, through a stream.
+class SourceReader
+{
+public:
+    SourceReader(const StretchJobs &jobs) : m_jobs(jobs) {
+        if (!m_jobs.data) {
+            m_file.open(m_jobs.fileName.data(),
+                        std::ios::in | std::ios::binary);
+        }
+    }
+
+    /// Frames [from, to) of the sample data, valid until the next
+    /// call.  Any that can't be read are silent.
+    const unsigned char *getFrames(long from, long to) {
+        if (m_jobs.data) return m_jobs.data + from * m_jobs.bytesPerFrame;
+
+        size_t bytes = (to - from) * m_jobs.bytesPerFrame;
+        m_buffer.resize(bytes);
+        size_t obtained = 0;
+
+        if (m_file.is_open()) {
+            m_file.clear();
+            m_file.seekg(m_jobs.dataStart +
+                         std::streamoff(from * m_jobs.bytesPerFrame));
+            m_file.read(&m_buffer[0], bytes);
+            obtained = m_file.gcount();
+        }
+
+        std::fill(m_buffer.begin() + obtained, m_buffer.end(), 0);
+        return (const unsigned char *)&m_buffer[0];
+    }
+
+private:
+    const StretchJobs &m_jobs;
+    std::ifstream m_file;
+    std::vector<char> m_buffer;
+};
+
+/// Read frames of the stretcher's input, from the given position,
+/// for one channel, or all mixed down if channel is -1.  scratch
+/// must have a buffer per channel of at least frames.
+void
+readInput(const StretchJobs &jobs, SourceReader &reader, size_t position,
+          size_t frames, int channel, float *out,
+          std::vector<float *> &scratch)
+{
+    for (size_t i = 0; i < frames; ++i) out[i] = 0.f;
+
+    // The part of it that's in the file
+    long fileFrom = long(position) - long(jobs.padding);
+    long begin = std::max(fileFrom, 0L);
+    long end = std::min(fileFrom + long(frames), long(jobs.fileFrames));
+    if (begin >= end) return;
+
+    RIFFAudioFile::decodeFrames(reader.getFrames(begin, end),
+                                jobs.bits, jobs.channels, end - begin,
+                                scratch);
+
+    float *target = out + (begin - fileFrom);
+    for (int c = 0; c < jobs.channels; ++c) {
+        if (channel >= 0 && c != channel) continue;
+        for (long i = 0; i < end - begin; ++i) {
+            target[i] += scratch[c][i];
+        }
+    }
+}
+
+/// Stretch one channel of one chunk into result.  Returns false if
+/// cancelled.
+bool
+stretchChunk(const StretchJobs &jobs, size_t chunk, int channel,
+             std::vector<float> &result)
+{
+    const size_t firstHop = jobs.chunkHops[chunk];
+    const size_t from = jobs.chunkStarts[chunk];
+    const size_t to = jobs.getChunkEnd(chunk);
+
+    result.resize(to - from);
+
+    AudioTimeStretcher stretcher(jobs.sampleRate, 1, jobs.ratio, true,
+                                 jobs.outputBlock);
+    stretcher.followSchedule(&jobs.schedule, firstHop);
+
+    std::vector<std::vector<float> > buffers
+        (jobs.channels, std::vector<float>(jobs.inputBlock));
+    std::vector<float *> scratch;
+    for (int c = 0; c < jobs.channels; ++c) {
+        scratch.push_back(&buffers[c][0]);
+    }
+
+    std::vector<float> in(jobs.inputBlock), out(jobs.outputBlock);
+    float *inp = &in[0], *outp = &out[0];
+
+    SourceReader reader(jobs);
+
+    size_t inputAt = firstHop * jobs.n1;
+    size_t outputAt = jobs.hopOutput[firstHop];
+
+    while (outputAt < to) {
+
+        if (jobs.cancelled.fetchAndAddRelaxed(0)) return false;
+
+        readInput(jobs, reader, inputAt, jobs.inputBlock, channel, inp,
+                  scratch);
+        inputAt += jobs.inputBlock;
+
+        stretcher.putInput(&inp, jobs.inputBlock);
+
+        size_t available = stretcher.getAvailableOutputSamples();
+
+        while (available > 0 && outputAt < to) {
+
+            size_t count = std::min(available, jobs.outputBlock);
+            stretcher.getOutput(&outp, count);
+
+            for (size_t i = 0; i < count; ++i) {
+                size_t position = outputAt + i;
+                if (position >= from && position < to) {
+                    result[position - from] = out[i];
+                }
+            }
+
+            outputAt += count;
+            available -= count;
+        }
+    }
+
+    return true;
+}
+
+void
+StretchJobs::run(size_t n)
+{
+    stretchChunk(*this, n / channels, int(n % channels), results[n]);
+}
+
+}
+
+
+const int AudioFileTimeStretcher::MaxThreads;
+const int AudioFileTimeStretcher::DefaultChunkSeconds;
+int AudioFileTimeStretcher::m_threadCount = 0;
+bool AudioFileTimeStretcher::m_useMappedFiles = true;
+int AudioFileTimeStretcher::m_chunkSeconds =
+    AudioFileTimeStretcher::DefaultChunkSeconds;
+
 AudioFileTimeStretcher::AudioFileTimeStretcher(AudioFileManager *afm) :
         m_audioFileManager(afm)
 {
@@ -68,13 +273,46 @@ AudioFileTimeStretcher::getStretchedAudioFile(AudioFileId source,
 
     RG_DEBUG << "getStretchedAudioFile(): got derived file id " << file->getId() << ", name " << file->getFilename();
 
-    std::ifstream streamIn(sourceFile->getFilename().toLocal8Bit(),
-                           std::ios::in | std::ios::binary);
-    if (!streamIn) {
-        RG_WARNING << "getStretchedAudioFile(): WARNING: Creation of ifstream failed for file " << sourceFile->getFilename();
+    if (!stretch(sourceFile, file->getFilename(), ratio)) {
         return -1;
     }
-    
+
+    RG_DEBUG << "getStretchedAudioFile(): success, id is " << file->getId();
+
+    return file->getId();
+}
+
+bool
+AudioFileTimeStretcher::stretch(AudioFile *sourceFile,
+                                const QString &fileName,
+                                float ratio)
+{
+    if (!dynamic_cast<RIFFAudioFile *>(sourceFile)) {
+        RG_WARNING << "stretch(): WARNING: Can't read sample data from file " << sourceFile->getFilename();
+        return false;
+    }
+
+    // We decode straight from a mapping of the file, which any number
+    // of threads can read at once.  Failing that, each thread reads
+    // through a stream of its own, from the start of the data that
+    // scanTo() finds.
+    AudioFileMapping *mapping = 0;
+    if (m_useMappedFiles) {
+        mapping = AudioFileMapping::acquire(sourceFile->getFilename());
+    }
+
+    std::streamoff dataStart = 0;
+
+    if (!mapping) {
+        std::ifstream file(sourceFile->getFilename().toLocal8Bit(),
+                           std::ios::in | std::ios::binary);
+        if (!file || !sourceFile->scanTo(&file, RealTime::zeroTime)) {
+            RG_WARNING << "stretch(): WARNING: Can't read sample data from file " << sourceFile->getFilename();
+            return false;
+        }
+        dataStart = file.tellg();
+    }
+
     if (m_progressDialog) {
         m_progressDialog->setLabelText(tr("Rescaling audio file..."));
         m_progressDialog->setRange(0, 100);
@@ -87,7 +325,7 @@ AudioFileTimeStretcher::getStretchedAudioFile(AudioFileId source,
     // (like libsndfile, or hey!, we could use libsndfile...)
 
     WAVAudioFile writeFile
-        (file->getFilename(),
+        (fileName,
          sourceFile->getChannels(),
          sourceFile->getSampleRate(),
          sourceFile->getSampleRate() * 4 * sourceFile->getChannels(),
@@ -95,171 +333,189 @@ AudioFileTimeStretcher::getStretchedAudioFile(AudioFileId source,
          32);
 
     if (!writeFile.write()) {
-        RG_WARNING << "getStretchedAudioFile(): WARNING: write() failed for file " << file->getFilename();
-        return -1;
-    }
-    
-    int obs = 1024;
-    int ibs = obs / ratio;
-    int ch = sourceFile->getChannels();
-    int sr = sourceFile->getSampleRate();
-
-    AudioTimeStretcher stretcher(sr, ch, ratio, true, obs);
-
-    // We'll first prime the timestretcher with half its window size
-    // of silence, an amount which we then discard at the start of the
-    // output (as well as its own processing latency).  Really the
-    // timestretcher should handle this itself and report it in its
-    // own latency calculation
-
-    size_t padding = stretcher.getWindowSize()/2;
-
-    char *ebf = (char *)alloca
-        (ch * ibs * sourceFile->getBytesPerFrame());
-    
-    std::vector<float *> dbfs;
-    for (int c = 0; c < ch; ++c) {
-        dbfs.push_back((float *)alloca((ibs > int(padding) ? size_t(ibs) : padding)
-                                       * sizeof(float)));
+        RG_WARNING << "stretch(): WARNING: write() failed for file " << fileName;
+        AudioFileMapping::release(mapping);
+        return false;
     }
-    
-    float **ibfs = (float **)alloca(ch * sizeof(float *));
-    float **obfs = (float **)alloca(ch * sizeof(float *));
-            
-    for (int c = 0; c < ch; ++c) {
-        ibfs[c] = dbfs[c];
-    }
-        
-    for (int c = 0; c < ch; ++c) {
-        obfs[c] = (float *)alloca(obs * sizeof(float));
-    }
-        
-    char *oebf = (char *)alloca(ch * obs * sizeof(float));
-        
-    int totalIn = 0, totalOut = 0;
-        
-    for (int c = 0; c < ch; ++c) {
-        for (size_t i = 0; i < padding; ++i) {
-            ibfs[c][i] = 0.f;
-        }
+
+    // (as PlayableAudioFile, we take the rest of a file we can't map
+    // to be its data)
+    const size_t dataSize = mapping ? mapping->getDataSize() :
+        sourceFile->getSize() - std::min(size_t(dataStart),
+                                         sourceFile->getSize());
+
+    StretchJobs jobs;
+    jobs.data = mapping ? mapping->getData() : 0;
+    jobs.fileName = sourceFile->getFilename().toLocal8Bit();
+    jobs.dataStart = dataStart;
+    jobs.bits = sourceFile->getBitsPerSample();
+    jobs.channels = sourceFile->getChannels();
+    jobs.bytesPerFrame = sourceFile->getBytesPerFrame();
+    jobs.fileFrames = jobs.bytesPerFrame ? dataSize / jobs.bytesPerFrame : 0;
+    jobs.sampleRate = sourceFile->getSampleRate();
+    jobs.ratio = ratio;
+    jobs.outputBlock = 1024;
+    jobs.inputBlock = size_t(jobs.outputBlock / ratio);
+
+    // The first pass.  This stretcher makes the decisions the others
+    // follow, and in making it we get its FFT plans made here rather
+    // than on the workers.
+
+    AudioTimeStretcher scheduler(jobs.sampleRate, 1, ratio, true,
+                                 jobs.outputBlock);
+    scheduler.recordSchedule(&jobs.schedule, true);
+
+    jobs.n1 = scheduler.getInputIncrement();
+    const size_t wlen = scheduler.getWindowSize();
+
+    // The stretcher is primed with half its window size of silence,
+    // an amount which we then discard at the start of the output (as
+    // well as its own processing latency).  Really the timestretcher
+    // should handle this itself and report it in its own latency
+    // calculation
+    jobs.padding = wlen / 2;
+    jobs.end = jobs.padding + size_t(ceil(jobs.fileFrames * ratio));
+
+    std::vector<std::vector<float> > buffers
+        (jobs.channels, std::vector<float>(jobs.inputBlock));
+    std::vector<float *> scratch;
+    for (int c = 0; c < jobs.channels; ++c) {
+        scratch.push_back(&buffers[c][0]);
     }
-    stretcher.putInput(ibfs, padding);
+    std::vector<float> mixdown(jobs.inputBlock);
+    float *mixdownp = &mixdown[0];
 
-    RealTime totalTime = sourceFile->getLength();
-    long fileTotalIn = RealTime::realTime2Frame
-        (totalTime, sourceFile->getSampleRate());
+    SourceReader reader(jobs);
+
+    jobs.hopOutput.push_back(0);
+    size_t inputAt = 0;
     int progressCount = 0;
 
-    long expectedOut = ceil(fileTotalIn * ratio);
+    // Until the decisions reach the end of the output
+    while (jobs.hopOutput.back() < jobs.end) {
 
-    bool inputExhausted = false;
+        readInput(jobs, reader, inputAt, jobs.inputBlock, -1, mixdownp,
+                  scratch);
+        inputAt += jobs.inputBlock;
 
-    sourceFile->scanTo(&streamIn, RealTime::zeroTime);
+        scheduler.putInput(&mixdownp, jobs.inputBlock);
 
-    while (1) {
-            
-        if (m_progressDialog  &&  m_progressDialog->wasCanceled()) {
-            RG_DEBUG << "getStretchedAudioFile(): cancelled";
-            return -1;
+        while (jobs.hopOutput.size() <= jobs.schedule.size()) {
+            jobs.hopOutput.push_back(jobs.hopOutput.back() +
+                                     jobs.schedule[jobs.hopOutput.size() - 1].n2);
         }
 
-        unsigned int thisRead = 0;
-
-        if (!inputExhausted) {
-            thisRead = sourceFile->getSampleFrames(&streamIn, ebf, ibs);
-            if (int(thisRead) < ibs) inputExhausted = true;
-        }
-            
-        if (thisRead == 0) {
-            if (totalOut >= expectedOut) break;
-            else {
-                // run out of input data, continue feeding zeroes until
-                // we have enough output data
-                for (int c = 0; c < ch; ++c) {
-                    for (int i = 0; i < ibs; ++i) {
-                        ibfs[c][i] = 0.f;
-                    }
+        if (++progressCount == 100) {
+            if (m_progressDialog) {
+                if (m_progressDialog->wasCanceled()) {
+                    RG_DEBUG << "stretch(): cancelled";
+                    AudioFileMapping::release(mapping);
+                    return false;
                 }
-                thisRead = ibs;
+                m_progressDialog->setValue
+                    (int(10.0 * inputAt / (jobs.fileFrames + jobs.padding)));
             }
+            qApp->processEvents();
+            progressCount = 0;
         }
-            
-        if (!sourceFile->decode((unsigned char *)ebf,
-                                thisRead * sourceFile->getBytesPerFrame(),
-                                sr, ch,
-                                thisRead, dbfs, false)) {
-            RG_WARNING << "getStretchedAudioFile(): ERROR: AudioFile failed to decode its own output";
-            break;
-        }
-            
-        stretcher.putInput(ibfs, thisRead);
-        totalIn += thisRead;
-            
-        unsigned int available = stretcher.getAvailableOutputSamples();
-            
-        while (available > 0) {
-                
-            unsigned int count = available;
-            if (count > (unsigned int)obs) count = (unsigned int)obs;
-
-            if (padding > 0) {
-                if (count <= padding) {
-                    stretcher.getOutput(obfs, count);
-                    padding -= count;
-                    available -= count;
-                    continue;
-                } else {
-                    stretcher.getOutput(obfs, padding);
-                    count -= padding;
-                    available -= padding;
-                    padding = 0;
+    }
+
+    // Chunks of about getChunkSeconds() each, each starting at a transient.
+    // The hop after a transient resets its phases, so a stretcher
+    // started at the transient gives the same output as one started
+    // at the beginning, from a window's length after it.
+
+    const size_t chunkHops =
+        std::max(size_t(1), size_t(m_chunkSeconds * jobs.sampleRate) / jobs.n1);
+
+    jobs.chunkHops.push_back(0);
+    jobs.chunkStarts.push_back(jobs.padding);
+
+    for (size_t hop = chunkHops; hop + 1 < jobs.schedule.size(); ++hop) {
+        if (!jobs.schedule[hop].transient) continue;
+        size_t start = jobs.hopOutput[hop] + wlen;
+        if (start >= jobs.end) break;
+        if (start <= jobs.chunkStarts.back()) continue;
+        jobs.chunkHops.push_back(hop);
+        jobs.chunkStarts.push_back(start);
+        hop += chunkHops - 1;
+    }
+
+    const size_t chunks = jobs.chunkHops.size();
+    const size_t jobCount = chunks * jobs.channels;
+    jobs.results.resize(jobCount);
+
+    const int threads = std::min(getThreadCount(), int(jobCount));
+
+    RG_DEBUG << "stretch(): " << jobs.schedule.size() << " hops in " << chunks << " chunks of " << jobs.channels << " channels, on " << threads << " threads";
+
+    bool cancelled = false;
+
+    // (in a block of its own, so that the workers are done with the
+    // mapping before it's released)
+    {
+        JobPool pool(jobs, jobCount, threads);
+
+        // Write each chunk out as all its channels are done, and keep
+        // the progress dialog going, until they all are
+        size_t written = 0;
+        std::vector<float> interleaved;
+
+        while (written < chunks && !cancelled) {
+
+            const size_t first = written * jobs.channels;
+            bool ready = pool.waitFor(first, first + jobs.channels, 50);
+            size_t finished = pool.getFinishedCount();
+
+            if (ready) {
+                size_t frames = jobs.results[first].size();
+                interleaved.resize(frames * jobs.channels);
+                for (int c = 0; c < jobs.channels; ++c) {
+                    std::vector<float> &result = jobs.results[first + c];
+                    for (size_t i = 0; i < frames; ++i) {
+                        interleaved[i * jobs.channels + c] = result[i];
+                    }
+                    std::vector<float>().swap(result);
                 }
-            }
-                
-            stretcher.getOutput(obfs, count);
-                
-            char *encodePointer = oebf;
-            for (unsigned int i = 0; i < count; ++i) {
-                for (int c = 0; c < ch; ++c) {
-                    float sample = obfs[c][i];
-                    *(float *)encodePointer = sample;
-                    encodePointer += sizeof(float);
+                if (frames > 0) {
+                    writeFile.appendSamples((const char *)&interleaved[0], frames);
                 }
-            }
-                
-            if (totalOut < expectedOut &&
-                totalOut + int(count) > expectedOut) {
-                count = expectedOut - totalOut;
+                ++written;
             }
 
-            writeFile.appendSamples(oebf, count);
-            totalOut += count;
-            available -= count;
+            if (m_progressDialog) {
+                if (m_progressDialog->wasCanceled()) {
+                    RG_DEBUG << "stretch(): cancelled";
+                    jobs.cancelled.fetchAndStoreRelaxed(1);
+                    cancelled = true;
+                } else {
+                    m_progressDialog->setValue
+                        (10 + int(90.0 * finished / jobCount));
+                }
+            }
 
-            if (totalOut >= expectedOut) break;
+            qApp->processEvents();
         }
-            
-        if (++progressCount == 100) {
-            int progress = static_cast<int>(100.0 * totalIn / fileTotalIn);
-            if (m_progressDialog)
-                m_progressDialog->setValue(progress);
+    }
 
-            progressCount = 0;
-        }
+    AudioFileMapping::release(mapping);
+
+    if (cancelled) return false;
 
-        qApp->processEvents();
-    }
-        
     if (m_progressDialog)
         m_progressDialog->setValue(100);
 
     qApp->processEvents();
 
     writeFile.close();
-    
-    RG_DEBUG << "getStretchedAudioFile(): success, id is " << file->getId();
 
-    return file->getId();
+    return true;
+}
+
+int
+AudioFileTimeStretcher::getThreadCount()
+{
+    return JobPool::getThreadCount(m_threadCount, MaxThreads);
 }
 
 
@@ -48,13 +48,60 @@ public:
     AudioFileId getStretchedAudioFile(AudioFileId source,
                                       float ratio);
 
+    /**
+     * Stretch a WAV or BWF file into a new 32-bit float WAV file of
+     * the given name.  Returns false on error, or if cancelled.
+     *
+     * The stretch is made in two passes.  The first, on the calling
+     * thread, decides where the transients are and how far the output
+     * moves on at each step, from a mixdown of the channels.  The
+     * second stretches each channel of each chunk of the file (chunks
+     * start just after a transient, where the output can be picked up
+     * exactly) separately, following those decisions, on up to
+     * getThreadCount() worker threads.  So the result doesn't depend
+     * on the number of threads, and the channels stay together.
+     */
+    bool stretch(AudioFile *source, const QString &fileName, float ratio);
+
     void setProgressDialog(QPointer<QProgressDialog> progressDialog)
             { m_progressDialog = progressDialog; }
 
+    /// How many channels of chunks stretch() works on at once.
+    /**
+     * Set for tests and benchmarks, which compare the result on
+     * different numbers of threads.  Left at zero, there's a thread
+     * for each core, up to MaxThreads.
+     */
+    static void setThreadCount(int threads)  { m_threadCount = threads; }
+    static int getThreadCount();
+
+    /// The most threads stretch() uses by default.
+    static const int MaxThreads = 8;
+
+    /// Roughly how long a chunk of the file one job stretches is.
+    /**
+     * DefaultChunkSeconds unless set.  For tests: a length longer than
+     * the file stretches it as one chunk.
+     */
+    static void setChunkSeconds(int seconds)  { m_chunkSeconds = seconds; }
+    static int getChunkSeconds()  { return m_chunkSeconds; }
+
+    static const int DefaultChunkSeconds = 10;
+
+    /// Whether stretch() reads its source through a memory mapping
+    /// (the default) rather than streams, as PlayableAudioFile.  For
+    /// tests.
+    static void setUseMappedFiles(bool use)  { m_useMappedFiles = use; }
+    static bool getUseMappedFiles()  { return m_useMappedFiles; }
+
 protected:
     AudioFileManager *m_audioFileManager;
 
     QPointer<QProgressDialog> m_progressDialog;
+
+    static int m_threadCount;
+    static int m_chunkSeconds;
+    static bool m_useMappedFiles;
 };
 
 }
@@ -0,0 +1,382 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "AudioKernels.h"
+
+// The vector versions are compiled for their instruction sets with
+// target attributes rather than compiler flags, so that the rest of
+// the build still runs on CPUs without them.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RG_AUDIO_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace Rosegarden
+{
+
+
+// Scalar versions.  These also finish off the few samples at the end
+// of a buffer that don't fill a vector.
+
+static bool
+applyGainScalar(float *buffer, size_t n, float gain)
+{
+    bool nonZero = false;
+    for (size_t i = 0; i < n; ++i) {
+        buffer[i] *= gain;
+        if (buffer[i] != 0.0f) nonZero = true;
+    }
+    return nonZero;
+}
+
+static bool
+panScalar(const float *in, float *left, float *right, size_t n,
+          float gainLeft, float gainRight)
+{
+    bool nonZero = false;
+    for (size_t i = 0; i < n; ++i) {
+        float sample = in[i];
+        left[i] = sample * gainLeft;
+        right[i] = sample * gainRight;
+        if (sample != 0.0f) nonZero = true;
+    }
+    return nonZero;
+}
+
+static void
+mixScalar(float *dst, const float *src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+static float
+mixAndPeakScalar(float *dst, const float *src, size_t n, float peak)
+{
+    for (size_t i = 0; i < n; ++i) {
+        float sample = src[i];
+        if (sample > peak) peak = sample;
+        dst[i] += sample;
+    }
+    return peak;
+}
+
+static float
+peakScalar(const float *buffer, size_t n, float peak)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (buffer[i] > peak) peak = buffer[i];
+    }
+    return peak;
+}
+
+static float
+applyGainAndPeakScalar(float *buffer, size_t n, float gain, float peak)
+{
+    for (size_t i = 0; i < n; ++i) {
+        float sample = buffer[i] * gain;
+        if (sample > peak) peak = sample;
+        buffer[i] = sample;
+    }
+    return peak;
+}
+
+
+#ifdef RG_AUDIO_KERNELS_X86
+
+// SSE2 versions, four samples at a time
+
+__attribute__((target("sse2"))) static float
+maxOf(__m128 v, float peak)
+{
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    for (int i = 0; i < 4; ++i) {
+        if (lanes[i] > peak) peak = lanes[i];
+    }
+    return peak;
+}
+
+__attribute__((target("sse2"))) static bool
+applyGainSSE2(float *buffer, size_t n, float gain)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    const __m128 zero = _mm_setzero_ps();
+    int nonZero = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(buffer + i), g);
+        _mm_storeu_ps(buffer + i, v);
+        nonZero |= _mm_movemask_ps(_mm_cmpneq_ps(v, zero));
+    }
+    return applyGainScalar(buffer + i, n - i, gain) || nonZero;
+}
+
+__attribute__((target("sse2"))) static bool
+panSSE2(const float *in, float *left, float *right, size_t n,
+        float gainLeft, float gainRight)
+{
+    const __m128 gl = _mm_set1_ps(gainLeft);
+    const __m128 gr = _mm_set1_ps(gainRight);
+    const __m128 zero = _mm_setzero_ps();
+    int nonZero = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(in + i);
+        _mm_storeu_ps(left + i, _mm_mul_ps(v, gl));
+        _mm_storeu_ps(right + i, _mm_mul_ps(v, gr));
+        nonZero |= _mm_movemask_ps(_mm_cmpneq_ps(v, zero));
+    }
+    return panScalar(in + i, left + i, right + i, n - i,
+                     gainLeft, gainRight) || nonZero;
+}
+
+__attribute__((target("sse2"))) static void
+mixSSE2(float *dst, const float *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i),
+                                          _mm_loadu_ps(src + i)));
+    }
+    mixScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2"))) static float
+mixAndPeakSSE2(float *dst, const float *src, size_t n, float peak)
+{
+    __m128 p = _mm_set1_ps(peak);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(src + i);
+        p = _mm_max_ps(p, v);
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), v));
+    }
+    return mixAndPeakScalar(dst + i, src + i, n - i, maxOf(p, peak));
+}
+
+__attribute__((target("sse2"))) static float
+peakSSE2(const float *buffer, size_t n, float peak)
+{
+    __m128 p = _mm_set1_ps(peak);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        p = _mm_max_ps(p, _mm_loadu_ps(buffer + i));
+    }
+    return peakScalar(buffer + i, n - i, maxOf(p, peak));
+}
+
+__attribute__((target("sse2"))) static float
+applyGainAndPeakSSE2(float *buffer, size_t n, float gain, float peak)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    __m128 p = _mm_set1_ps(peak);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(buffer + i), g);
+        p = _mm_max_ps(p, v);
+        _mm_storeu_ps(buffer + i, v);
+    }
+    return applyGainAndPeakScalar(buffer + i, n - i, gain, maxOf(p, peak));
+}
+
+
+// AVX2 versions, eight samples at a time
+
+__attribute__((target("avx2"))) static float
+maxOf(__m256 v, float peak)
+{
+    float lanes[8];
+    _mm256_storeu_ps(lanes, v);
+    for (int i = 0; i < 8; ++i) {
+        if (lanes[i] > peak) peak = lanes[i];
+    }
+    return peak;
+}
+
+__attribute__((target("avx2"))) static bool
+applyGainAVX2(float *buffer, size_t n, float gain)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    const __m256 zero = _mm256_setzero_ps();
+    int nonZero = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(buffer + i), g);
+        _mm256_storeu_ps(buffer + i, v);
+        nonZero |= _mm256_movemask_ps(_mm256_cmp_ps(v, zero, _CMP_NEQ_UQ));
+    }
+    return applyGainScalar(buffer + i, n - i, gain) || nonZero;
+}
+
+__attribute__((target("avx2"))) static bool
+panAVX2(const float *in, float *left, float *right, size_t n,
+        float gainLeft, float gainRight)
+{
+    const __m256 gl = _mm256_set1_ps(gainLeft);
+    const __m256 gr = _mm256_set1_ps(gainRight);
+    const __m256 zero = _mm256_setzero_ps();
+    int nonZero = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(in + i);
+        _mm256_storeu_ps(left + i, _mm256_mul_ps(v, gl));
+        _mm256_storeu_ps(right + i, _mm256_mul_ps(v, gr));
+        nonZero |= _mm256_movemask_ps(_mm256_cmp_ps(v, zero, _CMP_NEQ_UQ));
+    }
+    return panScalar(in + i, left + i, right + i, n - i,
+                     gainLeft, gainRight) || nonZero;
+}
+
+__attribute__((target("avx2"))) static void
+mixAVX2(float *dst, const float *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i),
+                                                _mm256_loadu_ps(src + i)));
+    }
+    mixScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2"))) static float
+mixAndPeakAVX2(float *dst, const float *src, size_t n, float peak)
+{
+    __m256 p = _mm256_set1_ps(peak);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(src + i);
+        p = _mm256_max_ps(p, v);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), v));
+    }
+    return mixAndPeakScalar(dst + i, src + i, n - i, maxOf(p, peak));
+}
+
+__attribute__((target("avx2"))) static float
+peakAVX2(const float *buffer, size_t n, float peak)
+{
+    __m256 p = _mm256_set1_ps(peak);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        p = _mm256_max_ps(p, _mm256_loadu_ps(buffer + i));
+    }
+    return peakScalar(buffer + i, n - i, maxOf(p, peak));
+}
+
+__attribute__((target("avx2"))) static float
+applyGainAndPeakAVX2(float *buffer, size_t n, float gain, float peak)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    __m256 p = _mm256_set1_ps(peak);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(buffer + i), g);
+        p = _mm256_max_ps(p, v);
+        _mm256_storeu_ps(buffer + i, v);
+    }
+    return applyGainAndPeakScalar(buffer + i, n - i, gain, maxOf(p, peak));
+}
+
+#endif
+
+
+bool
+AudioKernels::isSupported(Variant variant)
+{
+    switch (variant) {
+    case Scalar:
+        return true;
+#ifdef RG_AUDIO_KERNELS_X86
+    case SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#else
+    case SSE2:
+    case AVX2:
+        return false;
+#endif
+    }
+    return false;
+}
+
+const char *
+AudioKernels::getVariantName(Variant variant)
+{
+    switch (variant) {
+    case Scalar: return "scalar";
+    case SSE2: return "SSE2";
+    case AVX2: return "AVX2";
+    }
+    return "unknown";
+}
+
+AudioKernels::Variant
+AudioKernels::getBestVariant()
+{
+    if (isSupported(AVX2)) return AVX2;
+    if (isSupported(SSE2)) return SSE2;
+    return Scalar;
+}
+
+AudioKernels::Table
+AudioKernels::makeTable(Variant variant)
+{
+    Table table;
+    table.variant = Scalar;
+    table.applyGain = applyGainScalar;
+    table.pan = panScalar;
+    table.mix = mixScalar;
+    table.mixAndPeak = mixAndPeakScalar;
+    table.peak = peakScalar;
+    table.applyGainAndPeak = applyGainAndPeakScalar;
+
+#ifdef RG_AUDIO_KERNELS_X86
+    if (variant == SSE2) {
+        table.variant = SSE2;
+        table.applyGain = applyGainSSE2;
+        table.pan = panSSE2;
+        table.mix = mixSSE2;
+        table.mixAndPeak = mixAndPeakSSE2;
+        table.peak = peakSSE2;
+        table.applyGainAndPeak = applyGainAndPeakSSE2;
+    } else if (variant == AVX2) {
+        table.variant = AVX2;
+        table.applyGain = applyGainAVX2;
+        table.pan = panAVX2;
+        table.mix = mixAVX2;
+        table.mixAndPeak = mixAndPeakAVX2;
+        table.peak = peakAVX2;
+        table.applyGainAndPeak = applyGainAndPeakAVX2;
+    }
+#endif
+
+    return table;
+}
+
+bool
+AudioKernels::setVariant(Variant variant)
+{
+    if (!isSupported(variant)) return false;
+    m_table = makeTable(variant);
+    return true;
+}
+
+AudioKernels::Table AudioKernels::m_table =
+    AudioKernels::makeTable(AudioKernels::getBestVariant());
+
+}
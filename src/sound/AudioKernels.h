@@ -0,0 +1,98 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_AUDIO_KERNELS_H
+#define RG_AUDIO_KERNELS_H
+
+#include <cstddef>
+
+namespace Rosegarden
+{
+
+/// The per-sample inner loops of the audio mixers.
+/**
+ * Each kernel has a scalar version and, on x86, SSE2 and AVX2
+ * versions.  The best one the CPU supports is chosen when the program
+ * starts, so that callers don't need to know which is in use.
+ *
+ * All kernels are RT safe.  Buffers need no particular alignment.
+ *
+ * Peaks follow the meters in JackDriver: the greatest sample value,
+ * not the greatest magnitude, and never less than the peak passed in.
+ */
+class AudioKernels
+{
+public:
+    enum Variant { Scalar, SSE2, AVX2 };
+
+    /// Multiply n samples in place by gain.  Returns true if any of
+    /// the results is non-zero.
+    static bool applyGain(float *buffer, size_t n, float gain)
+        { return m_table.applyGain(buffer, n, gain); }
+
+    /// Write in * gainLeft to left and in * gainRight to right.  in
+    /// may be the same buffer as left.  Returns true if any input
+    /// sample is non-zero.
+    static bool pan(const float *in, float *left, float *right, size_t n,
+                    float gainLeft, float gainRight)
+        { return m_table.pan(in, left, right, n, gainLeft, gainRight); }
+
+    /// Add n samples of src into dst.
+    static void mix(float *dst, const float *src, size_t n)
+        { m_table.mix(dst, src, n); }
+
+    /// Add n samples of src into dst, returning the peak of src.
+    static float mixAndPeak(float *dst, const float *src, size_t n,
+                            float peak)
+        { return m_table.mixAndPeak(dst, src, n, peak); }
+
+    /// The peak of n samples.
+    static float peak(const float *buffer, size_t n, float peak)
+        { return m_table.peak(buffer, n, peak); }
+
+    /// Multiply n samples in place by gain, returning the peak of the
+    /// results.
+    static float applyGainAndPeak(float *buffer, size_t n, float gain,
+                                  float peak)
+        { return m_table.applyGainAndPeak(buffer, n, gain, peak); }
+
+    static Variant getVariant()  { return m_table.variant; }
+    static bool isSupported(Variant);
+    static const char *getVariantName(Variant);
+
+    /// Switch to another supported variant, for tests and benchmarks.
+    /// Not RT safe: no other thread may be in a kernel.
+    static bool setVariant(Variant);
+
+private:
+    struct Table
+    {
+        Variant variant;
+        bool (*applyGain)(float *, size_t, float);
+        bool (*pan)(const float *, float *, float *, size_t, float, float);
+        void (*mix)(float *, const float *, size_t);
+        float (*mixAndPeak)(float *, const float *, size_t, float);
+        float (*peak)(const float *, size_t, float);
+        float (*applyGainAndPeak)(float *, size_t, float, float);
+    };
+
+    static Table makeTable(Variant);
+    static Variant getBestVariant();
+
+    static Table m_table;
+};
+
+}
+
+#endif
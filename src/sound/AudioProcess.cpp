@@ -17,12 +17,14 @@
 
 #include "RunnablePluginInstance.h"
 #include "PlayableAudioFile.h"
+#include "RingBufferPool.h"
 #include "RecordableAudioFile.h"
 #include "WAVAudioFile.h"
 #include "MappedStudio.h"
 #include "base/Profiler.h"
 #include "base/AudioLevel.h"
 #include "AudioPlayQueue.h"
+#include "AudioKernels.h"
 #include "PluginFactory.h"
 
 #include "misc/Strings.h"
@@ -768,9 +770,8 @@ AudioBussMixer::processBlocks()
                 if (dormant) {
                     rec.buffers[ch]->zero(m_blockSize);
                 } else {
-                    for (size_t j = 0; j < m_blockSize; ++j) {
-                        m_processBuffers[ch][j] *= gain[ch];
-                    }
+                    AudioKernels::applyGain(m_processBuffers[ch], m_blockSize,
+                                            gain[ch]);
                     rec.buffers[ch]->write(m_processBuffers[ch], m_blockSize);
                 }
             }
@@ -1966,16 +1967,10 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
 
     if (targetChannels == 2 && channels == 1) {
 
-        for (size_t i = 0; i < m_blockSize; ++i) {
-
-            sample_t sample = m_processBuffers[0][i];
-
-            m_processBuffers[0][i] = sample * rec.gainLeft;
-            m_processBuffers[1][i] = sample * rec.gainRight;
-
-            if (allZeros && sample != 0.0)
-                allZeros = false;
-        }
+        if (AudioKernels::pan(m_processBuffers[0],
+                              m_processBuffers[0], m_processBuffers[1],
+                              m_blockSize, rec.gainLeft, rec.gainRight))
+            allZeros = false;
 
         rec.buffers[0]->write(m_processBuffers[0], m_blockSize);
         rec.buffers[1]->write(m_processBuffers[1], m_blockSize);
@@ -1987,14 +1982,10 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
             float gain = ((ch == 0) ? rec.gainLeft :
                           (ch == 1) ? rec.gainRight : rec.volume);
 
-            for (size_t i = 0; i < m_blockSize; ++i) {
-
-                // handle volume and pan
-                m_processBuffers[ch][i] *= gain;
-
-                if (allZeros && m_processBuffers[ch][i] != 0.0)
-                    allZeros = false;
-            }
+            // handle volume and pan
+            if (AudioKernels::applyGain(m_processBuffers[ch], m_blockSize,
+                                        gain))
+                allZeros = false;
 
             rec.buffers[ch]->write(m_processBuffers[ch], m_blockSize);
         }
@@ -2111,6 +2102,7 @@ AudioFileReader::fillBuffers(const RealTime &currentTime)
 #ifdef DEBUG_READER
 
     std::cerr << "AudioFileReader::fillBuffers: have " << files.size() << " audio files total" << std::endl;
+    PlayableAudioFile::getRingBufferPool()->dumpStats(std::cerr);
 #endif
 
     for (AudioPlayQueue::FileSet::const_iterator fi = files.begin();
@@ -2327,6 +2319,8 @@ AudioFileWriter::write(InstrumentId id,
 {
     if (!m_files[id].first)
         return ; // no file
+    if (m_files[id].second->getStatus() == RecordableAudioFile::DEFUNCT)
+        return ; // being closed
     if (m_files[id].second->buffer(samples, channel, sampleCount) < sampleCount) {
         m_driver->reportFailure(MappedEvent::FailureDiscOverrun);
     }
@@ -2339,7 +2333,19 @@ AudioFileWriter::closeRecordFile(InstrumentId id, AudioFileId &returnedId)
         return false;
 
     returnedId = m_files[id].first->getId();
-    m_files[id].second->setStatus(RecordableAudioFile::DEFUNCT);
+
+    // Finish the file and its peaks now, rather than in the next
+    // kick(), so that both are complete by the time the GUI hears
+    // that the recording has stopped and comes to preview it.  Mark
+    // it defunct first, so that the process thread stops buffering
+    // into it, then write out what it has already buffered, and only
+    // then close it.
+    getLock();
+    RecordableAudioFile *raf = m_files[id].second;
+    raf->setStatus(RecordableAudioFile::DEFUNCT);
+    raf->write();
+    raf->close();
+    releaseLock();
 
 #ifdef DEBUG_WRITER
 
@@ -2347,8 +2353,9 @@ AudioFileWriter::closeRecordFile(InstrumentId id, AudioFileId &returnedId)
 #endif
 
     // Don't reset the file pointers here; that will be done in the
-    // next call to kick().  Doesn't really matter when that happens,
-    // but let's encourage it to happen soon just for certainty.
+    // next call to kick(), as the process thread may still be
+    // buffering into the file.  Let's encourage it to happen soon just
+    // for certainty.
     signal();
 
     return true;
@@ -15,10 +15,12 @@
 
 #include "AudioTimeStretcher.h"
 
+#include <QMutex>
 #include <QtGlobal>
 
 #include <fstream>
 #include <cstring>
+#include <map>
 
 namespace Rosegarden 
 {
@@ -48,7 +50,12 @@ AudioTimeStretcher::AudioTimeStretcher(size_t sampleRate,
     m_transientCount(0),
     m_n2sum(0),
     m_n2total(0),
-    m_adjustCount(50)
+    m_adjustCount(50),
+    m_n2remainder(0.f),
+    m_recordSchedule(0),
+    m_followSchedule(0),
+    m_analyseOnly(false),
+    m_hop(0)
 {
     pthread_mutex_t initialisingMutex = PTHREAD_MUTEX_INITIALIZER;
     memcpy(&m_mutex, &initialisingMutex, sizeof(pthread_mutex_t));
@@ -58,19 +65,67 @@ AudioTimeStretcher::AudioTimeStretcher(size_t sampleRate,
 
 AudioTimeStretcher::~AudioTimeStretcher()
 {
+#ifdef DEBUG_AUDIO_TIME_STRETCHER
     std::cerr << "AudioTimeStretcher::~AudioTimeStretcher" << std::endl;
 
     std::cerr << "AudioTimeStretcher::~AudioTimeStretcher: actual ratio = " << (m_totalCount > 0 ? (float (m_n2total) / float(m_totalCount * m_n1)) : 1.f) << ", ideal = " << m_ratio << ", nominal = " << getRatio() << ")" << std::endl;
+#endif
 
     cleanup();
     
     pthread_mutex_destroy(&m_mutex);
 }
 
+namespace
+{
+    // Plans for each window length, forward and inverse
+    typedef std::pair<fftwf_plan, fftwf_plan> PlanPair;
+    std::map<size_t, PlanPair> plans;
+    QMutex planMutex;
+}
+
+QMutex *
+AudioTimeStretcher::getPlannerMutex()
+{
+    return &planMutex;
+}
+
+void
+AudioTimeStretcher::getPlans(size_t wlen, fftwf_plan &plan, fftwf_plan &iplan)
+{
+    QMutexLocker locker(&planMutex);
+
+    std::map<size_t, PlanPair>::iterator i = plans.find(wlen);
+
+    if (i == plans.end()) {
+
+        // The arrays are only for the planner to look at: the plans
+        // are executed on each stretcher's own, which are allocated
+        // (and so aligned) the same way
+        float *time = (float *)fftwf_malloc(sizeof(float) * wlen);
+        fftwf_complex *freq = (fftwf_complex *)fftwf_malloc
+            (sizeof(fftwf_complex) * (wlen / 2 + 1));
+
+        PlanPair pair;
+        pair.first = fftwf_plan_dft_r2c_1d(wlen, time, freq, FFTW_ESTIMATE);
+        pair.second = fftwf_plan_dft_c2r_1d(wlen, freq, time, FFTW_ESTIMATE);
+
+        fftwf_free(time);
+        fftwf_free(freq);
+
+        i = plans.insert(std::make_pair(wlen, pair)).first;
+    }
+
+    plan = i->second.first;
+    iplan = i->second.second;
+}
+
 void
 AudioTimeStretcher::initialise()
 {
+#ifdef DEBUG_AUDIO_TIME_STRETCHER
     std::cerr << "AudioTimeStretcher::initialise" << std::endl;
+#endif
 
     calculateParameters();
         
@@ -88,8 +143,7 @@ AudioTimeStretcher::initialise()
 
     m_time = new float *[m_channels];
     m_freq = new fftwf_complex *[m_channels];
-    m_plan = new fftwf_plan[m_channels];
-    m_iplan = new fftwf_plan[m_channels];
+    getPlans(m_wlen, m_plan, m_iplan);
 
     m_inbuf = new RingBuffer<float> *[m_channels];
     m_outbuf = new RingBuffer<float> *[m_channels];
@@ -105,16 +159,16 @@ AudioTimeStretcher::initialise()
         m_time[c] = (float *)fftwf_malloc(sizeof(float) * m_wlen);
         m_freq[c] = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) *
                                                   (m_wlen / 2 + 1));
-        
-        m_plan[c] = fftwf_plan_dft_r2c_1d(m_wlen, m_time[c], m_freq[c], FFTW_ESTIMATE);
-        m_iplan[c] = fftwf_plan_dft_c2r_1d(m_wlen, m_freq[c], m_time[c], FFTW_ESTIMATE);
+
 
         m_outbuf[c] = new RingBuffer<float>
             ((m_maxOutputBlockSize + m_wlen) * 2);
         m_inbuf[c] = new RingBuffer<float>
             (lrintf(m_outbuf[c]->getSize() / m_ratio) + m_wlen);
 
+#ifdef DEBUG_AUDIO_TIME_STRETCHER
         std::cerr << "making inbuf size " << m_inbuf[c]->getSize() << " (outbuf size is " << m_outbuf[c]->getSize() << ", ratio " << m_ratio << ")" << std::endl;
+#endif
 
            
         m_mashbuf[c] = (float *)fftwf_malloc(sizeof(float) * m_wlen);
@@ -141,7 +195,9 @@ AudioTimeStretcher::initialise()
 void
 AudioTimeStretcher::calculateParameters()
 {
+#ifdef DEBUG_AUDIO_TIME_STRETCHER
     std::cerr << "AudioTimeStretcher::calculateParameters" << std::endl;
+#endif
 
     m_wlen = 1024;
 
@@ -192,23 +248,27 @@ AudioTimeStretcher::calculateParameters()
     m_n2sum = 0;
     m_n2total = 0;
     m_n2list.clear();
+    m_n2remainder = 0.f;
 
+#ifdef DEBUG_AUDIO_TIME_STRETCHER
     std::cerr << "AudioTimeStretcher: channels = " << m_channels
               << ", ratio = " << m_ratio
               << ", n1 = " << m_n1 << ", n2 = " << m_n2 << ", wlen = "
               << m_wlen << ", max = " << m_maxOutputBlockSize << std::endl;
 //              << ", outbuflen = " << m_outbuf[0]->getSize() << std::endl;
+#endif
 }
 
 void
 AudioTimeStretcher::cleanup()
 {
+#ifdef DEBUG_AUDIO_TIME_STRETCHER
     std::cerr << "AudioTimeStretcher::cleanup" << std::endl;
+#endif
 
-    for (size_t c = 0; c < m_channels; ++c) {
+    // The plans belong to the cache
 
-        fftwf_destroy_plan(m_plan[c]);
-        fftwf_destroy_plan(m_iplan[c]);
+    for (size_t c = 0; c < m_channels; ++c) {
 
         fftwf_free(m_time[c]);
         fftwf_free(m_freq[c]);
@@ -232,8 +292,6 @@ AudioTimeStretcher::cleanup()
     delete[] m_mashbuf;
     delete[] m_time;
     delete[] m_freq;
-    delete[] m_plan;
-    delete[] m_iplan;
 
     delete m_analysisWindow;
     delete m_synthesisWindow;
@@ -309,6 +367,31 @@ AudioTimeStretcher::getProcessingLatency() const
     return getWindowSize() - getInputIncrement();
 }
 
+void
+AudioTimeStretcher::recordSchedule(Schedule *schedule, bool analyseOnly)
+{
+    pthread_mutex_lock(&m_mutex);
+
+    m_recordSchedule = schedule;
+    m_followSchedule = 0;
+    m_analyseOnly = analyseOnly;
+
+    pthread_mutex_unlock(&m_mutex);
+}
+
+void
+AudioTimeStretcher::followSchedule(const Schedule *schedule, size_t firstHop)
+{
+    pthread_mutex_lock(&m_mutex);
+
+    m_followSchedule = schedule;
+    m_recordSchedule = 0;
+    m_analyseOnly = false;
+    m_hop = firstHop;
+
+    pthread_mutex_unlock(&m_mutex);
+}
+
 size_t
 AudioTimeStretcher::getRequiredInputSamples() const
 {
@@ -379,50 +462,83 @@ AudioTimeStretcher::putInput(float **input, size_t samples)
             
             for (size_t c = 0; c < m_channels; ++c) {
 
-#ifndef NDEBUG
                 size_t got = m_inbuf[c]->peek(m_tempbuf, m_wlen);
                 Q_ASSERT(got == m_wlen);
-#endif
+                Q_UNUSED(got);
 
                 analyseBlock(c, m_tempbuf);
             }
 
             bool transient = false;
-            if (shouldSharpen()) transient = isTransient();
-
             size_t n2 = m_n2;
 
-            if (transient) {
-                n2 = m_n1;
-            }
+            if (m_followSchedule && m_hop < m_followSchedule->size()) {
 
-            ++m_totalCount;
-            if (transient) ++m_transientCount;
+                const Hop &hop = (*m_followSchedule)[m_hop];
+                transient = hop.transient;
+                n2 = hop.n2;
 
-            m_n2sum += n2;
-            m_n2total += n2;
+                ++m_totalCount;
+                if (transient) ++m_transientCount;
+                m_n2total += n2;
 
-            if (m_totalCount > 50 && m_transientCount < m_totalCount) {
+            } else {
 
-                int fixed = m_transientCount * m_n1;
+                if (shouldSharpen()) transient = isTransient();
 
-                float idealTotal = m_totalCount * m_n1 * m_ratio;
-                float idealSquashy = idealTotal - fixed;
+                if (transient) {
+                    n2 = m_n1;
+                }
+
+                ++m_totalCount;
+                if (transient) ++m_transientCount;
+
+                m_n2sum += n2;
+                m_n2total += n2;
+
+                if (m_totalCount > 50 && m_transientCount < m_totalCount) {
+
+                    int fixed = m_transientCount * m_n1;
 
-                float squashyCount = m_totalCount - m_transientCount;
+                    float idealTotal = m_totalCount * m_n1 * m_ratio;
+                    float idealSquashy = idealTotal - fixed;
+
+                    float squashyCount = m_totalCount - m_transientCount;
                 
-                float fn2 = idealSquashy / squashyCount;
+                    float fn2 = idealSquashy / squashyCount;
 
-                n2 = int(fn2);
+                    n2 = int(fn2);
 
-                float remainder = fn2 - n2;
-                if (drand48() < remainder) ++n2;
+                    // Carry the fraction over, rather than dithering
+                    // at random, so that a schedule made twice (or
+                    // followed) comes out the same
+                    m_n2remainder += fn2 - n2;
+                    if (m_n2remainder >= 1.f) {
+                        ++n2;
+                        m_n2remainder -= 1.f;
+                    }
 
 #ifdef DEBUG_AUDIO_TIME_STRETCHER
-                if (n2 != m_n2) {
-                    std::cerr << m_n2 << " -> " << n2 << " (ideal = " << (idealSquashy / squashyCount) << ")" << std::endl;
-                }
+                    if (n2 != m_n2) {
+                        std::cerr << m_n2 << " -> " << n2 << " (ideal = " << (idealSquashy / squashyCount) << ")" << std::endl;
+                    }
 #endif
+                }
+
+                if (m_recordSchedule) {
+                    m_recordSchedule->push_back(Hop(transient, n2));
+                }
+            }
+
+            ++m_hop;
+
+            if (m_analyseOnly) {
+                for (size_t c = 0; c < m_channels; ++c) {
+                    m_inbuf[c]->skip(m_n1);
+                }
+                m_prevTransient = transient;
+                if (!transient) m_n2 = n2;
+                continue;
             }
 
             for (size_t c = 0; c < m_channels; ++c) {
@@ -547,7 +663,7 @@ AudioTimeStretcher::analyseBlock(size_t c, float *buf)
 	m_time[c][i] = buf[i];
     }
 
-    fftwf_execute(m_plan[c]); // m_time -> m_freq
+    fftwf_execute_dft_r2c(m_plan, m_time[c], m_freq[c]); // m_time -> m_freq
 }
 
 bool
@@ -636,7 +752,7 @@ AudioTimeStretcher::synthesiseBlock(size_t c,
         m_prevAdjustedPhase[c][i] = adjustedPhase;
     }
 
-    fftwf_execute(m_iplan[c]); // m_freq -> m_time, inverse fft
+    fftwf_execute_dft_c2r(m_iplan, m_freq[c], m_time[c]); // m_freq -> m_time, inverse fft
 
     for (size_t i = 0; i < m_wlen/2; ++i) {
         float temp = m_time[c][i];
@@ -39,6 +39,9 @@
 #include <fftw3.h>
 #include <pthread.h>
 #include <list>
+#include <vector>
+
+class QMutex;
 
 namespace Rosegarden
 {
@@ -136,6 +139,42 @@ public:
      */
     size_t getProcessingLatency() const;
 
+    /**
+     * The decision made at one hop: whether a transient was found,
+     * and how far the output moved on.
+     */
+    struct Hop {
+        Hop(bool t, size_t n) : transient(t), n2(n) { }
+        bool transient;
+        size_t n2;
+    };
+    typedef std::vector<Hop> Schedule;
+
+    /**
+     * Append the decision made at each hop from now on to the given
+     * schedule.  If analyseOnly is true, make no output at all: the
+     * schedule is all that is wanted, and it costs a fraction of the
+     * full stretch to make.
+     */
+    void recordSchedule(Schedule *schedule, bool analyseOnly);
+
+    /**
+     * Take the decision at each hop from the given schedule, starting
+     * at the given hop, instead of making it.  A schedule recorded from
+     * a mixdown of several channels makes the same decisions a
+     * stretcher of all of them would, so the channels can be stretched
+     * separately and still line up; and a stretcher started just after
+     * a transient (where the phases are reset) soon gives exactly the
+     * output one started from the beginning would.
+     */
+    void followSchedule(const Schedule *schedule, size_t firstHop);
+
+    /**
+     * The lock to hold while creating or destroying any FFTW plan, in
+     * the stretchers or anywhere else they may run alongside.
+     */
+    static QMutex *getPlannerMutex();
+
 protected:
     /**
      * Process a single phase vocoder frame from "in" into
@@ -163,6 +202,13 @@ protected:
     void calculateParameters();
     void cleanup();
 
+    /**
+     * Get the forward and inverse plans for a window length.  Plans
+     * are cached, and shared by all stretchers: FFTW's planner is not
+     * thread safe, but executing a plan on new arrays is.
+     */
+    static void getPlans(size_t wlen, fftwf_plan &plan, fftwf_plan &iplan);
+
     bool shouldSharpen() {
         return m_sharpen && (m_ratio > 0.25);
     }
@@ -185,6 +231,12 @@ protected:
     int m_n2total;
     std::list<int> m_n2list;
     int m_adjustCount;
+    float m_n2remainder;
+
+    Schedule *m_recordSchedule;
+    const Schedule *m_followSchedule;
+    bool m_analyseOnly;
+    size_t m_hop;
 
     float **m_prevPhase;
     float **m_prevAdjustedPhase;
@@ -197,8 +249,8 @@ protected:
     float *m_tempbuf;
     float **m_time;
     fftwf_complex **m_freq;
-    fftwf_plan *m_plan;
-    fftwf_plan *m_iplan;
+    fftwf_plan m_plan;
+    fftwf_plan m_iplan;
     
     RingBuffer<float> **m_inbuf;
     RingBuffer<float> **m_outbuf;
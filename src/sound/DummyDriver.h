@@ -49,6 +49,10 @@ public:
                                   const RealTime &,
                                   const RealTime &) { }
 
+    virtual void processEventsOut(const MappedEventBatch &,
+                                  const RealTime &,
+                                  const RealTime &) { }
+
     // Activate a recording state
     //
     virtual bool record(RecordStatus /*recordStatus*/,
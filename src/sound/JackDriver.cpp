@@ -19,6 +19,7 @@
 #include "AlsaDriver.h"
 #include "MappedStudio.h"
 #include "AudioProcess.h"
+#include "AudioKernels.h"
 #include "base/Profiler.h"
 #include "base/AudioLevel.h"
 #include "Audit.h"
@@ -1063,12 +1064,8 @@ JackDriver::jackProcess(jack_nframes_t nframes)
                 if (actual < nframes) {
                     reportFailure(MappedEvent::FailureBussMixUnderrun);
                 }
-                for (size_t i = 0; i < nframes; ++i) {
-                    sample_t sample = submaster[ch][i];
-                    if (sample > peak[ch])
-                        peak[ch] = sample;
-                    master[ch][i] += sample;
-                }
+                peak[ch] = AudioKernels::mixAndPeak(master[ch], submaster[ch],
+                                                    nframes, peak[ch]);
             }
         }
 
@@ -1179,12 +1176,13 @@ JackDriver::jackProcess(jack_nframes_t nframes)
                     reportFailure(MappedEvent::FailureMixUnderrun);
                 }
 
-                for (size_t f = 0; f < nframes; ++f) {
-                    sample_t sample = instrument[ch][f];
-                    if (sample > peak[ch])
-                        peak[ch] = sample;
-                    if (directToMaster)
-                        master[ch][f] += sample;
+                if (directToMaster) {
+                    peak[ch] = AudioKernels::mixAndPeak(master[ch],
+                                                        instrument[ch],
+                                                        nframes, peak[ch]);
+                } else {
+                    peak[ch] = AudioKernels::peak(instrument[ch], nframes,
+                                                  peak[ch]);
                 }
             }
 
@@ -1225,12 +1223,8 @@ JackDriver::jackProcess(jack_nframes_t nframes)
     float masterPeak[2] = { 0.0, 0.0 };
 
     for (int ch = 0; ch < 2; ++ch) {
-        for (size_t i = 0; i < nframes; ++i) {
-            sample_t sample = master[ch][i] * gain;
-            if (sample > masterPeak[ch])
-                masterPeak[ch] = sample;
-            master[ch][i] = sample;
-        }
+        masterPeak[ch] = AudioKernels::applyGainAndPeak(master[ch], nframes,
+                                                        gain, masterPeak[ch]);
     }
 
     LevelInfo info;
@@ -24,8 +24,7 @@
 #include "sound/MappedInserterBase.h"
 #include "sound/ControlBlock.h"
 
-#include <queue>
-#include <functional>
+#include <algorithm>
 
 //#define DEBUG_META_ITERATOR 1
 //#define DEBUG_PLAYING_AUDIO_FILES 1
@@ -124,9 +123,9 @@ MappedBufMetaIterator::moveIteratorToTime(MappedEventBuffer::iterator &iter,
 {
     // ??? Move this routine to MappedEventBuffer::iterator::moveTo(time).
 
-    // Rather than briefly unlock and immediately relock each
-    // iteration, we leave the lock on until we're done.
-    QReadLocker locker(iter.getLock());
+    // Rather than briefly leave and immediately re-enter each
+    // iteration, we stay in the read section until we're done.
+    MappedEventBuffer::ReadSection section(iter);
 
     // For each event from the current iterator position
     while (1) {
@@ -201,15 +200,9 @@ MappedBufMetaIterator::fetchEvents(MappedInserterBase &inserter,
     // fetchEventsNoncompeting.  We could re-slice it smarter but this
     // suffices.
 
-    // Make a queue of all segment starts that occur during the slice.
-    // ??? Why not use std::set instead?  All this is doing is sorting
-    //     the start times.  std::vector and std::sort() should be another
-    //     option.  Using std::priority_queue implies there will be a
-    //     Compare predicate that is more interesting than std::greater.
-    std::priority_queue<RealTime,
-                        std::vector<RealTime>,
-                        std::greater<RealTime> >
-        segStarts;
+    // Sort all segment starts that occur during the slice.  The
+    // vector is a member so that its storage is reused.
+    m_segmentStarts.clear();
 
     for (SegmentIterators::iterator i = m_iterators.begin();
          i != m_iterators.end();
@@ -218,20 +211,20 @@ MappedBufMetaIterator::fetchEvents(MappedInserterBase &inserter,
         RealTime end;
         (*i)->getSegment()->getStartEnd(start, end);
         // If this segment's start is within the timeslice, add it
-        // to segStarts.
+        // to m_segmentStarts.
         if (start >= startTime  &&  start < endTime)
-            segStarts.push(start);
+            m_segmentStarts.push_back(start);
     }
 
+    std::sort(m_segmentStarts.begin(), m_segmentStarts.end());
+
     // The progressive starting time, updated each iteration.
     RealTime innerStart = startTime;
 
     // For each distinct gap, do a slice.
-    while (!segStarts.empty()) {
+    for (size_t i = 0; i < m_segmentStarts.size(); ++i) {
         // We're at innerStart.  Get a mapper that didn't start yet.
-        RealTime innerEnd = segStarts.top();
-        // Remove it from the queue.
-        segStarts.pop();
+        RealTime innerEnd = m_segmentStarts[i];
         // If it starts exactly at innerStart, it doesn't need its own
         // slice.
         if (innerEnd == innerStart)
@@ -243,8 +236,8 @@ MappedBufMetaIterator::fetchEvents(MappedInserterBase &inserter,
     }
 
     // Do one more slice to take us to the end time.  This is always
-    // correct to do, since segStarts can't contain a start equal to
-    // endTime.
+    // correct to do, since m_segmentStarts can't contain a start equal
+    // to endTime.
     fetchEventsNoncompeting(inserter, innerStart, endTime);
 
     return;
@@ -263,144 +256,152 @@ fetchEventsNoncompeting(MappedInserterBase &inserter,
     Profiler profiler("MappedBufMetaIterator::fetchEventsNoncompeting", false);
 
     m_currentTime = endTime;
-    
-    // For each segment, activate segments that have anything playing.
-    for (SegmentIterators::iterator i = m_iterators.begin();
-         i != m_iterators.end();
-         ++i) { 
+
+    // Merge the active segments' events in time order.  Each active
+    // segment with an event in this slice has one entry in the heap
+    // m_pending, keyed on the time of that event, so that taking an
+    // event costs O(log n) in the number of active segments rather
+    // than a pass over all of them.  Segments that aren't active
+    // never enter the heap, and those that run out of events for this
+    // slice leave it.
+    m_pending.clear();
+
+    // For each segment, activate segments that have anything playing,
+    // and queue their first events.
+    for (size_t i = 0; i < m_iterators.size(); ++i) {
+        MappedEventBuffer::iterator *iter = m_iterators[i];
         RealTime start;
         RealTime end;
-        (*i)->getSegment()->getStartEnd(start, end);
+        iter->getSegment()->getStartEnd(start, end);
 
         // Activate segments that have anything playing during this
         // slice.  We include segments that end exactly when we start, but
         // not segments that start exactly when we end.
         bool active = (start < endTime  &&  end >= startTime);
-        (*i)->setActive(active, startTime);
+        iter->setActive(active, startTime);
+
+        queueNextEvent(inserter, i, startTime, endTime);
     }
 
-    // State variable to allow the outer (round-robin) loop to run until
-    // the inner (segment) loop has nothing to do.
-    bool segmentsHaveMore = false;
-
-    // For each pass through the segments.
-    // On each pass, we only process one event in each segment.
-    // ??? Why not process all the events in each segment?
-    //     for each segment
-    //         for each event
-    //             process the event
-    //         rof
-    //     rof
-    //     Is this round-robin approach intended to spread the locks out?
-    //     Is it really necessary?
-    //     Prior to the auto-channels feature, this routine was called
-    //     MappedSegmentsMetaIterator::fillCompositionWithEventsUntil().
-    //     It has always used this round-robin approach.
-    do {
-        segmentsHaveMore = false;
-
-        // For each segment, process only the first event.
-        for (size_t i = 0; i < m_iterators.size(); ++i) {
-            MappedEventBuffer::iterator *iter = m_iterators[i];
+    while (!m_pending.empty()) {
+        std::pop_heap(m_pending.begin(), m_pending.end());
+        const size_t i = m_pending.back().index;
+        m_pending.pop_back();
 
-#ifdef DEBUG_META_ITERATOR
-            RG_DEBUG << "fetchEventsNoncompeting() : checking segment #" << i;
-#endif
+        MappedEventBuffer::iterator *iter = m_iterators[i];
 
-            // Skip any segments that aren't active.
-            if (!iter->getActive()) {
-#ifdef DEBUG_META_ITERATOR
-                RG_DEBUG << "fetchEventsNoncompeting() : no more events to get for this slice in segment #" << i;
-#endif
+        {
+            // This keeps the iterator's buffer from being freed by
+            // a reallocation while we are holding a pointer into it.
+            // No function we call will hold the `event' pointer past
+            // its own scope, implying that nothing holds it past this
+            // block, which is this section's scope.
+            MappedEventBuffer::ReadSection section(*iter);
 
+            // Look again, in case the buffer was refilled since we
+            // queued it.
+            MappedEvent *event = iter->peek();
+            if (!event  ||  !event->isValid())
                 continue;
-            }
 
-            if (iter->atEnd()) {
-#ifdef DEBUG_META_ITERATOR
-                RG_DEBUG << "fetchEventsNoncompeting() : " << endTime << " reached end of segment #" << i;
-#endif
-                // Make this iterator abort early in future
-                // iterations, since we know it's all done.
+            if (event->getEventTime() >= endTime) {
                 iter->setInactive();
                 continue;
             }
 
-            // This locks the iterator's buffer against writes, lest
-            // writing cause reallocating the buffer while we are
-            // holding a pointer into it.  No function we call will
-            // hold the `event' pointer past its own scope, implying
-            // that nothing holds it past an iteration of this loop,
-            // which is this lock's scope.
-            QReadLocker locker(iter->getLock());
-
-            MappedEvent *event = iter->peek();
-
-            // We couldn't fetch an event or it failed a sanity check.
-            // So proceed to the next iterator but keep looking at
-            // this one - incrementing it does nothing useful, and it
-            // might get more events.  But don't set segmentsHaveMore,
-            // lest we loop forever waiting for a valid event.
-            if (!event  ||  !event->isValid())
-                continue;
+            // Increment the iterator, since we're taking this event.
+            ++(*iter);
 
-            // If we got this far, make the mapper ready.  Do this
-            // even if the note won't play during this slice, because
-            // sometimes/always we prepare channels slightly ahead of
-            // their first notes, to fix bug #1378
-            if (!iter->isReady())
-                iter->makeReady(inserter, startTime);
-
-            // If this event starts prior to the end of the slice, take it.
-            if (event->getEventTime() < endTime) {
-                // Increment the iterator, since we're taking this
-                // event.  NB, in the other branch it is not yet used
-                // so we leave `iter' where it is.
-                ++(*iter);
-
-                // If we got this far, we'll want to try the next
-                // iteration, so note it.
-                segmentsHaveMore = true;
-                
 #ifdef DEBUG_META_ITERATOR
-                RG_DEBUG << "fetchEventsNoncompeting() : " << endTime
-                         << " seeing evt from segment #" << i
-                         << " : trackId: " << event->getTrackId()
-                         << " channel: " << (unsigned int) event->getRecordedChannel()
-                         << " - inst: " << event->getInstrument()
-                         << " - type: " << event->getType()
-                         << " - time: " << event->getEventTime()
-                         << " - duration: " << event->getDuration()
-                         << " - data1: " << (unsigned int)event->getData1()
-                         << " - data2: " << (unsigned int)event->getData2();
+            RG_DEBUG << "fetchEventsNoncompeting() : " << endTime
+                     << " seeing evt from segment #" << i
+                     << " : trackId: " << event->getTrackId()
+                     << " channel: " << (unsigned int) event->getRecordedChannel()
+                     << " - inst: " << event->getInstrument()
+                     << " - type: " << event->getType()
+                     << " - time: " << event->getEventTime()
+                     << " - duration: " << event->getDuration()
+                     << " - data1: " << (unsigned int)event->getData1()
+                     << " - data2: " << (unsigned int)event->getData2();
 #endif
 
-                if (iter->shouldPlay(event, startTime)) {
-                    iter->doInsert(inserter, *event);
+            if (iter->shouldPlay(event, startTime)) {
+                iter->doInsert(inserter, *event);
 #ifdef DEBUG_META_ITERATOR
-                    RG_DEBUG << "  Inserting event";
+                RG_DEBUG << "  Inserting event";
 #endif
 
-                } else {
-#ifdef DEBUG_META_ITERATOR
-                    RG_DEBUG << "  Skipping event";
-#endif
-                }
             } else {
-                // This iterator has more events but they only sound
-                // after the end of this slice, so it's done.
-                iter->setInactive();
-
 #ifdef DEBUG_META_ITERATOR
-                RG_DEBUG << "fetchEventsNoncompeting() : Event is past end for segment #" << i;
+                RG_DEBUG << "  Skipping event";
 #endif
             }
         }
-    } while (segmentsHaveMore);
+
+        // Put the segment back with its next event, if that's in the
+        // slice too
+        queueNextEvent(inserter, i, startTime, endTime);
+    }
 
     return;
 }
 
+void
+MappedBufMetaIterator::queueNextEvent(MappedInserterBase &inserter,
+                                      size_t index,
+                                      const RealTime &startTime,
+                                      const RealTime &endTime)
+{
+    MappedEventBuffer::iterator *iter = m_iterators[index];
+
+    // Skip any segments that aren't active.
+    if (!iter->getActive()) {
+#ifdef DEBUG_META_ITERATOR
+        RG_DEBUG << "fetchEventsNoncompeting() : no more events to get for this slice in segment #" << index;
+#endif
+        return;
+    }
+
+    if (iter->atEnd()) {
+#ifdef DEBUG_META_ITERATOR
+        RG_DEBUG << "fetchEventsNoncompeting() : " << endTime << " reached end of segment #" << index;
+#endif
+        iter->setInactive();
+        return;
+    }
+
+    MappedEventBuffer::ReadSection section(*iter);
+
+    const MappedEvent *event = iter->peek();
+
+    // We couldn't fetch an event or it failed a sanity check.  Leave
+    // this one out of the rest of the slice; it might have more
+    // events by the next one.
+    if (!event  ||  !event->isValid())
+        return;
+
+    // If we got this far, make the mapper ready.  Do this even if the
+    // note won't play during this slice, because sometimes/always we
+    // prepare channels slightly ahead of their first notes, to fix
+    // bug #1378
+    if (!iter->isReady())
+        iter->makeReady(inserter, startTime);
+
+    // If this event starts prior to the end of the slice, queue it.
+    if (event->getEventTime() < endTime) {
+        m_pending.push_back(PendingEvent(event->getEventTime(), index));
+        std::push_heap(m_pending.begin(), m_pending.end());
+    } else {
+        // This iterator has more events but they only sound after the
+        // end of this slice, so it's done.
+        iter->setInactive();
+
+#ifdef DEBUG_META_ITERATOR
+        RG_DEBUG << "fetchEventsNoncompeting() : Event is past end for segment #" << index;
+#endif
+    }
+}
+
 void
 MappedBufMetaIterator::
 resetIteratorForSegment(QSharedPointer<MappedEventBuffer> mappedEventBuffer, bool immediate)
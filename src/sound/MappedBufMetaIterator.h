@@ -135,6 +135,38 @@ private:
     typedef std::vector<MappedEventBuffer::iterator *> SegmentIterators;
     SegmentIterators m_iterators;
 
+    /// An active iterator and the time of its next event.
+    struct PendingEvent
+    {
+        PendingEvent(const RealTime &t, size_t i) : time(t), index(i) { }
+        RealTime time;
+        size_t index;  // into m_iterators
+
+        /// For a min-heap: earliest time, then lowest index, on top.
+        bool operator<(const PendingEvent &other) const {
+            if (time != other.time) return other.time < time;
+            return other.index < index;
+        }
+    };
+
+    /// Start times of segments that start within the current slice.
+    std::vector<RealTime> m_segmentStarts;
+
+    /// Heap of the iterators with events left in the current slice.
+    /**
+     * Kept as a member so that its storage is reused from slice to
+     * slice.
+     */
+    std::vector<PendingEvent> m_pending;
+
+    /// Peek at iter's next event and queue it if it is in the slice.
+    /**
+     * Makes the mapper ready on the way, and marks the iterator
+     * inactive if it has nothing more for this slice.
+     */
+    void queueNextEvent(MappedInserterBase &inserter, size_t index,
+                        const RealTime &startTime, const RealTime &endTime);
+
     std::vector<MappedEvent> m_playingAudioSegments;
 };
 
@@ -23,9 +23,12 @@
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QMutexLocker>
 #include <QtGlobal>
 
+#include <algorithm>
 #include <cstdlib>
+#include <ostream>
 
 // #define DEBUG_MAPPEDEVENT 1
 
@@ -173,6 +176,7 @@ MappedEvent::operator=(const MappedEvent &mE)
     m_fadeOutTime = mE.getFadeOutTime();
     m_recordedChannel = mE.getRecordedChannel();
     m_recordedDevice = mE.getRecordedDevice();
+    m_stretchRatio = mE.getStretchRatio();
 
     return *this;
 }
@@ -310,6 +314,109 @@ void DataBlockFile::prepareToRead()
 
 //--------------------------------------------------
 
+/// The bytes of a data block, shared by DataBlock handles.
+/**
+ * Only the first size bytes are the block.  Any space after them is
+ * room for DataBlockRepository to extend the block in place: readers
+ * never look past the size they saw, so appending there and then
+ * publishing the new size is safe.
+ */
+class DataBlockPayload
+{
+public:
+    DataBlockPayload() :
+        refs(1), id(0), size(0), spilled(false), hash(0),
+        registrations(1) { }
+
+    QAtomicInt refs;
+    /// The full id, generation and all, that this payload was
+    /// published under.  Never changes, so readers may compare it.
+    DataBlockRepository::blockid id;
+    std::vector<char> bytes;  // empty if spilled
+    mutable QAtomicInt size;
+    bool spilled;
+    unsigned int hash;
+    /// How many times the block has been registered and not yet
+    /// unregistered.  Written and read with the write lock held.
+    int registrations;
+
+    size_t getSize() const  { return size.fetchAndAddAcquire(0); }
+};
+
+DataBlock::DataBlock() :
+    m_payload(0),
+    m_size(0)
+{
+}
+
+DataBlock::DataBlock(DataBlockPayload *payload) :
+    m_payload(payload),
+    m_size(payload ? payload->getSize() : 0)
+{
+}
+
+DataBlock::DataBlock(const DataBlock &other) :
+    m_payload(other.m_payload),
+    m_size(other.m_size)
+{
+    if (m_payload) m_payload->refs.ref();
+}
+
+DataBlock &
+DataBlock::operator=(const DataBlock &other)
+{
+    if (other.m_payload) other.m_payload->refs.ref();
+    if (m_payload && !m_payload->refs.deref()) delete m_payload;
+    m_payload = other.m_payload;
+    m_size = other.m_size;
+    return *this;
+}
+
+DataBlock::~DataBlock()
+{
+    if (m_payload && !m_payload->refs.deref()) delete m_payload;
+}
+
+const char *
+DataBlock::data() const
+{
+    return m_size ? &m_payload->bytes[0] : "";
+}
+
+size_t
+DataBlock::size() const
+{
+    return m_size;
+}
+
+std::string
+DataBlock::toString() const
+{
+    return std::string(data(), m_size);
+}
+
+//--------------------------------------------------
+
+static const unsigned int HashSeed = 2166136261u;
+
+static unsigned int
+hashBytes(const char *s, size_t n, unsigned int h = HashSeed)
+{
+    // FNV-1a, which can be carried on from an earlier hash when a
+    // block is extended
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+const size_t DataBlockRepository::ChunkSize;
+const size_t DataBlockRepository::MaxChunks;
+const unsigned int DataBlockRepository::IndexBits;
+const DataBlockRepository::blockid DataBlockRepository::IndexMask;
+const DataBlockRepository::blockid DataBlockRepository::GenerationMask;
+
 DataBlockRepository* DataBlockRepository::getInstance()
 {
     if (!m_instance)
@@ -317,74 +424,332 @@ DataBlockRepository* DataBlockRepository::getInstance()
     return m_instance;
 }
 
-std::string DataBlockRepository::getDataBlock(DataBlockRepository::blockid id)
+DataBlockRepository::blockid
+DataBlockRepository::reuseId(blockid id)
+{
+    blockid generation = ((id >> IndexBits) + 1) & GenerationMask;
+    return (generation << IndexBits) | (id & IndexMask);
+}
+
+DataBlockRepository::Slot *
+DataBlockRepository::findSlot(blockid id)
+{
+    size_t chunk = (id & IndexMask) / ChunkSize;
+    if (chunk >= MaxChunks) return 0;
+
+    Slot *table = m_chunks[chunk].fetchAndAddAcquire(0);
+    if (!table) return 0;
+    return &table[id % ChunkSize];
+}
+
+DataBlockRepository::Slot *
+DataBlockRepository::findOrCreateSlot(blockid id)
 {
-    DataBlockFile dataBlockFile(id);
+    size_t chunk = (id & IndexMask) / ChunkSize;
+    if (chunk >= MaxChunks) return 0;
 
-    if (dataBlockFile.exists())
-        return dataBlockFile.getData();
+    Slot *table = m_chunks[chunk].fetchAndAddRelaxed(0);
+    if (!table) {
+        table = new Slot[ChunkSize];
+        m_chunks[chunk].fetchAndStoreOrdered(table);
+    }
+    return &table[id % ChunkSize];
+}
 
-    return std::string();
+DataBlockPayload *
+DataBlockRepository::findPayload(blockid id)
+{
+    Slot *slot = findSlot(id);
+    DataBlockPayload *payload = slot ? slot->fetchAndAddRelaxed(0) : 0;
+    return (payload && payload->id == id) ? payload : 0;
+}
+
+DataBlock DataBlockRepository::getBlock(DataBlockRepository::blockid id)
+{
+    // Count ourselves in, so that a writer won't free a payload we
+    // might be about to take a reference to
+    m_readers.ref();
+    DataBlockPayload *payload = 0;
+    Slot *slot = findSlot(id);
+    if (slot) {
+        payload = slot->fetchAndAddAcquire(0);
+        // (an older id for the slot, held by a stale copy of an event)
+        if (payload && payload->id != id) payload = 0;
+        if (payload) payload->refs.ref();
+    }
+    m_readers.deref();
+
+    if (!payload || !payload->spilled) return DataBlock(payload);
+
+    DataBlockPayload *loaded = new DataBlockPayload;
+    {
+        QMutexLocker locker(&m_writeLock);
+        // The id may have been retired and reused since we looked
+        if (findPayload(id) == payload) {
+            std::string bytes = DataBlockFile(id).getData();
+            loaded->bytes.assign(bytes.begin(), bytes.end());
+            loaded->size.fetchAndStoreRelease(int(bytes.size()));
+            ++m_stats.fileReads;
+        }
+    }
+    if (!payload->refs.deref()) delete payload;
+    return DataBlock(loaded);
+}
+
+std::string DataBlockRepository::getDataBlock(DataBlockRepository::blockid id)
+{
+    return getBlock(id).toString();
 }
 
 
 std::string DataBlockRepository::getDataBlockForEvent(const MappedEvent* e)
+{
+    return getBlockForEvent(e).toString();
+}
+
+DataBlock DataBlockRepository::getBlockForEvent(const MappedEvent* e)
 {
     blockid id = e->getDataBlockId();
     if (id == 0) {
    //     std::cerr << "WARNING: DataBlockRepository::getDataBlockForEvent called on event with data block id 0" << std::endl;
-        return "";
+        return DataBlock();
     }
-    return getInstance()->getDataBlock(id);
+    return getInstance()->getBlock(id);
 }
 
 void DataBlockRepository::setDataBlockForEvent(MappedEvent* e,
                                                const std::string& s,
                                                bool extend)
 {
+    DataBlockRepository *repository = getInstance();
     blockid id = e->getDataBlockId();
-    if (id == 0) {
+
+    if (id != 0 && extend) {
 #ifdef DEBUG_MAPPEDEVENT
-        RG_DEBUG << "Creating new datablock for event";
+        RG_DEBUG << "Extending datablock" << id << "by" << s.length()
+                  << "chars";
 #endif
-        getInstance()->registerDataBlockForEvent(s, e);
-    } else {
+        e->setDataBlockId(repository->extendDataBlock(id, s));
+        return;
+    }
+
 #ifdef DEBUG_MAPPEDEVENT
-        RG_DEBUG << "Writing" << s.length()
-                  << "chars to file for datablock" << id;
+    RG_DEBUG << "Creating new datablock for event";
 #endif
+    // Register the new block before releasing the old, so that
+    // setting the same bytes again doesn't free and remake them
+    repository->registerDataBlockForEvent(s, e);
+    if (id != 0) repository->unregisterDataBlock(id);
+}
+
+bool DataBlockRepository::hasDataBlock(DataBlockRepository::blockid id)
+{
+    m_readers.ref();
+    Slot *slot = findSlot(id);
+    DataBlockPayload *payload = slot ? slot->fetchAndAddAcquire(0) : 0;
+    bool found = (payload && payload->id == id);
+    m_readers.deref();
+    return found;
+}
+
+DataBlockPayload *
+DataBlockRepository::makePayload(blockid id, const std::string &s)
+{
+    DataBlockPayload *payload = new DataBlockPayload;
+    payload->id = id;
+    payload->hash = hashBytes(s.data(), s.size());
+    payload->size.fetchAndStoreRelaxed(int(s.size()));
+
+    if (m_spillThreshold > 0 && s.size() > m_spillThreshold) {
         DataBlockFile dataBlockFile(id);
-        if (extend)
-            { dataBlockFile.addDataString(s);}
-        else
-            { dataBlockFile.setData(s); }
+        dataBlockFile.setData(s);
+        payload->spilled = true;
+        ++m_stats.fileWrites;
+        ++m_stats.spilled;
+    } else {
+        payload->bytes.assign(s.begin(), s.end());
+        m_stats.bytes += s.size();
     }
+
+    ++m_stats.blocks;
+    return payload;
 }
 
-bool DataBlockRepository::hasDataBlock(DataBlockRepository::blockid id)
+void
+DataBlockRepository::publish(blockid id, DataBlockPayload *payload)
 {
-    return DataBlockFile(id).exists();
+    Slot *slot = findOrCreateSlot(id);
+    DataBlockPayload *old = slot->fetchAndStoreOrdered(payload);
+    if (old) m_retired.push_back(old);
+}
+
+void
+DataBlockRepository::retire(blockid id)
+{
+    Slot *slot = findSlot(id);
+    if (!slot) return;
+
+    DataBlockPayload *payload = slot->fetchAndStoreOrdered(0);
+    if (!payload) return;
+
+    if (payload->spilled) {
+        // (named for the full id, which may not be the one given)
+        DataBlockFile dataBlockFile(payload->id);
+        dataBlockFile.clear();
+        --m_stats.spilled;
+    } else {
+        m_stats.bytes -= payload->getSize();
+    }
+    --m_stats.blocks;
+
+    m_retired.push_back(payload);
+}
+
+void
+DataBlockRepository::reclaim()
+{
+    // A reader that loaded a retired payload did so inside a lookup,
+    // and took its reference before leaving.  So once there are no
+    // readers in a lookup, only references can keep a payload alive.
+    if (m_readers.fetchAndAddOrdered(0) != 0) return;
+
+    for (size_t i = 0; i < m_retired.size(); ++i) {
+        if (!m_retired[i]->refs.deref()) delete m_retired[i];
+    }
+    m_retired.clear();
+}
+
+void
+DataBlockRepository::removeHash(unsigned int hash, blockid id)
+{
+    typedef std::multimap<unsigned int, blockid>::iterator HashIterator;
+    std::pair<HashIterator, HashIterator> range = m_byHash.equal_range(hash);
+    for (HashIterator i = range.first; i != range.second; ++i) {
+        if (i->second == id) {
+            m_byHash.erase(i);
+            return;
+        }
+    }
 }
 
 DataBlockRepository::blockid DataBlockRepository::registerDataBlock(const std::string& s)
 {
-    blockid id = 0;
-    while (id == 0 || DataBlockFile(id).exists())
-        id = (blockid)random();
+    QMutexLocker locker(&m_writeLock);
+
+    // Look for an identical block
+    unsigned int hash = hashBytes(s.data(), s.size());
+    typedef std::multimap<unsigned int, blockid>::const_iterator HashIterator;
+    std::pair<HashIterator, HashIterator> range = m_byHash.equal_range(hash);
+    for (HashIterator i = range.first; i != range.second; ++i) {
+        DataBlockPayload *payload = findPayload(i->second);
+        if (!payload || payload->getSize() != s.size()) continue;
+
+        bool same;
+        if (payload->spilled) {
+            same = (DataBlockFile(i->second).getData() == s);
+            ++m_stats.fileReads;
+        } else {
+            same = std::equal(s.begin(), s.end(), payload->bytes.begin());
+        }
+        if (same) {
+            ++payload->registrations;
+            ++m_stats.shared;
+            return i->second;
+        }
+    }
+
+    // Reuse the slot of a block that has been unregistered, if any,
+    // under a new generation of its id
+    blockid id;
+    if (!m_freeIds.empty()) {
+        id = reuseId(m_freeIds.back());
+        m_freeIds.pop_back();
+    } else if (m_nextId / ChunkSize < MaxChunks) {
+        id = m_nextId++;
+    } else {
+        RG_WARNING << "DataBlockRepository::registerDataBlock(): out of block ids";
+        return 0;
+    }
 
  //   std::cerr << "DataBlockRepository::registerDataBlock: " << s.length() << " chars, id is " << id << std::endl;
 
-    DataBlockFile dataBlockFile(id);
-    dataBlockFile.setData(s);
+    publish(id, makePayload(id, s));
+    m_byHash.insert(std::pair<unsigned int, blockid>(hash, id));
+    reclaim();
 
     return id;
 }
 
+DataBlockRepository::blockid
+DataBlockRepository::extendDataBlock(blockid id, const std::string &s)
+{
+    {
+        QMutexLocker locker(&m_writeLock);
+
+        // A block registered only once, and in memory, belongs to the
+        // event extending it, so we can append to it rather than
+        // copying it.  Growing its space geometrically keeps adding a
+        // byte at a time linear overall.
+        DataBlockPayload *payload = findPayload(id);
+        const size_t newSize = payload ? payload->getSize() + s.size() : 0;
+
+        if (payload && !payload->spilled && payload->registrations == 1 &&
+            (m_spillThreshold == 0 || newSize <= m_spillThreshold)) {
+
+            const size_t oldSize = payload->getSize();
+            const unsigned int hash =
+                hashBytes(s.data(), s.size(), payload->hash);
+
+            removeHash(payload->hash, id);
+
+            if (newSize <= payload->bytes.size()) {
+                std::copy(s.begin(), s.end(),
+                          payload->bytes.begin() + oldSize);
+                payload->hash = hash;
+                payload->size.fetchAndStoreRelease(int(newSize));
+            } else {
+                DataBlockPayload *grown = new DataBlockPayload;
+                grown->id = id;
+                grown->bytes.resize(std::max(newSize,
+                                             payload->bytes.size() * 2));
+                std::copy(payload->bytes.begin(),
+                          payload->bytes.begin() + oldSize,
+                          grown->bytes.begin());
+                std::copy(s.begin(), s.end(),
+                          grown->bytes.begin() + oldSize);
+                grown->hash = hash;
+                grown->size.fetchAndStoreRelaxed(int(newSize));
+                publish(id, grown);
+                reclaim();
+            }
+
+            m_byHash.insert(std::pair<unsigned int, blockid>(hash, id));
+            m_stats.bytes += s.size();
+            return id;
+        }
+    }
+
+    // Shared or in a file: make a new block, and let go of the old
+    blockid newId = registerDataBlock(getDataBlock(id) + s);
+    unregisterDataBlock(id);
+    return newId;
+}
+
 void DataBlockRepository::unregisterDataBlock(DataBlockRepository::blockid id)
 {
-    DataBlockFile dataBlockFile(id);
+    QMutexLocker locker(&m_writeLock);
 
-    dataBlockFile.clear();
+    DataBlockPayload *payload = findPayload(id);
+    if (!payload) return;
+
+    // Other registrations of the same bytes still use it
+    if (--payload->registrations > 0) return;
+
+    removeHash(payload->hash, id);
+    retire(id);
+    reclaim();
+
+    m_freeIds.push_back(id);
 }
 
 void DataBlockRepository::registerDataBlockForEvent(const std::string& s, MappedEvent* e)
@@ -395,10 +760,13 @@ void DataBlockRepository::registerDataBlockForEvent(const std::string& s, Mapped
 void DataBlockRepository::unregisterDataBlockForEvent(MappedEvent* e)
 {
     unregisterDataBlock(e->getDataBlockId());
+    e->setDataBlockId(0);
 }
 
 
-DataBlockRepository::DataBlockRepository()
+DataBlockRepository::DataBlockRepository() :
+    m_nextId(1),
+    m_spillThreshold(0)
 {}
 
 void DataBlockRepository::clear()
@@ -407,7 +775,27 @@ void DataBlockRepository::clear()
     RG_DEBUG << "DataBlockRepository::clear()";
 #endif
 
-    // Erase all 'datablock_*' files
+    DataBlockRepository *repository = getInstance();
+    {
+        QMutexLocker locker(&repository->m_writeLock);
+
+        // Every slot in use becomes free for reuse, in a new
+        // generation, so that events from before the clear still
+        // find nothing
+        for (blockid index = 1; index < repository->m_nextId; ++index) {
+            Slot *slot = repository->findSlot(index);
+            DataBlockPayload *payload =
+                slot ? slot->fetchAndAddRelaxed(0) : 0;
+            if (!payload) continue;
+            repository->m_freeIds.push_back(payload->id);
+            repository->retire(index);
+        }
+        repository->m_byHash.clear();
+        repository->reclaim();
+    }
+
+    // Erase any 'datablock_*' files left by earlier versions, which
+    // kept all blocks in files
     //
     QString tmpPath = TempDir::path();
 
@@ -426,15 +814,35 @@ void DataBlockRepository::clear()
     }
 }
 
-// !!! We assume there is already a datablock
-void DataBlockRepository::addDataByteForEvent(MidiByte byte, MappedEvent* e)
+void DataBlockRepository::setSpillThreshold(size_t bytes)
 {
-    DataBlockFile dataBlockFile(e->getDataBlockId());
-    dataBlockFile.addDataByte(byte);
+    DataBlockRepository *repository = getInstance();
+    QMutexLocker locker(&repository->m_writeLock);
+    repository->m_spillThreshold = bytes;
+}
 
+DataBlockRepository::Stats DataBlockRepository::getStats()
+{
+    DataBlockRepository *repository = getInstance();
+    QMutexLocker locker(&repository->m_writeLock);
+    return repository->m_stats;
+}
+
+void DataBlockRepository::dumpStats(std::ostream &out)
+{
+    Stats stats = getStats();
+
+    out << "DataBlockRepository: " << stats.blocks << " blocks ("
+        << stats.bytes << " bytes in memory, " << stats.spilled
+        << " in files), " << stats.shared << " shared registrations, "
+        << stats.fileReads << " file reads, " << stats.fileWrites
+        << " file writes" << std::endl;
 }
 
-// setDataBlockForEvent does what addDataStringForEvent used to do.
+void DataBlockRepository::addDataByteForEvent(MidiByte byte, MappedEvent* e)
+{
+    setDataBlockForEvent(e, std::string(1, char(byte)), true);
+}
 
 
 DataBlockRepository* DataBlockRepository::m_instance = 0;
@@ -15,19 +15,81 @@
 #ifndef RG_MAPPEDEVENT_H
 #define RG_MAPPEDEVENT_H
 
+#include <QAtomicInt>
+#include <QAtomicPointer>
 #include <QDataStream>
+#include <QMutex>
 
 #include "base/RealTime.h"
 #include "base/Track.h"
 #include "base/Event.h"
 
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+
 
 namespace Rosegarden
 {
 class MappedEvent;
+class DataBlockPayload;
+
+/// A read-only handle to the bytes of a data block.
+/**
+ * Handles share the bytes by reference count, so that they stay valid
+ * after the block is replaced or the repository is cleared, and
+ * copying a handle doesn't copy the data.
+ */
+class DataBlock
+{
+public:
+    DataBlock();
+    DataBlock(const DataBlock &);
+    DataBlock &operator=(const DataBlock &);
+    ~DataBlock();
+
+    bool isNull() const  { return m_payload == 0; }
+    const char *data() const;
+    size_t size() const;
+
+    std::string toString() const;
+
+private:
+    friend class DataBlockRepository;
+    explicit DataBlock(DataBlockPayload *payload);
+
+    DataBlockPayload *m_payload;
+    /// The size of the block when the handle was taken.  The block
+    /// may be extended later, but not within this handle.
+    size_t m_size;
+};
 
 /// Used for storing data blocks for SysEx messages.
 /**
+ *  Blocks are held in memory.  Reading one (getDataBlockForEvent(),
+ *  getBlockForEvent()) takes no lock and does no file I/O, so that the
+ *  sequencer thread can send a large SysEx dump during playback.
+ *
+ *  Blocks are looked up by id in a table whose slots are published
+ *  atomically.  A block that is replaced or cleared while a reader is
+ *  looking it up is retired rather than deleted, and freed by a later
+ *  writer once no reader is inside a lookup.
+ *
+ *  Registering the same bytes twice gives the same id, so remapping a
+ *  segment full of SysEx doesn't grow the repository.  Each block
+ *  counts its registrations, and unregistering it only frees it, and
+ *  its id for reuse, once the last registration has gone.
+ *  MappedEvents are copied by value, so a registration belongs to
+ *  whoever made it rather than to every copy of the event.
+ *
+ *  Extending a block that only one registration uses appends to it in
+ *  place, keeping its id.  A shared block is left alone: the event
+ *  gets a new block with the extended bytes and lets go of the old.
+ *
+ *  Blocks larger than the spill threshold, if one is set, are kept in
+ *  files under TempDir::path() instead, and read back when asked for.
+ *
  *  @see MappedEvent::m_dataBlockId
  */
 class DataBlockRepository
@@ -38,18 +100,38 @@ public:
 
     static DataBlockRepository* getInstance();
     static std::string getDataBlockForEvent(const MappedEvent*);
+    static DataBlock getBlockForEvent(const MappedEvent*);
     static void setDataBlockForEvent(MappedEvent*, const std::string&,
                                      bool extend = false);
     /**
-     * Clear all block files
+     * Clear all blocks, and remove any spill files
      */
     static void clear();
     bool hasDataBlock(blockid);
 
+    /// Keep blocks larger than this many bytes in files.  0 (the
+    /// default) keeps all blocks in memory.
+    static void setSpillThreshold(size_t bytes);
+
+    struct Stats
+    {
+        Stats() : blocks(0), bytes(0), shared(0), spilled(0),
+                  fileReads(0), fileWrites(0) { }
+        int blocks;      ///< Blocks currently registered
+        size_t bytes;    ///< Bytes held in memory by them
+        int shared;      ///< Registrations that found an identical block
+        int spilled;     ///< Blocks currently kept in files
+        int fileReads;
+        int fileWrites;
+    };
+    static Stats getStats();
+    static void dumpStats(std::ostream &);
+
 protected:
     DataBlockRepository();
 
     std::string getDataBlock(blockid);
+    DataBlock getBlock(blockid);
 
     void addDataByteForEvent(MidiByte byte, MappedEvent*);
 
@@ -57,13 +139,76 @@ protected:
     blockid registerDataBlock(const std::string&);
     void unregisterDataBlock(blockid);
 
+    /// Append to a block, returning the id of the extended block.
+    blockid extendDataBlock(blockid, const std::string&);
+
     void registerDataBlockForEvent(const std::string&, MappedEvent*);
     void unregisterDataBlockForEvent(MappedEvent*);
 
+private:
+    typedef QAtomicPointer<DataBlockPayload> Slot;
+
+    /// The table is allocated in chunks as ids are used, and chunks
+    /// are never freed, so that a reader can index it without a lock.
+    static const size_t ChunkSize = 1024;
+    static const size_t MaxChunks = 4096;
+
+    /// An id is the index of its slot in the low IndexBits bits
+    /// (enough for ChunkSize * MaxChunks slots), and above them a
+    /// generation, counting how often the slot has been reused.  A
+    /// copy of an event still holding an unregistered id then finds
+    /// nothing, rather than the block that took its slot.
+    static const unsigned int IndexBits = 22;
+    static const blockid IndexMask = (1ul << IndexBits) - 1;
+    static const blockid GenerationMask = 0x3ff;
+
+    /// The id to give a block in the slot of the unregistered \a id
+    static blockid reuseId(blockid id);
+
+    Slot *findSlot(blockid);
+    Slot *findOrCreateSlot(blockid);
+
+    /// The payload in a block's slot.  Call with m_writeLock held.
+    DataBlockPayload *findPayload(blockid);
+
+    /// Put a block in its slot, retiring any payload it replaces.
+    /// Call with m_writeLock held.
+    void publish(blockid, DataBlockPayload *);
+
+    /// Empty a slot, keeping its payload for reclaim().  Call with
+    /// m_writeLock held.
+    void retire(blockid);
+
+    /// Free retired payloads if no reader can still be looking at
+    /// them.  Call with m_writeLock held.
+    void reclaim();
+
+    DataBlockPayload *makePayload(blockid, const std::string &);
+
+    /// Call with m_writeLock held.
+    void removeHash(unsigned int hash, blockid);
 
     //--------------- Data members ---------------------------------
 
     static DataBlockRepository* m_instance;
+
+    QAtomicPointer<Slot> m_chunks[MaxChunks];
+    QAtomicInt m_readers;
+
+    /// Held by writers only
+    QMutex m_writeLock;
+    /// The next slot index never used
+    blockid m_nextId;
+    /// Ids of unregistered blocks, whose slots are reused (in a new
+    /// generation) before m_nextId
+    std::vector<blockid> m_freeIds;
+    std::vector<DataBlockPayload *> m_retired;
+
+    /// Content hash to ids, for finding identical blocks
+    std::multimap<unsigned int, blockid> m_byHash;
+
+    size_t m_spillThreshold;
+    Stats m_stats;
 };
 
 /// A MIDI event that is ready for playback
@@ -220,7 +365,8 @@ public:
                    m_fadeInTime(RealTime::zeroTime),
                    m_fadeOutTime(RealTime::zeroTime),
                    m_recordedChannel(0),
-                   m_recordedDevice(0) {}
+                   m_recordedDevice(0),
+                   m_stretchRatio(1.f) {}
 
     // Construct from Events to Internal (MIDI) type MappedEvent
     //
@@ -255,7 +401,8 @@ public:
         m_fadeInTime(RealTime::zeroTime),
         m_fadeOutTime(RealTime::zeroTime),
         m_recordedChannel(0),
-        m_recordedDevice(0) {}
+        m_recordedDevice(0),
+        m_stretchRatio(1.f) {}
 
     // Audio MappedEvent shortcut constructor
     //
@@ -278,7 +425,8 @@ public:
          m_fadeInTime(RealTime::zeroTime),
          m_fadeOutTime(RealTime::zeroTime),
          m_recordedChannel(0),
-         m_recordedDevice(0) {}
+         m_recordedDevice(0),
+         m_stretchRatio(1.f) {}
 
     // More generalised MIDI event containers for
     // large and small events (one param, two param)
@@ -301,7 +449,8 @@ public:
          m_fadeInTime(RealTime::zeroTime),
          m_fadeOutTime(RealTime::zeroTime),
          m_recordedChannel(0),
-         m_recordedDevice(0) {}
+         m_recordedDevice(0),
+         m_stretchRatio(1.f) {}
 
     MappedEvent(InstrumentId id,
                 MappedEventType type,
@@ -320,7 +469,8 @@ public:
         m_fadeInTime(RealTime::zeroTime),
         m_fadeOutTime(RealTime::zeroTime),
         m_recordedChannel(0),
-        m_recordedDevice(0) {}
+        m_recordedDevice(0),
+        m_stretchRatio(1.f) {}
 
 
     // Construct SysExs say
@@ -341,7 +491,8 @@ public:
         m_fadeInTime(RealTime::zeroTime),
         m_fadeOutTime(RealTime::zeroTime),
         m_recordedChannel(0),
-        m_recordedDevice(0) {}
+        m_recordedDevice(0),
+        m_stretchRatio(1.f) {}
 
     // Copy constructor
     //
@@ -361,7 +512,8 @@ public:
         m_fadeInTime(mE.getFadeInTime()),
         m_fadeOutTime(mE.getFadeOutTime()),
         m_recordedChannel(mE.getRecordedChannel()),
-        m_recordedDevice(mE.getRecordedDevice()) {}
+        m_recordedDevice(mE.getRecordedDevice()),
+        m_stretchRatio(mE.getStretchRatio()) {}
 
     // Copy from pointer
     // Fix for 674731 by Pedro Lopez-Cabanillas (20030531)
@@ -380,7 +532,8 @@ public:
         m_fadeInTime(mE->getFadeInTime()),
         m_fadeOutTime(mE->getFadeOutTime()),
         m_recordedChannel(mE->getRecordedChannel()),
-        m_recordedDevice(mE->getRecordedDevice()) {}
+        m_recordedDevice(mE->getRecordedDevice()),
+        m_stretchRatio(mE->getStretchRatio()) {}
 
     // Construct perhaps without initialising, for placement new or equivalent
     MappedEvent(bool initialise) {
@@ -509,6 +662,12 @@ public:
     unsigned int getRecordedDevice() const { return m_recordedDevice; }
     void setRecordedDevice(const unsigned int device) { m_recordedDevice = device; }
 
+    // The ratio an audio file is time-stretched by as it plays.  The
+    // audio start marker and duration are in stretched time.
+    //
+    float getStretchRatio() const { return m_stretchRatio; }
+    void setStretchRatio(float ratio) { m_stretchRatio = ratio; }
+
 private:
     TrackId          m_trackId;
     InstrumentId     m_instrument;
@@ -539,6 +698,10 @@ private:
     // used for output.
     unsigned int          m_recordedChannel;
     unsigned int          m_recordedDevice;
+
+    // Audio time-stretching
+    //
+    float                 m_stretchRatio;
 };
 
 
@@ -0,0 +1,73 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "MappedEventBatch.h"
+
+#include <algorithm>
+
+namespace Rosegarden
+{
+
+const size_t MappedEventBatch::DefaultCapacity;
+
+MappedEventBatch::MappedEventBatch(size_t capacity) :
+    m_events(capacity > 0 ? capacity : 1),
+    m_order(m_events.size(), 0),
+    m_size(0),
+    m_growCount(0)
+{
+}
+
+void
+MappedEventBatch::insert(const MappedEvent &e)
+{
+    if (m_size == m_events.size()) grow();
+
+    MappedEvent *event = &m_events[m_size];
+    *event = e;
+
+    // Merge into the order.  The common case is an event at or after
+    // the last one, which upper_bound finds at the end.
+    MappedEvent **first = &m_order[0];
+    MappedEvent **last = first + m_size;
+    MappedEvent **pos = last;
+    if (m_size > 0 && *event < *last[-1]) {
+        pos = std::upper_bound(first, last, event,
+                               MappedEvent::MappedEventCmp());
+        std::copy_backward(pos, last, last + 1);
+    }
+    *pos = event;
+
+    ++m_size;
+}
+
+void
+MappedEventBatch::grow()
+{
+    std::vector<MappedEvent> events(m_events.size() * 2);
+    std::copy(m_events.begin(), m_events.begin() + m_size, events.begin());
+
+    // Repoint the order at the new storage
+    MappedEvent *oldBase = &m_events[0];
+    MappedEvent *newBase = &events[0];
+    for (size_t i = 0; i < m_size; ++i) {
+        m_order[i] = newBase + (m_order[i] - oldBase);
+    }
+
+    m_events.swap(events);
+    m_order.resize(m_events.size(), 0);
+    ++m_growCount;
+}
+
+}
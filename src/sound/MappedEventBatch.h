@@ -0,0 +1,90 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_MAPPED_EVENT_BATCH_H
+#define RG_MAPPED_EVENT_BATCH_H
+
+#include "MappedEvent.h"
+
+#include <vector>
+
+namespace Rosegarden
+{
+
+/// A time-ordered set of MappedEvents that doesn't allocate per event.
+/**
+ * Used by RosegardenSequencer to pass each playback slice to the
+ * driver, in place of a MappedEventList.  MappedEventList allocates a
+ * MappedEvent and a set node for every event, on the sequencer
+ * thread; MappedEventBatch copies events into storage allocated up
+ * front and reused by every slice after clear().
+ *
+ * Events are kept in MappedEventList's order.  The batch keeps an
+ * array of pointers to its events, and insert() merges each new one
+ * into that array by a binary search and a shift.  Slices arrive
+ * almost in time order, so the shift is usually of nothing.
+ *
+ * Iterating gives MappedEvent pointers, as with MappedEventList, so
+ * that code can be written for either.  The pointers stay valid until
+ * clear(), or until an insert() has to grow the batch.
+ *
+ * If a slice has more events than the capacity, insert() doubles the
+ * capacity rather than drop events.  getGrowCount() reports how often
+ * that happened, so that the initial capacity can be tuned.
+ */
+class MappedEventBatch
+{
+public:
+    typedef MappedEvent *const *iterator;
+    typedef MappedEvent *const *const_iterator;
+
+    static const size_t DefaultCapacity = 4096;
+
+    explicit MappedEventBatch(size_t capacity = DefaultCapacity);
+
+    /// Copy e into the batch, after any events that compare equal.
+    void insert(const MappedEvent &e);
+
+    /// Forget all events, keeping the storage.
+    void clear()  { m_size = 0; }
+
+    size_t size() const  { return m_size; }
+    bool empty() const  { return m_size == 0; }
+    size_t capacity() const  { return m_events.size(); }
+
+    const_iterator begin() const  { return &m_order[0]; }
+    const_iterator end() const  { return &m_order[0] + m_size; }
+
+    /// Number of times insert() had to grow the storage.
+    int getGrowCount() const  { return m_growCount; }
+
+private:
+    /// Double the capacity, moving the events.
+    void grow();
+
+    std::vector<MappedEvent> m_events;
+
+    /// Pointers into m_events, in time order
+    std::vector<MappedEvent *> m_order;
+
+    size_t m_size;
+    int m_growCount;
+
+    MappedEventBatch(const MappedEventBatch &);
+    MappedEventBatch &operator=(const MappedEventBatch &);
+};
+
+}
+
+#endif
@@ -17,6 +17,7 @@
 
 #include "MappedEventInserter.h"
 #include "sound/MappedEventList.h"
+#include "sound/MappedEventBatch.h"
 
 namespace Rosegarden
 {
@@ -25,7 +26,11 @@ void
 MappedEventInserter:: 
 insertCopy(const MappedEvent &evt)
 {
-  m_list.insert(new MappedEvent(evt));
+    if (m_batch) {
+        m_batch->insert(evt);
+    } else {
+        m_list->insert(new MappedEvent(evt));
+    }
 }
 
 }
@@ -24,11 +24,12 @@ namespace Rosegarden
 {
 
 class MappedEventList;
+class MappedEventBatch;
 
-/// Inserts MappedEvent objects into a MappedEventList.
+/// Inserts MappedEvent objects into a MappedEventList or MappedEventBatch.
 /**
  * This is primarily used by RosegardenSequencer::getSlice() during playback
- * to generate a MappedEventList to send off to ALSA.
+ * to generate a MappedEventBatch to send off to ALSA.
  *
  * ??? This inside-out thinking hurts my brain.  Can we instead just send
  *     a MappedEventList & to whoever needs to insert things, and let them
@@ -38,14 +39,21 @@ class MappedEventInserter : public MappedInserterBase
 {
 public:
     MappedEventInserter(MappedEventList &list) :
-        m_list(list)
+        m_list(&list),
+        m_batch(0)
     { }
 
-    /// Inserts an event into the MappedEventList (m_list).
+    MappedEventInserter(MappedEventBatch &batch) :
+        m_list(0),
+        m_batch(&batch)
+    { }
+
+    /// Inserts an event into the MappedEventList or MappedEventBatch.
     virtual void insertCopy(const MappedEvent &evt);
 
 private:
-    MappedEventList &m_list;
+    MappedEventList *m_list;
+    MappedEventBatch *m_batch;
 };
 
 }
@@ -25,6 +25,7 @@
 #include <QDateTime>
 #include <QProgressDialog>
 #include <QStringList>
+#include <QThread>
 
 #include "PeakFile.h"
 #include "AudioFile.h"
@@ -50,10 +51,18 @@ static const float SAMPLE_MAX_8BIT  = (float)(0xff);
 static const float SAMPLE_MAX_16BIT = (float)(0xffff/2);
 static const float SAMPLE_MAX_24BIT = (float)(0xffffff/2);
 static const char AUDIO_BWF_PEAK_ID[] = "levl";  // BWF peak chunk id
+static const char AUDIO_PEAK_PYRAMID_ID[] = "pyrm";  // in the reserved space
+
+// While peaks are appended, how many more to write before updating the
+// header for readers: about a second and a half at 44.1kHz
+static const int HEADER_UPDATE_PEAKS = 256;
 
 namespace Rosegarden
 {
 
+const int PeakFile::PyramidFactor;
+bool PeakFile::m_usePyramid = true;
+
 PeakFile::PeakFile(AudioFile *audioFile) :
         SoundFile(audioFile->getPeakFilename()),
         m_audioFile(audioFile),
@@ -71,7 +80,16 @@ PeakFile::PeakFile(AudioFile *audioFile) :
         m_lastPreviewStartTime(0, 0),
         m_lastPreviewEndTime(0, 0),
         m_lastPreviewWidth( -1),
-        m_lastPreviewShowMinima(false)
+        m_lastPreviewShowMinima(false),
+        m_kilobytesRead(0),
+        m_cancelled(0),
+        m_appending(false),
+        m_peaksInHeader(0),
+        m_sampleMax(0),
+        m_sampleFrameCount(0),
+        m_sampleRate(0),
+        m_pyramidLoaded(false),
+        m_pyramidLevels(0)
 {
 }
 
@@ -148,12 +166,28 @@ PeakFile::parseHeader()
     m_numberOfPeaks = getIntegerFromLittleEndian(header.substr(28, 4));
     m_positionPeakOfPeaks = getIntegerFromLittleEndian(header.substr(32, 4));
 
+    // Our peak pyramid, if there is one, is described in the reserved
+    // space after the date
+    //
+    m_pyramid.clear();
+    m_pyramidLoaded = false;
+    m_pyramidLevels = 0;
+
+    if (header.compare(68, 4, AUDIO_PEAK_PYRAMID_ID) == 0 &&
+        getIntegerFromLittleEndian(header.substr(72, 4)) == PyramidFactor) {
+        m_pyramidLevels = getIntegerFromLittleEndian(header.substr(76, 4));
+    }
+
     // Read in date string and convert it up to QDateTime
     //
     QString dateString = QString(header.substr(40, 28).c_str());
 
     QStringList dateTime = dateString.split(":", QString::SkipEmptyParts);
 
+    // Not yet filled in by whatever is writing the file
+    if (dateTime.size() < 7)
+        throw(BadSoundFileException(m_fileName, "PeakFile::parseHeader - no date"));
+
     m_modificationTime.setDate(QDate(dateTime[0].toInt(),
                                      dateTime[1].toInt(),
                                      dateTime[2].toInt()));
@@ -222,6 +256,10 @@ PeakFile::write()
     if (!(*m_outFile))
         return false;
 
+    m_pyramid.clear();
+    m_pyramidLoaded = false;
+    m_pyramidLevels = 0;
+
     // write out the header
     writeHeader(m_outFile);
 
@@ -245,6 +283,26 @@ PeakFile::close()
     if (m_outFile == 0)
         return ;
 
+    // Finish peaks appended by appendSamples()
+    //
+    if (m_appending) {
+        m_outFile->seekp(0, std::ios::end);
+        finishPeaks(m_outFile);
+        m_appending = false;
+    }
+
+    writeHeaderFields();
+
+    // Ok, now close and tidy up
+    //
+    m_outFile->close();
+    delete m_outFile;
+    m_outFile = 0;
+}
+
+void
+PeakFile::writeHeaderFields()
+{
     // Seek to start of chunk
     //
     m_outFile->seekp(m_chunkStartPosition, std::ios::beg);
@@ -296,11 +354,97 @@ PeakFile::close()
     dateString += "     ";
     putBytes(m_outFile, dateString);
 
-    // Ok, now close and tidy up
+    // Describe the peak pyramid that follows the chunk
     //
-    m_outFile->close();
-    delete m_outFile;
-    m_outFile = 0;
+    if (m_pyramidLevels > 0) {
+        putBytes(m_outFile, AUDIO_PEAK_PYRAMID_ID);
+        putBytes(m_outFile, getLittleEndianFromInteger(PyramidFactor, 4));
+        putBytes(m_outFile, getLittleEndianFromInteger(m_pyramidLevels, 4));
+    }
+}
+
+bool
+PeakFile::beginWrite()
+{
+    if (m_outFile) {
+        m_outFile->close();
+        delete m_outFile;
+    }
+
+    // create and test that we've made it
+    m_outFile = new std::ofstream(m_fileName.toLocal8Bit(),
+                                  std::ios::out | std::ios::binary);
+    if (!(*m_outFile))
+        return false;
+
+    m_pyramid.clear();
+    m_pyramidLoaded = false;
+    m_pyramidLevels = 0;
+
+    writeHeader(m_outFile);
+    startPeaks();
+    m_appending = true;
+
+    // Fill in the header at once, so that the (so far empty) peak file
+    // can be read from the start
+    updateHeader();
+
+    return true;
+}
+
+void
+PeakFile::appendSamples(const char *data, size_t frames)
+{
+    if (!m_appending || !m_outFile)
+        return;
+
+    const size_t frameBytes = m_audioFile->getChannels() *
+        (m_audioFile->getBitsPerSample() / 8);
+    const size_t blockBytes = m_blockSize * frameBytes;
+
+    const unsigned char *samples = (const unsigned char *)data;
+    size_t length = frames * frameBytes;
+
+    // Complete the block left over from last time, if there is one
+    //
+    if (!m_pendingSamples.empty()) {
+        size_t wanted = std::min(blockBytes - m_pendingSamples.length(),
+                                 length);
+        m_pendingSamples.append((const char *)samples, wanted);
+        samples += wanted;
+        length -= wanted;
+
+        if (m_pendingSamples.length() < blockBytes)
+            return;
+
+        writePeakBlock(m_outFile,
+                       (const unsigned char *)m_pendingSamples.data());
+        m_pendingSamples.clear();
+    }
+
+    while (length >= blockBytes) {
+        writePeakBlock(m_outFile, samples);
+        samples += blockBytes;
+        length -= blockBytes;
+    }
+
+    m_pendingSamples.assign((const char *)samples, length);
+
+    if (m_numberOfPeaks - m_peaksInHeader >= HEADER_UPDATE_PEAKS)
+        updateHeader();
+}
+
+void
+PeakFile::updateHeader()
+{
+    // The peaks must reach the file before the header counts them
+    m_outFile->flush();
+
+    writeHeaderFields();
+    m_peaksInHeader = m_numberOfPeaks;
+
+    m_outFile->seekp(0, std::ios::end);
+    m_outFile->flush();
 }
 
 bool
@@ -479,32 +623,22 @@ PeakFile::writePeaks(std::ofstream *file)
 
     // Store our samples
     //
-    std::vector<std::pair<int, int> > channelPeaks;
     std::string samples;
-    unsigned char *samplePtr;
-
-    int sampleValue;
-    int sampleMax = 0 ;
-    int sampleFrameCount = 0;
 
     int channels = m_audioFile->getChannels();
     int bytes = m_audioFile->getBitsPerSample() / 8;
 
-    m_format = bytes;
-    if (bytes == 3 || bytes == 4) // 24-bit PCM or 32-bit float
-        m_format = 2; // write 16-bit PCM instead
+    startPeaks();
 
     // for the progress dialog
     size_t apprxTotalBytes = m_audioFile->getSize();
     size_t byteCount = 0;
+    // and for the shared progress counter
+    size_t reportedBytes = 0;
 
-    for (int i = 0; i < channels; i++)
-        channelPeaks.push_back(std::pair<int, int>());
-
-    // clear down info
-    m_numberOfPeaks = 0;
-    m_bodyBytes = 0;
-    m_positionPeakOfPeaks = 0;
+    // Only the GUI thread may touch the progress dialog or process
+    // events.
+    const bool guiThread = (QThread::currentThread() == qApp->thread());
 
     // ??? Block count?  How does this differ from m_numberOfPeaks?
     int ct = 0;
@@ -546,100 +680,371 @@ PeakFile::writePeaks(std::ofstream *file)
 
             //RG_DEBUG << "writePeaks(): progress" << progress;
 
-            if (m_progressDialog) {
-                if (m_progressDialog->wasCanceled())
-                    break;
-
-                m_progressDialog->setValue(progress);
+            if (m_kilobytesRead) {
+                size_t kilobytes = (byteCount - reportedBytes) / 1024;
+                m_kilobytesRead->fetchAndAddRelaxed(int(kilobytes));
+                reportedBytes += kilobytes * 1024;
             }
 
-            qApp->processEvents(QEventLoop::AllEvents);
+            if (m_cancelled  &&  m_cancelled->fetchAndAddRelaxed(0))
+                break;
+
+            if (guiThread) {
+                if (m_progressDialog) {
+                    if (m_progressDialog->wasCanceled())
+                        break;
+
+                    m_progressDialog->setValue(progress);
+                }
+
+                qApp->processEvents(QEventLoop::AllEvents);
+            }
         }
         ++ct;
 
-        samplePtr = (unsigned char *)samples.c_str();
+        writePeakBlock(file, (const unsigned char *)samples.c_str());
+    }
 
-        for (int i = 0; i < m_blockSize; i++) {
-            for (unsigned int ch = 0; ch < m_audioFile->getChannels(); ch++) {
-                // Single byte format values range from 0-255 and then
-                // shifted down about the x-axis.  Double byte and above
-                // are already centred about x-axis.
-                //
-                if (bytes == 1) {
-                    // get value
-                    sampleValue = int(*samplePtr) - 128;
-                    samplePtr++;
-                } else if (bytes == 2) {
-                    unsigned char b2 = samplePtr[0];
-                    unsigned char b1 = samplePtr[1];
-                    unsigned int bits = (b1 << 8) + b2;
-                    sampleValue = (short)bits;
-                    samplePtr += 2;
-                } else if (bytes == 3) {
-                    unsigned char b3 = samplePtr[0];
-                    unsigned char b2 = samplePtr[1];
-                    unsigned char b1 = samplePtr[2];
-                    unsigned int bits = (b1 << 24) + (b2 << 16) + (b3 << 8);
-
-                    // write out as 16-bit (m_format == 2)
-                    sampleValue = int(bits) / 65536;
-
-                    samplePtr += 3;
-                } else if (bytes == 4)  // IEEE float (enforced by RIFFAudioFile)
-                {
-                    // write out as 16-bit (m_format == 2)
-                    float val = *(float *)samplePtr;
-                    sampleValue = (int)(32767.0 * val);
-                    samplePtr += 4;
-                } else {
-                    throw(BadSoundFileException(m_fileName, "PeakFile::writePeaks - unsupported bit depth"));
-                }
+    if (m_kilobytesRead) {
+        m_kilobytesRead->fetchAndAddRelaxed(
+                int((byteCount - reportedBytes) / 1024));
+    }
+
+    finishPeaks(file);
+
+#ifdef DEBUG_PEAKFILE
+    RG_DEBUG << "writePeaks() - completed peaks";
+#endif
+
+}
+
+void
+PeakFile::startPeaks()
+{
+    int bytes = m_audioFile->getBitsPerSample() / 8;
+
+    m_format = bytes;
+    if (bytes == 3 || bytes == 4) // 24-bit PCM or 32-bit float
+        m_format = 2; // write 16-bit PCM instead
+
+    // clear down info
+    m_numberOfPeaks = 0;
+    m_bodyBytes = 0;
+    m_positionPeakOfPeaks = 0;
+
+    m_sampleMax = 0;
+    m_sampleFrameCount = 0;
+    m_firstLevel.clear();
+    m_pendingSamples.clear();
+}
+
+void
+PeakFile::writePeakBlock(std::ofstream *file,
+                         const unsigned char *samplePtr)
+{
+    int channels = m_audioFile->getChannels();
+    int bytes = m_audioFile->getBitsPerSample() / 8;
+
+    std::vector<std::pair<int, int> > channelPeaks(channels);
+    int sampleValue;
+
+    for (int i = 0; i < m_blockSize; i++) {
+        for (unsigned int ch = 0; ch < m_audioFile->getChannels(); ch++) {
+            // Single byte format values range from 0-255 and then
+            // shifted down about the x-axis.  Double byte and above
+            // are already centred about x-axis.
+            //
+            if (bytes == 1) {
+                // get value
+                sampleValue = int(*samplePtr) - 128;
+                samplePtr++;
+            } else if (bytes == 2) {
+                unsigned char b2 = samplePtr[0];
+                unsigned char b1 = samplePtr[1];
+                unsigned int bits = (b1 << 8) + b2;
+                sampleValue = (short)bits;
+                samplePtr += 2;
+            } else if (bytes == 3) {
+                unsigned char b3 = samplePtr[0];
+                unsigned char b2 = samplePtr[1];
+                unsigned char b1 = samplePtr[2];
+                unsigned int bits = (b1 << 24) + (b2 << 16) + (b3 << 8);
+
+                // write out as 16-bit (m_format == 2)
+                sampleValue = int(bits) / 65536;
+
+                samplePtr += 3;
+            } else if (bytes == 4)  // IEEE float (enforced by RIFFAudioFile)
+            {
+                // write out as 16-bit (m_format == 2)
+                float val = *(float *)samplePtr;
+                sampleValue = (int)(32767.0 * val);
+                samplePtr += 4;
+            } else {
+                throw(BadSoundFileException(m_fileName, "PeakFile::writePeaks - unsupported bit depth"));
+            }
 
-                // First time for each channel
+            // First time for each channel
+            //
+            if (i == 0) {
+                channelPeaks[ch].first = sampleValue;
+                channelPeaks[ch].second = sampleValue;
+            } else {
+                // Compare and store
                 //
-                if (i == 0) {
+                if (sampleValue > channelPeaks[ch].first)
                     channelPeaks[ch].first = sampleValue;
+
+                if (sampleValue < channelPeaks[ch].second)
                     channelPeaks[ch].second = sampleValue;
-                } else {
-                    // Compare and store
-                    //
-                    if (sampleValue > channelPeaks[ch].first)
-                        channelPeaks[ch].first = sampleValue;
+            }
 
-                    if (sampleValue < channelPeaks[ch].second)
-                        channelPeaks[ch].second = sampleValue;
-                }
+            // Store peak of peaks if it fits
+            //
+            if (std::abs(sampleValue) > m_sampleMax) {
+                m_sampleMax = std::abs(sampleValue);
+                m_positionPeakOfPeaks = m_sampleFrameCount;
+            }
+        }
 
-                // Store peak of peaks if it fits
-                //
-                if (std::abs(sampleValue) > sampleMax) {
-                    sampleMax = std::abs(sampleValue);
-                    m_positionPeakOfPeaks = sampleFrameCount;
+        // for peak of peaks as well as frame count
+        m_sampleFrameCount++;
+    }
+
+    // Write absolute peak data in channel order
+    //
+    for (unsigned int i = 0; i < m_audioFile->getChannels(); i++) {
+        std::string hi = getLittleEndianFromInteger(channelPeaks[i].first,
+                                                    m_format);
+        std::string lo = getLittleEndianFromInteger(channelPeaks[i].second,
+                                                    m_format);
+        putBytes(file, hi);
+        putBytes(file, lo);
+        m_bodyBytes += m_format * 2;
+
+        // Reduce the values as they will be read back, into the first
+        // level of the pyramid
+        int hiValue = decodePeakValue((const unsigned char *)hi.data());
+        int loValue = decodePeakValue((const unsigned char *)lo.data());
+
+        if (m_numberOfPeaks % PyramidFactor == 0) {
+            m_firstLevel.push_back(hiValue);
+            m_firstLevel.push_back(loValue);
+        } else {
+            size_t index = (m_numberOfPeaks / PyramidFactor) *
+                channels * 2 + i * 2;
+            m_firstLevel[index] = std::max(m_firstLevel[index], hiValue);
+            m_firstLevel[index + 1] = std::min(m_firstLevel[index + 1],
+                                               loValue);
+        }
+    }
+
+    // increment number of peak frames
+    m_numberOfPeaks++;
+}
+
+void
+PeakFile::finishPeaks(std::ofstream *file)
+{
+    // Follow the peak chunk with the rest of the pyramid
+    //
+    m_pyramid.clear();
+    if (!m_firstLevel.empty()) {
+        m_pyramid.push_back(std::vector<int>());
+        m_pyramid[0].swap(m_firstLevel);
+        buildPyramid();
+    }
+    m_pyramidLoaded = true;
+    m_pyramidLevels = m_pyramid.size();
+
+    writePyramid(file);
+
+    // Any part block left over is dropped, as by writePeaks()
+    m_pendingSamples.clear();
+}
+
+int
+PeakFile::decodePeakValue(const unsigned char *bytes) const
+{
+    // Little-endian, as getIntegerFromLittleEndian(), with values over
+    // the format's maximum taken as negative, as getPreview() always
+    // has
+    int value = bytes[0];
+    if (m_format == 2) value |= (bytes[1] << 8);
+
+    int maximum = int(m_format == 1 ? SAMPLE_MAX_8BIT : SAMPLE_MAX_16BIT);
+    while (value > maximum) {
+        value -= (1 << (m_format * 8));
+    }
+
+    return value;
+}
+
+void
+PeakFile::reducePeaks(const std::vector<int> &from,
+                      std::vector<int> &to,
+                      int channels)
+{
+    const size_t entrySize = channels * 2;
+    const size_t entries = from.size() / entrySize;
+
+    to.clear();
+    to.reserve((entries + PyramidFactor - 1) / PyramidFactor * entrySize);
+
+    for (size_t e = 0; e < entries; e += PyramidFactor) {
+
+        size_t end = std::min(entries, e + PyramidFactor);
+
+        // For each channel, the maximum of the maxima and the minimum
+        // of the minima
+        for (size_t v = 0; v < entrySize; v += 2) {
+            int hi = from[e * entrySize + v];
+            int lo = from[e * entrySize + v + 1];
+            for (size_t f = e + 1; f < end; ++f) {
+                hi = std::max(hi, from[f * entrySize + v]);
+                lo = std::min(lo, from[f * entrySize + v + 1]);
+            }
+            to.push_back(hi);
+            to.push_back(lo);
+        }
+    }
+}
+
+void
+PeakFile::buildPyramid()
+{
+    const size_t entrySize = m_channels * 2;
+
+    while (!m_pyramid.empty() && m_pyramid.back().size() > entrySize) {
+        std::vector<int> next;
+        reducePeaks(m_pyramid.back(), next, m_channels);
+        m_pyramid.push_back(std::vector<int>());
+        m_pyramid.back().swap(next);
+    }
+}
+
+void
+PeakFile::writePyramid(std::ofstream *file)
+{
+    for (size_t level = 0; level < m_pyramid.size(); ++level) {
+        const std::vector<int> &values = m_pyramid[level];
+        std::string bytes;
+        bytes.reserve(values.size() * m_format);
+        for (size_t i = 0; i < values.size(); ++i) {
+            bytes += getLittleEndianFromInteger(values[i], m_format);
+        }
+        putBytes(file, bytes);
+    }
+}
+
+bool
+PeakFile::loadPyramid()
+{
+    if (m_pyramidLoaded)
+        return !m_pyramid.empty();
+
+    m_pyramidLoaded = true;
+
+    if (m_pointsPerValue != 2 || m_channels <= 0 ||
+        (m_format != 1 && m_format != 2) || m_numberOfPeaks <= 1 ||
+        !m_inFile || !m_inFile->is_open()) {
+        return false;
+    }
+
+    const size_t entryValues = m_pointsPerValue * m_channels;
+    const size_t entryBytes = m_format * entryValues;
+
+    std::vector<unsigned char> buffer;
+
+    if (m_pyramidLevels > 0) {
+
+        size_t entries = m_numberOfPeaks;
+        size_t total = 0;
+        for (int level = 0; level < m_pyramidLevels; ++level) {
+            entries = (entries + PyramidFactor - 1) / PyramidFactor;
+            total += entries;
+        }
+
+        buffer.resize(total * entryBytes);
+
+        m_inFile->clear();
+        m_inFile->seekg(m_chunkStartPosition +
+                        std::streamoff(128 + m_numberOfPeaks * entryBytes));
+
+        if (getBytes(m_inFile, (char *)&buffer[0], buffer.size()) ==
+            buffer.size()) {
+
+            const unsigned char *bytes = &buffer[0];
+            entries = m_numberOfPeaks;
+
+            for (int level = 0; level < m_pyramidLevels; ++level) {
+                entries = (entries + PyramidFactor - 1) / PyramidFactor;
+                m_pyramid.push_back(std::vector<int>(entries * entryValues));
+                std::vector<int> &values = m_pyramid.back();
+                for (size_t i = 0; i < values.size(); ++i) {
+                    values[i] = decodePeakValue(bytes);
+                    bytes += m_format;
                 }
             }
 
-            // for peak of peaks as well as frame count
-            sampleFrameCount++;
+        } else {
+            RG_WARNING << "loadPyramid(): peak pyramid in" << m_fileName
+                       << "is incomplete, rebuilding it";
         }
+    }
 
-        // Write absolute peak data in channel order
+    if (m_pyramid.empty()) {
+
+        // An older peak file: reduce the peaks themselves, a multiple
+        // of PyramidFactor of them at a time
         //
-        for (unsigned int i = 0; i < m_audioFile->getChannels(); i++) {
-            putBytes(file, getLittleEndianFromInteger(channelPeaks[i].first,
-                     m_format));
-            putBytes(file, getLittleEndianFromInteger(channelPeaks[i].second,
-                     m_format));
-            m_bodyBytes += m_format * 2;
+        const size_t chunkEntries = 4096 * PyramidFactor;
+        buffer.resize(chunkEntries * entryBytes);
+
+        m_inFile->clear();
+        m_inFile->seekg(m_chunkStartPosition + std::streamoff(128));
+
+        std::vector<int> peaks;
+        std::vector<int> reduced;
+        std::vector<int> firstLevel;
+        size_t remaining = m_numberOfPeaks;
+
+        while (remaining > 0) {
+            size_t wanted = std::min(remaining, chunkEntries);
+            size_t obtained = getBytes(m_inFile, (char *)&buffer[0],
+                                       wanted * entryBytes) / entryBytes;
+            if (obtained == 0)
+                break;
+
+            peaks.resize(obtained * entryValues);
+            for (size_t i = 0; i < peaks.size(); ++i) {
+                peaks[i] = decodePeakValue(&buffer[i * m_format]);
+            }
+
+            reducePeaks(peaks, reduced, m_channels);
+            firstLevel.insert(firstLevel.end(), reduced.begin(), reduced.end());
+
+            remaining -= obtained;
+            if (obtained < wanted)
+                break;
         }
 
-        // increment number of peak frames
-        m_numberOfPeaks++;
+        if (!firstLevel.empty()) {
+            m_pyramid.push_back(std::vector<int>());
+            m_pyramid[0].swap(firstLevel);
+            buildPyramid();
+        }
     }
 
-#ifdef DEBUG_PEAKFILE
-    RG_DEBUG << "writePeaks() - completed peaks";
+    // We've moved the stream from under any buffered read
+    m_inFile->clear();
+    m_loseBuffer = true;
+
+#ifdef DEBUG_PEAKFILE_CACHE
+    RG_DEBUG << "loadPyramid() -" << m_pyramid.size() << "levels";
 #endif
 
+    return !m_pyramid.empty();
 }
 
 std::vector<float>
@@ -667,13 +1072,20 @@ PeakFile::getPreview(const RealTime &startTime,
         RG_DEBUG << "getPreview() - no peak cache";
 #endif
 
-        if (getSize() < (256 *1024)) // if less than 256K PeakFile
+        // Just the peaks, not any pyramid after them
+        size_t peakBytes = getSize() - 128;
+        if (m_pyramidLevels > 0) {
+            peakBytes = size_t(m_numberOfPeaks) *
+                m_format * m_pointsPerValue * m_channels;
+        }
+
+        if (peakBytes < (256 *1024)) // if less than 256K of peaks
         {
             // Scan to start of peak data
             scanToPeak(0);
             try
             {
-                m_peakCache = getBytes(m_inFile, getSize() - 128);
+                m_peakCache = getBytes(m_inFile, peakBytes);
             } catch (BadSoundFileException e)
             {
                 RG_WARNING << "PeakFile::getPreview: " << e.getMessage();
@@ -749,6 +1161,28 @@ PeakFile::getPreview(const RealTime &startTime,
         return m_lastPreviewCache;
     }
 
+    // Zoomed out far enough for each pixel to cover PyramidFactor or
+    // more peaks, read from the level of the pyramid with one or more
+    // entries per pixel rather than from every peak
+    //
+    int level = 0;
+    for (double s = step; s >= PyramidFactor; s /= PyramidFactor) {
+        ++level;
+    }
+
+    if (level > 0 && m_usePyramid && loadPyramid()) {
+
+        getPreviewFromPyramid(std::min(level, int(m_pyramid.size())),
+                              startPeak, step, width, showMinima, divisor);
+
+        m_lastPreviewStartTime = startTime;
+        m_lastPreviewEndTime = endTime;
+        m_lastPreviewWidth = width;
+        m_lastPreviewShowMinima = showMinima;
+
+        return m_lastPreviewCache;
+    }
+
     float *hiValues = new float[m_channels];
     float *loValues = new float[m_channels];
 
@@ -909,19 +1343,147 @@ done:
     return m_lastPreviewCache;
 }
 
+void
+PeakFile::getPreviewFromPyramid(int level, int startPeak, double step,
+                                int width, bool showMinima, float divisor)
+{
+    std::vector<int> hi(m_channels), lo(m_channels);
+
+    for (int i = 0; i < width; i++) {
+
+        int peakNumber = startPeak + int(double(i) * step);
+        int nextPeakNumber = std::min(startPeak + int(double(i + 1) * step),
+                                      m_numberOfPeaks);
+
+        bool found = false;
+        foldPeakRange(level, peakNumber, nextPeakNumber, hi, lo, found);
+
+        // Past the end: return what we have, as for the peaks
+        if (!found)
+            break;
+
+        for (int ch = 0; ch < m_channels; ++ch) {
+            if (showMinima) {
+                m_lastPreviewCache.push_back(lo[ch] / divisor);
+            } else {
+                m_lastPreviewCache.push_back
+                    (std::max(std::fabs(hi[ch] / divisor),
+                              std::fabs(lo[ch] / divisor)));
+            }
+        }
+    }
+
+    // We may have moved the stream from under any buffered read
+    m_inFile->clear();
+    m_loseBuffer = true;
+}
+
+void
+PeakFile::foldPeakRange(int level, int first, int last,
+                        std::vector<int> &hi, std::vector<int> &lo,
+                        bool &found)
+{
+    if (first >= last)
+        return;
+
+    if (level == 0) {
+        foldPeaks(first, last, hi, lo, found);
+        return;
+    }
+
+    const std::vector<int> &values = m_pyramid[level - 1];
+
+    int scale = 1;
+    for (int i = 0; i < level; ++i) {
+        scale *= PyramidFactor;
+    }
+
+    const size_t entrySize = m_channels * 2;
+    const int entries = values.size() / entrySize;
+
+    // The entries lying wholly within the range
+    int firstEntry = std::min((first + scale - 1) / scale, entries);
+    int lastEntry = std::min(last / scale, entries);
+
+    if (firstEntry >= lastEntry) {
+        foldPeakRange(level - 1, first, last, hi, lo, found);
+        return;
+    }
+
+    for (int e = firstEntry; e < lastEntry; ++e) {
+        for (int ch = 0; ch < m_channels; ++ch) {
+            int entryHi = values[e * entrySize + ch * 2];
+            int entryLo = values[e * entrySize + ch * 2 + 1];
+            if (!found || entryHi > hi[ch]) hi[ch] = entryHi;
+            if (!found || entryLo < lo[ch]) lo[ch] = entryLo;
+        }
+        found = true;
+    }
+
+    // And the parts of entries at either end, from the level below
+    foldPeakRange(level - 1, first, firstEntry * scale, hi, lo, found);
+    foldPeakRange(level - 1, lastEntry * scale, last, hi, lo, found);
+}
+
+void
+PeakFile::foldPeaks(int first, int last,
+                    std::vector<int> &hi, std::vector<int> &lo, bool &found)
+{
+    const size_t entryBytes = m_format * 2 * m_channels;
+    const size_t wanted = (last - first) * entryBytes;
+
+    std::string bytes;
+
+    if (m_peakCache.length()) {
+        if (first * entryBytes < m_peakCache.length()) {
+            bytes = m_peakCache.substr(first * entryBytes, wanted);
+        }
+    } else {
+        std::vector<char> buffer(wanted);
+        m_inFile->clear();
+        m_inFile->seekg(m_chunkStartPosition +
+                        std::streamoff(128 + first * entryBytes));
+        bytes.assign(&buffer[0], getBytes(m_inFile, &buffer[0], wanted));
+    }
+
+    const unsigned char *data = (const unsigned char *)bytes.data();
+    const size_t count = bytes.length() / entryBytes;
+
+    for (size_t e = 0; e < count; ++e) {
+        for (int ch = 0; ch < m_channels; ++ch) {
+            const unsigned char *value =
+                data + e * entryBytes + ch * 2 * m_format;
+            int peakHi = decodePeakValue(value);
+            int peakLo = decodePeakValue(value + m_format);
+            if (!found || peakHi > hi[ch]) hi[ch] = peakHi;
+            if (!found || peakLo < lo[ch]) lo[ch] = peakLo;
+        }
+        found = true;
+    }
+}
+
 int
 PeakFile::getPeak(const RealTime &time)
 {
     double frames = ((time.sec * 1000000.0) + time.usec()) *
-                    m_audioFile->getSampleRate() / 1000000.0;
+                    getSampleRate() / 1000000.0;
     return int(frames / double(m_blockSize));
 }
 
+unsigned int
+PeakFile::getSampleRate()
+{
+    if (m_sampleRate)
+        return m_sampleRate;
+
+    return m_audioFile->getSampleRate();
+}
+
 RealTime
 PeakFile::getTime(int peak)
 {
     int usecs = int((double)peak * (double)m_blockSize *
-                    double(1000000.0) / double(m_audioFile->getSampleRate()));
+                    double(1000000.0) / double(getSampleRate()));
     return RealTime(usecs / 1000000, (usecs % 1000000) * 1000);
 }
 
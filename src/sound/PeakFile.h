@@ -15,6 +15,7 @@
 #include <vector>
 
 #include <QObject>
+#include <QAtomicInt>
 #include <QDateTime>
 #include <QPointer>
 
@@ -45,6 +46,15 @@ typedef std::pair<RealTime, RealTime> SplitPointPair;
  * the sample file itself (writeToHandle()) or used to generate an
  * external peak file (write()).  At the moment the only type of file
  * with an embedded peak chunk is the BWF file itself.
+ *
+ * External peak files also carry a pyramid of reduced peaks after the
+ * peak chunk: each level holds the maxima and minima of PyramidFactor
+ * values of the level below, the first level reducing the chunk's own
+ * peaks.  getPreview() reads from the level nearest the resolution it
+ * is asked for, so that a preview costs about the same at any zoom.
+ * The pyramid is described in the reserved part of the chunk header,
+ * which other readers ignore.  For peak files without one, the
+ * pyramid is built from the peak chunk when first needed.
  */
 class PeakFile : public QObject, public SoundFile
 {
@@ -61,9 +71,39 @@ public:
     void setProgressDialog(QPointer<QProgressDialog> progressDialog)
             { m_progressDialog = progressDialog; }
 
+    /// Set up shared progress for write() away from the GUI thread.
+    /**
+     * In place of a progress dialog, write() adds the kilobytes of
+     * audio it reads to kilobytesRead, and stops early once cancelled
+     * is set.  Both may be shared by several PeakFiles being written
+     * at once.  See PeakFileManager::generatePeaks().
+     */
+    void setProgressCounters(QAtomicInt *kilobytesRead,
+                             QAtomicInt *cancelled)
+            { m_kilobytesRead = kilobytesRead; m_cancelled = cancelled; }
+
     /// Write to standard peak file
     virtual bool write();
 
+    /// Start a peak file to be written as the audio file is.
+    /**
+     * For recording: rather than read the audio file once it is
+     * complete, as write() does, take the sample data from
+     * appendSamples() as it is written to the audio file, and finish
+     * the peak file on close().  The header is brought up to date every
+     * second or two, so that the peaks so far can be read meanwhile.
+     */
+    bool beginWrite();
+
+    /// Add sample data, as written to the audio file, after beginWrite().
+    void appendSamples(const char *data, size_t frames);
+
+    /// Sample rate for reading the peaks of an audio file not yet read.
+    /**
+     * As when previewing a file that is still being recorded.
+     */
+    void setSampleRate(unsigned int sampleRate)  { m_sampleRate = sampleRate; }
+
     /// Is the peak file valid and up to date?
     /**
      * If the audio file is more recently modified than the modification time
@@ -94,6 +134,12 @@ public:
     /// For debugging
     void printStats();
 
+    /// The reduction from each level of the peak pyramid to the next.
+    static const int PyramidFactor = 4;
+
+    /// Whether getPreview() may use the peak pyramid.  For tests.
+    static void setUsePyramid(bool use)  { m_usePyramid = use; }
+
     /// Write peak chunk to file handle (BWF)
     //bool writeToHandle(std::ofstream *file, unsigned short updatePercentage);
 
@@ -126,6 +172,55 @@ protected:
 
     void parseHeader();
 
+    /// Decode one peak value of m_format bytes.
+    int decodePeakValue(const unsigned char *bytes) const;
+
+    /// Load the peak pyramid from the file, or build it from the peaks
+    /// if the file hasn't one.  Returns false if there is none to use.
+    bool loadPyramid();
+
+    /// Reduce by PyramidFactor the entries of one pyramid level (or
+    /// the peaks) to make the next.
+    static void reducePeaks(const std::vector<int> &from,
+                            std::vector<int> &to,
+                            int channels);
+
+    /// Add the levels above m_pyramid[0] until a level has one entry.
+    void buildPyramid();
+
+    void writePyramid(std::ofstream *file);
+
+    /// Set up to write the peaks, for writePeaks() or beginWrite().
+    void startPeaks();
+    /// Write the peaks of one block of m_blockSize frames of samples.
+    void writePeakBlock(std::ofstream *file, const unsigned char *samples);
+    /// Follow the peaks with the pyramid.
+    void finishPeaks(std::ofstream *file);
+
+    /// Fill in the header fields known only once the peaks are written.
+    void writeHeaderFields();
+    /// Bring the header up to date with the peaks appended so far.
+    void updateHeader();
+
+    unsigned int getSampleRate();
+
+    /// As the peak loop in getPreview(), reading whole entries of the
+    /// pyramid up to the given level and the peaks themselves where a
+    /// pixel starts or ends part way through an entry.
+    void getPreviewFromPyramid(int level, int startPeak, double step,
+                               int width, bool showMinima, float divisor);
+
+    /// Fold peaks [first, last) into the maxima and minima for each
+    /// channel, from pyramid levels no higher than level (0 for the
+    /// peaks themselves).  found is set if there were any.
+    void foldPeakRange(int level, int first, int last,
+                       std::vector<int> &hi, std::vector<int> &lo,
+                       bool &found);
+    /// Fold peaks [first, last) as foldPeakRange(), from the peak
+    /// cache or the peak file.
+    void foldPeaks(int first, int last,
+                   std::vector<int> &hi, std::vector<int> &lo, bool &found);
+
     /// The AudioFile that this peak file is based on.
     AudioFile *m_audioFile;
 
@@ -158,8 +253,38 @@ protected:
     /// Optional progress dialog for write().
     QPointer<QProgressDialog> m_progressDialog;
 
+    /// Optional shared progress for write().
+    QAtomicInt *m_kilobytesRead;
+    QAtomicInt *m_cancelled;
+
+    // Peaks being written.
+    bool               m_appending;
+    int                m_peaksInHeader;
+    int                m_sampleMax;
+    int                m_sampleFrameCount;
+    /// The first level of the pyramid, reduced from the peaks as they
+    /// are written.
+    std::vector<int>   m_firstLevel;
+    /// Samples appended short of a whole block.
+    std::string        m_pendingSamples;
+
+    /// If set, used in place of the audio file's.
+    unsigned int       m_sampleRate;
+
     /// Cached in-memory copy of the peak file for getPreview().
     std::string        m_peakCache;
+
+    /// The peak pyramid.  m_pyramid[0] reduces the peaks once, and
+    /// each level after reduces the one before.  Each entry holds a
+    /// maximum and a minimum for each channel, decoded as by
+    /// decodePeakValue().
+    std::vector<std::vector<int> > m_pyramid;
+    bool               m_pyramidLoaded;
+
+    /// Levels of pyramid stored in the file, from the header.
+    int                m_pyramidLevels;
+
+    static bool        m_usePyramid;
     
     bool scanToPeak(int peak);
     //bool scanForward(int numberOfPeaks);
@@ -17,19 +17,90 @@
 
 #include "PeakFileManager.h"
 
+#include <algorithm>  // std::min(), std::max()
 #include <vector>
 
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QFile>
+#include <QMutexLocker>
 #include <QProgressDialog>
 
 #include "AudioFile.h"
 #include "base/RealTime.h"
 #include "PeakFile.h"
 #include "misc/Debug.h"
+#include "misc/JobPool.h"
 
 namespace Rosegarden
 {
 
 
+namespace
+{
+
+/// The peak files shared out between generatePeaks()'s worker threads.
+struct PeakJobs : public JobPool::Jobs
+{
+    PeakJobs() :
+        kilobytesRead(0),
+        cancelled(0)
+    { }
+
+    /// Write the peak file for job n.
+    virtual void run(size_t n);
+
+    enum Result { Written, Failed, Cancelled };
+
+    std::vector<PeakFile *> files;
+    /// What became of each file, once its job is finished.
+    std::vector<Result> results;
+
+    QAtomicInt kilobytesRead;
+    QAtomicInt cancelled;
+};
+
+void
+PeakJobs::run(size_t n)
+{
+    PeakFile *peakFile = files[n];
+
+    bool written = false;
+
+    if (!cancelled.fetchAndAddRelaxed(0)) {
+        try {
+            written = peakFile->write();
+        } catch (SoundFile::BadSoundFileException e) {
+            RG_WARNING << "PeakJobs::run():" << e.getMessage();
+        }
+    }
+
+    bool wasCancelled = cancelled.fetchAndAddRelaxed(0);
+
+    if (written) {
+        // close writes out important things
+        peakFile->close();
+
+        // If we were cancelled, don't leave a partial peak file
+        // lying around.
+        if (wasCancelled) {
+            QFile file(peakFile->getFilename());
+            file.remove();
+        }
+    }
+
+    if (wasCancelled)
+        results[n] = Cancelled;
+    else
+        results[n] = written ? Written : Failed;
+}
+
+}
+
+
+const int PeakFileManager::MaxThreads;
+int PeakFileManager::m_threadCount = 0;
+
 PeakFileManager::PeakFileManager()
 {
 }
@@ -106,6 +177,10 @@ PeakFileManager::getPeakFile(AudioFile *audioFile)
 bool
 PeakFileManager::hasValidPeaks(AudioFile *audioFile)
 {
+    // Not until they're written
+    if (isGenerating(audioFile))
+        return false;
+
     if (audioFile->getType() == WAV) {
         // Check external peak file
         PeakFile *peakFile = getPeakFile(audioFile);
@@ -147,6 +222,10 @@ PeakFileManager::generatePeaks(AudioFile *audioFile)
 #endif
 
     if (audioFile->getType() == WAV) {
+        // Already on its way
+        if (isGenerating(audioFile))
+            return;
+
         PeakFile *currentPeakFile = getPeakFile(audioFile);
 
         currentPeakFile->setProgressDialog(m_progressDialog);
@@ -170,6 +249,8 @@ PeakFileManager::generatePeaks(AudioFile *audioFile)
         // close writes out important things
         currentPeakFile->close();
 
+        emit peaksGenerated(audioFile->getId());
+
     } else if (audioFile->getType() == BWF) {
         // write the file out and incorporate the peak chunk
         RG_WARNING << "generatePeaks() - unsupported file type: BWF";
@@ -178,6 +259,156 @@ PeakFileManager::generatePeaks(AudioFile *audioFile)
     }
 }
 
+void
+PeakFileManager::generatePeaks(const std::vector<AudioFile *> &audioFiles)
+{
+    writePeaks(preparePeaks(audioFiles));
+}
+
+std::vector<PeakFile *>
+PeakFileManager::preparePeaks(const std::vector<AudioFile *> &audioFiles)
+{
+    std::vector<PeakFile *> peakFiles;
+
+    // For each AudioFile
+    for (std::vector<AudioFile *>::const_iterator it = audioFiles.begin();
+         it != audioFiles.end();
+         ++it) {
+        AudioFile *audioFile = *it;
+
+        if (audioFile->getType() == BWF) {
+            RG_WARNING << "generatePeaks() - unsupported file type: BWF";
+            continue;
+        } else if (audioFile->getType() != WAV) {
+            RG_WARNING << "generatePeaks() - unknown file type";
+            continue;
+        }
+
+        if (isGenerating(audioFile))
+            continue;
+
+        PeakFile *peakFile = getPeakFile(audioFile);
+        if (!peakFile)
+            continue;
+
+        peakFiles.push_back(peakFile);
+    }
+
+    QMutexLocker locker(&m_generatingMutex);
+    for (size_t i = 0; i < peakFiles.size(); ++i) {
+        m_generating.insert(peakFiles[i]->getAudioFile()->getId());
+    }
+
+    return peakFiles;
+}
+
+void
+PeakFileManager::writePeaks(const std::vector<PeakFile *> &peakFiles)
+{
+    if (peakFiles.empty())
+        return;
+
+    PeakJobs jobs;
+    jobs.files = peakFiles;
+    jobs.results.resize(jobs.files.size(), PeakJobs::Failed);
+    size_t totalKilobytes = 0;
+
+    for (size_t i = 0; i < jobs.files.size(); ++i) {
+        PeakFile *peakFile = jobs.files[i];
+
+        // The workers mustn't touch the progress dialog.
+        peakFile->setProgressDialog(0);
+        peakFile->setProgressCounters(&jobs.kilobytesRead, &jobs.cancelled);
+
+        totalKilobytes += peakFile->getAudioFile()->getSize() / 1024;
+    }
+
+    const int threads = std::min(getThreadCount(), int(jobs.files.size()));
+
+#ifdef DEBUG_PEAKFILEMANAGER
+    RG_DEBUG << "generatePeaks() - generating peaks for" << jobs.files.size() << "files on" << threads << "threads";
+#endif
+
+    QString failedFileName;
+
+    {
+        JobPool pool(jobs, jobs.files.size(), threads);
+
+        std::vector<bool> reported(jobs.files.size(), false);
+        size_t reportedCount = 0;
+
+        // Report each file as it's finished, and keep the progress
+        // dialog going, until they all are.
+        while (reportedCount < jobs.files.size()) {
+
+            pool.waitForFinished(reportedCount, 50);
+
+            for (size_t i = 0; i < jobs.files.size(); ++i) {
+                if (reported[i] || !pool.isFinished(i))
+                    continue;
+                reported[i] = true;
+                ++reportedCount;
+
+                AudioFile *audioFile = jobs.files[i]->getAudioFile();
+
+                if (jobs.results[i] == PeakJobs::Failed) {
+                    RG_WARNING << "generatePeaks() - Can't write peak file for " << audioFile->getFilename() << " - no preview generated";
+                    if (failedFileName.isEmpty())
+                        failedFileName = audioFile->getFilename();
+
+                    QMutexLocker locker(&m_generatingMutex);
+                    m_generating.erase(audioFile->getId());
+
+                } else if (jobs.results[i] == PeakJobs::Written) {
+                    {
+                        QMutexLocker locker(&m_generatingMutex);
+                        m_generating.erase(audioFile->getId());
+                    }
+                    emit peaksGenerated(audioFile->getId());
+                }
+            }
+
+            if (m_progressDialog) {
+                if (m_progressDialog->wasCanceled()) {
+                    jobs.cancelled.fetchAndStoreRelaxed(1);
+                } else if (totalKilobytes > 0) {
+                    double kilobytes = jobs.kilobytesRead.fetchAndAddRelaxed(0);
+                    m_progressDialog->setValue(
+                            int(kilobytes / double(totalKilobytes) * 100.0));
+                }
+            }
+
+            qApp->processEvents(QEventLoop::AllEvents);
+        }
+    }
+
+    // Files that were cancelled are left as they were.
+    {
+        QMutexLocker locker(&m_generatingMutex);
+        for (size_t i = 0; i < jobs.files.size(); ++i) {
+            jobs.files[i]->setProgressCounters(0, 0);
+            m_generating.erase(jobs.files[i]->getAudioFile()->getId());
+        }
+    }
+
+    if (!failedFileName.isEmpty()) {
+        throw BadPeakFileException(failedFileName, __FILE__, __LINE__);
+    }
+}
+
+bool
+PeakFileManager::isGenerating(AudioFile *audioFile) const
+{
+    QMutexLocker locker(&m_generatingMutex);
+    return m_generating.find(audioFile->getId()) != m_generating.end();
+}
+
+int
+PeakFileManager::getThreadCount()
+{
+    return JobPool::getThreadCount(m_threadCount, MaxThreads);
+}
+
 std::vector<float>
 PeakFileManager::getPreview(AudioFile *audioFile,
                             const RealTime &startTime,
@@ -194,6 +425,12 @@ PeakFileManager::getPreview(AudioFile *audioFile,
         return rV;
 
     if (audioFile->getType() == WAV) {
+        // Still being written
+        if (isGenerating(audioFile)) {
+            throw BadPeakFileException(
+                    audioFile->getFilename(), __FILE__, __LINE__);
+        }
+
         PeakFile *peakFile = getPeakFile(audioFile);
 
         // just write out a peak file
@@ -222,6 +459,33 @@ PeakFileManager::getPreview(AudioFile *audioFile,
     return rV;
 }
 
+std::vector<float>
+PeakFileManager::getRecordingPreview(AudioFile *audioFile,
+                                     unsigned int sampleRate,
+                                     const RealTime &startTime,
+                                     const RealTime &endTime,
+                                     int width,
+                                     bool showMinima)
+{
+    // Not the PeakFile from getPeakFile(), which would keep the header
+    // it first read, and its caches.
+    PeakFile peakFile(audioFile);
+    peakFile.setSampleRate(sampleRate);
+
+    try {
+        if (!peakFile.open())
+            return std::vector<float>();
+
+        return peakFile.getPreview(startTime, endTime, width, showMinima);
+    } catch (SoundFile::BadSoundFileException e) {
+#ifdef DEBUG_PEAKFILEMANAGER
+        RG_WARNING << "getRecordingPreview() - \"" << e << "\"";
+#endif
+
+        return std::vector<float>();
+    }
+}
+
 void
 PeakFileManager::clear()
 {
@@ -241,6 +505,9 @@ PeakFileManager::getSplitPoints(AudioFile *audioFile,
                                 int threshold,
                                 const RealTime &minTime)
 {
+    if (isGenerating(audioFile))
+        return std::vector<SplitPointPair>();
+
     PeakFile *peakFile = getPeakFile(audioFile);
 
     if (peakFile == 0)
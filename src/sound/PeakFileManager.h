@@ -17,15 +17,18 @@
 #ifndef RG_PEAKFILEMANAGER_H
 #define RG_PEAKFILEMANAGER_H
 
+#include <set>
 #include <vector>
 
 #include <QObject>
+#include <QMutex>
 #include <QString>
 #include <QPointer>
 
 class QProgressDialog;
 
 #include "sound/SoundFile.h"
+#include "AudioFile.h"  // for AudioFileId
 #include "PeakFile.h"  // for SplitPointPair
 
 namespace Rosegarden
@@ -90,6 +93,60 @@ public:
      */
     void generatePeaks(AudioFile *audioFile);
 
+    /// Generate peak files for several audio files at once.
+    /**
+     * The peak files are written on up to getThreadCount() worker
+     * threads, while the calling (GUI) thread keeps the progress
+     * dialog and the event loop going.  peaksGenerated() is emitted
+     * for each file as soon as its peaks are written, so that previews
+     * of the files which are ready can be drawn while the others are
+     * still being read.  Cancelling the progress dialog stops all of
+     * them, and no partial peak files are left behind.
+     *
+     * As with generatePeaks(AudioFile *), only WAV files are handled.
+     *
+     * throws BadPeakFileException for the first file that couldn't be
+     * written, once all the others are done.
+     */
+    void generatePeaks(const std::vector<AudioFile *> &audioFiles);
+
+    /// The first half of generatePeaks(): find or make the peak files
+    /// for the audio files that need writing, and mark them as being
+    /// generated.
+    /**
+     * This changes the list of peak files, so a caller that shares the
+     * manager with other threads (AudioFileManager) calls it with its
+     * lock held, and writePeaks() without, so that previews can be
+     * read while the peaks are written.
+     */
+    std::vector<PeakFile *> preparePeaks(
+            const std::vector<AudioFile *> &audioFiles);
+
+    /// The second half of generatePeaks(): write peak files returned
+    /// by preparePeaks().
+    void writePeaks(const std::vector<PeakFile *> &peakFiles);
+
+    /// Is generatePeaks() still writing peaks for this file?
+    /**
+     * Its peak file mustn't be read until it's done.
+     */
+    bool isGenerating(AudioFile *audioFile) const;
+
+    /// Number of files generatePeaks() writes at once.
+    /**
+     * For tests and benchmarks.  Unset (zero), it's as many as there
+     * are cores, within MaxThreads.
+     */
+    static void setThreadCount(int threads)  { m_threadCount = threads; }
+    static int getThreadCount();
+
+    /// The most threads generatePeaks() uses by default.
+    /**
+     * Generating peaks is mostly reading the audio files, and beyond a
+     * few readers the disk, not the cores, sets the pace.
+     */
+    static const int MaxThreads = 4;
+
     /**
      * throws BadSoundFileException, BadPeakFileException
      */
@@ -98,6 +155,19 @@ public:
                                   const RealTime &endTime,
                                   int   width,
                                   bool  showMinima);
+    /// Get a preview of an audio file that is still being recorded.
+    /**
+     * Its peaks are read afresh each time, as they grow.  The audio
+     * file itself can't be read yet, so its sample rate is given.
+     * Returns nothing if there are no peaks yet.
+     */
+    std::vector<float> getRecordingPreview(AudioFile *audioFile,
+                                           unsigned int sampleRate,
+                                           const RealTime &startTime,
+                                           const RealTime &endTime,
+                                           int   width,
+                                           bool  showMinima);
+
     /// Removes peak file from PeakFileManager - doesn't affect audioFile
     bool removeAudioFile(AudioFile *audioFile);
 
@@ -116,6 +186,10 @@ public:
     std::vector<PeakFile *>::const_iterator end() const
                 { return m_peakFiles.end(); }
 
+signals:
+    /// Emitted when the peak file for an audio file has been written.
+    void peaksGenerated(AudioFileId);
+
 protected:
     /// Insert PeakFile based on AudioFile if it doesn't already exist.
     bool insertAudioFile(AudioFile *audioFile);
@@ -125,6 +199,12 @@ protected:
     std::vector<PeakFile *> m_peakFiles;
 
     QPointer<QProgressDialog> m_progressDialog;
+
+    /// Audio files whose peaks generatePeaks() is writing.
+    std::set<AudioFileId> m_generating;
+    mutable QMutex m_generatingMutex;
+
+    static int m_threadCount;
 };
 
 
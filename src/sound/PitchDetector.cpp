@@ -19,10 +19,12 @@
 #include <stdlib.h>
 #include <fstream>
 
+#include <QMutex>
 #include <QObject>
 #include <QVector>
 
 #include "PitchDetector.h"
+#include "AudioTimeStretcher.h"
 
 #define DEBUG_PT 0
 
@@ -66,7 +68,9 @@ PitchDetector::PitchDetector( int fs, int ss, int sr ) {
     m_cepstralIn = (float *)fftwf_malloc(sizeof(float) * m_frameSize );
     m_cepstralOut = (fftwf_complex *)fftwf_malloc(sizeof(fftwf_complex) * m_frameSize );
 
-    // create fft plans
+    // create fft plans, under the lock the time stretchers' planner
+    // uses, as FFTW's planner is not thread safe
+    QMutexLocker locker(AudioTimeStretcher::getPlannerMutex());
     m_p1= fftwf_plan_dft_r2c_1d( m_frameSize, m_in1, m_ft1, FFTW_MEASURE );
     m_p2= fftwf_plan_dft_r2c_1d( m_frameSize, m_in2, m_ft2, FFTW_MEASURE );
 
@@ -137,6 +141,7 @@ PitchDetector::~PitchDetector() {
     fftwf_free(m_ft2);
     fftwf_free(m_cepstralIn);
     fftwf_free(m_cepstralOut);
+    QMutexLocker locker(AudioTimeStretcher::getPlannerMutex());
     fftwf_destroy_plan(m_p1);
     fftwf_destroy_plan(m_p2);
     fftwf_destroy_plan(m_pc);
@@ -14,279 +14,21 @@
 */
 
 #include "PlayableAudioFile.h"
+#include "AudioFileMapping.h"
+#include "AudioTimeStretcher.h"
+#include "Resampler.h"
+#include "RingBufferPool.h"
+
+#include <cmath>
 
 namespace Rosegarden
 {
 
-//#define DEBUG_RING_BUFFER_POOL 1
 //#define DEBUG_PLAYABLE 1
 //#define DEBUG_PLAYABLE_READ 1
 
-class RingBufferPool
-{
-public:
-    typedef float sample_t;
-
-    RingBufferPool(size_t bufferSize);
-    virtual ~RingBufferPool();
-
-    /**
-     * Set the default size for buffers.  Buffers currently allocated
-     * will not be resized until they are returned.
-     */
-    void setBufferSize(size_t n);
-
-    size_t getBufferSize() const
-    {
-        return m_bufferSize;
-    }
-
-    /**
-     * Discard or create buffers as necessary so as to have n buffers
-     * in the pool.  This will not discard any buffers that are
-     * currently allocated, so if more than n are allocated, more than
-     * n will remain.
-     */
-    void setPoolSize(size_t n);
-
-    size_t getPoolSize() const
-    {
-        return m_buffers.size();
-    }
-
-    /**
-     * Return true if n buffers available, false otherwise.
-     */
-    bool getBuffers(size_t n, RingBuffer<sample_t> **buffers);
-
-    /**
-     * Return a buffer to the pool.
-     */
-    void returnBuffer(RingBuffer<sample_t> *buffer);
-
-protected:
-    // Want to avoid memory allocation if possible when marking a buffer
-    // unallocated or allocated, so we use a single container for all
-
-    typedef std::pair<RingBuffer<sample_t> *, bool> AllocPair;
-    typedef std::vector<AllocPair> AllocList;
-    AllocList m_buffers;
-
-    size_t m_bufferSize;
-    size_t m_available;
-
-    pthread_mutex_t m_lock;
-};
-
-
-RingBufferPool::RingBufferPool(size_t bufferSize) :
-    m_bufferSize(bufferSize),
-    m_available(0)
-{
-    pthread_mutex_t initialisingMutex = PTHREAD_MUTEX_INITIALIZER;
-    memcpy(&m_lock, &initialisingMutex, sizeof(pthread_mutex_t));
-}
-
-RingBufferPool::~RingBufferPool()
-{
-    size_t allocatedCount = 0;
-    for (AllocList::iterator i = m_buffers.begin(); i != m_buffers.end(); ++i) {
-        if (i->second)
-            ++allocatedCount;
-    }
-
-    if (allocatedCount > 0) {
-        std::cerr << "WARNING: RingBufferPool::~RingBufferPool: deleting pool with " << allocatedCount << " allocated buffers" << std::endl;
-    }
-
-    for (AllocList::iterator i = m_buffers.begin(); i != m_buffers.end(); ++i) {
-        delete i->first;
-    }
-
-    m_buffers.clear();
-
-    pthread_mutex_destroy(&m_lock);
-}
-
-void
-RingBufferPool::setBufferSize(size_t n)
-{
-    if (m_bufferSize == n)
-        return ;
-
-    pthread_mutex_lock(&m_lock);
-
-#ifdef DEBUG_RING_BUFFER_POOL
-
-    std::cerr << "RingBufferPool::setBufferSize: from " << m_bufferSize
-              << " to " << n << std::endl;
-    int c = 0;
-#endif
-
-    for (AllocList::iterator i = m_buffers.begin(); i != m_buffers.end(); ++i) {
-        if (!i->second) {
-            delete i->first;
-            i->first = new RingBuffer<sample_t>(n);
-#ifdef DEBUG_RING_BUFFER_POOL
-
-            std::cerr << "Resized buffer " << c++ << std::endl;
-#endif
-
-        } else {
-#ifdef DEBUG_RING_BUFFER_POOL
-            std::cerr << "Buffer " << c++ << " is already in use, resizing in place" << std::endl;
-#endif
-
-            i->first->resize(n);
-        }
-    }
-
-    m_bufferSize = n;
-    pthread_mutex_unlock(&m_lock);
-}
-
-void
-RingBufferPool::setPoolSize(size_t n)
-{
-    pthread_mutex_lock(&m_lock);
-
-#ifdef DEBUG_RING_BUFFER_POOL
-
-    std::cerr << "RingBufferPool::setPoolSize: from " << m_buffers.size()
-              << " to " << n << std::endl;
-#endif
-
-    size_t allocatedCount = 0, count = 0;
-
-    for (AllocList::iterator i = m_buffers.begin(); i != m_buffers.end(); ++i) {
-        if (i->second)
-            ++allocatedCount;
-        ++count;
-    }
-
-    if (count > n) {
-        for (AllocList::iterator i = m_buffers.begin(); i != m_buffers.end(); ) {
-            if (!i->second) {
-                delete i->first;
-                m_buffers.erase(i);
-                if (--count == n)
-                    break;
-            } else {
-                ++i;
-            }
-        }
-    }
-
-    while (count < n) {
-        m_buffers.push_back(AllocPair(new RingBuffer<sample_t>(m_bufferSize),
-                                      false));
-        ++count;
-    }
-
-    m_available = std::max(allocatedCount, n) - allocatedCount;
-
-#ifdef DEBUG_RING_BUFFER_POOL
-
-    std::cerr << "RingBufferPool::setPoolSize: have " << m_buffers.size()
-              << " buffers (" << allocatedCount << " allocated, " << m_available << " available)" << std::endl;
-#endif
-
-    pthread_mutex_unlock(&m_lock);
-}
-
-bool
-RingBufferPool::getBuffers(size_t n, RingBuffer<sample_t> **buffers)
-{
-    pthread_mutex_lock(&m_lock);
-
-    size_t count = 0;
-
-    for (AllocList::iterator i = m_buffers.begin(); i != m_buffers.end(); ++i) {
-        if (!i->second && ++count == n)
-            break;
-    }
-
-    if (count < n) {
-#ifdef DEBUG_RING_BUFFER_POOL
-        std::cerr << "RingBufferPool::getBuffers(" << n << "): not available (in pool of " << m_buffers.size() << "), resizing" << std::endl;
-#endif
-
-        AllocList newBuffers;
-
-        while (count < n) {
-            for (size_t i = 0; i < m_buffers.size(); ++i) {
-                newBuffers.push_back(m_buffers[i]);
-            }
-            for (size_t i = 0; i < m_buffers.size(); ++i) {
-                newBuffers.push_back(AllocPair(new RingBuffer<sample_t>(m_bufferSize),
-                                               false));
-            }
-            count += m_buffers.size();
-            m_available += m_buffers.size();
-        }
-
-        m_buffers = newBuffers;
-    }
-
-    count = 0;
-
-#ifdef DEBUG_RING_BUFFER_POOL
-
-    std::cerr << "RingBufferPool::getBuffers(" << n << "): available" << std::endl;
-#endif
-
-    for (AllocList::iterator i = m_buffers.begin(); i != m_buffers.end(); ++i) {
-        if (!i->second) {
-            i->second = true;
-            i->first->reset();
-            i->first->mlock();
-            buffers[count] = i->first;
-            --m_available;
-            if (++count == n)
-                break;
-        }
-    }
-
-#ifdef DEBUG_RING_BUFFER_POOL
-    std::cerr << "RingBufferPool::getBuffers: " << m_available << " remain in pool of " << m_buffers.size() << std::endl;
-#endif
-
-    pthread_mutex_unlock(&m_lock);
-    return true;
-}
-
-void
-RingBufferPool::returnBuffer(RingBuffer<sample_t> *buffer)
-{
-    pthread_mutex_lock(&m_lock);
-
-#ifdef DEBUG_RING_BUFFER_POOL
-
-    std::cerr << "RingBufferPool::returnBuffer" << std::endl;
-#endif
-
-    buffer->munlock();
-
-    for (AllocList::iterator i = m_buffers.begin(); i != m_buffers.end(); ++i) {
-        if (i->first == buffer) {
-            i->second = false;
-            ++m_available;
-            if (buffer->getSize() != m_bufferSize) {
-                delete buffer;
-                i->first = new RingBuffer<sample_t>(m_bufferSize);
-            }
-        }
-    }
-
-#ifdef DEBUG_RING_BUFFER_POOL
-    std::cerr << "RingBufferPool::returnBuffer: " << m_available << " remain in pool of " << m_buffers.size() << std::endl;
-#endif
-
-    pthread_mutex_unlock(&m_lock);
-}
-
-
 AudioCache PlayableAudioFile::m_smallFileCache;
+bool PlayableAudioFile::m_preResampleSmallFiles = true;
 
 std::vector<PlayableAudioFile::sample_t *> PlayableAudioFile::m_workBuffers;
 size_t PlayableAudioFile::m_workBufferSize = 0;
@@ -298,6 +40,18 @@ RingBufferPool *PlayableAudioFile::m_ringBufferPool = 0;
 
 size_t PlayableAudioFile::m_xfadeFrames = 30;
 
+bool PlayableAudioFile::m_useMappedFiles = true;
+
+// How far ahead of the play position to ask the kernel to read a
+// mapped file: some multiple of what we just read, and at least this
+static const size_t minReadAheadBytes = 256 * 1024;
+
+// The most a time stretcher makes in one go, which sizes its buffers
+static const size_t stretchBlockSize = 1024;
+
+// How many frames of a file to resample at a time
+static const size_t resampleBlockSize = 1024;
+
 PlayableAudioFile::PlayableAudioFile(InstrumentId instrumentId,
                                      AudioFile *audioFile,
                                      const RealTime &startTime,
@@ -306,11 +60,15 @@ PlayableAudioFile::PlayableAudioFile(InstrumentId instrumentId,
                                      size_t bufferSize,
                                      size_t smallFileSize,
                                      int targetChannels,
-                                     int targetSampleRate) :
+                                     int targetSampleRate,
+                                     float stretchRatio) :
     m_startTime(startTime),
     m_startIndex(startIndex),
     m_duration(duration),
     m_file(0),
+    m_mapping(0),
+    m_mappedFrame(0),
+    m_readAheadEnd(0),
     m_audioFile(audioFile),
     m_instrumentId(instrumentId),
     m_targetChannels(targetChannels),
@@ -319,11 +77,22 @@ PlayableAudioFile::PlayableAudioFile(InstrumentId instrumentId,
     m_firstRead(true),
     m_runtimeSegmentId( -1),
     m_isSmallFile(false),
+    m_smallFileReference(0),
+    m_smallFileData(0),
+    m_smallFileChannels(0),
+    m_smallFileFrames(0),
     m_currentScanPoint(RealTime::zeroTime),
     m_smallFileScanFrame(0),
     m_autoFade(false),
     m_fadeInTime(RealTime::zeroTime),
-    m_fadeOutTime(RealTime::zeroTime)
+    m_fadeOutTime(RealTime::zeroTime),
+    m_stretchRatio(stretchRatio > 0.f ? stretchRatio : 1.f),
+    m_stretcher(0),
+    m_stretchSilence(0),
+    m_stretchDiscard(0),
+    m_sourceEnded(false),
+    m_resampler(0),
+    m_resampleEnded(false)
 {
 #ifdef DEBUG_PLAYABLE
     std::cerr << "PlayableAudioFile::PlayableAudioFile - creating " << this << " for instrument " << instrumentId << " with file " << (m_audioFile ? m_audioFile->getShortFilename() : "(none)") << std::endl;
@@ -363,9 +132,53 @@ PlayableAudioFile::initialise(size_t bufferSize, size_t smallFileSize)
     std::cerr << "PlayableAudioFile::initialise() " << this << std::endl;
 #endif
 
-    checkSmallFileCache(smallFileSize);
+    // Small files are cached decoded at the target rate, so we need
+    // that first
+    if (m_targetChannels <= 0)
+        m_targetChannels = m_audioFile->getChannels();
+    if (m_targetSampleRate <= 0)
+        m_targetSampleRate = m_audioFile->getSampleRate();
 
-    if (!m_isSmallFile) {
+    // A stretched file is never small: the cache holds files as they
+    // are, and we make stretched audio only as we play it
+    if (m_stretchRatio == 1.f &&
+        (m_preResampleSmallFiles ||
+         m_targetSampleRate == int(m_audioFile->getSampleRate()))) {
+        checkSmallFileCache(smallFileSize);
+    }
+
+    // Other files at another rate are resampled as they are read
+    if (!m_isSmallFile &&
+        m_targetSampleRate != int(m_audioFile->getSampleRate())) {
+        try {
+            m_resampler = new Resampler(Resampler::FastestTolerable,
+                                        m_targetChannels,
+                                        int(resampleBlockSize));
+        } catch (Resampler::Exception) {
+            std::cerr << "WARNING: PlayableAudioFile::initialise: Failed to create resampler, resampling badly instead" << std::endl;
+            m_resampler = 0;
+        }
+    }
+
+    if (m_resampler) {
+        // (room for the last block, with the tail the final call
+        // flushes)
+        size_t outputSize = m_resampler->getFinalOutputSpace
+            (int(resampleBlockSize),
+             float(m_targetSampleRate) / float(m_audioFile->getSampleRate()));
+        for (int ch = 0; ch < m_targetChannels; ++ch) {
+            m_resampleInput.push_back(new sample_t[resampleBlockSize]);
+            m_resampleOutput.push_back(new sample_t[outputSize]);
+            m_resampleBuffers.push_back
+                (new RingBuffer<sample_t>(outputSize * 2));
+        }
+    }
+
+    if (!m_isSmallFile && m_useMappedFiles) {
+        m_mapping = AudioFileMapping::acquire(m_audioFile->getFilename());
+    }
+
+    if (!m_isSmallFile && !m_mapping) {
 
         m_file = new std::ifstream(m_audioFile->getFilename().toLocal8Bit(),
                                    std::ios::in | std::ios::binary);
@@ -383,13 +196,13 @@ PlayableAudioFile::initialise(size_t bufferSize, size_t smallFileSize)
     std::cerr << "PlayableAudioFile::initialise - scanning to " << m_startIndex << std::endl;
 #endif
 
-    if (m_file) {
+    if (m_file || m_mapping) {
         scanTo(m_startIndex);
     } else {
         m_fileEnded = false;
         m_currentScanPoint = m_startIndex;
         m_smallFileScanFrame = (size_t)RealTime::realTime2Frame
-            (m_currentScanPoint, m_audioFile->getSampleRate());
+            (m_currentScanPoint, m_targetSampleRate);
     }
 
 #ifdef DEBUG_PLAYABLE
@@ -398,11 +211,6 @@ PlayableAudioFile::initialise(size_t bufferSize, size_t smallFileSize)
     (void)bufferSize;
 #endif
 
-    if (m_targetChannels <= 0)
-        m_targetChannels = m_audioFile->getChannels();
-    if (m_targetSampleRate <= 0)
-        m_targetSampleRate = m_audioFile->getSampleRate();
-
     m_ringBuffers = new RingBuffer<sample_t> *[m_targetChannels];
     for (int ch = 0; ch < m_targetChannels; ++ch) {
         m_ringBuffers[ch] = 0;
@@ -416,14 +224,27 @@ PlayableAudioFile::~PlayableAudioFile()
         delete m_file;
     }
 
+    AudioFileMapping::release(m_mapping);
+
     returnRingBuffers();
     delete[] m_ringBuffers;
     m_ringBuffers = 0;
 
-    if (m_isSmallFile) {
-        m_smallFileCache.decrementReference(m_audioFile);
+    delete m_stretcher;
+    for (size_t i = 0; i < m_stretchInput.size(); ++i) {
+        delete[] m_stretchInput[i];
+    }
+
+    delete m_resampler;
+    for (size_t i = 0; i < m_resampleBuffers.size(); ++i) {
+        delete[] m_resampleInput[i];
+        delete[] m_resampleOutput[i];
+        delete m_resampleBuffers[i];
     }
 
+    // Lock-free, as we may be destroyed on an RT thread
+    m_smallFileCache.decrementReference(m_smallFileReference);
+
 #ifdef DEBUG_PLAYABLE 
     //    std::cerr << "PlayableAudioFile::~PlayableAudioFile - destroying - " << this << std::endl;
 #endif
@@ -452,19 +273,40 @@ PlayableAudioFile::scanTo(const RealTime &time)
 
     bool ok = false;
 
+    // Where to read the file from: for a stretched file, somewhat
+    // before the unstretched equivalent of time
+    RealTime fileTime = time;
+    if (m_stretchRatio != 1.f) {
+        fileTime = resetStretcher(time);
+    }
+
     if (m_isSmallFile) {
 
         m_currentScanPoint = time;
         m_smallFileScanFrame = (size_t)RealTime::realTime2Frame
-            (time, m_audioFile->getSampleRate());
+            (time, m_targetSampleRate);
 #ifdef DEBUG_PLAYABLE_READ
         std::cerr << "... maps to frame " << m_smallFileScanFrame << std::endl;
 #endif
         ok = true;
 
+    } else if (m_mapping) {
+
+        size_t frame = (size_t)RealTime::realTime2Frame
+            (fileTime, m_audioFile->getSampleRate());
+        size_t offset = frame * getBytesPerFrame();
+
+        if (offset <= m_mapping->getDataSize()) {
+            m_mappedFrame = frame;
+            m_currentScanPoint = time;
+            m_mapping->willNeed(offset, minReadAheadBytes);
+            m_readAheadEnd = offset + minReadAheadBytes;
+            ok = true;
+        }
+
     } else {
 
-        ok = m_audioFile->scanTo(m_file, time);
+        ok = m_audioFile->scanTo(m_file, fileTime);
         if (ok) {
             m_currentScanPoint = time;
         }
@@ -474,6 +316,10 @@ PlayableAudioFile::scanTo(const RealTime &time)
     std::cerr << "PlayableAudioFile::scanTo(" << time << "): set m_currentScanPoint to " << m_currentScanPoint << std::endl;
 #endif
 
+    if (ok && m_resampler) {
+        resetResampler();
+    }
+
     m_firstRead = true; // so we know to xfade in
 
     return ok;
@@ -486,11 +332,8 @@ PlayableAudioFile::getSampleFramesAvailable()
     size_t actual = 0;
 
     if (m_isSmallFile) {
-        size_t cchannels;
-        size_t cframes;
-        (void)m_smallFileCache.getData(m_audioFile, cchannels, cframes);
-        if (cframes > m_smallFileScanFrame)
-            return cframes - m_smallFileScanFrame;
+        if (m_smallFileFrames > m_smallFileScanFrame)
+            return m_smallFileFrames - m_smallFileScanFrame;
         else
             return 0;
     }
@@ -553,9 +396,9 @@ PlayableAudioFile::addSamples(std::vector<sample_t *> &destination,
 
     } else {
 
-        size_t cchannels;
-        size_t cframes;
-        float **cached = m_smallFileCache.getData(m_audioFile, cchannels, cframes);
+        size_t cchannels = m_smallFileChannels;
+        size_t cframes = m_smallFileFrames;
+        float **cached = m_smallFileData;
 
         if (!cached) {
             std::cerr << "WARNING: PlayableAudioFile::addSamples: Failed to find small file in cache" << std::endl;
@@ -628,16 +471,30 @@ PlayableAudioFile::addSamples(std::vector<sample_t *> &destination,
     return 0;
 }
 
+AudioCache::Key
+PlayableAudioFile::getSmallFileCacheKey() const
+{
+    return AudioCache::Key::forFile(m_audioFile->getId(), m_targetSampleRate,
+                                    m_audioFile->getFilename());
+}
+
 void
 PlayableAudioFile::checkSmallFileCache(size_t smallFileSize)
 {
-    if (m_smallFileCache.has(m_audioFile)) {
+    const AudioCache::Key key = getSmallFileCacheKey();
+
+    // Evict whatever files that stopped playing since the last look
+    // have left over the budget, as they can't do it themselves
+    m_smallFileCache.purge();
+
+    m_smallFileReference = m_smallFileCache.incrementReference(key);
+
+    if (m_smallFileReference) {
 
 #ifdef DEBUG_PLAYABLE
         std::cerr << "PlayableAudioFile::checkSmallFileCache: Found file in small file cache" << std::endl;
 #endif
 
-        m_smallFileCache.incrementReference(m_audioFile);
         m_isSmallFile = true;
 
     } else if (m_audioFile->getSize() <= smallFileSize) {
@@ -668,33 +525,72 @@ PlayableAudioFile::checkSmallFileCache(size_t smallFileSize)
 //        std::cerr <<"obtained=" << obtained << std::endl;
 
         size_t nch = getSourceChannels();
+
+        std::vector<sample_t *> samples;
+        for (size_t ch = 0; ch < nch; ++ch) {
+            samples.push_back(new sample_t[obtained]);
+        }
+
         size_t nframes = obtained;
-        if (int(getSourceSampleRate()) != m_targetSampleRate) {
+        bool ok = (obtained > 0 &&
+                   m_audioFile->decode(buffer,
+                                       obtained * m_audioFile->getBytesPerFrame(),
+                                       getSourceSampleRate(),
+                                       nch,
+                                       obtained,
+                                       samples));
+
+        if (ok && int(getSourceSampleRate()) != m_targetSampleRate) {
+
 #ifdef DEBUG_PLAYABLE
-            std::cerr << "PlayableAudioFile::checkSmallFileCache: Resampling badly from " << getSourceSampleRate() << " to " << m_targetSampleRate << std::endl;
+            std::cerr << "PlayableAudioFile::checkSmallFileCache: Resampling from " << getSourceSampleRate() << " to " << m_targetSampleRate << std::endl;
 #endif
-            nframes = size_t(float(nframes) * float(m_targetSampleRate) /
-                             float(getSourceSampleRate()));
-        }
 
-        std::vector<sample_t *> samples;
-        for (size_t ch = 0; ch < nch; ++ch) {
-            samples.push_back(new sample_t[nframes]);
+            // Once, so we can afford to do it well
+            const float ratio =
+                float(m_targetSampleRate) / float(getSourceSampleRate());
+
+            std::vector<sample_t *> resampled;
+
+            try {
+                Resampler resampler(Resampler::Best, int(nch), int(obtained));
+
+                // (with room for the tail the final call flushes)
+                nframes = resampler.getFinalOutputSpace(int(obtained), ratio);
+                for (size_t ch = 0; ch < nch; ++ch) {
+                    resampled.push_back(new sample_t[nframes]);
+                }
+
+                nframes = resampler.resample(&samples[0], &resampled[0],
+                                             int(obtained), ratio, true);
+            } catch (Resampler::Exception) {
+                ok = false;
+            }
+
+            if (ok) {
+                for (size_t ch = 0; ch < nch; ++ch) {
+                    delete[] samples[ch];
+                }
+                samples = resampled;
+            } else {
+                for (size_t ch = 0; ch < resampled.size(); ++ch) {
+                    delete[] resampled[ch];
+                }
+            }
         }
 
-        if (!m_audioFile->decode(buffer,
-                                 obtained * m_audioFile->getBytesPerFrame(),
-                                 m_targetSampleRate,
-                                 nch,
-                                 nframes,
-                                 samples)) {
+        if (!ok) {
             std::cerr << "PlayableAudioFile::checkSmallFileCache: failed to decode file" << std::endl;
+            for (size_t ch = 0; ch < nch; ++ch) {
+                delete[] samples[ch];
+            }
         } else {
             sample_t **toCache = new sample_t * [nch];
             for (size_t ch = 0; ch < nch; ++ch) {
                 toCache[ch] = samples[ch];
             }
-            m_smallFileCache.addData(m_audioFile, nch, nframes, toCache);
+            m_smallFileReference =
+                m_smallFileCache.addData(key, nch, nframes, toCache);
             m_isSmallFile = true;
         }
 
@@ -704,6 +600,8 @@ PlayableAudioFile::checkSmallFileCache(size_t smallFileSize)
     }
 
     if (m_isSmallFile) {
+        m_smallFileData = m_smallFileCache.getData
+            (key, m_smallFileChannels, m_smallFileFrames);
         if (m_file) {
             m_file->close();
             delete m_file;
@@ -724,7 +622,7 @@ PlayableAudioFile::fillBuffers()
     }
 #endif
 
-    if (!m_isSmallFile && (!m_file || !*m_file)) {
+    if (!m_isSmallFile && !m_mapping && (!m_file || !*m_file)) {
         m_file = new std::ifstream(m_audioFile->getFilename().toLocal8Bit(),
                                    std::ios::in | std::ios::binary);
         if (!*m_file) {
@@ -768,7 +666,7 @@ PlayableAudioFile::fillBuffers(const RealTime &currentTime)
         return true;
     }
 
-    if (!m_isSmallFile && (!m_file || !*m_file)) {
+    if (!m_isSmallFile && !m_mapping && (!m_file || !*m_file)) {
         m_file = new std::ifstream(m_audioFile->getFilename().toLocal8Bit(),
                                    std::ios::in | std::ios::binary);
         if (!*m_file) {
@@ -810,7 +708,7 @@ PlayableAudioFile::updateBuffers()
 {
     if (m_isSmallFile)
         return false;
-    if (!m_file)
+    if (!m_file && !m_mapping)
         return false;
 
     if (m_fileEnded) {
@@ -828,9 +726,12 @@ PlayableAudioFile::updateBuffers()
             return false;
         }
 
-        // need a buffer: can we get one?
+        // need a buffer: can we get one?  If not, the pool is making
+        // more in the background, and we'll have them next time round
         if (!m_ringBufferPool->getBuffers(m_targetChannels, m_ringBuffers)) {
-            std::cerr << "WARNING: PlayableAudioFile::updateBuffers: no ring buffers available" << std::endl;
+#ifdef DEBUG_PLAYABLE_READ
+            std::cerr << "PlayableAudioFile::updateBuffers: no ring buffers available yet" << std::endl;
+#endif
             return false;
         }
     }
@@ -868,70 +769,35 @@ PlayableAudioFile::updateBuffers()
         m_fileEnded = true;
     }
 
-    size_t fileFrames = nframes;
-    if (m_targetSampleRate != int(getSourceSampleRate())) {
-        fileFrames = size_t(float(fileFrames) * float(getSourceSampleRate()) /
-                            float(m_targetSampleRate));
-    }
-
-#ifdef DEBUG_PLAYABLE_READ
-    std::cerr << "Want " << fileFrames << " (" << block << ") from file (" << (m_duration + m_startIndex - m_currentScanPoint - block) << " to go)" << std::endl;
-#endif
-
-    //!!! need to be doing this in initialise, want to avoid allocations here
-    if ((getBytesPerFrame() * fileFrames) > m_rawFileBufferSize) {
-        delete[] m_rawFileBuffer;
-        m_rawFileBufferSize = getBytesPerFrame() * fileFrames;
-#ifdef DEBUG_PLAYABLE_READ
+    bool fileRanOut = false;
+    bool decoded = false;
 
-        std::cerr << "Expanding raw file buffer to " << m_rawFileBufferSize << " chars" << std::endl;
-#endif
+    ensureWorkBuffers(nframes);
 
-        m_rawFileBuffer = new char[m_rawFileBufferSize];
-    }
+    if (m_stretcher) {
 
-    size_t obtained =
-        m_audioFile->getSampleFrames(m_file, m_rawFileBuffer, fileFrames);
+        readStretched(nframes);
+        decoded = (nframes > 0);
 
-    if (obtained < fileFrames || m_file->eof()) {
-        m_fileEnded = true;
-    }
+    } else {
 
-#ifdef DEBUG_PLAYABLE
-    std::cerr << "requested " << fileFrames << " frames from file for " << nframes << " frames, got " << obtained << " frames" << std::endl;
+#ifdef DEBUG_PLAYABLE_READ
+        std::cerr << "Want " << nframes << " (" << block << ") from file (" << (m_duration + m_startIndex - m_currentScanPoint - block) << " to go)" << std::endl;
 #endif
 
-    if (nframes > m_workBufferSize) {
+        size_t obtained = readFromFile(nframes, m_workBuffers, fileRanOut);
+        decoded = (obtained > 0);
 
-        for (size_t i = 0; i < m_workBuffers.size(); ++i) {
-            delete[] m_workBuffers[i];
+        if (fileRanOut) {
+            m_fileEnded = true;
         }
 
-        m_workBuffers.clear();
-        m_workBufferSize = nframes;
-#ifdef DEBUG_PLAYABLE_READ
-
-        std::cerr << "Expanding work buffer to " << m_workBufferSize << " frames" << std::endl;
+#ifdef DEBUG_PLAYABLE
+        std::cerr << "requested " << nframes << " frames from file, got " << obtained << " frames" << std::endl;
 #endif
-
-        for (int i = 0; i < m_targetChannels; ++i) {
-            m_workBuffers.push_back(new sample_t[m_workBufferSize]);
-        }
-
-    } else {
-
-        while (m_targetChannels > (int)m_workBuffers.size()) {
-            m_workBuffers.push_back(new sample_t[m_workBufferSize]);
-        }
     }
 
-    if (m_audioFile->decode((const unsigned char *)m_rawFileBuffer,
-                            obtained * getBytesPerFrame(),
-                            m_targetSampleRate,
-                            m_targetChannels,
-                            nframes,
-                            m_workBuffers,
-                            false)) {
+    if (decoded) {
 
         /*!!! No -- GUI and notification side of things isn't up to this yet,
           so comment it out just in case
@@ -1011,7 +877,7 @@ PlayableAudioFile::updateBuffers()
 
     m_firstRead = false;
 
-    if (obtained < fileFrames) {
+    if (!m_stretcher && fileRanOut) {
         if (m_file) {
             m_file->close();
             delete m_file;
@@ -1023,6 +889,314 @@ PlayableAudioFile::updateBuffers()
 }
 
 
+const unsigned char *
+PlayableAudioFile::readRaw(size_t fileFrames, size_t &obtained, bool &ended)
+{
+    const unsigned char *source = 0;
+    obtained = 0;
+
+    if (m_mapping) {
+
+        // Decode straight from the mapping
+        size_t bytesPerFrame = getBytesPerFrame();
+        size_t mappedFrames = m_mapping->getDataSize() / bytesPerFrame;
+
+        if (m_mappedFrame < mappedFrames) {
+            obtained = std::min(fileFrames, mappedFrames - m_mappedFrame);
+        }
+        source = m_mapping->getData() + m_mappedFrame * bytesPerFrame;
+        m_mappedFrame += obtained;
+
+        if (obtained < fileFrames || m_mappedFrame >= mappedFrames) {
+            ended = true;
+        }
+
+        // and have the kernel read ahead of where we've got to, once
+        // we're into the second half of what we last asked for
+        size_t position = m_mappedFrame * bytesPerFrame;
+        size_t window = std::max(obtained * bytesPerFrame * 4,
+                                 minReadAheadBytes);
+        if (position + window / 2 > m_readAheadEnd) {
+            m_mapping->willNeed(position, window);
+            m_readAheadEnd = position + window;
+        }
+
+    } else {
+
+        //!!! need to be doing this in initialise, want to avoid allocations here
+        if ((getBytesPerFrame() * fileFrames) > m_rawFileBufferSize) {
+            delete[] m_rawFileBuffer;
+            m_rawFileBufferSize = getBytesPerFrame() * fileFrames;
+#ifdef DEBUG_PLAYABLE_READ
+
+            std::cerr << "Expanding raw file buffer to " << m_rawFileBufferSize << " chars" << std::endl;
+#endif
+
+            m_rawFileBuffer = new char[m_rawFileBufferSize];
+        }
+
+        obtained =
+            m_audioFile->getSampleFrames(m_file, m_rawFileBuffer, fileFrames);
+
+        if (obtained < fileFrames || m_file->eof()) {
+            ended = true;
+        }
+
+        source = (const unsigned char *)m_rawFileBuffer;
+    }
+
+    return source;
+}
+
+size_t
+PlayableAudioFile::readFromFile(size_t nframes,
+                                std::vector<sample_t *> &target,
+                                bool &ended)
+{
+    if (m_resampler) {
+        return readResampled(nframes, target, ended);
+    }
+
+    size_t fileFrames = nframes;
+    if (m_targetSampleRate != int(getSourceSampleRate())) {
+        fileFrames = size_t(float(fileFrames) * float(getSourceSampleRate()) /
+                            float(m_targetSampleRate));
+    }
+
+    size_t obtained = 0;
+    const unsigned char *source = readRaw(fileFrames, obtained, ended);
+
+    // (decode() needs at least one frame to work from)
+    if (obtained == 0 ||
+        !m_audioFile->decode(source,
+                             obtained * getBytesPerFrame(),
+                             m_targetSampleRate,
+                             m_targetChannels,
+                             nframes,
+                             target,
+                             false)) {
+        return 0;
+    }
+
+    // decode() repeats the last frame to make up a short read
+    if (obtained < fileFrames) {
+        return std::max(size_t(1), obtained * nframes / fileFrames);
+    }
+    return nframes;
+}
+
+size_t
+PlayableAudioFile::readResampled(size_t nframes,
+                                 std::vector<sample_t *> &target,
+                                 bool &ended)
+{
+    const float ratio = float(m_targetSampleRate) / float(getSourceSampleRate());
+    size_t done = 0;
+
+    while (true) {
+
+        // Take what's been resampled already
+        size_t count = std::min(m_resampleBuffers[0]->getReadSpace(),
+                                nframes - done);
+        for (int ch = 0; ch < m_targetChannels; ++ch) {
+            m_resampleBuffers[ch]->read(target[ch] + done, count);
+        }
+        done += count;
+
+        if (done == nframes || m_resampleEnded) break;
+
+        // and resample another block of the file.  We decode it at
+        // the file's own rate, which decode() does without resampling.
+        size_t obtained = 0;
+        const unsigned char *source =
+            readRaw(resampleBlockSize, obtained, m_resampleEnded);
+
+        if (obtained > 0 &&
+            !m_audioFile->decode(source,
+                                 obtained * getBytesPerFrame(),
+                                 getSourceSampleRate(),
+                                 m_targetChannels,
+                                 obtained,
+                                 m_resampleInput,
+                                 false)) {
+            obtained = 0;
+        }
+
+        // (at the end, with final set, to get the last of it out)
+        int resampled = m_resampler->resample(&m_resampleInput[0],
+                                              &m_resampleOutput[0],
+                                              int(obtained), ratio,
+                                              m_resampleEnded);
+
+        for (int ch = 0; ch < m_targetChannels; ++ch) {
+            m_resampleBuffers[ch]->write(m_resampleOutput[ch], resampled);
+        }
+    }
+
+    for (int ch = 0; ch < m_targetChannels; ++ch) {
+        for (size_t i = done; i < nframes; ++i) {
+            target[ch][i] = 0.f;
+        }
+    }
+
+    if (m_resampleEnded && m_resampleBuffers[0]->getReadSpace() == 0) {
+        ended = true;
+    }
+
+    return done;
+}
+
+void
+PlayableAudioFile::resetResampler()
+{
+    m_resampler->reset();
+    for (size_t ch = 0; ch < m_resampleBuffers.size(); ++ch) {
+        m_resampleBuffers[ch]->reset();
+    }
+    m_resampleEnded = false;
+}
+
+void
+PlayableAudioFile::ensureWorkBuffers(size_t nframes)
+{
+    if (nframes > m_workBufferSize) {
+
+        for (size_t i = 0; i < m_workBuffers.size(); ++i) {
+            delete[] m_workBuffers[i];
+        }
+
+        m_workBuffers.clear();
+        m_workBufferSize = nframes;
+#ifdef DEBUG_PLAYABLE_READ
+
+        std::cerr << "Expanding work buffer to " << m_workBufferSize << " frames" << std::endl;
+#endif
+
+        for (int i = 0; i < m_targetChannels; ++i) {
+            m_workBuffers.push_back(new sample_t[m_workBufferSize]);
+        }
+
+    } else {
+
+        while (m_targetChannels > (int)m_workBuffers.size()) {
+            m_workBuffers.push_back(new sample_t[m_workBufferSize]);
+        }
+    }
+}
+
+RealTime
+PlayableAudioFile::resetStretcher(const RealTime &time)
+{
+    // The stretcher has no way to be reset, so we make a new one: its
+    // FFT plans are shared, so this is cheap enough
+
+    delete m_stretcher;
+    m_stretcher = new AudioTimeStretcher(m_targetSampleRate,
+                                         m_targetChannels,
+                                         m_stretchRatio,
+                                         true,
+                                         stretchBlockSize);
+
+    const size_t wlen = m_stretcher->getWindowSize();
+
+    if (m_stretchInput.empty()) {
+        // It never asks for more than a window's worth of input
+        for (int ch = 0; ch < m_targetChannels; ++ch) {
+            m_stretchInput.push_back(new sample_t[wlen]);
+        }
+        m_stretchPointers.resize(m_targetChannels);
+    }
+
+    // The stretcher's output for an input frame comes half a window
+    // later than the stretched position of that frame.  So we start
+    // its input half a window early (with silence, if that's before
+    // the start of the file) and discard the first half window of its
+    // output, after which its output is at the stretched position we
+    // wanted -- as it would be in a file stretched from the start.
+
+    const long padding = long(wlen / 2);
+    long from = long(RealTime::realTime2Frame(time, m_targetSampleRate) /
+                     m_stretchRatio) - padding;
+
+    m_stretchSilence = (from < 0 ? size_t(-from) : 0);
+    m_stretchDiscard = size_t(padding);
+    m_sourceEnded = false;
+
+#ifdef DEBUG_PLAYABLE_READ
+    std::cerr << "PlayableAudioFile::resetStretcher(" << time << "): reading from frame " << from << " at ratio " << m_stretchRatio << std::endl;
+#endif
+
+    return RealTime::frame2RealTime(std::max(from, 0L), m_targetSampleRate);
+}
+
+void
+PlayableAudioFile::feedStretcher()
+{
+    const size_t frames = std::max(m_stretcher->getRequiredInputSamples(),
+                                   m_stretcher->getInputIncrement());
+
+    size_t at = std::min(m_stretchSilence, frames);
+    m_stretchSilence -= at;
+
+    size_t got = 0;
+
+    if (at < frames && !m_sourceEnded) {
+
+        for (int ch = 0; ch < m_targetChannels; ++ch) {
+            m_stretchPointers[ch] = m_stretchInput[ch] + at;
+        }
+
+        got = readFromFile(frames - at, m_stretchPointers, m_sourceEnded);
+    }
+
+    // Silence before the file, and after it
+    for (int ch = 0; ch < m_targetChannels; ++ch) {
+        for (size_t i = 0; i < at; ++i) {
+            m_stretchInput[ch][i] = 0.f;
+        }
+        for (size_t i = at + got; i < frames; ++i) {
+            m_stretchInput[ch][i] = 0.f;
+        }
+    }
+
+    m_stretcher->putInput(&m_stretchInput[0], frames);
+}
+
+void
+PlayableAudioFile::readStretched(size_t nframes)
+{
+    size_t done = 0;
+
+    while (done < nframes) {
+
+        size_t available = m_stretcher->getAvailableOutputSamples();
+        if (available == 0) {
+            feedStretcher();
+            continue;
+        }
+
+        size_t count = 0;
+
+        if (m_stretchDiscard > 0) {
+            // latency, to be thrown away
+            count = std::min(std::min(available, m_stretchDiscard), nframes);
+            for (int ch = 0; ch < m_targetChannels; ++ch) {
+                m_stretchPointers[ch] = m_workBuffers[ch];
+            }
+            m_stretchDiscard -= count;
+        } else {
+            count = std::min(available, nframes - done);
+            for (int ch = 0; ch < m_targetChannels; ++ch) {
+                m_stretchPointers[ch] = m_workBuffers[ch] + done;
+            }
+            done += count;
+        }
+
+        m_stretcher->getOutput(&m_stretchPointers[0], count);
+    }
+}
+
+
 // How many channels in the base AudioFile?
 //
 unsigned int
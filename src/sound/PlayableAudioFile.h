@@ -28,6 +28,9 @@ namespace Rosegarden
 {
 
 class RingBufferPool;
+class AudioFileMapping;
+class AudioTimeStretcher;
+class Resampler;
 
 
 class PlayableAudioFile
@@ -43,11 +46,39 @@ public:
                       size_t bufferSize = 4096,
                       size_t smallFileSize = 131072,
                       int targetChannels = -1, // default same as file
-                      int targetSampleRate = -1); // default same as file
+                      int targetSampleRate = -1, // default same as file
+                      float stretchRatio = 1.f); // default not stretched
     ~PlayableAudioFile();
 
     static void setRingBufferPoolSizes(size_t n, size_t nframes);
 
+    // Whether files are read through a memory mapping (the default)
+    // rather than a stream.  Affects files opened after the call.
+    //
+    static void setUseMappedFiles(bool use) { m_useMappedFiles = use; }
+    static bool getUseMappedFiles() { return m_useMappedFiles; }
+
+    // The cache of decoded small files, shared by all playable files.
+    // Its budget is how much it keeps of files no longer playing.
+    //
+    static void setSmallFileCacheBudget(size_t bytes)
+        { m_smallFileCache.setBudget(bytes); }
+    static AudioCache &getSmallFileCache() { return m_smallFileCache; }
+
+    // Whether small files at a sample rate other than the target are
+    // resampled once, at best quality, into the cache (the default),
+    // rather than streamed through a resampler like other files.
+    // Affects files opened after the call.
+    //
+    static void setPreResampleSmallFiles(bool pre)
+        { m_preResampleSmallFiles = pre; }
+    static bool getPreResampleSmallFiles() { return m_preResampleSmallFiles; }
+
+    // The pool of ring buffers that other files are read into, shared
+    // by all playable files.  Null until the first is made or sized.
+    //
+    static RingBufferPool *getRingBufferPool() { return m_ringBufferPool; }
+
     void setStartTime(const RealTime &time) { m_startTime = time; }
     RealTime getStartTime() const { return m_startTime; }
 
@@ -60,6 +91,16 @@ public:
 
     bool isSmallFile() const { return m_isSmallFile; }
 
+    // The ratio the file is time-stretched by as it plays.  If it is
+    // not 1, the start index and duration are in stretched time, and
+    // the file is read through a time stretcher rather than cached.
+    //
+    float getStretchRatio() const { return m_stretchRatio; }
+
+    // Is this file being read through a memory mapping?
+    //
+    bool isMapped() const { return m_mapping != 0; }
+
     // Get audio file for interrogation
     //
     AudioFile* getAudioFile() const { return m_audioFile; }
@@ -156,9 +197,49 @@ public:
 protected: 
     void initialise(size_t bufferSize, size_t smallFileSize);
     void checkSmallFileCache(size_t smallFileSize);
+    AudioCache::Key getSmallFileCacheKey() const;
     bool scanTo(const RealTime &time);
     void returnRingBuffers();
 
+    // Read fileFrames of raw sample data from the file at the current
+    // position, returning where they are, and the number obtained.
+    // Sets ended if the file ran out.
+    //
+    const unsigned char *readRaw(size_t fileFrames, size_t &obtained,
+                                 bool &ended);
+
+    // Read from the file at the current position into target, as
+    // nframes at the target rate and channel count.  Returns the
+    // number of those that came from the file, or 0 if nothing could
+    // be decoded; the rest are made up.  Sets ended if the file ran
+    // out.
+    //
+    size_t readFromFile(size_t nframes, std::vector<sample_t *> &target,
+                        bool &ended);
+
+    // The same, through the resampler
+    //
+    size_t readResampled(size_t nframes, std::vector<sample_t *> &target,
+                         bool &ended);
+
+    void resetResampler();
+
+    void ensureWorkBuffers(size_t nframes);
+
+    // Start the stretcher afresh, to make output from the given
+    // (stretched) time.  Returns the time in the file to read from.
+    //
+    RealTime resetStretcher(const RealTime &time);
+
+    // Put another block of the file (or the silence around it) into
+    // the stretcher
+    //
+    void feedStretcher();
+
+    // Get nframes of stretched output into m_workBuffers
+    //
+    void readStretched(size_t nframes);
+
     RealTime              m_startTime;
     RealTime              m_startIndex;
     RealTime              m_duration;
@@ -169,6 +250,16 @@ protected:
     //
     std::ifstream        *m_file;
 
+    // Or, in preference, a shared mapping of the file, and the frame
+    // we're at within its data.  Samples are decoded from the mapping
+    // without being copied into m_rawFileBuffer first.
+    //
+    AudioFileMapping     *m_mapping;
+    size_t                m_mappedFrame;
+    // The end of the range we last asked the kernel to read ahead
+    size_t                m_readAheadEnd;
+    static bool           m_useMappedFiles;
+
     // AudioFile handle
     //
     AudioFile            *m_audioFile;
@@ -186,7 +277,16 @@ protected:
     int                   m_runtimeSegmentId;
 
     static AudioCache     m_smallFileCache;
+    static bool           m_preResampleSmallFiles;
     bool                  m_isSmallFile;
+    AudioCache::Reference m_smallFileReference;
+
+    // Our small file's data in the cache, looked up once: we hold a
+    // reference to it, so it can't go away while we play
+    //
+    float               **m_smallFileData;
+    size_t                m_smallFileChannels;
+    size_t                m_smallFileFrames;
 
     static std::vector<sample_t *> m_workBuffers;
     static size_t         m_workBufferSize;
@@ -204,6 +304,30 @@ protected:
     RealTime  m_fadeInTime;
     RealTime  m_fadeOutTime;
 
+    // Time-stretching, if m_stretchRatio is not 1.  The stretcher's
+    // input runs from half its window before the wanted position, and
+    // it makes that much output before the wanted output starts, which
+    // we discard.
+    //
+    float                 m_stretchRatio;
+    AudioTimeStretcher   *m_stretcher;
+    std::vector<sample_t *> m_stretchInput;
+    std::vector<sample_t *> m_stretchPointers;
+    size_t                m_stretchSilence;  // to put in before the file
+    size_t                m_stretchDiscard;  // output to throw away
+    bool                  m_sourceEnded;
+
+    // Resampling, if the file's rate is not the target rate.  The file
+    // is decoded at its own rate into m_resampleInput a block at a
+    // time, and resampled into m_resampleBuffers to be taken from as
+    // needed.
+    //
+    Resampler            *m_resampler;
+    std::vector<sample_t *> m_resampleInput;
+    std::vector<sample_t *> m_resampleOutput;
+    std::vector<RingBuffer<sample_t> *> m_resampleBuffers;
+    bool                  m_resampleEnded;
+
 private:
     PlayableAudioFile(const PlayableAudioFile &pAF); // not provided
 };
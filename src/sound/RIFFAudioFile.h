@@ -128,6 +128,22 @@ public:
     // number of bytes for the sample width
     float convertBytesToSample(const unsigned char *bytes);
 
+    // Decode and de-interleave frames of interleaved little-endian
+    // samples of the given width (8, 16 or 24-bit integer, or 32-bit
+    // float) into one target buffer per channel, writing over or
+    // adding to what is there.  Gives the same values as
+    // convertBytesToSample, using a kernel specialised for the sample
+    // width and (for mono and stereo) the channel count.  There is no
+    // resampling or channel mapping.  RT safe.  Returns false for an
+    // unsupported sample width.
+    //
+    static bool decodeFrames(const unsigned char *sourceData,
+                             int bitsPerSample,
+                             size_t channels,
+                             size_t frames,
+                             std::vector<float *> &targetData,
+                             bool addToResultBuffers = false);
+
     // Decode and de-interleave the given samples that were retrieved
     // from this file or another with the same format as it.  Place
     // the results in the given float buffer.  Return true for
@@ -14,6 +14,7 @@
 */
 
 #include "RecordableAudioFile.h"
+#include "PeakFile.h"
 
 #include <cstdlib>
 
@@ -25,7 +26,9 @@ namespace Rosegarden
 RecordableAudioFile::RecordableAudioFile(AudioFile *audioFile,
 					 size_t bufferSize) :
     m_audioFile(audioFile),
-    m_status(IDLE)
+    m_peakFile(0),
+    m_status(IDLE),
+    m_closed(false)
 {
     for (unsigned int ch = 0; ch < audioFile->getChannels(); ++ch) {
 
@@ -35,12 +38,19 @@ RecordableAudioFile::RecordableAudioFile(AudioFile *audioFile,
 	    std::cerr << "WARNING: RecordableAudioFile::initialise: couldn't lock buffer into real memory, performance may be impaired" << std::endl;
 	}
     }
+
+    m_peakFile = new PeakFile(audioFile);
+
+    if (!m_peakFile->beginWrite()) {
+	std::cerr << "WARNING: RecordableAudioFile::initialise: couldn't write peak file " << m_peakFile->getFilename() << ", peaks will be generated when recording stops" << std::endl;
+	delete m_peakFile;
+	m_peakFile = 0;
+    }
 }
 
 RecordableAudioFile::~RecordableAudioFile()
 {
-    write();
-    m_audioFile->close();
+    close();
     delete m_audioFile;
 
     for (size_t i = 0; i < m_ringBuffers.size(); ++i) {
@@ -72,9 +82,31 @@ RecordableAudioFile::buffer(const sample_t *data, int channel, size_t frames)
     return frames;
 }
 
+void
+RecordableAudioFile::close()
+{
+    if (m_closed)
+	return ;
+
+    write();
+    m_audioFile->close();
+
+    // After the audio file, so that the peaks are newer and so valid
+    if (m_peakFile) {
+	m_peakFile->close();
+	delete m_peakFile;
+	m_peakFile = 0;
+    }
+
+    m_closed = true;
+}
+
 void
 RecordableAudioFile::write()
 {
+    if (m_closed)
+	return ;
+
     // Use a static buffer -- this obviously requires that write() is
     // only called from a single thread
     static size_t bufferSize = 0;
@@ -152,6 +184,10 @@ RecordableAudioFile::write()
 #endif
 
     m_audioFile->appendSamples(encodeBuffer, s);
+
+    // The peaks of the same bytes, as they would be read back
+    if (m_peakFile)
+	m_peakFile->appendSamples(encodeBuffer, s);
 }
 
 }
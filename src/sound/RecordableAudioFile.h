@@ -24,9 +24,13 @@
 namespace Rosegarden
 {
 
+class PeakFile;
+
 // A wrapper class for writing out a recording file.  We assume the
 // data is provided by a process thread and the writes are requested
-// by a disk thread.
+// by a disk thread.  The file's peaks are written as it is, so that
+// the recording can be previewed as it goes and needs no peaks
+// generated once it's done.
 //
 class RecordableAudioFile
 {
@@ -50,9 +54,15 @@ public:
     size_t buffer(const sample_t *data, int channel, size_t frames);
     void write();
 
+    // Write out what's buffered and close the file and its peaks.
+    // Nothing is written after this.
+    void close();
+
 protected:
     AudioFile            *m_audioFile;
+    PeakFile             *m_peakFile;
     RecordStatus          m_status;
+    bool                  m_closed;
 
     std::vector<RingBuffer<sample_t> *> m_ringBuffers; // one per channel
 };
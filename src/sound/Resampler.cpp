@@ -42,6 +42,8 @@ public:
                                     float ratio,
                                     bool final) = 0;
 
+    virtual int getFinalOutputSpace(int incount, float ratio) const = 0;
+
     virtual int getChannelCount() const = 0;
 
     virtual void reset() = 0;
@@ -68,11 +70,15 @@ public:
                             float ratio,
                             bool final = false);
 
+    int getFinalOutputSpace(int incount, float ratio) const;
+
     int getChannelCount() const { return m_channels; }
 
     void reset();
 
 protected:
+    int process(SRC_DATA &data, bool final);
+
     SRC_STATE *m_src;
     float *m_iin;
     float *m_iout;
@@ -80,6 +86,7 @@ protected:
     int m_channels;
     int m_iinsize;
     int m_ioutsize;
+    int m_latency;
     int m_debugLevel;
 };
 
@@ -92,6 +99,9 @@ D_SRC::D_SRC(Resampler::Quality quality, int channels, int maxBufferSize,
     m_channels(channels),
     m_iinsize(0),
     m_ioutsize(0),
+    m_latency(quality == Resampler::Best ? 256 :
+              quality == Resampler::Fastest ? 4 :
+              64),
     m_debugLevel(debugLevel)
 {
     if (m_debugLevel > 0) {
@@ -136,7 +146,8 @@ D_SRC::resample(const float *const *const in,
 {
     SRC_DATA data;
 
-    int outcount = lrintf(ceilf(incount * ratio));
+    int outcount = (final ? getFinalOutputSpace(incount, ratio) :
+                    lrintf(ceilf(incount * ratio)));
 
     if (m_channels == 1) {
         data.data_in = const_cast<float *>(*in); //!!!???
@@ -163,19 +174,12 @@ D_SRC::resample(const float *const *const in,
     data.input_frames = incount;
     data.output_frames = outcount;
     data.src_ratio = ratio;
-    data.end_of_input = (final ? 1 : 0);
-
-    int err = src_process(m_src, &data);
 
-    if (err) {
-        RG_WARNING << "Resampler::process: libsamplerate error: "
-                  << src_strerror(err);
-        throw Resampler::ImplementationError; //!!! of course, need to catch this!
-    }
+    int generated = process(data, final);
 
     if (m_channels > 1) {
         int idx = 0;
-        for (int i = 0; i < data.output_frames_gen; ++i) {
+        for (int i = 0; i < generated; ++i) {
             for (int j = 0; j < m_channels; ++j) {
                 out[j][i] = m_iout[idx++];
             }
@@ -184,7 +188,7 @@ D_SRC::resample(const float *const *const in,
 
     m_lastRatio = ratio;
 
-    return data.output_frames_gen;
+    return generated;
 }
 
 int
@@ -196,7 +200,8 @@ D_SRC::resampleInterleaved(const float *const in,
 {
     SRC_DATA data;
 
-    int outcount = lrintf(ceilf(incount * ratio));
+    int outcount = (final ? getFinalOutputSpace(incount, ratio) :
+                    lrintf(ceilf(incount * ratio)));
 
     data.data_in = const_cast<float *>(in);
     data.data_out = out;
@@ -204,19 +209,56 @@ D_SRC::resampleInterleaved(const float *const in,
     data.input_frames = incount;
     data.output_frames = outcount;
     data.src_ratio = ratio;
+
+    int generated = process(data, final);
+
+    m_lastRatio = ratio;
+
+    return generated;
+}
+
+int
+D_SRC::process(SRC_DATA &data, bool final)
+{
     data.end_of_input = (final ? 1 : 0);
 
-    int err = src_process(m_src, &data);
+    int generated = 0;
 
-    if (err) {
-        RG_WARNING << "Resampler::process: libsamplerate error: "
-                  << src_strerror(err);
-        throw Resampler::ImplementationError; //!!! of course, need to catch this!
+    while (true) {
+
+        int err = src_process(m_src, &data);
+
+        if (err) {
+            RG_WARNING << "Resampler::process: libsamplerate error: "
+                      << src_strerror(err);
+            throw Resampler::ImplementationError; //!!! of course, need to catch this!
+        }
+
+        generated += data.output_frames_gen;
+
+        // One call is enough, except at the end of the input, where
+        // we carry on until the filter has let out all it held back
+        if (!final || data.output_frames_gen == 0 ||
+            data.output_frames_gen == data.output_frames) {
+            break;
+        }
+
+        data.data_in += data.input_frames_used * m_channels;
+        data.input_frames -= data.input_frames_used;
+        data.data_out += data.output_frames_gen * m_channels;
+        data.output_frames -= data.output_frames_gen;
     }
 
-    m_lastRatio = ratio;
+    return generated;
+}
 
-    return data.output_frames_gen;
+int
+D_SRC::getFinalOutputSpace(int incount, float ratio) const
+{
+    // The filter holds back about m_latency frames at the lower of
+    // the two rates
+    return lrintf(ceilf(incount * ratio)) +
+        lrintf(ceilf(m_latency * (ratio > 1.f ? ratio : 1.f))) + 1;
 }
 
 void
@@ -257,6 +299,12 @@ Resampler::resampleInterleaved(const float *const in,
     return d->resampleInterleaved(in, out, incount, ratio, final);
 }
 
+int
+Resampler::getFinalOutputSpace(int incount, float ratio) const
+{
+    return d->getFinalOutputSpace(incount, ratio);
+}
+
 int
 Resampler::getChannelCount() const
 {
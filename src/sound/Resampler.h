@@ -40,6 +40,11 @@ public:
      * Resample the given multi-channel buffers, where incount is the
      * number of frames in the input buffers.  Returns the number of
      * frames written to the output buffers.
+     *
+     * The output buffers need room for ceil(incount * ratio) frames,
+     * or getFinalOutputSpace(incount, ratio) if final is set: the
+     * final call also flushes what the resampler is still holding
+     * back.
      */
     int resample(const float *const *const in,
                  float *const *const out,
@@ -51,7 +56,8 @@ public:
      * Resample the given interleaved buffer, where incount is the
      * number of frames in the input buffer (i.e. it has incount *
      * getChannelCount() samples).  Returns the number of frames
-     * written to the output buffer.
+     * written to the output buffer, which needs room as for
+     * resample().
      */
     int resampleInterleaved(const float *const in,
                             float *const out,
@@ -59,6 +65,13 @@ public:
                             float ratio,
                             bool final = false);
 
+    /**
+     * Return the number of frames of output room a final call with
+     * incount frames of input may need, allowing for the resampler's
+     * latency.
+     */
+    int getFinalOutputSpace(int incount, float ratio) const;
+
     int getChannelCount() const;
 
     void reset();
@@ -21,6 +21,7 @@
 #include <string.h>
 
 #include "Scavenger.h"
+#include "AudioKernels.h"
 
 //#define DEBUG_RINGBUFFER 1
 //#define DEBUG_RINGBUFFER_CREATE_DESTROY 1
@@ -39,6 +40,23 @@ static int extant_ringbuffers = 0;
 
 namespace Rosegarden {
 
+/**
+ * Add n samples of src into dst, for RingBuffer::readAdding().  The
+ * float version uses the vectorised mixing kernel.
+ */
+template <typename T>
+inline void mixSamples(T *dst, const T *src, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+inline void mixSamples(float *dst, const float *src, size_t n)
+{
+    AudioKernels::mix(dst, src, n);
+}
+
 /**
  * RingBuffer implements a lock-free ring buffer for one writer and N
  * readers, that is to be used to store a sample type T.
@@ -434,16 +452,10 @@ RingBuffer<T, N>::readAdding(T *destination, size_t n, int R)
     size_t here = m_size - m_readers[R];
 
     if (here >= n) {
-        for (size_t i = 0; i < n; ++i) {
-            destination[i] += (m_buffer + m_readers[R])[i];
-        }
+        mixSamples(destination, m_buffer + m_readers[R], n);
     } else {
-        for (size_t i = 0; i < here; ++i) {
-            destination[i] += (m_buffer + m_readers[R])[i];
-        }
-        for (size_t i = 0; i < (n - here); ++i) {
-            destination[i + here] += m_buffer[i];
-        }
+        mixSamples(destination, m_buffer + m_readers[R], here);
+        mixSamples(destination + here, m_buffer, n - here);
     }
 
     m_readers[R] = (m_readers[R] + n) % m_size;
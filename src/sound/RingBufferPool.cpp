@@ -0,0 +1,386 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "RingBufferPool.h"
+
+#include <QThread>
+
+#include <algorithm>
+#include <iostream>
+
+namespace Rosegarden
+{
+
+//#define DEBUG_RING_BUFFER_POOL 1
+
+const int RingBufferPool::MaxBuffers;
+
+// How long the background thread sleeps between looks at the pool if
+// nobody wakes it, in ms.  It is woken whenever the pool runs low, so
+// this only matters if a wakeup is missed.
+static const unsigned long replenishInterval = 1000;
+
+// The fewest free buffers it keeps
+static const int minLowWater = 4;
+
+class RingBufferPool::Replenisher : public QThread
+{
+public:
+    Replenisher(RingBufferPool *pool) : m_pool(pool) { }
+
+protected:
+    virtual void run() { m_pool->runReplenisher(); }
+
+private:
+    RingBufferPool *m_pool;
+};
+
+
+RingBufferPool::RingBufferPool(size_t bufferSize) :
+    m_free(new Slot[MaxBuffers]),
+    m_slotCount(0),
+    m_available(0),
+    m_inUse(0),
+    m_highWaterMark(0),
+    m_shortfalls(0),
+    m_wanted(0),
+    m_stale(0),
+    m_lowWater(minLowWater),
+    m_replenishWanted(0),
+    m_bufferSize(bufferSize),
+    m_poolSize(0),
+    m_grown(0),
+    m_exiting(false),
+    m_replenisher(0)
+{
+    m_replenisher = new Replenisher(this);
+    m_replenisher->start();
+}
+
+RingBufferPool::~RingBufferPool()
+{
+    m_mutex.lock();
+    m_exiting = true;
+    m_condition.wakeAll();
+    m_mutex.unlock();
+
+    m_replenisher->wait();
+    delete m_replenisher;
+
+    int allocatedCount = m_inUse.fetchAndAddRelaxed(0);
+    if (allocatedCount > 0) {
+        std::cerr << "WARNING: RingBufferPool::~RingBufferPool: deleting pool with " << allocatedCount << " allocated buffers" << std::endl;
+    }
+
+    for (size_t i = 0; i < m_buffers.size(); ++i) {
+        delete m_buffers[i];
+    }
+    m_buffers.clear();
+
+    delete[] m_free;
+}
+
+bool
+RingBufferPool::reserve(int n)
+{
+    while (true) {
+        int available = m_available.fetchAndAddRelaxed(0);
+        if (available < n) return false;
+        if (m_available.testAndSetAcquire(available, available - n)) {
+            return true;
+        }
+    }
+}
+
+RingBufferPool::Buffer *
+RingBufferPool::take()
+{
+    // A reserved buffer is always in the table somewhere, though
+    // others may be taking and putting buffers around us as we look
+    while (true) {
+        int used = m_slotCount.fetchAndAddAcquire(0);
+        for (int i = 0; i < used; ++i) {
+            if (!m_free[i].fetchAndAddRelaxed(0)) continue;
+            Buffer *buffer = m_free[i].fetchAndStoreAcquire(0);
+            if (buffer) return buffer;
+        }
+    }
+}
+
+void
+RingBufferPool::put(Buffer *buffer)
+{
+    // There are never more free buffers than slots in use, so there
+    // is always an empty slot for this one
+    while (true) {
+        int used = m_slotCount.fetchAndAddAcquire(0);
+        for (int i = 0; i < used; ++i) {
+            if (m_free[i].testAndSetRelease(0, buffer)) {
+                m_available.fetchAndAddRelease(1);
+                return;
+            }
+        }
+    }
+}
+
+void
+RingBufferPool::setBufferSize(size_t n)
+{
+    QMutexLocker locker(&m_mutex);
+
+    if (m_bufferSize == n)
+        return ;
+
+#ifdef DEBUG_RING_BUFFER_POOL
+    std::cerr << "RingBufferPool::setBufferSize: from " << m_bufferSize
+              << " to " << n << std::endl;
+#endif
+
+    m_bufferSize = n;
+    resizeFree();
+}
+
+void
+RingBufferPool::setPoolSize(size_t n)
+{
+    QMutexLocker locker(&m_mutex);
+
+#ifdef DEBUG_RING_BUFFER_POOL
+    std::cerr << "RingBufferPool::setPoolSize: from " << m_buffers.size()
+              << " to " << n << std::endl;
+#endif
+
+    m_poolSize = int(std::min(n, size_t(MaxBuffers)));
+    m_lowWater.fetchAndStoreRelaxed(std::max(m_poolSize / 4, minLowWater));
+
+    int count = int(m_buffers.size());
+
+    if (count > m_poolSize) {
+        discardFree(std::min(count - m_poolSize,
+                             m_available.fetchAndAddRelaxed(0)));
+    } else if (count < m_poolSize) {
+        create(m_poolSize - count);
+    }
+
+#ifdef DEBUG_RING_BUFFER_POOL
+    std::cerr << "RingBufferPool::setPoolSize: have " << m_buffers.size()
+              << " buffers (" << m_inUse.fetchAndAddRelaxed(0) << " allocated, "
+              << m_available.fetchAndAddRelaxed(0) << " available)" << std::endl;
+#endif
+}
+
+size_t
+RingBufferPool::getPoolSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_buffers.size();
+}
+
+bool
+RingBufferPool::getBuffers(size_t n, RingBuffer<sample_t> **buffers)
+{
+    if (!reserve(int(n))) {
+#ifdef DEBUG_RING_BUFFER_POOL
+        std::cerr << "RingBufferPool::getBuffers(" << n << "): not available, asking for more" << std::endl;
+#endif
+        m_shortfalls.fetchAndAddRelaxed(1);
+        m_wanted.fetchAndAddRelaxed(int(n));
+        wakeReplenisher();
+        return false;
+    }
+
+    if (m_available.fetchAndAddRelaxed(0) < m_lowWater.fetchAndAddRelaxed(0)) {
+        wakeReplenisher();
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        buffers[i] = take();
+        buffers[i]->reset();
+    }
+
+    int inUse = m_inUse.fetchAndAddRelaxed(int(n)) + int(n);
+    int highWaterMark = m_highWaterMark.fetchAndAddRelaxed(0);
+    while (inUse > highWaterMark &&
+           !m_highWaterMark.testAndSetRelaxed(highWaterMark, inUse)) {
+        highWaterMark = m_highWaterMark.fetchAndAddRelaxed(0);
+    }
+
+#ifdef DEBUG_RING_BUFFER_POOL
+    std::cerr << "RingBufferPool::getBuffers: " << m_available.fetchAndAddRelaxed(0) << " remain" << std::endl;
+#endif
+
+    return true;
+}
+
+void
+RingBufferPool::returnBuffer(RingBuffer<sample_t> *buffer)
+{
+#ifdef DEBUG_RING_BUFFER_POOL
+    std::cerr << "RingBufferPool::returnBuffer" << std::endl;
+#endif
+
+    // A buffer of the old size is still good to use, if not ideal:
+    // leave it for the background thread to replace
+    if (buffer->getSize() != m_bufferSize) {
+        m_stale.fetchAndAddRelaxed(1);
+        wakeReplenisher();
+    }
+
+    m_inUse.fetchAndAddRelaxed(-1);
+    put(buffer);
+}
+
+void
+RingBufferPool::create(int n)
+{
+    for (int i = 0; i < n; ++i) {
+
+        if (int(m_buffers.size()) >= MaxBuffers) {
+            std::cerr << "WARNING: RingBufferPool::create: pool is full at " << MaxBuffers << " buffers" << std::endl;
+            return;
+        }
+
+        Buffer *buffer = new Buffer(m_bufferSize);
+        buffer->mlock();
+        m_buffers.push_back(buffer);
+
+        // Slots once used stay in use, so that a buffer can always
+        // be put back wherever there's room
+        int count = int(m_buffers.size());
+        if (count > m_slotCount.fetchAndAddRelaxed(0)) {
+            m_slotCount.fetchAndStoreRelease(count);
+        }
+
+        put(buffer);
+    }
+}
+
+void
+RingBufferPool::discardFree(int n)
+{
+    if (n <= 0 || !reserve(n)) return;
+
+    for (int i = 0; i < n; ++i) {
+        Buffer *buffer = take();
+        m_buffers.erase(std::find(m_buffers.begin(), m_buffers.end(), buffer));
+        delete buffer;
+    }
+}
+
+void
+RingBufferPool::resizeFree()
+{
+    // Take out every free buffer, and put back ones of the right size
+    // in their place.  Anyone wanting buffers meanwhile will ask again.
+
+    int n = m_available.fetchAndAddRelaxed(0);
+    while (n > 0 && !reserve(n)) {
+        n = m_available.fetchAndAddRelaxed(0);
+    }
+
+    std::vector<Buffer *> taken;
+    for (int i = 0; i < n; ++i) {
+        Buffer *buffer = take();
+        if (buffer->getSize() != m_bufferSize) {
+            std::vector<Buffer *>::iterator j =
+                std::find(m_buffers.begin(), m_buffers.end(), buffer);
+            delete buffer;
+            buffer = new Buffer(m_bufferSize);
+            buffer->mlock();
+            *j = buffer;
+        }
+        taken.push_back(buffer);
+    }
+
+    for (size_t i = 0; i < taken.size(); ++i) {
+        put(taken[i]);
+    }
+}
+
+void
+RingBufferPool::replenish()
+{
+    if (m_stale.fetchAndStoreRelaxed(0) > 0) {
+        resizeFree();
+    }
+
+    int wanted = m_wanted.fetchAndStoreRelaxed(0);
+    int available = m_available.fetchAndAddRelaxed(0);
+
+    int n = std::max(m_lowWater.fetchAndAddRelaxed(0) + wanted - available,
+                     m_poolSize - int(m_buffers.size()));
+    if (n <= 0) return;
+
+#ifdef DEBUG_RING_BUFFER_POOL
+    std::cerr << "RingBufferPool::replenish: " << available << " available, "
+              << wanted << " wanted, making " << n << " more" << std::endl;
+#endif
+
+    size_t before = m_buffers.size();
+    create(n);
+    m_grown += m_buffers.size() - before;
+}
+
+void
+RingBufferPool::wakeReplenisher()
+{
+    // Signalled without the mutex, as AudioThread::signal() does, so
+    // as not to block the caller.  A wakeup while the thread is busy
+    // has it look again before waiting, through the flag; one just as
+    // it starts to wait is lost, until the next caller or the timeout.
+    m_replenishWanted.fetchAndStoreRelaxed(1);
+    m_condition.wakeOne();
+}
+
+void
+RingBufferPool::runReplenisher()
+{
+    QMutexLocker locker(&m_mutex);
+
+    while (!m_exiting) {
+        m_replenishWanted.fetchAndStoreRelaxed(0);
+        replenish();
+        if (m_replenishWanted.fetchAndAddRelaxed(0)) continue;
+        m_condition.wait(&m_mutex, replenishInterval);
+    }
+}
+
+RingBufferPool::Stats
+RingBufferPool::getStats() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    Stats stats;
+    stats.buffers = m_buffers.size();
+    stats.available = m_available.fetchAndAddRelaxed(0);
+    stats.inUse = m_inUse.fetchAndAddRelaxed(0);
+    stats.highWaterMark = m_highWaterMark.fetchAndAddRelaxed(0);
+    stats.shortfalls = m_shortfalls.fetchAndAddRelaxed(0);
+    stats.grown = m_grown;
+    return stats;
+}
+
+void
+RingBufferPool::dumpStats(std::ostream &out) const
+{
+    Stats stats = getStats();
+    out << "RingBufferPool: " << stats.buffers << " buffers of "
+        << getBufferSize() << " frames (" << stats.inUse << " in use, "
+        << stats.available << " free); at most " << stats.highWaterMark
+        << " in use; " << stats.shortfalls << " shortfalls, "
+        << stats.grown << " made in the background" << std::endl;
+}
+
+}
@@ -0,0 +1,179 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2018 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_RING_BUFFER_POOL_H
+#define RG_RING_BUFFER_POOL_H
+
+#include "RingBuffer.h"
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <ostream>
+#include <vector>
+
+namespace Rosegarden
+{
+
+/**
+ * A pool of ring buffers for PlayableAudioFiles to read into.
+ *
+ * Getting and returning buffers takes no lock and never allocates:
+ * free buffers sit in a fixed table of atomic slots.  All allocation
+ * is done up front by setPoolSize, or in the background by the pool's
+ * own thread, which sleeps until the free buffers run low (or a
+ * request for buffers could not be met) and then tops them up.  So when many files
+ * start at once, a file may have to wait a moment for its buffers,
+ * but the thread asking for them never waits on a lock or on the
+ * memory allocator.
+ *
+ * Buffers are mlocked when they are made, rather than when they are
+ * handed out.
+ */
+
+class RingBufferPool
+{
+public:
+    typedef float sample_t;
+
+    RingBufferPool(size_t bufferSize);
+    ~RingBufferPool();
+
+    /**
+     * Set the default size for buffers.  Free buffers are replaced at
+     * once; buffers currently allocated keep their size, and are
+     * replaced in the background once they are returned.
+     */
+    void setBufferSize(size_t n);
+
+    size_t getBufferSize() const
+    {
+        return m_bufferSize;
+    }
+
+    /**
+     * Discard or create buffers as necessary so as to have n buffers
+     * in the pool.  This will not discard any buffers that are
+     * currently allocated, so if more than n are allocated, more than
+     * n will remain.  It also sets how many buffers the background
+     * thread keeps free: a quarter of n, and never fewer than a few.
+     */
+    void setPoolSize(size_t n);
+
+    size_t getPoolSize() const;
+
+    /**
+     * Get n buffers, if n are free, returning true.  Otherwise get
+     * none, ask the background thread for more, and return false.
+     * Also wakes the background thread if this leaves the pool low.
+     * Lock-free.
+     */
+    bool getBuffers(size_t n, RingBuffer<sample_t> **buffers);
+
+    /**
+     * Return a buffer to the pool.  Lock-free.
+     */
+    void returnBuffer(RingBuffer<sample_t> *buffer);
+
+    struct Stats {
+        Stats() : buffers(0), available(0), inUse(0), highWaterMark(0),
+                  shortfalls(0), grown(0) { }
+        size_t buffers;         // buffers in the pool
+        size_t available;       // of which free
+        size_t inUse;           // and allocated
+        size_t highWaterMark;   // most ever allocated at once
+        size_t shortfalls;      // getBuffers calls that found too few free
+        size_t grown;           // buffers made in the background
+    };
+
+    Stats getStats() const;
+    void dumpStats(std::ostream &) const;
+
+    /// The most buffers a pool can have
+    static const int MaxBuffers = 16384;
+
+private:
+    typedef RingBuffer<sample_t> Buffer;
+    typedef QAtomicPointer<Buffer> Slot;
+
+    class Replenisher;
+    friend class Replenisher;
+
+    /// Claim n of the free buffers, or none
+    bool reserve(int n);
+
+    /// Take a buffer from the free table.  Call with one reserved.
+    Buffer *take();
+
+    /// Put a buffer in the free table, and make it available.
+    void put(Buffer *);
+
+    // The rest are for the non-RT side, and are called with m_mutex
+    // held
+
+    void create(int n);
+    void discardFree(int n);
+    void resizeFree();
+    void replenish();
+    void runReplenisher();
+
+    /// Wake the background thread to top up the pool.  Lock-free.
+    void wakeReplenisher();
+
+    /// The free buffers, in no particular order, and empty slots.
+    /// Only the first m_slotCount slots are used.
+    Slot *m_free;
+    QAtomicInt m_slotCount;
+
+    mutable QAtomicInt m_available;
+    mutable QAtomicInt m_inUse;
+    mutable QAtomicInt m_highWaterMark;
+    mutable QAtomicInt m_shortfalls;
+
+    /// Buffers asked for and not found, since the last replenish
+    QAtomicInt m_wanted;
+
+    /// Buffers of the wrong size returned, since the last replenish
+    QAtomicInt m_stale;
+
+    /// The fewest free buffers the background thread keeps.  Set
+    /// under m_mutex.
+    QAtomicInt m_lowWater;
+
+    /// Set when the background thread is woken, and cleared when it
+    /// looks at the pool
+    QAtomicInt m_replenishWanted;
+
+    size_t m_bufferSize;
+
+    /// Everything below belongs to the non-RT side, under m_mutex
+    mutable QMutex m_mutex;
+    QWaitCondition m_condition;
+    std::vector<Buffer *> m_buffers;
+    int m_poolSize;
+    size_t m_grown;
+    bool m_exiting;
+    Replenisher *m_replenisher;
+
+private:
+    RingBufferPool(const RingBufferPool &); // not provided
+    RingBufferPool &operator=(const RingBufferPool &); // not provided
+};
+
+}
+
+#endif
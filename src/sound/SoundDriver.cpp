@@ -131,7 +131,8 @@ SoundDriver::initialiseAudioQueue(const std::vector<MappedEvent> &events)
                                             bufferFrames,
                                             size_t(getSmallFileSize()) * 1024,
                                             channels,
-                                            int(getSampleRate()));
+                                            int(getSampleRate()),
+                                            i->getStretchRatio());
             } catch (...) {
                 continue;
             }
@@ -23,6 +23,7 @@
 
 #include "base/Device.h"
 #include "MappedEventList.h"
+#include "MappedEventBatch.h"
 #include "MappedInstrument.h"
 #include "MappedDevice.h"
 #include "SequencerDataBlock.h"
@@ -172,6 +173,13 @@ public:
                                   const RealTime &sliceStart,
                                   const RealTime &sliceEnd) = 0;
 
+    // The same for a playback slice, which the sequencer builds
+    // without allocating
+    //
+    virtual void processEventsOut(const MappedEventBatch &batch,
+                                  const RealTime &sliceStart,
+                                  const RealTime &sliceEnd) = 0;
+
     // Activate a recording state.  armedInstruments and audioFileNames
     // can be NULL if no audio tracks recording.
     //
@@ -18,6 +18,7 @@
 #include "WAVAudioFile.h"
 #include "base/RealTime.h"
 
+#include <algorithm>
 #include <sstream>
 
 #include "misc/Debug.h"
@@ -182,13 +183,27 @@ WAVAudioFile::decode(const unsigned char *ubuf,
 
     bool reduceToMono = (targetChannels == 1 && sourceChannels == 2);
 
+    // Without resampling or mixing down, the frames the source has go
+    // straight through the decoder specialised for this format.  Any
+    // frames beyond those repeat the last one, below.
+
+    size_t decoded = 0;
+
+    if (sourceSampleRate == targetSampleRate &&
+        sourceChannels <= targetChannels) {
+        decoded = std::min(nframes, fileFrames);
+        decodeFrames(ubuf, bitsPerSample, sourceChannels, decoded,
+                     target, adding);
+    }
+
     for (size_t ch = 0; ch < sourceChannels; ++ch) {
 
         if (!reduceToMono || ch == 0) {
             if (ch >= targetChannels)
                 break;
             if (!adding)
-                memset(target[ch], 0, nframes * sizeof(float));
+                memset(target[ch] + decoded, 0,
+                       (nframes - decoded) * sizeof(float));
         }
 
         int tch = ch; // target channel for this data
@@ -201,7 +216,7 @@ WAVAudioFile::decode(const unsigned char *ubuf,
             ratio = float(sourceSampleRate) / float(targetSampleRate);
         }
 
-        for (size_t i = 0; i < nframes; ++i) {
+        for (size_t i = decoded; i < nframes; ++i) {
 
             size_t j = i;
             if (sourceSampleRate != targetSampleRate) {
@@ -79,10 +79,11 @@ AudioReadStream::getInterleavedFrames(size_t count, float *frames)
 
         float ratio = float(m_retrievalRate) / float(m_sampleRate);
         size_t req = size_t(ceil(count / ratio));
-        size_t outSz = size_t(ceil(req * ratio));
+        // (room for the last block, with the tail the final call flushes)
+        size_t outSz = m_resampler->getFinalOutputSpace(int(req), ratio);
 
         float *in  = new float[req * m_channelCount];
-        float *out = new float[(outSz + 1) * m_channelCount];   // take one extra space to be sure
+        float *out = new float[outSz * m_channelCount];
 
         size_t got = getFrames(req, in);
     
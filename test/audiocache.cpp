@@ -0,0 +1,220 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "sound/AudioCache.h"
+#include <QTest>
+
+using namespace Rosegarden;
+
+// Tests for the small file AudioCache: keys, the memory budget and
+// least recently used eviction, pinning while playing, eviction left
+// until a purge after a release, and files that change on disk
+
+class TestAudioCache : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testKeys();
+    void testEviction();
+    void testPinning();
+    void testDuplicateAdd();
+    void testChangedFile();
+};
+
+// Mono data of the given number of frames, first sample set to value
+static float **makeData(size_t frames, float value = 0.0f)
+{
+    float **data = new float *[1];
+    data[0] = new float[frames];
+    data[0][0] = value;
+    return data;
+}
+
+static AudioCache::Key key(unsigned int id, unsigned int rate = 48000)
+{
+    return AudioCache::Key(id, rate, QString("file%1.wav").arg(id));
+}
+
+// Bytes of mono data of the given number of frames
+static size_t bytes(size_t frames)
+{
+    return frames * sizeof(float);
+}
+
+void TestAudioCache::testKeys()
+{
+    AudioCache cache;
+    AudioCache::Reference added =
+        cache.addData(key(1), 1, 100, makeData(100));
+    QVERIFY(added);
+
+    QVERIFY(cache.has(key(1)));
+    // The same file at another rate is decoded separately
+    QVERIFY(!cache.has(key(1, 44100)));
+    // As is another document's file with the same id
+    QVERIFY(!cache.has(AudioCache::Key(1, 48000, "other.wav")));
+
+    QVERIFY(!cache.incrementReference(key(2)));
+    AudioCache::Reference found = cache.incrementReference(key(1));
+    QCOMPARE(found, added);
+
+    AudioCache::Stats stats = cache.getStats();
+    QCOMPARE(stats.hits, size_t(1));
+    QCOMPARE(stats.misses, size_t(1));
+
+    cache.decrementReference(found);
+    cache.decrementReference(added);
+}
+
+void TestAudioCache::testEviction()
+{
+    AudioCache cache(bytes(300));
+
+    for (unsigned int id = 1; id <= 3; ++id) {
+        cache.decrementReference
+            (cache.addData(key(id), 1, 100, makeData(100)));
+    }
+
+    // All within budget, and kept after they stop playing
+    AudioCache::Stats stats = cache.getStats();
+    QCOMPARE(stats.entries, size_t(3));
+    QCOMPARE(stats.pinned, size_t(0));
+    QCOMPARE(stats.bytes, bytes(300));
+
+    // Play 1 again, so that 2 is now the least recently used
+    AudioCache::Reference ref = cache.incrementReference(key(1));
+    QVERIFY(ref);
+    cache.decrementReference(ref);
+
+    cache.decrementReference(cache.addData(key(4), 1, 100, makeData(100)));
+
+    QVERIFY(cache.has(key(1)));
+    QVERIFY(!cache.has(key(2)));
+    QVERIFY(cache.has(key(3)));
+    QVERIFY(cache.has(key(4)));
+
+    stats = cache.getStats();
+    QCOMPARE(stats.evictions, size_t(1));
+    QCOMPARE(stats.evictedBytes, bytes(100));
+    QCOMPARE(stats.bytes, bytes(300));
+
+    // Shrinking the budget evicts at once
+    cache.setBudget(bytes(100));
+    QCOMPARE(cache.getStats().entries, size_t(1));
+    QVERIFY(cache.has(key(4)));
+
+    cache.setBudget(0);
+    QCOMPARE(cache.getStats().entries, size_t(0));
+    QCOMPARE(cache.getStats().bytes, size_t(0));
+}
+
+void TestAudioCache::testPinning()
+{
+    AudioCache cache(bytes(100));
+
+    AudioCache::Reference ref1 =
+        cache.addData(key(1), 1, 100, makeData(100, 1.0f));
+    AudioCache::Reference ref2 =
+        cache.addData(key(2), 1, 100, makeData(100, 2.0f));
+
+    // Both playing, so both kept although over budget
+    AudioCache::Stats stats = cache.getStats();
+    QCOMPARE(stats.entries, size_t(2));
+    QCOMPARE(stats.pinned, size_t(2));
+    QCOMPARE(stats.evictions, size_t(0));
+
+    size_t channels = 0, frames = 0;
+    float **data = cache.getData(key(1), channels, frames);
+    QVERIFY(data);
+    QCOMPARE(channels, size_t(1));
+    QCOMPARE(frames, size_t(100));
+    QCOMPARE(data[0][0], 1.0f);
+
+    // A second reader of 2, then 2 stops once: still playing
+    AudioCache::Reference again = cache.incrementReference(key(2));
+    QCOMPARE(again, ref2);
+    cache.decrementReference(again);
+    cache.purge();
+    QVERIFY(cache.has(key(2)));
+
+    // When 2 stops altogether the cache is over budget, but the
+    // release leaves it to the next purge to evict 2
+    cache.decrementReference(ref2);
+    QVERIFY(cache.has(key(2)));
+    QCOMPARE(cache.getStats().pinned, size_t(1));
+    cache.purge();
+    QVERIFY(!cache.has(key(2)));
+    QVERIFY(cache.has(key(1)));
+
+    // 1 alone is within budget, so stays when it stops
+    cache.decrementReference(ref1);
+    cache.purge();
+    QVERIFY(cache.has(key(1)));
+}
+
+void TestAudioCache::testDuplicateAdd()
+{
+    AudioCache cache;
+
+    // Two readers that both missed and decoded the same file
+    AudioCache::Reference first =
+        cache.addData(key(1), 1, 100, makeData(100, 1.0f));
+    AudioCache::Reference second =
+        cache.addData(key(1), 1, 100, makeData(100, 2.0f));
+    QCOMPARE(second, first);
+
+    AudioCache::Stats stats = cache.getStats();
+    QCOMPARE(stats.entries, size_t(1));
+    QCOMPARE(stats.bytes, bytes(100));
+
+    size_t channels = 0, frames = 0;
+    QCOMPARE(cache.getData(key(1), channels, frames)[0][0], 1.0f);
+
+    // Both hold a reference
+    cache.decrementReference(first);
+    QCOMPARE(cache.getStats().pinned, size_t(1));
+    cache.decrementReference(second);
+    QCOMPARE(cache.getStats().pinned, size_t(0));
+}
+
+void TestAudioCache::testChangedFile()
+{
+    AudioCache cache;
+    AudioCache::Key before(1, 48000, "take.wav", 1000, 100);
+    AudioCache::Key after(1, 48000, "take.wav", 1200, 160);
+    AudioCache::Key other(1, 48000, "other.wav", 1000, 100);
+
+    AudioCache::Reference beforeRef =
+        cache.addData(before, 1, 100, makeData(100, 1.0f));
+    AudioCache::Reference otherRef =
+        cache.addData(other, 1, 100, makeData(100, 3.0f));
+    QVERIFY(!cache.has(after));
+
+    // While the old data is playing it stays
+    AudioCache::Reference afterRef =
+        cache.addData(after, 1, 120, makeData(120, 2.0f));
+    QVERIFY(cache.has(before));
+    QCOMPARE(cache.getStats().entries, size_t(3));
+
+    size_t channels = 0, frames = 0;
+    float **data = cache.getData(after, channels, frames);
+    QVERIFY(data);
+    QCOMPARE(frames, size_t(120));
+    QCOMPARE(data[0][0], 2.0f);
+
+    // Once released, it goes the next time the file is added, but
+    // other files with the same id are left alone
+    cache.decrementReference(beforeRef);
+    cache.decrementReference(afterRef);
+    afterRef = cache.addData(after, 1, 120, makeData(120, 2.0f));
+    QVERIFY(!cache.has(before));
+    QVERIFY(cache.has(after));
+    QVERIFY(cache.has(other));
+
+    cache.decrementReference(afterRef);
+    cache.decrementReference(otherRef);
+}
+
+QTEST_MAIN(TestAudioCache)
+
+#include "audiocache.moc"
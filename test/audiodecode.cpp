@@ -0,0 +1,192 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "sound/WAVAudioFile.h"
+#include <QTest>
+
+#include <cstdlib>
+#include <string.h>
+#include <vector>
+
+using namespace Rosegarden;
+
+// The fast decode kernels against RIFFAudioFile::convertBytesToSample,
+// plus a benchmark of each sample width
+
+class TestAudioDecode : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testKernelsMatchConvert();
+    void testDecodePastEnd();
+
+    void benchmarkDecode_data();
+    void benchmarkDecode();
+};
+
+// Random sample data: any bytes will do for the integer formats, but
+// floats need to be numbers to compare
+static std::vector<unsigned char> randomSamples(int bits, size_t samples)
+{
+    std::vector<unsigned char> data(samples * (bits / 8) + 1);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = (unsigned char)rand();
+    }
+    if (bits == 32) {
+        for (size_t i = 0; i < samples; ++i) {
+            float f = float(rand()) / RAND_MAX - 0.5f;
+            memcpy(&data[i * 4], &f, sizeof(float));
+        }
+    }
+    return data;
+}
+
+static std::vector<float *> pointers(std::vector<std::vector<float> > &v)
+{
+    std::vector<float *> p;
+    for (size_t i = 0; i < v.size(); ++i) p.push_back(&v[i][0]);
+    return p;
+}
+
+void TestAudioDecode::testKernelsMatchConvert()
+{
+    const int widths[] = { 8, 16, 24, 32 };
+
+    for (int w = 0; w < 4; ++w) {
+        int bits = widths[w];
+        // Constructing a file for writing doesn't create it
+        WAVAudioFile file("unused.wav", 1, 48000, 48000 * bits / 8,
+                          bits / 8, bits);
+
+        for (size_t channels = 1; channels <= 6; ++channels) {
+            // Every length up to a few vectors, to cover the tails
+            for (size_t frames = 0; frames < 40; ++frames) {
+
+                std::vector<unsigned char> data =
+                    randomSamples(bits, frames * channels);
+
+                for (int adding = 0; adding < 2; ++adding) {
+
+                    // One more frame than decoded, to check it's left alone
+                    std::vector<std::vector<float> > result
+                        (channels, std::vector<float>(frames + 1, 0.25f));
+                    std::vector<float *> targets = pointers(result);
+
+                    QVERIFY(RIFFAudioFile::decodeFrames
+                            (&data[0], bits, channels, frames, targets,
+                             adding));
+
+                    for (size_t ch = 0; ch < channels; ++ch) {
+                        for (size_t i = 0; i < frames; ++i) {
+                            float expected = file.convertBytesToSample
+                                (&data[(i * channels + ch) * (bits / 8)]);
+                            if (adding) expected += 0.25f;
+                            QCOMPARE(result[ch][i], expected);
+                        }
+                        QCOMPARE(result[ch][frames], 0.25f);
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<float> target(4);
+    std::vector<float *> targets(1, &target[0]);
+    unsigned char data[4] = { 0, 0, 0, 0 };
+    QVERIFY(!RIFFAudioFile::decodeFrames(data, 12, 1, 1, targets));
+}
+
+void TestAudioDecode::testDecodePastEnd()
+{
+    // Asking decode() for more frames than it's given repeats the
+    // last one, and a mono source fills both channels of a stereo
+    // target
+    WAVAudioFile file("unused.wav", 1, 48000, 96000, 2, 16);
+
+    const size_t frames = 21;
+    std::vector<unsigned char> data = randomSamples(16, frames);
+
+    std::vector<std::vector<float> > result
+        (2, std::vector<float>(frames + 5, 1.0f));
+    std::vector<float *> targets = pointers(result);
+
+    QVERIFY(file.decode(&data[0], frames * 2, 48000, 2, frames + 5,
+                        targets, false));
+
+    for (size_t i = 0; i < frames + 5; ++i) {
+        size_t j = (i < frames ? i : frames - 1);
+        float expected = file.convertBytesToSample(&data[j * 2]);
+        QCOMPARE(result[0][i], expected);
+        QCOMPARE(result[1][i], expected);
+    }
+}
+
+void TestAudioDecode::benchmarkDecode_data()
+{
+    QTest::addColumn<int>("bits");
+    QTest::addColumn<int>("channels");
+    QTest::addColumn<bool>("kernel");
+
+    const int widths[] = { 16, 24, 32 };
+
+    for (int w = 0; w < 3; ++w) {
+        for (int channels = 1; channels <= 2; ++channels) {
+            for (int kernel = 0; kernel < 2; ++kernel) {
+                QString name = QString("%1-bit %2 %3").arg(widths[w]).
+                    arg(channels == 1 ? "mono" : "stereo").
+                    arg(kernel ? "kernel" : "convert");
+                QTest::newRow(name.toLocal8Bit().data())
+                    << widths[w] << channels << bool(kernel);
+            }
+        }
+    }
+}
+
+void TestAudioDecode::benchmarkDecode()
+{
+    QFETCH(int, bits);
+    QFETCH(int, channels);
+    QFETCH(bool, kernel);
+
+    // Each iteration decodes a million frames, in the 4096-frame
+    // blocks PlayableAudioFile reads, so that the reported msecs per
+    // iteration read directly as ns per frame
+    const size_t block = 4096;
+    const int blocks = 244;
+
+    WAVAudioFile file("unused.wav", channels, 48000,
+                      48000 * channels * bits / 8, channels * bits / 8,
+                      bits);
+
+    std::vector<unsigned char> data = randomSamples(bits, block * channels);
+    std::vector<std::vector<float> > result
+        (channels, std::vector<float>(block));
+    std::vector<float *> targets = pointers(result);
+
+    const size_t width = bits / 8;
+
+    if (kernel) {
+        QBENCHMARK {
+            for (int b = 0; b < blocks; ++b) {
+                RIFFAudioFile::decodeFrames(&data[0], bits, channels, block,
+                                            targets);
+            }
+        }
+    } else {
+        // The per-sample loop decode() used to run
+        QBENCHMARK {
+            for (int b = 0; b < blocks; ++b) {
+                for (int ch = 0; ch < channels; ++ch) {
+                    for (size_t i = 0; i < block; ++i) {
+                        targets[ch][i] = file.convertBytesToSample
+                            (&data[width * (ch + i * channels)]);
+                    }
+                }
+            }
+        }
+    }
+}
+
+QTEST_MAIN(TestAudioDecode)
+
+#include "audiodecode.moc"
@@ -0,0 +1,230 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/RealTime.h"
+#include "misc/TempDir.h"
+#include "sound/AudioFileMapping.h"
+#include "sound/PlayableAudioFile.h"
+#include "sound/WAVAudioFile.h"
+#include <QFile>
+#include <QTest>
+
+#include <algorithm>
+#include <ctime>
+#include <vector>
+
+using namespace Rosegarden;
+
+// Reading takes through a memory mapping rather than an ifstream.
+// The benchmark plays many takes at once, printing throughput and
+// CPU time per stream.
+
+class TestAudioFileRead : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testMappedMatchesStream();
+    void testRewrittenFile();
+
+    void benchmarkStreams_data();
+    void benchmarkStreams();
+
+private:
+    std::vector<WAVAudioFile *> m_files;
+};
+
+// Ten seconds of 16-bit stereo at 48kHz per file
+static const unsigned int sampleRate = 48000;
+static const unsigned int seconds = 10;
+static const int fileCount = 8;
+
+void TestAudioFileRead::initTestCase()
+{
+    std::vector<short> frame(sampleRate * 2);
+
+    for (int f = 0; f < fileCount; ++f) {
+        QString name = TempDir::path() +
+            QString("/rg-test-audiofileread-%1.wav").arg(f);
+
+        WAVAudioFile writer(name, 2, sampleRate, sampleRate * 4, 4, 16);
+        QVERIFY(writer.write());
+        for (unsigned int s = 0; s < seconds; ++s) {
+            for (unsigned int i = 0; i < sampleRate; ++i) {
+                frame[i * 2] = short((i * (f + 3) + s) % 20000 - 10000);
+                frame[i * 2 + 1] = short((i * 7 + f) % 30000 - 15000);
+            }
+            writer.appendSamples((const char *)&frame[0], sampleRate);
+        }
+        writer.close();
+
+        WAVAudioFile *file = new WAVAudioFile(f, "take", name);
+        QVERIFY(file->open());
+        m_files.push_back(file);
+    }
+
+    PlayableAudioFile::setRingBufferPoolSizes(256, 4096);
+}
+
+void TestAudioFileRead::cleanupTestCase()
+{
+    for (size_t f = 0; f < m_files.size(); ++f) {
+        QString name = m_files[f]->getFilename();
+        delete m_files[f];
+        QFile::remove(name);
+    }
+    PlayableAudioFile::setUseMappedFiles(true);
+}
+
+// Play all the files through to the end as the file reader and mixer
+// threads would, in 1024-frame blocks.  Returns the frames played, and
+// the left channel of the first file in out if given.
+static size_t play(std::vector<PlayableAudioFile *> &files,
+                   std::vector<float> *out = 0)
+{
+    const size_t block = 1024;
+    std::vector<float> left(block), right(block);
+    std::vector<float *> dest;
+    dest.push_back(&left[0]);
+    dest.push_back(&right[0]);
+
+    for (size_t i = 0; i < files.size(); ++i) {
+        files[i]->fillBuffers(RealTime::zeroTime);
+    }
+
+    size_t total = 0;
+    bool playing = true;
+
+    while (playing) {
+        playing = false;
+        for (size_t i = 0; i < files.size(); ++i) {
+            PlayableAudioFile *file = files[i];
+            file->updateBuffers();
+            if (file->isFullyBuffered() &&
+                file->getSampleFramesAvailable() == 0) {
+                continue;
+            }
+            playing = true;
+
+            std::fill(left.begin(), left.end(), 0.0f);
+            size_t got = file->addSamples(dest, 2, block);
+            total += got;
+            if (out && i == 0) {
+                out->insert(out->end(), left.begin(), left.begin() + got);
+            }
+        }
+    }
+
+    return total;
+}
+
+static std::vector<PlayableAudioFile *>
+makeStreams(std::vector<WAVAudioFile *> &files, int streams)
+{
+    std::vector<PlayableAudioFile *> playable;
+    for (int i = 0; i < streams; ++i) {
+        WAVAudioFile *file = files[i % files.size()];
+        // A small-file size of zero, so that nothing is cached
+        playable.push_back(new PlayableAudioFile
+                           (0, file, RealTime::zeroTime, RealTime::zeroTime,
+                            file->getLength(), 4096, 0));
+    }
+    return playable;
+}
+
+static void deleteStreams(std::vector<PlayableAudioFile *> &playable)
+{
+    for (size_t i = 0; i < playable.size(); ++i) {
+        delete playable[i];
+    }
+    playable.clear();
+}
+
+void TestAudioFileRead::testMappedMatchesStream()
+{
+    std::vector<float> samples[2];
+
+    for (int mapped = 0; mapped < 2; ++mapped) {
+        PlayableAudioFile::setUseMappedFiles(mapped);
+        std::vector<PlayableAudioFile *> playable = makeStreams(m_files, 1);
+        QCOMPARE(playable[0]->isMapped(), bool(mapped));
+        QVERIFY(play(playable, &samples[mapped]) > 0);
+        deleteStreams(playable);
+    }
+
+    QVERIFY(samples[0].size() >= (seconds - 1) * sampleRate);
+    QVERIFY(samples[0] == samples[1]);
+}
+
+void TestAudioFileRead::testRewrittenFile()
+{
+    QString name = TempDir::path() + "/rg-test-audiofileread-rewrite.wav";
+    std::vector<short> frames(sampleRate * 2);
+
+    for (int pass = 0; pass < 2; ++pass) {
+        WAVAudioFile writer(name, 2, sampleRate, sampleRate * 4, 4, 16);
+        QVERIFY(writer.write());
+        std::fill(frames.begin(), frames.end(), short(pass + 1));
+        for (int s = 0; s <= pass; ++s) {
+            writer.appendSamples((const char *)&frames[0], sampleRate);
+        }
+        writer.close();
+
+        AudioFileMapping *mapping = AudioFileMapping::acquire(name);
+        QVERIFY(mapping);
+        QCOMPARE(mapping->getDataSize(), size_t((pass + 1) * sampleRate * 4));
+        QCOMPARE(((const short *)mapping->getData())[0], short(pass + 1));
+
+        // A second user of the same file shares the mapping
+        AudioFileMapping *again = AudioFileMapping::acquire(name);
+        QVERIFY(again == mapping);
+        AudioFileMapping::release(again);
+        AudioFileMapping::release(mapping);
+    }
+
+    QFile::remove(name);
+}
+
+void TestAudioFileRead::benchmarkStreams_data()
+{
+    QTest::addColumn<bool>("mapped");
+    QTest::addColumn<int>("streams");
+
+    QTest::newRow("stream 8") << false << 8;
+    QTest::newRow("mapped 8") << true << 8;
+    QTest::newRow("stream 80") << false << 80;
+    QTest::newRow("mapped 80") << true << 80;
+}
+
+void TestAudioFileRead::benchmarkStreams()
+{
+    QFETCH(bool, mapped);
+    QFETCH(int, streams);
+    PlayableAudioFile::setUseMappedFiles(mapped);
+
+    // The files are small enough to stay in the page cache, so this
+    // measures the cost of getting the samples from the cache into
+    // the ring buffers rather than the disk
+    size_t frames = 0;
+    int runs = 0;
+    clock_t cpuStart = clock();
+
+    QBENCHMARK {
+        std::vector<PlayableAudioFile *> playable =
+            makeStreams(m_files, streams);
+        frames += play(playable);
+        deleteStreams(playable);
+        ++runs;
+    }
+
+    double cpu = double(clock() - cpuStart) / CLOCKS_PER_SEC;
+    qDebug() << (mapped ? "mapped:" : "stream:") << streams << "streams,"
+             << (frames / cpu / 1e6) << "Mframes per CPU second,"
+             << (cpu * 1000.0 / runs / streams) << "ms CPU per stream";
+}
+
+QTEST_MAIN(TestAudioFileRead)
+
+#include "audiofileread.moc"
@@ -0,0 +1,199 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "sound/AudioKernels.h"
+#include <QTest>
+
+#include <cstdlib>
+#include <vector>
+
+using namespace Rosegarden;
+
+// SIMD variants of the mixer kernels, compared with the scalar code
+// and timed on whatever this CPU supports
+
+Q_DECLARE_METATYPE(AudioKernels::Variant)
+
+class TestAudioKernels : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void cleanupTestCase();
+
+    void testVariantsMatchScalar();
+
+    void benchmarkKernels_data();
+    void benchmarkKernels();
+};
+
+static std::vector<float> noise(size_t n)
+{
+    std::vector<float> v(n + 1);
+    for (size_t i = 0; i < n; ++i) {
+        v[i] = float(rand()) / RAND_MAX - 0.5f;
+    }
+    // Some silence, for the non-zero results
+    if (n > 2) v[n / 2] = 0.0f;
+    return v;
+}
+
+void TestAudioKernels::cleanupTestCase()
+{
+    // Back to the variant chosen at startup
+    if (!AudioKernels::setVariant(AudioKernels::AVX2))
+        AudioKernels::setVariant(AudioKernels::SSE2);
+}
+
+void TestAudioKernels::testVariantsMatchScalar()
+{
+    const AudioKernels::Variant variants[] = {
+        AudioKernels::SSE2, AudioKernels::AVX2
+    };
+
+    for (int v = 0; v < 2; ++v) {
+        if (!AudioKernels::isSupported(variants[v])) {
+            qDebug() << AudioKernels::getVariantName(variants[v])
+                     << "not supported, skipping";
+            continue;
+        }
+
+        // 0 to 39 floats covers an empty buffer, lengths shorter than
+        // one AVX2 register and every remainder after four of them
+        for (size_t n = 0; n < 40; ++n) {
+            std::vector<float> a = noise(n), b = noise(n);
+            std::vector<float> silence(n + 1, 0.0f);
+
+            std::vector<float> gain[2], left[2], right[2], mixed[2];
+            std::vector<float> masterOut[2];
+            bool nonZero[3][2];
+            float peaks[3][2];
+
+            for (int pass = 0; pass < 2; ++pass) {
+                QVERIFY(AudioKernels::setVariant(pass == 0 ?
+                                                 AudioKernels::Scalar :
+                                                 variants[v]));
+                gain[pass] = a;
+                nonZero[0][pass] =
+                    AudioKernels::applyGain(&gain[pass][0], n, 0.7f);
+
+                left[pass] = a;
+                right[pass] = std::vector<float>(n + 1);
+                nonZero[1][pass] =
+                    AudioKernels::pan(&left[pass][0], &left[pass][0],
+                                      &right[pass][0], n, 0.3f, 0.9f);
+                nonZero[2][pass] =
+                    AudioKernels::applyGain(&silence[0], n, 2.0f);
+
+                mixed[pass] = a;
+                peaks[0][pass] =
+                    AudioKernels::mixAndPeak(&mixed[pass][0], &b[0], n, 0.0f);
+                AudioKernels::mix(&mixed[pass][0], &a[0], n);
+
+                peaks[1][pass] = AudioKernels::peak(&b[0], n, 0.1f);
+
+                masterOut[pass] = b;
+                peaks[2][pass] =
+                    AudioKernels::applyGainAndPeak(&masterOut[pass][0], n,
+                                                   1.5f, 0.0f);
+            }
+
+            QVERIFY(gain[0] == gain[1]);
+            QVERIFY(left[0] == left[1]);
+            QVERIFY(right[0] == right[1]);
+            QVERIFY(mixed[0] == mixed[1]);
+            QVERIFY(masterOut[0] == masterOut[1]);
+            for (int k = 0; k < 3; ++k) {
+                QCOMPARE(nonZero[k][1], nonZero[k][0]);
+                QCOMPARE(peaks[k][1], peaks[k][0]);
+            }
+        }
+    }
+}
+
+void TestAudioKernels::benchmarkKernels_data()
+{
+    QTest::addColumn<QString>("kernel");
+    QTest::addColumn<AudioKernels::Variant>("variant");
+
+    const char *kernels[] = {
+        "applyGain", "pan", "mix", "mixAndPeak", "peak", "applyGainAndPeak"
+    };
+    const AudioKernels::Variant variants[] = {
+        AudioKernels::Scalar, AudioKernels::SSE2, AudioKernels::AVX2
+    };
+
+    for (int k = 0; k < 6; ++k) {
+        for (int v = 0; v < 3; ++v) {
+            if (!AudioKernels::isSupported(variants[v])) continue;
+            QString name = QString("%1 %2").arg(kernels[k]).
+                arg(AudioKernels::getVariantName(variants[v]));
+            QTest::newRow(name.toLocal8Bit().data())
+                << QString(kernels[k]) << variants[v];
+        }
+    }
+}
+
+void TestAudioKernels::benchmarkKernels()
+{
+    QFETCH(QString, kernel);
+    QFETCH(AudioKernels::Variant, variant);
+    QVERIFY(AudioKernels::setVariant(variant));
+
+    // 4000 calls on 250-frame buffers, the size of a small JACK
+    // period, so per-call overhead shows up alongside the loop itself
+    const size_t block = 250;
+    const int blocks = 4000;
+
+    std::vector<float> a = noise(block), b = noise(block);
+    std::vector<float> c(block + 1);
+    float peak = 0.0f;
+    bool nonZero = false;
+
+    if (kernel == "applyGain") {
+        QBENCHMARK {
+            for (int i = 0; i < blocks; ++i) {
+                nonZero |= AudioKernels::applyGain(&a[0], block, 1.0f);
+            }
+        }
+    } else if (kernel == "pan") {
+        QBENCHMARK {
+            for (int i = 0; i < blocks; ++i) {
+                nonZero |= AudioKernels::pan(&a[0], &b[0], &c[0], block,
+                                             0.5f, 0.5f);
+            }
+        }
+    } else if (kernel == "mix") {
+        QBENCHMARK {
+            for (int i = 0; i < blocks; ++i) {
+                AudioKernels::mix(&a[0], &b[0], block);
+            }
+        }
+    } else if (kernel == "mixAndPeak") {
+        QBENCHMARK {
+            for (int i = 0; i < blocks; ++i) {
+                peak = AudioKernels::mixAndPeak(&a[0], &b[0], block, 0.0f);
+            }
+        }
+    } else if (kernel == "peak") {
+        QBENCHMARK {
+            for (int i = 0; i < blocks; ++i) {
+                peak = AudioKernels::peak(&a[0], block, 0.0f);
+            }
+        }
+    } else if (kernel == "applyGainAndPeak") {
+        QBENCHMARK {
+            for (int i = 0; i < blocks; ++i) {
+                peak = AudioKernels::applyGainAndPeak(&a[0], block, 1.0f,
+                                                      0.0f);
+            }
+        }
+    }
+
+    // Keep the results live
+    QVERIFY(peak >= 0.0f);
+    Q_UNUSED(nonZero);
+}
+
+QTEST_MAIN(TestAudioKernels)
+
+#include "audiokernels.moc"
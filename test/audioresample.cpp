@@ -0,0 +1,231 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/RealTime.h"
+#include "misc/TempDir.h"
+#include "sound/PlayableAudioFile.h"
+#include "sound/WAVAudioFile.h"
+#include <QFile>
+#include <QTest>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace Rosegarden;
+
+// Playback of files whose rate differs from the driver's: length,
+// pitch and smoothness, streamed and cached
+
+class TestAudioResample : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void cleanupTestCase();
+
+    void testStreamed_data();
+    void testStreamed();
+    void testSmallFile();
+
+    void benchmarkStream_data();
+    void benchmarkStream();
+
+private:
+    QString makeFile(unsigned int rate, unsigned int seconds);
+    std::vector<float> play(AudioFile *file, const RealTime &duration,
+                            int targetRate, size_t smallFileSize);
+};
+
+// Stereo, a 1kHz tone
+QString TestAudioResample::makeFile(unsigned int rate, unsigned int seconds)
+{
+    QString fileName = TempDir::path() +
+        QString("/rg-test-audioresample-%1-%2.wav").arg(rate).arg(seconds);
+    if (QFile::exists(fileName)) return fileName;
+
+    WAVAudioFile writer(fileName, 2, rate, rate * 4, 4, 16);
+    if (!writer.write()) return QString();
+
+    std::vector<short> samples(rate * 2);
+    for (unsigned int s = 0; s < seconds; ++s) {
+        for (unsigned int i = 0; i < rate; ++i) {
+            short v = short(16000 * sin(2.0 * M_PI * 1000.0 * i / rate));
+            samples[i * 2] = v;
+            samples[i * 2 + 1] = v;
+        }
+        writer.appendSamples((const char *)&samples[0], rate);
+    }
+    writer.close();
+
+    return fileName;
+}
+
+void TestAudioResample::cleanupTestCase()
+{
+    const unsigned int rates[] = { 44100, 48000 };
+    const unsigned int lengths[] = { 1, 10 };
+    for (int r = 0; r < 2; ++r) {
+        for (int l = 0; l < 2; ++l) {
+            QFile::remove(TempDir::path() +
+                          QString("/rg-test-audioresample-%1-%2.wav")
+                          .arg(rates[r]).arg(lengths[l]));
+        }
+    }
+    PlayableAudioFile::setPreResampleSmallFiles(true);
+}
+
+// Play the left channel of a file at the target rate, as the sequencer
+// would
+std::vector<float> TestAudioResample::play(AudioFile *file,
+                                           const RealTime &duration,
+                                           int targetRate,
+                                           size_t smallFileSize)
+{
+    // (so that it needn't wait for buffers to be made)
+    PlayableAudioFile::setRingBufferPoolSizes(4, 4096);
+
+    PlayableAudioFile playable(0, file, RealTime::zeroTime,
+                               RealTime::zeroTime, duration, 4096,
+                               smallFileSize, 2, targetRate);
+
+    std::vector<float> played;
+    std::vector<float> left(1024), right(1024);
+    std::vector<float *> target;
+    target.push_back(&left[0]);
+    target.push_back(&right[0]);
+
+    playable.fillBuffers(RealTime::zeroTime);
+
+    for (int tries = 0; tries < 1000000; ++tries) {
+        size_t available = std::min(playable.getSampleFramesAvailable(),
+                                    left.size());
+        if (available == 0) {
+            if (playable.isFullyBuffered()) break;
+            playable.updateBuffers();
+            continue;
+        }
+        std::fill(left.begin(), left.end(), 0.f);
+        size_t n = playable.addSamples(target, 2, available);
+        if (n == 0) break;
+        played.insert(played.end(), left.begin(), left.begin() + n);
+        playable.updateBuffers();
+    }
+
+    return played;
+}
+
+// Rising zero crossings per second, for the frequency of a tone
+static double
+crossingsPerSecond(const std::vector<float> &samples, int rate)
+{
+    int crossings = 0;
+    for (size_t i = 1; i < samples.size(); ++i) {
+        if (samples[i - 1] < 0.f && samples[i] >= 0.f) ++crossings;
+    }
+    return double(crossings) * rate / samples.size();
+}
+
+void TestAudioResample::testStreamed_data()
+{
+    QTest::addColumn<int>("sourceRate");
+    QTest::addColumn<int>("targetRate");
+
+    QTest::newRow("44.1 to 48kHz") << 44100 << 48000;
+    QTest::newRow("48 to 44.1kHz") << 48000 << 44100;
+    QTest::newRow("48 to 96kHz") << 48000 << 96000;
+}
+
+void TestAudioResample::testStreamed()
+{
+    QFETCH(int, sourceRate);
+    QFETCH(int, targetRate);
+
+    QString name = makeFile(sourceRate, 1);
+    QVERIFY(!name.isEmpty());
+
+    WAVAudioFile file(1, "tone", name);
+    QVERIFY(file.open());
+
+    std::vector<float> played = play(&file, RealTime(1, 0), targetRate, 0);
+
+    // A second at the target rate
+    QVERIFY(played.size() + 1 >= size_t(targetRate));
+    QVERIFY(played.size() <= size_t(targetRate) + 1);
+
+    double frequency = crossingsPerSecond(played, targetRate);
+    QVERIFY(fabs(frequency - 1000.0) < 5.0);
+
+    // and no crude steps: sample to sample, the tone changes no more
+    // than a smooth one at the target rate would
+    float worst = 0.f;
+    const double step =
+        (16000.0 / 32768.0) * 2.0 * M_PI * 1000.0 / targetRate;
+    for (size_t i = 1000; i + 1000 < played.size(); ++i) {
+        worst = std::max(worst, float(fabs(played[i] - played[i - 1])));
+    }
+    QVERIFY(worst < step * 1.03);
+}
+
+void TestAudioResample::testSmallFile()
+{
+    QString name = makeFile(44100, 1);
+    QVERIFY(!name.isEmpty());
+
+    WAVAudioFile file(1, "tone", name);
+    QVERIFY(file.open());
+
+    // Resampled once into the cache
+    PlayableAudioFile::setPreResampleSmallFiles(true);
+    {
+        PlayableAudioFile playable(0, &file, RealTime::zeroTime,
+                                   RealTime::zeroTime, RealTime(1, 0),
+                                   4096, 1024 * 1024, 2, 48000);
+        QVERIFY(playable.isSmallFile());
+    }
+
+    // all of it, including the resampler's tail
+    std::vector<float> cached = play(&file, RealTime(1, 0), 48000, 1024 * 1024);
+    QVERIFY(cached.size() + 1 >= 48000);
+    QVERIFY(fabs(crossingsPerSecond(cached, 48000) - 1000.0) < 5.0);
+
+    // Or not, and streamed instead
+    PlayableAudioFile::setPreResampleSmallFiles(false);
+    {
+        PlayableAudioFile playable(0, &file, RealTime::zeroTime,
+                                   RealTime::zeroTime, RealTime(1, 0),
+                                   4096, 1024 * 1024, 2, 48000);
+        QVERIFY(!playable.isSmallFile());
+    }
+    PlayableAudioFile::setPreResampleSmallFiles(true);
+}
+
+void TestAudioResample::benchmarkStream_data()
+{
+    QTest::addColumn<int>("sourceRate");
+    QTest::addColumn<int>("targetRate");
+
+    QTest::newRow("not resampled") << 48000 << 48000;
+    QTest::newRow("44.1 to 48kHz") << 44100 << 48000;
+    QTest::newRow("48 to 96kHz") << 48000 << 96000;
+}
+
+// Ten seconds of one stereo stream
+void TestAudioResample::benchmarkStream()
+{
+    QFETCH(int, sourceRate);
+    QFETCH(int, targetRate);
+
+    QString name = makeFile(sourceRate, 10);
+    QVERIFY(!name.isEmpty());
+
+    WAVAudioFile file(1, "tone", name);
+    QVERIFY(file.open());
+
+    QBENCHMARK {
+        QVERIFY(!play(&file, RealTime(10, 0), targetRate, 0).empty());
+    }
+}
+
+QTEST_MAIN(TestAudioResample)
+
+#include "audioresample.moc"
@@ -0,0 +1,276 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/RealTime.h"
+#include "misc/TempDir.h"
+#include "sound/AudioFileMapping.h"
+#include "sound/AudioFileTimeStretcher.h"
+#include "sound/PlayableAudioFile.h"
+#include "sound/WAVAudioFile.h"
+#include <QFile>
+#include <QTest>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace Rosegarden;
+
+// Offline and live time stretching.  A chunked, threaded stretch must
+// match a single whole-file stretch bit for bit, whether it reads its
+// source through a mapping or through streams.
+
+class TestAudioStretch : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void cleanupTestCase();
+
+    void testThreadsMatchSerial();
+    void testPlaybackMatchesFile();
+
+    void benchmarkStretch_data();
+    void benchmarkStretch();
+
+private:
+    QString makeFile(const QString &name, unsigned int seconds);
+    QString makeTone(unsigned int seconds);
+    QByteArray stretch(const QString &source, int threads, float ratio);
+    std::vector<float> play(AudioFile *file, const RealTime &startIndex,
+                            const RealTime &duration, float ratio);
+};
+
+static const unsigned int sampleRate = 44100;
+
+// Stereo, with a tone on each side and a click every quarter second,
+// so that there are transients for the chunks to start at
+QString TestAudioStretch::makeFile(const QString &name, unsigned int seconds)
+{
+    QString fileName = TempDir::path() + "/rg-test-audiostretch-" + name + ".wav";
+    if (QFile::exists(fileName)) return fileName;
+
+    WAVAudioFile writer(fileName, 2, sampleRate, sampleRate * 4, 4, 16);
+    if (!writer.write()) return QString();
+
+    std::vector<short> samples(sampleRate * 2);
+    for (unsigned int s = 0; s < seconds; ++s) {
+        for (unsigned int i = 0; i < sampleRate; ++i) {
+            double click = (i % (sampleRate / 4) < 200) ? 0.5 : 0.0;
+            samples[i * 2] = short(12000 * sin(i * 0.05) + 16000 * click);
+            samples[i * 2 + 1] = short(12000 * sin(i * 0.02 + s) - 16000 * click);
+        }
+        writer.appendSamples((const char *)&samples[0], sampleRate);
+    }
+    writer.close();
+
+    return fileName;
+}
+
+// Mono, a steady tone
+QString TestAudioStretch::makeTone(unsigned int seconds)
+{
+    QString fileName = TempDir::path() + "/rg-test-audiostretch-tone.wav";
+    if (QFile::exists(fileName)) return fileName;
+
+    WAVAudioFile writer(fileName, 1, sampleRate, sampleRate * 2, 2, 16);
+    if (!writer.write()) return QString();
+
+    std::vector<short> samples(sampleRate);
+    for (unsigned int s = 0; s < seconds; ++s) {
+        for (unsigned int i = 0; i < sampleRate; ++i) {
+            samples[i] = short(16000 * sin((s * sampleRate + i) * 0.06));
+        }
+        writer.appendSamples((const char *)&samples[0], sampleRate);
+    }
+    writer.close();
+
+    return fileName;
+}
+
+void TestAudioStretch::cleanupTestCase()
+{
+    QFile::remove(TempDir::path() + "/rg-test-audiostretch-tone.wav");
+    QFile::remove(TempDir::path() + "/rg-test-audiostretch-short.wav");
+    QFile::remove(TempDir::path() + "/rg-test-audiostretch-long.wav");
+    QFile::remove(TempDir::path() + "/rg-test-audiostretch-out.wav");
+    AudioFileTimeStretcher::setThreadCount(0);
+    AudioFileTimeStretcher::setChunkSeconds
+        (AudioFileTimeStretcher::DefaultChunkSeconds);
+    AudioFileTimeStretcher::setUseMappedFiles(true);
+}
+
+// Stretch the source, returning the sample data of the result
+QByteArray TestAudioStretch::stretch(const QString &source, int threads,
+                                     float ratio)
+{
+    QString target = TempDir::path() + "/rg-test-audiostretch-out.wav";
+    QFile::remove(target);
+
+    WAVAudioFile sourceFile(1, "source", source);
+    if (!sourceFile.open()) return QByteArray();
+
+    AudioFileTimeStretcher::setThreadCount(threads);
+    AudioFileTimeStretcher stretcher(0);
+    if (!stretcher.stretch(&sourceFile, target, ratio)) return QByteArray();
+
+    AudioFileMapping *mapping = AudioFileMapping::acquire(target);
+    if (!mapping) return QByteArray();
+    QByteArray data((const char *)mapping->getData(), int(mapping->getDataSize()));
+    AudioFileMapping::release(mapping);
+    return data;
+}
+
+// Play a mono file stretched, as the sequencer would, returning what
+// it played
+std::vector<float> TestAudioStretch::play(AudioFile *file,
+                                          const RealTime &startIndex,
+                                          const RealTime &duration,
+                                          float ratio)
+{
+    // (so that it needn't wait for buffers to be made)
+    PlayableAudioFile::setRingBufferPoolSizes(4, 4096);
+
+    PlayableAudioFile playable(0, file, RealTime::zeroTime,
+                               startIndex, duration, 4096, 0,
+                               1, sampleRate, ratio);
+
+    std::vector<float> played;
+    std::vector<float> block(1024);
+    std::vector<float *> target(1, &block[0]);
+
+    playable.fillBuffers(RealTime::zeroTime);
+
+    for (int tries = 0; tries < 100000; ++tries) {
+        size_t available = std::min(playable.getSampleFramesAvailable(),
+                                    block.size());
+        if (available == 0) {
+            if (playable.isFullyBuffered()) break;
+            playable.updateBuffers();
+            continue;
+        }
+        std::fill(block.begin(), block.end(), 0.f);
+        size_t n = playable.addSamples(target, 1, available);
+        played.insert(played.end(), block.begin(), block.begin() + n);
+        playable.updateBuffers();
+    }
+
+    return played;
+}
+
+void TestAudioStretch::testPlaybackMatchesFile()
+{
+    const unsigned int seconds = 4;
+    const float ratio = 1.5f;
+
+    QString source = makeTone(seconds);
+    QVERIFY(!source.isEmpty());
+
+    QByteArray rendered = stretch(source, 1, ratio);
+    const float *expected = (const float *)rendered.constData();
+    const size_t frames = rendered.size() / sizeof(float);
+    QCOMPARE(frames, size_t(ceil(seconds * sampleRate * ratio)));
+
+    WAVAudioFile file(1, "tone", source);
+    QVERIFY(file.open());
+
+    // From the start, it makes just what the file has, apart from the
+    // crossfades at either end
+    std::vector<float> played =
+        play(&file, RealTime::zeroTime,
+             RealTime::frame2RealTime(frames, sampleRate), ratio);
+    QVERIFY(played.size() + 1 >= frames && played.size() <= frames + 1);
+
+    float worst = 0.f;
+    for (size_t i = 100; i + 100 < std::min(frames, played.size()); ++i) {
+        worst = std::max(worst, float(fabs(played[i] - expected[i])));
+    }
+    QVERIFY(worst < 1e-3f);
+
+    // From part way in, the phases are its own, but the level and the
+    // length are those of that part of the file
+    const size_t from = 3 * sampleRate;
+    played = play(&file, RealTime::frame2RealTime(from, sampleRate),
+                  RealTime(1, 0), ratio);
+    QVERIFY(played.size() + 1 >= sampleRate && played.size() <= sampleRate + 1);
+
+    double playedPower = 0.0, expectedPower = 0.0;
+    for (size_t i = 1000; i + 1000 < played.size(); ++i) {
+        playedPower += played[i] * played[i];
+        expectedPower += expected[from + i] * expected[from + i];
+    }
+    QVERIFY(expectedPower > 0.0);
+    QVERIFY(fabs(playedPower / expectedPower - 1.0) < 0.1);
+}
+
+void TestAudioStretch::testThreadsMatchSerial()
+{
+    const unsigned int seconds = 25;
+    QString source = makeFile("short", seconds);
+    QVERIFY(!source.isEmpty());
+
+    const float ratios[] = { 1.5f, 0.7f };
+
+    for (int r = 0; r < 2; ++r) {
+
+        // One stretcher run over the whole file, as one chunk
+        AudioFileTimeStretcher::setChunkSeconds(seconds * 2);
+        QByteArray serial = stretch(source, 1, ratios[r]);
+        AudioFileTimeStretcher::setChunkSeconds
+            (AudioFileTimeStretcher::DefaultChunkSeconds);
+
+        // Stereo 32-bit float, the length of the source stretched
+        const size_t frames = size_t(ceil(seconds * sampleRate * ratios[r]));
+        QCOMPARE(size_t(serial.size()), frames * 2 * sizeof(float));
+
+        const float *samples = (const float *)serial.constData();
+        float peak = 0.f;
+        bool channelsDiffer = false;
+        for (size_t i = 0; i < frames; ++i) {
+            peak = std::max(peak, float(fabs(samples[i * 2])));
+            if (samples[i * 2] != samples[i * 2 + 1]) channelsDiffer = true;
+        }
+        QVERIFY(peak > 0.2f);
+        QVERIFY(channelsDiffer);
+
+        // In chunks, on any number of threads, it's the same
+        for (int threads = 1; threads <= 4; threads *= 2) {
+            QByteArray parallel = stretch(source, threads, ratios[r]);
+            QCOMPARE(parallel.size(), serial.size());
+            QVERIFY(parallel == serial);
+        }
+
+        // And read through streams rather than a mapping
+        AudioFileTimeStretcher::setUseMappedFiles(false);
+        QByteArray streamed = stretch(source, 2, ratios[r]);
+        AudioFileTimeStretcher::setUseMappedFiles(true);
+        QCOMPARE(streamed.size(), serial.size());
+        QVERIFY(streamed == serial);
+    }
+}
+
+void TestAudioStretch::benchmarkStretch_data()
+{
+    QTest::addColumn<int>("threads");
+
+    QTest::newRow("1 thread") << 1;
+    QTest::newRow("2 threads") << 2;
+    QTest::newRow("4 threads") << 4;
+    QTest::newRow("default") << 0;
+}
+
+void TestAudioStretch::benchmarkStretch()
+{
+    QFETCH(int, threads);
+
+    // Ten minutes of stereo
+    QString source = makeFile("long", 600);
+    QVERIFY(!source.isEmpty());
+
+    QBENCHMARK_ONCE {
+        QVERIFY(!stretch(source, threads, 1.2f).isEmpty());
+    }
+}
+
+QTEST_MAIN(TestAudioStretch)
+
+#include "audiostretch.moc"
@@ -0,0 +1,239 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/Event.h"
+#include "base/MidiTypes.h"
+#include "base/Segment.h"
+#include "gui/seqmanager/MappedEventBuffer.h"
+#include "misc/TempDir.h"
+#include "sound/MappedBufMetaIterator.h"
+#include "sound/MappedEvent.h"
+#include "sound/MappedEventBatch.h"
+#include "sound/MappedEventInserter.h"
+#include <QDir>
+#include <QTest>
+
+#include <string>
+
+using namespace Rosegarden;
+
+// DataBlockRepository: SysEx playback from memory, spilling to disk,
+// shared blocks and in-place extension
+
+// Maps a segment's events at one millisecond per tick, as
+// SegmentMapper would at a fixed tempo
+class SysExBuffer : public MappedEventBuffer
+{
+public:
+    SysExBuffer(Segment &segment) :
+        MappedEventBuffer(0), m_segment(segment) { }
+
+    virtual int getSegmentRepeatCount() { return 0; }
+    virtual int calculateSize() { return m_segment.size(); }
+    virtual bool shouldPlay(MappedEvent *, RealTime) { return true; }
+
+    virtual void fillBuffer() {
+        resize(0);
+        for (Segment::iterator i = m_segment.begin();
+             i != m_segment.end(); ++i) {
+            MappedEvent e(0, **i,
+                          RealTime::fromMilliseconds((*i)->getAbsoluteTime()),
+                          RealTime::zeroTime);
+            mapAnEvent(&e);
+        }
+        setStartEnd(RealTime::zeroTime,
+                    RealTime::fromMilliseconds(m_segment.getEndTime()));
+    }
+
+private:
+    Segment &m_segment;
+};
+
+class TestDataBlocks : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testPlaybackWithoutFileIO();
+    void testSpill();
+    void testSharedRelease();
+    void testExtend();
+};
+
+// A patch dump for one bank slot: the same header, then data that
+// differs per patch
+static std::string makeDump(int patch, int length)
+{
+    std::string data("\x43\x00\x09\x20\x00", 5);
+    for (int i = 0; i < length; ++i) {
+        data += char((patch * 31 + i * 7) % 128);
+    }
+    return data;
+}
+
+static int countBlockFiles()
+{
+    return QDir(TempDir::path(), "rosegarden_datablock_*").count();
+}
+
+void TestDataBlocks::testPlaybackWithoutFileIO()
+{
+    DataBlockRepository::clear();
+    int filesBefore = countBlockFiles();
+
+    // A bank of 128 patches of 4K each, sent every 100ms
+    const int patches = 128;
+    Segment segment;
+    for (int p = 0; p < patches; ++p) {
+        segment.insert(SystemExclusive(makeDump(p, 4096)).
+                       getAsEvent(p * 100));
+    }
+
+    QSharedPointer<MappedEventBuffer> buffer(new SysExBuffer(segment));
+    buffer->init();
+    QCOMPARE(DataBlockRepository::getStats().blocks, patches);
+
+    // Remapping the same data finds the blocks already there
+    buffer->refresh();
+    QCOMPARE(DataBlockRepository::getStats().blocks, patches);
+    QVERIFY(DataBlockRepository::getStats().shared >= patches);
+
+    MappedBufMetaIterator metaIterator;
+    metaIterator.addSegment(buffer);
+    metaIterator.jumpToTime(RealTime::zeroTime);
+
+    MappedEventBatch batch;
+    MappedEventInserter inserter(batch);
+    RealTime slice = RealTime::fromMilliseconds(100);
+    int played = 0;
+
+    // Play, reading each block as the driver does
+    for (RealTime t; t < RealTime(patches / 10 + 1, 0); t = t + slice) {
+        batch.clear();
+        metaIterator.fetchEvents(inserter, t, t + slice);
+        for (MappedEventBatch::const_iterator i = batch.begin();
+             i != batch.end(); ++i) {
+            QCOMPARE((*i)->getType(), MappedEvent::MidiSystemMessage);
+            DataBlock block = DataBlockRepository::getBlockForEvent(*i);
+            int patch = (*i)->getEventTime().msec() / 100 +
+                        (*i)->getEventTime().sec * 10;
+            QVERIFY(std::string(block.data(), block.size()) ==
+                    makeDump(patch, 4096));
+            ++played;
+        }
+    }
+
+    QCOMPARE(played, patches);
+
+    DataBlockRepository::Stats stats = DataBlockRepository::getStats();
+    QCOMPARE(stats.fileReads, 0);
+    QCOMPARE(stats.fileWrites, 0);
+    QCOMPARE(countBlockFiles(), filesBefore);
+}
+
+void TestDataBlocks::testSpill()
+{
+    DataBlockRepository::clear();
+    DataBlockRepository::setSpillThreshold(64 * 1024);
+    DataBlockRepository::Stats before = DataBlockRepository::getStats();
+
+    MappedEvent small;
+    MappedEvent large;
+    DataBlockRepository::setDataBlockForEvent(&small, makeDump(0, 1024));
+    DataBlockRepository::setDataBlockForEvent(&large,
+                                              makeDump(1, 128 * 1024));
+
+    DataBlockRepository::Stats stats = DataBlockRepository::getStats();
+    QCOMPARE(stats.blocks, 2);
+    QCOMPARE(stats.spilled, 1);
+    QCOMPARE(stats.fileWrites - before.fileWrites, 1);
+
+    // Only the large block goes to the file
+    QVERIFY(DataBlockRepository::getDataBlockForEvent(&small) ==
+            makeDump(0, 1024));
+    QCOMPARE(DataBlockRepository::getStats().fileReads, before.fileReads);
+    QVERIFY(DataBlockRepository::getDataBlockForEvent(&large) ==
+            makeDump(1, 128 * 1024));
+    QCOMPARE(DataBlockRepository::getStats().fileReads - before.fileReads, 1);
+
+    // A handle outlives clearing the repository
+    DataBlock block = DataBlockRepository::getBlockForEvent(&small);
+    DataBlockRepository::clear();
+    DataBlockRepository::setSpillThreshold(0);
+    QVERIFY(!DataBlockRepository::getInstance()->
+            hasDataBlock(small.getDataBlockId()));
+    QVERIFY(block.toString() == makeDump(0, 1024));
+}
+
+void TestDataBlocks::testSharedRelease()
+{
+    DataBlockRepository::clear();
+
+    MappedEvent a;
+    MappedEvent b;
+    DataBlockRepository::setDataBlockForEvent(&a, makeDump(0, 256));
+    DataBlockRepository::setDataBlockForEvent(&b, makeDump(0, 256));
+    const DataBlockRepository::blockid shared = a.getDataBlockId();
+    QCOMPARE(b.getDataBlockId(), shared);
+    QCOMPARE(DataBlockRepository::getStats().blocks, 1);
+
+    // Giving one event other data keeps the block for the other
+    DataBlockRepository::setDataBlockForEvent(&a, makeDump(1, 256));
+    QVERIFY(DataBlockRepository::getInstance()->hasDataBlock(shared));
+    QVERIFY(DataBlockRepository::getDataBlockForEvent(&b) ==
+            makeDump(0, 256));
+    QCOMPARE(DataBlockRepository::getStats().blocks, 2);
+
+    // Until that one lets go too, and its slot is free for the next
+    MappedEvent stale(b);
+    DataBlockRepository::setDataBlockForEvent(&b, makeDump(1, 256));
+    QVERIFY(!DataBlockRepository::getInstance()->hasDataBlock(shared));
+    QCOMPARE(DataBlockRepository::getStats().blocks, 1);
+
+    MappedEvent c;
+    DataBlockRepository::setDataBlockForEvent(&c, makeDump(2, 256));
+    QVERIFY(DataBlockRepository::getDataBlockForEvent(&c) ==
+            makeDump(2, 256));
+    QCOMPARE(DataBlockRepository::getStats().blocks, 2);
+
+    // under another id, so a copy still holding the old one gets
+    // nothing rather than someone else's data
+    QVERIFY(c.getDataBlockId() != shared);
+    QVERIFY(DataBlockRepository::getDataBlockForEvent(&stale).empty());
+}
+
+void TestDataBlocks::testExtend()
+{
+    DataBlockRepository::clear();
+
+    // Building a block a byte at a time keeps one block, and one id
+    MappedEvent e;
+    std::string expected;
+    for (int i = 0; i < 100000; ++i) {
+        e.addDataByte(MidiByte(i % 128));
+        expected += char(i % 128);
+    }
+    QCOMPARE(DataBlockRepository::getStats().blocks, 1);
+    QVERIFY(DataBlockRepository::getDataBlockForEvent(&e) == expected);
+
+    // A handle keeps the size it was taken with
+    DataBlock before = DataBlockRepository::getBlockForEvent(&e);
+    e.addDataString("more");
+    QCOMPARE(before.size(), expected.size());
+    QVERIFY(DataBlockRepository::getDataBlockForEvent(&e) ==
+            expected + "more");
+
+    // Extending a shared block leaves the other event's bytes alone
+    MappedEvent a;
+    MappedEvent b;
+    DataBlockRepository::setDataBlockForEvent(&a, "abc");
+    DataBlockRepository::setDataBlockForEvent(&b, "abc");
+    a.addDataString("def");
+    QVERIFY(a.getDataBlockId() != b.getDataBlockId());
+    QVERIFY(DataBlockRepository::getDataBlockForEvent(&a) == "abcdef");
+    QVERIFY(DataBlockRepository::getDataBlockForEvent(&b) == "abc");
+    QCOMPARE(DataBlockRepository::getStats().blocks, 3);
+}
+
+QTEST_MAIN(TestDataBlocks)
+
+#include "datablocks.moc"
@@ -0,0 +1,148 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/Segment.h"
+#include "document/GzipFile.h"
+#include "document/RosegardenDocument.h"
+#include "document/RoseXmlHandler.h"
+#include "misc/TempDir.h"
+#include "scaleddocument.h"
+#include <QFile>
+#include <QTest>
+
+using namespace Rosegarden;
+
+// Round trip, truncation and load-time tests for the single-pass
+// .rg loader
+
+class TestDocumentLoad : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void cleanupTestCase();
+
+    void testRoundTrip();
+    void testTruncated();
+
+    void benchmarkLoad_data();
+    void benchmarkLoad();
+
+private:
+    QString fileName(const QString &name) const;
+    QString makeScaled(int scale);
+};
+
+static QString findFile(const QString &fileName) {
+    QString attempt = QFile::decodeName(SRCDIR) + '/' + fileName;
+    if (QFile::exists(attempt))
+        return attempt;
+    qWarning() << fileName << "NOT FOUND";
+    return QString();
+}
+
+QString TestDocumentLoad::fileName(const QString &name) const
+{
+    return TempDir::path() + "/rg-test-documentload-" + name + ".rg";
+}
+
+// The Brandenburg example with every segment repeated scale times
+QString TestDocumentLoad::makeScaled(int scale)
+{
+    QString name = fileName(QString("x%1").arg(scale));
+    if (QFile::exists(name)) return name;
+
+    const QString input = findFile("../data/examples/Brandenburg_No3-BWV_1048.rg");
+    if (!saveScaled(input, name, scale, false)) return QString();
+    return name;
+}
+
+void TestDocumentLoad::cleanupTestCase()
+{
+    QFile::remove(fileName("roundtrip"));
+    QFile::remove(fileName("truncated"));
+    QFile::remove(fileName("x1"));
+    QFile::remove(fileName("x10"));
+    QFile::remove(fileName("x50"));
+}
+
+void TestDocumentLoad::testRoundTrip()
+{
+    const QString input = findFile("../data/examples/Brandenburg_No3-BWV_1048.rg");
+    QVERIFY(!input.isEmpty());
+
+    RosegardenDocument doc(0, 0, true, true, false);
+    QVERIFY(doc.openDocument(input, false, true));
+    const Composition &comp = doc.getComposition();
+    QVERIFY(!comp.getSegments().empty());
+
+    QString errMsg;
+    QVERIFY2(doc.saveDocument(fileName("roundtrip"), errMsg, true),
+             qPrintable(errMsg));
+
+    RosegardenDocument loaded(0, 0, true, true, false);
+    QVERIFY(loaded.openDocument(fileName("roundtrip"), false, true));
+    const Composition &reloaded = loaded.getComposition();
+
+    QCOMPARE(reloaded.getNbSegments(), comp.getNbSegments());
+    Composition::const_iterator j = reloaded.begin();
+    for (Composition::const_iterator i = comp.begin(); i != comp.end(); ++i, ++j) {
+        QVERIFY(sameEvents(**i, **j));
+    }
+    QCOMPARE(reloaded.getNbTracks(), comp.getNbTracks());
+    QCOMPARE(reloaded.getTempoChangeCount(), comp.getTempoChangeCount());
+    QCOMPARE(reloaded.getTimeSignatureCount(), comp.getTimeSignatureCount());
+    QCOMPARE(reloaded.getTriggerSegments().size(),
+             comp.getTriggerSegments().size());
+}
+
+void TestDocumentLoad::testTruncated()
+{
+    QString source = makeScaled(1);
+    QVERIFY(!source.isEmpty());
+
+    // Cut off the compressed file part way through
+    QFile in(source);
+    QVERIFY(in.open(QIODevice::ReadOnly));
+    QByteArray data = in.readAll();
+    in.close();
+
+    QFile out(fileName("truncated"));
+    QVERIFY(out.open(QIODevice::WriteOnly));
+    out.write(data.left(data.size() / 2));
+    out.close();
+
+    RosegardenDocument doc(0, 0, true, true, false);
+    RoseXmlHandler handler(&doc, 0, false);
+    GzipReader file(fileName("truncated"));
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(!handler.parse(file));
+    QVERIFY(!handler.errorString().isEmpty());
+}
+
+void TestDocumentLoad::benchmarkLoad_data()
+{
+    QTest::addColumn<int>("scale");
+
+    QTest::newRow("x1") << 1;
+    QTest::newRow("x10") << 10;
+    QTest::newRow("x50") << 50;
+}
+
+void TestDocumentLoad::benchmarkLoad()
+{
+    QFETCH(int, scale);
+
+    QString name = makeScaled(scale);
+    QVERIFY(!name.isEmpty());
+
+    QBENCHMARK_ONCE {
+        RosegardenDocument doc(0, 0, true, true, false);
+        QVERIFY(doc.openDocument(name, false, true));
+    }
+}
+
+QTEST_MAIN(TestDocumentLoad)
+
+#include "documentload.moc"
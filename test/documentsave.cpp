@@ -0,0 +1,348 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include "document/DocumentSnapshot.h"
+#include "document/GzipFile.h"
+#include "document/RosegardenDocument.h"
+#include "gui/general/AutoSaveFinder.h"
+#include "misc/TempDir.h"
+#include <QFile>
+#include <QTest>
+
+#include <cstdlib>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace Rosegarden;
+
+// Tests for the streaming gzip writer, threaded segment formatting and
+// background autosave.  The benchmarks also print how much memory a
+// save takes, and measure how long an autosave holds the GUI thread.
+
+class TestDocumentSave : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestDocumentSave()
+        : m_doc(0, 0, true /*skip autoload*/, true, false /*no sound*/),
+          m_manySegments(0) {}
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testWriterChunks();
+    void testRoundTrip();
+    void testThreads();
+    void testAutoSave();
+
+    void benchmarkSave();
+    void benchmarkThreads_data();
+    void benchmarkThreads();
+    void benchmarkAutoSave();
+
+private:
+    QString fileName(const QString &name) const;
+    void addSegments(RosegardenDocument &doc, int count, int notes);
+
+    RosegardenDocument m_doc;
+    size_t m_events;
+
+    RosegardenDocument *m_manySegments;
+};
+
+static const int segments = 40;
+static const int notesPerSegment = 5000;
+
+static QString findFile(const QString &fileName) {
+    QString attempt = QFile::decodeName(SRCDIR) + '/' + fileName;
+    if (QFile::exists(attempt))
+        return attempt;
+    qWarning() << fileName << "NOT FOUND";
+    return QString();
+}
+
+// Peak resident size of this process so far, in kB.  A forked child
+// starts from the resident size of its parent at the fork, not from
+// the parent's peak.
+static long peakResident()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return usage.ru_maxrss;
+}
+
+QString TestDocumentSave::fileName(const QString &name) const
+{
+    return TempDir::path() + "/rg-test-documentsave-" + name + ".rg";
+}
+
+void TestDocumentSave::addSegments(RosegardenDocument &doc,
+                                   int count, int notes)
+{
+    Composition &comp = doc.getComposition();
+    TrackId track = (*comp.getSegments().begin())->getTrack();
+
+    for (int s = 0; s < count; ++s) {
+        Segment *segment = new Segment;
+        segment->setTrack(track);
+        for (int i = 0; i < notes; ++i) {
+            Event *e = new Event(Note::EventType, i * 240, 240);
+            e->set<Int>(BaseProperties::PITCH, 36 + rand() % 48);
+            e->set<Int>(BaseProperties::VELOCITY, 100);
+            segment->insert(e);
+        }
+        comp.addSegment(segment);
+    }
+    comp.setEndMarker(notes * 240 + 3840);
+}
+
+void TestDocumentSave::initTestCase()
+{
+    const QString input = findFile("../data/examples/test_selection.rg");
+    QVERIFY(!input.isEmpty());
+    m_doc.openDocument(input, false, true /*no progress dlg*/);
+
+    Composition &comp = m_doc.getComposition();
+    QVERIFY(!comp.getSegments().empty());
+
+    srand(11);
+    addSegments(m_doc, segments, notesPerSegment);
+
+    m_events = 0;
+    for (Composition::iterator i = comp.begin(); i != comp.end(); ++i) {
+        m_events += (*i)->size();
+    }
+}
+
+void TestDocumentSave::cleanupTestCase()
+{
+    QFile::remove(fileName("chunks"));
+    QFile::remove(fileName("roundtrip"));
+    QFile::remove(fileName("benchmark"));
+    QFile::remove(fileName("serial"));
+    QFile::remove(fileName("parallel"));
+    QFile::remove(fileName("threads"));
+    QFile::remove(fileName("expected"));
+    RosegardenDocument::setSaveThreadCount(0);
+    delete m_manySegments;
+}
+
+// Writes larger than zlib takes at once, and many small ones, come
+// back as they went in
+void TestDocumentSave::testWriterChunks()
+{
+    QByteArray big(1024 * 1024 + 17, 'x');
+    for (int i = 0; i < big.size(); i += 1000) big[i] = char('a' + i % 26);
+
+    GzipWriter writer(fileName("chunks"));
+    QVERIFY(writer.open(QIODevice::WriteOnly));
+    QCOMPARE(writer.write(big), qint64(big.size()));
+    for (int i = 0; i < 1000; ++i) {
+        QCOMPARE(writer.write("<e/>\n", 5), qint64(5));
+    }
+    writer.close();
+    QVERIFY(!writer.hasFailed());
+
+    QString text;
+    QVERIFY(GzipFile::readFromFile(fileName("chunks"), text));
+    QCOMPARE(text.size(), big.size() + 5000);
+    QVERIFY(text.startsWith(QString::fromLatin1(big)));
+    QVERIFY(text.endsWith("<e/>\n<e/>\n"));
+}
+
+void TestDocumentSave::testRoundTrip()
+{
+    const QString name = fileName("roundtrip");
+    QString errMsg;
+    QVERIFY2(m_doc.saveDocument(name, errMsg, true), qPrintable(errMsg));
+
+    QString text;
+    QVERIFY(GzipFile::readFromFile(name, text));
+    QVERIFY(text.startsWith("<?xml version=\"1.0\" encoding=\"UTF-8\"?>"));
+    QVERIFY(text.endsWith("</rosegarden-data>\n"));
+
+    RosegardenDocument loaded(0, 0, true, true, false);
+    QVERIFY(loaded.openDocument(name, false, true));
+
+    const Composition &comp = loaded.getComposition();
+    size_t events = 0;
+    for (Composition::const_iterator i = comp.begin(); i != comp.end(); ++i) {
+        events += (*i)->size();
+    }
+    QCOMPARE(comp.getSegments().size(),
+             m_doc.getComposition().getSegments().size());
+    QCOMPARE(events, m_events);
+}
+
+// The segments come out in the same order, and byte for byte the same,
+// however many threads format them
+void TestDocumentSave::testThreads()
+{
+    QString errMsg;
+
+    RosegardenDocument::setSaveThreadCount(1);
+    QVERIFY2(m_doc.saveDocument(fileName("serial"), errMsg, true),
+             qPrintable(errMsg));
+
+    RosegardenDocument::setSaveThreadCount(4);
+    QVERIFY2(m_doc.saveDocument(fileName("parallel"), errMsg, true),
+             qPrintable(errMsg));
+
+    RosegardenDocument::setSaveThreadCount(0);
+
+    QString serial, parallel;
+    QVERIFY(GzipFile::readFromFile(fileName("serial"), serial));
+    QVERIFY(GzipFile::readFromFile(fileName("parallel"), parallel));
+    QVERIFY(!serial.isEmpty());
+    QVERIFY(serial == parallel);
+}
+
+// An autosave writes the document as it was when it started, however
+// the document is changed while it is written in the background
+void TestDocumentSave::testAutoSave()
+{
+    RosegardenDocument doc(0, 0, true, true, false);
+    QVERIFY(doc.openDocument(findFile("../data/examples/test_selection.rg"),
+                             false, true));
+    srand(17);
+    addSegments(doc, 20, 5000);
+    doc.setAbsFilePath(fileName("autosave"));
+
+    // (autosaves keep these, though events copied in the usual way don't)
+    Composition &comp = doc.getComposition();
+    Segment *first = *comp.begin();
+    for (Segment::iterator i = first->begin(); i != first->end(); ++i) {
+        (*i)->set<Int>("rg-test-nonpersistent", 3, false);
+    }
+
+    QString errMsg;
+    QVERIFY2(doc.saveDocument(fileName("expected"), errMsg, true),
+             qPrintable(errMsg));
+
+    const QString autoSaveFile =
+        AutoSaveFinder().getAutoSavePath(doc.getAbsFilePath());
+    QFile::remove(autoSaveFile);
+
+    doc.slotDocumentModified();
+    doc.slotAutoSave();
+
+    // Change every event while the autosave is written, and drop a
+    // segment
+    for (Composition::iterator i = comp.begin(); i != comp.end(); ++i) {
+        for (Segment::iterator j = (*i)->begin(); j != (*i)->end(); ++j) {
+            (*j)->set<Int>(BaseProperties::VELOCITY, 1);
+        }
+    }
+    comp.deleteSegment(first);
+
+    doc.waitForAutoSave();
+
+    QString expected, saved;
+    QVERIFY(GzipFile::readFromFile(fileName("expected"), expected));
+    QVERIFY(GzipFile::readFromFile(autoSaveFile, saved));
+    QVERIFY(!saved.isEmpty());
+    QVERIFY(saved == expected);
+
+    // The document changed while the autosave was written, so no
+    // snapshot can be made for it
+    QVERIFY(!QFile::exists(DocumentSnapshot::getSnapshotPath(autoSaveFile)));
+
+    QFile::remove(autoSaveFile);
+}
+
+void TestDocumentSave::benchmarkSave()
+{
+    const QString name = fileName("benchmark");
+    QString errMsg;
+
+    QBENCHMARK_ONCE {
+        QVERIFY2(m_doc.saveDocument(name, errMsg, true), qPrintable(errMsg));
+    }
+
+    // The peak so far includes the loads and saves of the tests before
+    // this one, so save again in a child process, whose peak starts
+    // where this process is now.
+    pid_t pid = fork();
+    QVERIFY(pid >= 0);
+
+    if (pid == 0) {
+        long before = peakResident();
+        bool saved = m_doc.saveDocument(name, errMsg, true);
+        qDebug() << "saving" << m_events << "events took peak resident from"
+                 << before << "kB to" << peakResident() << "kB";
+        _exit(saved ? 0 : 1);
+    }
+
+    int status = 0;
+    QCOMPARE(waitpid(pid, &status, 0), pid);
+    QVERIFY(WIFEXITED(status));
+    QCOMPARE(WEXITSTATUS(status), 0);
+}
+
+void TestDocumentSave::benchmarkThreads_data()
+{
+    QTest::addColumn<int>("threads");
+
+    QTest::newRow("1 thread") << 1;
+    QTest::newRow("2 threads") << 2;
+    QTest::newRow("4 threads") << 4;
+    QTest::newRow("8 threads") << 8;
+}
+
+// 500 segments of 1000 notes each
+void TestDocumentSave::benchmarkThreads()
+{
+    QFETCH(int, threads);
+
+    if (!m_manySegments) {
+        m_manySegments = new RosegardenDocument(0, 0, true, true, false);
+        m_manySegments->openDocument
+            (findFile("../data/examples/test_selection.rg"), false, true);
+        QVERIFY(!m_manySegments->getComposition().getSegments().empty());
+        srand(13);
+        addSegments(*m_manySegments, 500, 1000);
+    }
+
+    RosegardenDocument::setSaveThreadCount(threads);
+
+    QString errMsg;
+    QBENCHMARK_ONCE {
+        QVERIFY2(m_manySegments->saveDocument(fileName("threads"), errMsg,
+                                              true),
+                 qPrintable(errMsg));
+    }
+
+    RosegardenDocument::setSaveThreadCount(0);
+}
+
+// The part of an autosave done on the GUI thread, for the large document
+void TestDocumentSave::benchmarkAutoSave()
+{
+    m_doc.setAbsFilePath(fileName("autosave-benchmark"));
+    const QString autoSaveFile =
+        AutoSaveFinder().getAutoSavePath(m_doc.getAbsFilePath());
+
+    m_doc.slotDocumentModified();
+
+    QBENCHMARK_ONCE {
+        m_doc.slotAutoSave();
+    }
+
+    m_doc.waitForAutoSave();
+    QVERIFY(QFile::exists(autoSaveFile));
+
+    qDebug() << "autosave of" << m_events << "events kept the GUI thread for"
+             << m_doc.getLastAutoSaveGuiTime() << "ms";
+
+    QFile::remove(autoSaveFile);
+}
+
+QTEST_MAIN(TestDocumentSave)
+
+#include "documentsave.moc"
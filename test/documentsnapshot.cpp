@@ -0,0 +1,162 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/Segment.h"
+#include "document/DocumentSnapshot.h"
+#include "document/RosegardenDocument.h"
+#include "misc/TempDir.h"
+#include "scaleddocument.h"
+#include <QFile>
+#include <QTest>
+
+using namespace Rosegarden;
+
+// Opening a document from its binary snapshot instead of XML
+
+class TestDocumentSnapshot : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void cleanupTestCase();
+
+    void testRoundTrip();
+    void testStale();
+
+    void benchmarkLoad_data();
+    void benchmarkLoad();
+
+private:
+    QString fileName(const QString &name) const;
+    QString makeFile(const QString &name, int scale);
+};
+
+static QString findFile(const QString &fileName) {
+    QString attempt = QFile::decodeName(SRCDIR) + '/' + fileName;
+    if (QFile::exists(attempt))
+        return attempt;
+    qWarning() << fileName << "NOT FOUND";
+    return QString();
+}
+
+QString TestDocumentSnapshot::fileName(const QString &name) const
+{
+    return TempDir::path() + "/rg-test-documentsnapshot-" + name + ".rg";
+}
+
+// The Brandenburg example with every segment repeated scale times,
+// saved with a snapshot
+QString TestDocumentSnapshot::makeFile(const QString &name, int scale)
+{
+    QString file = fileName(name);
+
+    const QString input = findFile("../data/examples/Brandenburg_No3-BWV_1048.rg");
+    if (!saveScaled(input, file, scale, true)) return QString();
+    return file;
+}
+
+void TestDocumentSnapshot::cleanupTestCase()
+{
+    const char *names[] = { "roundtrip", "stale", "large" };
+    for (int i = 0; i < 3; ++i) {
+        QFile::remove(DocumentSnapshot::getSnapshotPath(fileName(names[i])));
+        QFile::remove(fileName(names[i]));
+    }
+}
+
+void TestDocumentSnapshot::testRoundTrip()
+{
+    QString name = makeFile("roundtrip", 1);
+    QVERIFY(!name.isEmpty());
+    QVERIFY(QFile::exists(DocumentSnapshot::getSnapshotPath(name)));
+
+    DocumentSnapshot *snapshot = DocumentSnapshot::open(name);
+    QVERIFY(snapshot);
+    QVERIFY(snapshot->getSegmentCount() > 0);
+    delete snapshot;
+
+    RosegardenDocument fromSnapshot(0, 0, true, true, false);
+    QVERIFY(fromSnapshot.openDocument(name, false, true));
+
+    QVERIFY(QFile::remove(DocumentSnapshot::getSnapshotPath(name)));
+
+    RosegardenDocument fromXml(0, 0, true, true, false);
+    QVERIFY(fromXml.openDocument(name, false, true));
+
+    const Composition &a = fromSnapshot.getComposition();
+    const Composition &b = fromXml.getComposition();
+
+    QCOMPARE(a.getNbSegments(), b.getNbSegments());
+    QCOMPARE(a.getNbTracks(), b.getNbTracks());
+    QCOMPARE(a.getEndMarker(), b.getEndMarker());
+    QCOMPARE(a.getTriggerSegments().size(), b.getTriggerSegments().size());
+
+    Composition::const_iterator j = b.begin();
+    for (Composition::const_iterator i = a.begin(); i != a.end(); ++i, ++j) {
+        QVERIFY(sameEvents(**i, **j));
+        QCOMPARE((*i)->getEndMarkerTime(), (*j)->getEndMarkerTime());
+    }
+
+    QCOMPARE(a.getTempoChangeCount(), b.getTempoChangeCount());
+    for (int n = 0; n < a.getTempoChangeCount(); ++n) {
+        QVERIFY(a.getTempoChange(n) == b.getTempoChange(n));
+    }
+
+    QCOMPARE(a.getTimeSignatureCount(), b.getTimeSignatureCount());
+    for (int n = 0; n < a.getTimeSignatureCount(); ++n) {
+        std::pair<timeT, TimeSignature> sa = a.getTimeSignatureChange(n);
+        std::pair<timeT, TimeSignature> sb = b.getTimeSignatureChange(n);
+        QCOMPARE(sa.first, sb.first);
+        QVERIFY(sa.second == sb.second);
+    }
+}
+
+void TestDocumentSnapshot::testStale()
+{
+    QString name = makeFile("stale", 1);
+    QVERIFY(!name.isEmpty());
+
+    DocumentSnapshot *snapshot = DocumentSnapshot::open(name);
+    QVERIFY(snapshot);
+    delete snapshot;
+
+    // Change a byte of the file, keeping its size
+    QFile file(name);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QByteArray data = file.readAll();
+    data[data.size() / 2] = char(data[data.size() / 2] ^ 0x55);
+    QVERIFY(file.seek(0));
+    QCOMPARE(file.write(data), qint64(data.size()));
+    file.close();
+
+    QVERIFY(DocumentSnapshot::open(name) == 0);
+}
+
+void TestDocumentSnapshot::benchmarkLoad_data()
+{
+    QTest::addColumn<bool>("snapshot");
+
+    QTest::newRow("from XML") << false;
+    QTest::newRow("from snapshot") << true;
+}
+
+void TestDocumentSnapshot::benchmarkLoad()
+{
+    QFETCH(bool, snapshot);
+
+    QString name = makeFile("large", 50);
+    QVERIFY(!name.isEmpty());
+    if (!snapshot) {
+        QVERIFY(QFile::remove(DocumentSnapshot::getSnapshotPath(name)));
+    }
+
+    QBENCHMARK_ONCE {
+        RosegardenDocument doc(0, 0, true, true, false);
+        QVERIFY(doc.openDocument(name, false, true));
+    }
+}
+
+QTEST_MAIN(TestDocumentSnapshot)
+
+#include "documentsnapshot.moc"
@@ -0,0 +1,182 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "gui/seqmanager/MappedEventBuffer.h"
+#include "sound/MappedBufMetaIterator.h"
+#include "sound/MappedEvent.h"
+#include "sound/MappedEventBatch.h"
+#include "sound/MappedEventInserter.h"
+#include "sound/MappedEventList.h"
+#include <QTest>
+
+#include <cstdlib>
+#include <new>
+
+using namespace Rosegarden;
+
+// MappedEventBatch ordering and growth, and a check that a warmed-up
+// playback slice makes no heap allocations
+
+static bool s_countAllocations = false;
+static int s_allocations = 0;
+
+#if __cplusplus >= 201103L
+void *operator new(std::size_t size)
+#else
+void *operator new(std::size_t size) throw(std::bad_alloc)
+#endif
+{
+    if (s_countAllocations) ++s_allocations;
+    void *p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) throw()
+{
+    std::free(p);
+}
+
+// A segment of evenly spaced short notes
+class NoteBuffer : public MappedEventBuffer
+{
+public:
+    NoteBuffer(int id, RealTime start, RealTime spacing, int count) :
+        MappedEventBuffer(0),
+        m_id(id), m_start(start), m_spacing(spacing), m_count(count) { }
+
+    virtual int getSegmentRepeatCount() { return 0; }
+    virtual int calculateSize() { return m_count; }
+    virtual bool shouldPlay(MappedEvent *, RealTime) { return true; }
+
+    virtual void fillBuffer() {
+        resize(0);
+        RealTime t = m_start;
+        for (int i = 0; i < m_count; ++i) {
+            MappedEvent e(0, MappedEvent::MidiNote, m_id % 128, 100,
+                          t, m_spacing / 2, RealTime::zeroTime);
+            mapAnEvent(&e);
+            t = t + m_spacing;
+        }
+        RealTime end = t;
+        setStartEnd(m_start, end);
+    }
+
+private:
+    int m_id;
+    RealTime m_start;
+    RealTime m_spacing;
+    int m_count;
+};
+
+class TestEventBatch : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testOrderMatchesList();
+    void testGrow();
+    void testNoAllocationPerSlice();
+};
+
+static MappedEvent makeEvent(int ms, int pitch)
+{
+    return MappedEvent(0, MappedEvent::MidiNote, pitch, 100,
+                       RealTime::fromMilliseconds(ms),
+                       RealTime::fromMilliseconds(10),
+                       RealTime::zeroTime);
+}
+
+void TestEventBatch::testOrderMatchesList()
+{
+    MappedEventBatch batch(64);
+    MappedEventList list;
+
+    // Mostly in order, with some stragglers and equal times
+    srand(3);
+    for (int i = 0; i < 1000; ++i) {
+        int ms = (i % 10 == 0) ? rand() % (i + 1) : i;
+        MappedEvent e = makeEvent(ms, i % 128);
+        batch.insert(e);
+        list.insert(new MappedEvent(e));
+    }
+
+    QCOMPARE(batch.size(), list.size());
+    MappedEventBatch::const_iterator b = batch.begin();
+    for (MappedEventList::const_iterator l = list.begin();
+         l != list.end(); ++l, ++b) {
+        QCOMPARE((*b)->getEventTime(), (*l)->getEventTime());
+        QCOMPARE((*b)->getPitch(), (*l)->getPitch());
+    }
+}
+
+void TestEventBatch::testGrow()
+{
+    MappedEventBatch batch(4);
+    for (int i = 100; i > 0; --i) batch.insert(makeEvent(i, i));
+
+    QCOMPARE(int(batch.size()), 100);
+    QVERIFY(batch.capacity() >= 100);
+    QVERIFY(batch.getGrowCount() > 0);
+
+    int ms = 0;
+    for (MappedEventBatch::const_iterator i = batch.begin();
+         i != batch.end(); ++i) {
+        QCOMPARE((*i)->getEventTime(), RealTime::fromMilliseconds(++ms));
+    }
+
+    // Storage is kept across clear()
+    size_t capacity = batch.capacity();
+    batch.clear();
+    QVERIFY(batch.empty());
+    QCOMPARE(batch.capacity(), capacity);
+}
+
+void TestEventBatch::testNoAllocationPerSlice()
+{
+    // 500 dense overlapping segments, starting at staggered times so
+    // that slices also get split at segment starts
+    MappedBufMetaIterator metaIterator;
+    for (int i = 0; i < 500; ++i) {
+        QSharedPointer<MappedEventBuffer> buffer(
+            new NoteBuffer(i, RealTime::fromMilliseconds(i * 37),
+                           RealTime::fromMilliseconds(20 + i % 13),
+                           400));
+        buffer->init();
+        metaIterator.addSegment(buffer);
+    }
+
+    MappedEventBatch batch;
+    MappedEventInserter inserter(batch);
+    RealTime slice = RealTime::fromMilliseconds(100);
+    metaIterator.jumpToTime(RealTime::zeroTime);
+
+    // Warm up, so that the batch and the iterator's working storage
+    // reach the size the busiest slice needs
+    for (RealTime t; t < RealTime(30, 0); t = t + slice) {
+        batch.clear();
+        metaIterator.fetchEvents(inserter, t, t + slice);
+    }
+    metaIterator.jumpToTime(RealTime::zeroTime);
+
+    int slices = 0;
+    size_t events = 0;
+    s_allocations = 0;
+    s_countAllocations = true;
+    for (RealTime t; t < RealTime(30, 0); t = t + slice) {
+        batch.clear();
+        metaIterator.fetchEvents(inserter, t, t + slice);
+        events += batch.size();
+        ++slices;
+    }
+    s_countAllocations = false;
+
+    qDebug() << slices << "slices," << events << "events,"
+             << s_allocations << "allocations";
+
+    QVERIFY(events > 0);
+    QCOMPARE(s_allocations, 0);
+}
+
+QTEST_MAIN(TestEventBatch)
+
+#include "eventbatch.moc"
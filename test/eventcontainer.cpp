@@ -0,0 +1,324 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/ChunkedEventSet.h"
+#include "base/Segment.h"
+#include <QTest>
+
+#include <set>
+#include <vector>
+#include <cstdlib>
+
+using namespace Rosegarden;
+
+// Correctness tests for ChunkedEventSet against std::multiset, and
+// micro-benchmarks comparing the two EventContainer backends for
+// segments of 1k to 100k events, or 1M with RG_LARGE_BENCHMARKS set
+
+typedef std::multiset<Event *, Event::EventCmp> EventMultiset;
+
+class TestEventContainer : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testMatchesMultiset();
+    void testIteratorsSurviveModification();
+    void testFindTime();
+
+    void benchmarkInsert_data() { sizes(); }
+    void benchmarkInsert();
+    void benchmarkErase_data() { sizes(); }
+    void benchmarkErase();
+    void benchmarkRangeScan_data() { sizes(); }
+    void benchmarkRangeScan();
+    void benchmarkLowerBound_data() { sizes(); }
+    void benchmarkLowerBound();
+    void benchmarkSegmentFindTime_data();
+    void benchmarkSegmentFindTime();
+
+private:
+    void sizes();
+};
+
+static std::vector<Event *> makeEvents(int count)
+{
+    // Shuffled, with some chords (equal times) so that ordering of
+    // equivalent elements gets exercised
+    std::vector<Event *> events;
+    srand(42);
+    for (int i = 0; i < count; ++i) {
+        events.push_back(new Event("note", (rand() % count) * 10, 10));
+    }
+    return events;
+}
+
+static void deleteEvents(std::vector<Event *> &events)
+{
+    for (size_t i = 0; i < events.size(); ++i) delete events[i];
+    events.clear();
+}
+
+template <typename Container>
+static bool sameOrder(const Container &c, const EventMultiset &m)
+{
+    if (c.size() != m.size()) return false;
+    typename Container::const_iterator ci = c.begin();
+    for (EventMultiset::const_iterator mi = m.begin(); mi != m.end(); ++mi) {
+        if (*ci != *mi) return false;
+        ++ci;
+    }
+    return ci == c.end();
+}
+
+// A row for each container at each size, so that each gets its own
+// result
+void TestEventContainer::sizes()
+{
+    QTest::addColumn<QString>("container");
+    QTest::addColumn<int>("count");
+
+    const char *containers[] = { "std::multiset", "ChunkedEventSet" };
+    const char *names[] = { "1k", "10k", "100k", "1M" };
+    const int counts[] = { 1000, 10000, 100000, 1000000 };
+
+    // (a million events takes a while, so not in every test run)
+    const int sizeCount = qgetenv("RG_LARGE_BENCHMARKS").isEmpty() ? 3 : 4;
+
+    for (int n = 0; n < sizeCount; ++n) {
+        for (int c = 0; c < 2; ++c) {
+            QString name = QString("%1 %2").arg(containers[c]).arg(names[n]);
+            QTest::newRow(name.toLocal8Bit().data())
+                << QString(containers[c]) << counts[n];
+        }
+    }
+}
+
+void TestEventContainer::testMatchesMultiset()
+{
+    std::vector<Event *> events = makeEvents(5000);
+    ChunkedEventSet c;
+    EventMultiset m;
+
+    for (size_t i = 0; i < events.size(); ++i) {
+        c.insert(events[i]);
+        m.insert(events[i]);
+    }
+    QVERIFY(sameOrder(c, m));
+
+    // Erase a third of them, by iterator
+    for (size_t i = 0; i < events.size(); i += 3) {
+        ChunkedEventSet::iterator ci = c.lower_bound(events[i]);
+        while (*ci != events[i]) ++ci;
+        c.erase(ci);
+        EventMultiset::iterator mi = m.lower_bound(events[i]);
+        while (*mi != events[i]) ++mi;
+        m.erase(mi);
+    }
+    QVERIFY(sameOrder(c, m));
+
+    // Bounds and counts
+    for (int t = 0; t < 50000; t += 770) {
+        Event probe("dummy", t, 0, MIN_SUBORDERING);
+        QCOMPARE(c.count(&probe), m.count(&probe));
+        QCOMPARE(std::distance(c.begin(), c.lower_bound(&probe)),
+                 std::distance(m.begin(), m.lower_bound(&probe)));
+    }
+
+    // Reverse iteration
+    ChunkedEventSet::reverse_iterator cr = c.rbegin();
+    for (EventMultiset::reverse_iterator mr = m.rbegin(); mr != m.rend(); ++mr) {
+        QVERIFY(*cr == *mr);
+        ++cr;
+    }
+    QVERIFY(cr == c.rend());
+
+    ChunkedEventSet copy(c);
+    QVERIFY(copy == c);
+
+    deleteEvents(events);
+}
+
+void TestEventContainer::testIteratorsSurviveModification()
+{
+    std::vector<Event *> events = makeEvents(2000);
+    ChunkedEventSet c;
+    std::vector<ChunkedEventSet::iterator> iterators;
+    for (size_t i = 0; i < events.size(); ++i) {
+        iterators.push_back(c.insert(events[i]));
+    }
+
+    // Remove every other event; the remaining iterators must still
+    // refer to their events and step to the right neighbours
+    for (size_t i = 0; i < iterators.size(); i += 2) c.erase(iterators[i]);
+
+    for (size_t i = 1; i < iterators.size(); i += 2) {
+        QVERIFY(*iterators[i] == events[i]);
+        ChunkedEventSet::iterator next = iterators[i];
+        ++next;
+        ChunkedEventSet::iterator back = next;
+        --back;
+        QVERIFY(back == iterators[i]);
+    }
+
+    // erase(i++) idiom across the whole set
+    for (ChunkedEventSet::iterator i = c.begin(); i != c.end(); ) c.erase(i++);
+    QVERIFY(c.empty());
+
+    deleteEvents(events);
+}
+
+void TestEventContainer::testFindTime()
+{
+    Segment segment;
+    for (int i = 0; i < 100; ++i) {
+        segment.insert(new Event("note", i * 100, 100));
+    }
+
+    Segment::iterator i = segment.findTime(250);
+    QVERIFY(i != segment.end());
+    QCOMPARE((*i)->getAbsoluteTime(), timeT(300));
+
+    i = segment.findNearestTime(250);
+    QVERIFY(i != segment.end());
+    QCOMPARE((*i)->getAbsoluteTime(), timeT(200));
+
+    QVERIFY(segment.findTime(100000) == segment.end());
+}
+
+template <typename Container>
+static void runInsert(const std::vector<Event *> &events)
+{
+    Container c;
+    for (size_t i = 0; i < events.size(); ++i) c.insert(events[i]);
+}
+
+void TestEventContainer::benchmarkInsert()
+{
+    QFETCH(QString, container);
+    QFETCH(int, count);
+    std::vector<Event *> events = makeEvents(count);
+
+    if (container == "std::multiset") {
+        QBENCHMARK { runInsert<EventMultiset>(events); }
+    } else {
+        QBENCHMARK { runInsert<ChunkedEventSet>(events); }
+    }
+
+    deleteEvents(events);
+}
+
+template <typename Container>
+static void runErase(const std::vector<Event *> &events)
+{
+    Container c(events.begin(), events.end());
+    while (!c.empty()) c.erase(c.begin());
+}
+
+void TestEventContainer::benchmarkErase()
+{
+    QFETCH(QString, container);
+    QFETCH(int, count);
+    std::vector<Event *> events = makeEvents(count);
+
+    // Includes building the container, which benchmarkInsert measures
+    // on its own
+    if (container == "std::multiset") {
+        QBENCHMARK { runErase<EventMultiset>(events); }
+    } else {
+        QBENCHMARK { runErase<ChunkedEventSet>(events); }
+    }
+
+    deleteEvents(events);
+}
+
+template <typename Container>
+static long runScan(const Container &c)
+{
+    long total = 0;
+    for (typename Container::const_iterator i = c.begin(); i != c.end(); ++i) {
+        total += (*i)->getDuration();
+    }
+    return total;
+}
+
+void TestEventContainer::benchmarkRangeScan()
+{
+    QFETCH(QString, container);
+    QFETCH(int, count);
+    std::vector<Event *> events = makeEvents(count);
+
+    long total = 0;
+    if (container == "std::multiset") {
+        EventMultiset m(events.begin(), events.end());
+        QBENCHMARK { total = runScan(m); }
+    } else {
+        ChunkedEventSet c;
+        c.insert(events.begin(), events.end());
+        QBENCHMARK { total = runScan(c); }
+    }
+
+    QCOMPARE(total, long(count) * 10);
+    deleteEvents(events);
+}
+
+template <typename Container>
+static long runLowerBound(const Container &c, int count)
+{
+    long found = 0;
+    for (int t = 0; t < count * 10; t += 97) {
+        Event probe("dummy", t, 0, MIN_SUBORDERING);
+        if (c.lower_bound(&probe) != c.end()) ++found;
+    }
+    return found;
+}
+
+void TestEventContainer::benchmarkLowerBound()
+{
+    QFETCH(QString, container);
+    QFETCH(int, count);
+    std::vector<Event *> events = makeEvents(count);
+
+    long found = 0;
+    if (container == "std::multiset") {
+        EventMultiset m(events.begin(), events.end());
+        QBENCHMARK { found = runLowerBound(m, count); }
+    } else {
+        ChunkedEventSet c;
+        c.insert(events.begin(), events.end());
+        QBENCHMARK { found = runLowerBound(c, count); }
+    }
+
+    QVERIFY(found > 0);
+    deleteEvents(events);
+}
+
+void TestEventContainer::benchmarkSegmentFindTime_data()
+{
+    // Segment::insert does more work per event, so stop short of 1M
+    QTest::addColumn<int>("count");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+}
+
+void TestEventContainer::benchmarkSegmentFindTime()
+{
+    // Measures whichever backend this build was configured with
+    QFETCH(int, count);
+    Segment segment;
+    for (int i = 0; i < count; ++i) {
+        segment.insert(new Event("note", i * 10, 10));
+    }
+
+    long found = 0;
+    QBENCHMARK {
+        for (timeT t = 0; t < count * 10; t += 97) {
+            if (segment.findTime(t) != segment.end()) ++found;
+        }
+    }
+    QVERIFY(found > 0);
+}
+
+QTEST_MAIN(TestEventContainer)
+
+#include "eventcontainer.moc"
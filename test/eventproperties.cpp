@@ -0,0 +1,198 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/Event.h"
+#include "base/PropertyMap.h"
+#include "base/PropertyVector.h"
+#include <QTest>
+
+using namespace Rosegarden;
+
+// Tests for Event property storage, and a comparison of the compact
+// PropertyVector against the std::map-based PropertyMap it replaced
+
+class TestEventProperties : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void testGetSet();
+    void testPersistence();
+    void testCopyIsDeep();
+    void testXmlOrder();
+
+    void benchmarkMapSetGet();
+    void benchmarkVectorSetGet();
+    void benchmarkEventSetGet();
+    void reportStorageSize();
+
+private:
+    std::vector<PropertyName> m_names;
+};
+
+void TestEventProperties::initTestCase()
+{
+    // A typical mix for a note in a notation view: a few persistent
+    // performance values plus some cached layout values
+    m_names.push_back("pitch");
+    m_names.push_back("velocity");
+    m_names.push_back("!notationtime");
+    m_names.push_back("NoteType");
+    m_names.push_back("NoteDots");
+    m_names.push_back("HeightOnStaff");
+}
+
+void TestEventProperties::testGetSet()
+{
+    Event e("note", 0, 960);
+    e.set<Int>("pitch", 60);
+    e.set<Bool>("tied", true);
+    e.set<String>("text", "hello");
+    e.set<RealTimeT>("when", RealTime(1, 500));
+
+    QCOMPARE(e.get<Int>("pitch"), 60L);
+    QCOMPARE(e.get<Bool>("tied"), true);
+    QCOMPARE(e.get<String>("text"), std::string("hello"));
+    QVERIFY(e.get<RealTimeT>("when") == RealTime(1, 500));
+
+    e.set<Int>("pitch", 61);
+    QCOMPARE(e.get<Int>("pitch"), 61L);
+
+    long v = 0;
+    QVERIFY(!e.get<Int>("text", v));
+
+    e.unset("text");
+    QVERIFY(!e.has("text"));
+    QVERIFY(e.has("when"));
+}
+
+void TestEventProperties::testPersistence()
+{
+    Event e("note", 0, 960);
+    e.set<Int>("pitch", 60);
+    e.setMaybe<Int>("cached", 3);
+
+    QVERIFY(e.isPersistent<Int>("pitch"));
+    QVERIFY(!e.isPersistent<Int>("cached"));
+
+    // setMaybe must not overwrite a persistent value
+    e.setMaybe<Int>("pitch", 10);
+    QCOMPARE(e.get<Int>("pitch"), 60L);
+
+    e.set<Int>("cached", 4, true);
+    QVERIFY(e.isPersistent<Int>("cached"));
+    QCOMPARE(e.get<Int>("cached"), 4L);
+
+    e.setPersistence<Int>("pitch", false);
+    QVERIFY(!e.isPersistent<Int>("pitch"));
+    QCOMPARE(e.get<Int>("pitch"), 60L);
+
+    e.clearNonPersistentProperties();
+    QVERIFY(!e.has("pitch"));
+    QVERIFY(e.has("cached"));
+}
+
+void TestEventProperties::testCopyIsDeep()
+{
+    Event e("text", 0);
+    e.set<String>("text", "original");
+
+    Event copy(e);
+    copy.set<String>("text", "changed");
+
+    QCOMPARE(e.get<String>("text"), std::string("original"));
+    QCOMPARE(copy.get<String>("text"), std::string("changed"));
+
+    Event *moved = e.copyMoving(100);
+    QCOMPARE(moved->get<String>("text"), std::string("original"));
+    QCOMPARE(moved->getNotationAbsoluteTime(), timeT(100));
+    delete moved;
+}
+
+void TestEventProperties::testXmlOrder()
+{
+    // Properties must come out in the same order whatever order they
+    // were set in, as they did with the map
+    Event a("note", 0, 960);
+    Event b("note", 0, 960);
+    for (size_t i = 0; i < m_names.size(); ++i) {
+        a.set<Int>(m_names[i], long(i));
+        b.set<Int>(m_names[m_names.size() - i - 1],
+                   long(m_names.size() - i - 1));
+    }
+    QCOMPARE(a.toXmlString(), b.toXmlString());
+}
+
+void TestEventProperties::benchmarkMapSetGet()
+{
+    long total = 0;
+    QBENCHMARK {
+        PropertyMap map;
+        for (size_t i = 0; i < m_names.size(); ++i) {
+            map.insert(PropertyPair(m_names[i], new PropertyStore<Int>(long(i))));
+        }
+        for (size_t i = 0; i < m_names.size(); ++i) {
+            PropertyMap::iterator it = map.find(m_names[i]);
+            total += static_cast<PropertyStore<Int> *>(it->second)->getData();
+        }
+    }
+    QVERIFY(total > 0);
+}
+
+void TestEventProperties::benchmarkVectorSetGet()
+{
+    long total = 0;
+    QBENCHMARK {
+        PropertyVector vec;
+        for (size_t i = 0; i < m_names.size(); ++i) {
+            vec.insert<Int>(m_names[i], long(i));
+        }
+        for (size_t i = 0; i < m_names.size(); ++i) {
+            total += PropertySlotAccess<Int>::get(*vec.find(m_names[i]));
+        }
+    }
+    QVERIFY(total > 0);
+}
+
+void TestEventProperties::benchmarkEventSetGet()
+{
+    long total = 0;
+    QBENCHMARK {
+        Event e("note", 0, 960);
+        for (size_t i = 0; i < m_names.size(); ++i) {
+            e.set<Int>(m_names[i], long(i), i < 3);
+        }
+        for (size_t i = 0; i < m_names.size(); ++i) {
+            total += e.get<Int>(m_names[i]);
+        }
+    }
+    QVERIFY(total > 0);
+}
+
+void TestEventProperties::reportStorageSize()
+{
+    PropertyVector vec;
+    for (size_t i = 0; i < m_names.size(); ++i) {
+        vec.insert<Int>(m_names[i], long(i));
+    }
+    size_t vectorBytes = sizeof(PropertyVector) + vec.getStorageSize();
+
+    // The same properties as map nodes plus one PropertyStore each
+    // (node size assumes a typical std::map: three pointers and a
+    // colour word ahead of the value pair)
+    PropertyStore<Int> store(0);
+    size_t mapBytes = sizeof(PropertyMap) +
+        m_names.size() * (4 * sizeof(void *) + sizeof(PropertyPair) +
+                          store.getStorageSize());
+
+    qDebug() << "property bytes for" << int(m_names.size()) << "Int values:"
+             << "PropertyVector" << int(vectorBytes)
+             << "PropertyMap (estimated)" << int(mapBytes);
+
+    QVERIFY(vectorBytes < mapBytes);
+}
+
+QTEST_MAIN(TestEventProperties)
+
+#include "eventproperties.moc"
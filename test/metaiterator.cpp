@@ -0,0 +1,145 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "gui/seqmanager/MappedEventBuffer.h"
+#include "sound/MappedBufMetaIterator.h"
+#include "sound/MappedEvent.h"
+#include "sound/MappedInserterBase.h"
+#include <QTest>
+
+#include <vector>
+
+using namespace Rosegarden;
+
+// MappedBufMetaIterator over many segments: ordering, and the cost of
+// a playback slice as the segment count grows
+
+// A segment of evenly spaced short notes
+class NoteBuffer : public MappedEventBuffer
+{
+public:
+    NoteBuffer(int id, RealTime start, RealTime spacing, int count) :
+        MappedEventBuffer(0),
+        m_id(id), m_start(start), m_spacing(spacing), m_count(count) { }
+
+    virtual int getSegmentRepeatCount() { return 0; }
+    virtual int calculateSize() { return m_count; }
+    virtual bool shouldPlay(MappedEvent *, RealTime) { return true; }
+
+    virtual void fillBuffer() {
+        resize(0);
+        RealTime t = m_start;
+        for (int i = 0; i < m_count; ++i) {
+            MappedEvent e(0, MappedEvent::MidiNote, m_id % 128, 100,
+                          t, m_spacing / 2, RealTime::zeroTime);
+            e.setTrackId(m_id);
+            mapAnEvent(&e);
+            t = t + m_spacing;
+        }
+        RealTime end = t;
+        setStartEnd(m_start, end);
+    }
+
+private:
+    int m_id;
+    RealTime m_start;
+    RealTime m_spacing;
+    int m_count;
+};
+
+class CountingInserter : public MappedInserterBase
+{
+public:
+    CountingInserter() : count(0), ordered(true) { }
+
+    virtual void insertCopy(const MappedEvent &evt) {
+        if (count > 0 && evt.getEventTime() < last) ordered = false;
+        last = evt.getEventTime();
+        ++count;
+        ++perTrack[evt.getTrackId()];
+    }
+
+    int count;
+    bool ordered;
+    RealTime last;
+    std::vector<int> perTrack;
+};
+
+class TestMetaIterator : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testAllEventsInOrder();
+
+    void benchmarkSlices_data();
+    void benchmarkSlices();
+};
+
+// Short loops spread over a minute, overlapping in groups of about
+// a tenth of the total, as in an arrangement built from many clips
+static void addSegments(MappedBufMetaIterator &metaIterator, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        QSharedPointer<MappedEventBuffer> buffer(
+            new NoteBuffer(i, RealTime::fromMilliseconds((i % 10) * 6000 + i),
+                           RealTime::fromMilliseconds(50 + i % 7 * 10),
+                           60));
+        buffer->init();
+        metaIterator.addSegment(buffer);
+    }
+}
+
+void TestMetaIterator::testAllEventsInOrder()
+{
+    const int segments = 200;
+    MappedBufMetaIterator metaIterator;
+    addSegments(metaIterator, segments);
+    metaIterator.jumpToTime(RealTime::zeroTime);
+
+    CountingInserter inserter;
+    inserter.perTrack.resize(segments, 0);
+
+    // Slices of 100ms, as during playback
+    RealTime slice = RealTime::fromMilliseconds(100);
+    for (RealTime t; t < RealTime(70, 0); t = t + slice) {
+        metaIterator.fetchEvents(inserter, t, t + slice);
+    }
+
+    QCOMPARE(inserter.count, segments * 60);
+    QVERIFY(inserter.ordered);
+    for (int i = 0; i < segments; ++i) {
+        QCOMPARE(inserter.perTrack[i], 60);
+    }
+}
+
+void TestMetaIterator::benchmarkSlices_data()
+{
+    QTest::addColumn<int>("segments");
+    QTest::newRow("10") << 10;
+    QTest::newRow("100") << 100;
+    QTest::newRow("400") << 400;
+    QTest::newRow("1000") << 1000;
+}
+
+void TestMetaIterator::benchmarkSlices()
+{
+    QFETCH(int, segments);
+    MappedBufMetaIterator metaIterator;
+    addSegments(metaIterator, segments);
+
+    CountingInserter inserter;
+    inserter.perTrack.resize(segments, 0);
+    RealTime slice = RealTime::fromMilliseconds(100);
+
+    // Play the whole minute in slices
+    QBENCHMARK {
+        metaIterator.jumpToTime(RealTime::zeroTime);
+        for (RealTime t; t < RealTime(70, 0); t = t + slice) {
+            metaIterator.fetchEvents(inserter, t, t + slice);
+        }
+    }
+}
+
+QTEST_MAIN(TestMetaIterator)
+
+#include "metaiterator.moc"
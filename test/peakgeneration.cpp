@@ -0,0 +1,245 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/RealTime.h"
+#include "misc/TempDir.h"
+#include "sound/PeakFile.h"
+#include "sound/PeakFileManager.h"
+#include "sound/WAVAudioFile.h"
+#include <QFile>
+#include <QSignalSpy>
+#include <QTest>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace Rosegarden;
+
+// Threaded peak file generation, and peaks written while recording
+
+class TestPeakGeneration : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testThreadsMatchSerial();
+    void testRecordingPeaks();
+
+    void benchmarkGenerate_data();
+    void benchmarkGenerate();
+
+private:
+    std::vector<std::vector<float> > generate(int threads);
+
+    std::vector<AudioFile *> m_files;
+};
+
+static const unsigned int sampleRate = 44100;
+static const unsigned int fileCount = 8;
+
+void TestPeakGeneration::initTestCase()
+{
+    qRegisterMetaType<AudioFileId>("AudioFileId");
+
+    for (unsigned int f = 0; f < fileCount; ++f) {
+        QString fileName = TempDir::path() +
+            QString("/rg-test-peakgeneration-%1.wav").arg(f);
+
+        // Stereo files of different lengths, so that the threads don't
+        // finish together
+        const unsigned int frames = sampleRate * (4 + f);
+
+        WAVAudioFile writer(fileName, 2, sampleRate, sampleRate * 4, 4, 16);
+        QVERIFY(writer.write());
+
+        std::vector<short> samples(frames * 2);
+        for (unsigned int i = 0; i < frames; ++i) {
+            double level = 0.5 + 0.4 * sin(i * 0.00003 * (f + 1));
+            samples[i * 2] = short(32000 * level * sin(i * 0.05));
+            samples[i * 2 + 1] = short(16000 * level * sin(i * 0.031));
+        }
+        writer.appendSamples((const char *)&samples[0], frames);
+        writer.close();
+
+        m_files.push_back(new WAVAudioFile(f + 1, "file", fileName));
+    }
+}
+
+void TestPeakGeneration::cleanupTestCase()
+{
+    for (size_t f = 0; f < m_files.size(); ++f) {
+        QFile::remove(m_files[f]->getPeakFilename());
+        QFile::remove(m_files[f]->getFilename());
+        delete m_files[f];
+    }
+    PeakFileManager::setThreadCount(0);
+}
+
+// Generate the peak files, and read back a preview of each
+std::vector<std::vector<float> > TestPeakGeneration::generate(int threads)
+{
+    std::vector<std::vector<float> > previews;
+
+    for (size_t f = 0; f < m_files.size(); ++f) {
+        QFile::remove(m_files[f]->getPeakFilename());
+    }
+
+    PeakFileManager::setThreadCount(threads);
+    PeakFileManager manager;
+    QSignalSpy spy(&manager, SIGNAL(peaksGenerated(AudioFileId)));
+
+    manager.generatePeaks(m_files);
+
+    // One signal per file, and none still generating
+    if (spy.count() != int(m_files.size())) return previews;
+
+    for (size_t f = 0; f < m_files.size(); ++f) {
+        if (manager.isGenerating(m_files[f])) return previews;
+        if (!manager.hasValidPeaks(m_files[f])) return previews;
+
+        previews.push_back(manager.getPreview
+                           (m_files[f], RealTime::zeroTime,
+                            m_files[f]->getLength(), 500, true));
+    }
+
+    return previews;
+}
+
+void TestPeakGeneration::testThreadsMatchSerial()
+{
+    std::vector<std::vector<float> > serial = generate(1);
+    QCOMPARE(serial.size(), size_t(fileCount));
+
+    for (int threads = 2; threads <= 4; ++threads) {
+        std::vector<std::vector<float> > parallel = generate(threads);
+        QCOMPARE(parallel.size(), size_t(fileCount));
+
+        for (size_t f = 0; f < fileCount; ++f) {
+            QVERIFY(!parallel[f].empty());
+            QVERIFY(parallel[f] == serial[f]);
+        }
+    }
+}
+
+// The peak file, less the date it was written
+static QByteArray peakFileContents(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return QByteArray();
+    QByteArray contents = file.readAll();
+    if (contents.size() >= 68) contents.replace(40, 28, QByteArray(28, ' '));
+    return contents;
+}
+
+void TestPeakGeneration::testRecordingPeaks()
+{
+    QString fileName = TempDir::path() + "/rg-test-peakgeneration-rec.wav";
+    const unsigned int frames = sampleRate * 5 + 100;
+
+    std::vector<short> samples(frames * 2);
+    for (unsigned int i = 0; i < frames; ++i) {
+        samples[i * 2] = short(30000 * sin(i * 0.07) * sin(i * 0.0001));
+        samples[i * 2 + 1] = short(20000 * sin(i * 0.013));
+    }
+
+    // Record, in the odd sized lots the writer thread might
+    WAVAudioFile *recording =
+        new WAVAudioFile(fileName, 2, sampleRate, sampleRate * 4, 4, 16);
+    QVERIFY(recording->write());
+
+    PeakFile *recordingPeaks = new PeakFile(recording);
+    QVERIFY(recordingPeaks->beginWrite());
+
+    unsigned int written = 0;
+    int lot = 0;
+    bool previewed = false;
+
+    while (written < frames) {
+        unsigned int n = std::min(frames - written, 1000u + 777u * (lot++ % 5));
+        const char *data = (const char *)&samples[written * 2];
+        recording->appendSamples(data, n);
+        recordingPeaks->appendSamples(data, n);
+        written += n;
+
+        // Halfway through, the peaks so far can be read
+        if (!previewed && written > frames / 2) {
+            WAVAudioFile reader(1, "rec", fileName);
+            PeakFile peakFile(&reader);
+            peakFile.setSampleRate(sampleRate);
+            QVERIFY(peakFile.open());
+            std::vector<float> preview = peakFile.getPreview
+                (RealTime::zeroTime, RealTime(1, 0), 100, false);
+            QCOMPARE(preview.size(), size_t(200));
+            float peak = 0.0f;
+            for (size_t i = 0; i < preview.size(); ++i) {
+                peak = std::max(peak, preview[i]);
+            }
+            QVERIFY(peak > 0.1f);
+            previewed = true;
+        }
+    }
+
+    recording->close();
+    recordingPeaks->close();
+    delete recordingPeaks;
+    delete recording;
+
+    WAVAudioFile reader(1, "rec", fileName);
+    QVERIFY(reader.open());
+    const QString peakFileName = reader.getPeakFilename();
+
+    // Up to date, so no need to generate them again
+    {
+        PeakFile peakFile(&reader);
+        QVERIFY(peakFile.open());
+        QVERIFY(peakFile.isValid());
+    }
+
+    QByteArray recorded = peakFileContents(peakFileName);
+
+    // But if they were, they'd be the same
+    {
+        PeakFile peakFile(&reader);
+        QVERIFY(peakFile.write());
+        peakFile.close();
+    }
+
+    QByteArray generated = peakFileContents(peakFileName);
+
+    QVERIFY(generated.size() > 128);
+    QCOMPARE(recorded.size(), generated.size());
+    QVERIFY(recorded == generated);
+
+    QFile::remove(peakFileName);
+    QFile::remove(fileName);
+}
+
+void TestPeakGeneration::benchmarkGenerate_data()
+{
+    QTest::addColumn<int>("threads");
+
+    QTest::newRow("1 thread") << 1;
+    QTest::newRow("2 threads") << 2;
+    QTest::newRow("4 threads") << 4;
+    QTest::newRow("default") << 0;
+}
+
+void TestPeakGeneration::benchmarkGenerate()
+{
+    QFETCH(int, threads);
+
+    PeakFileManager::setThreadCount(threads);
+    PeakFileManager manager;
+
+    // Existing peak files are written again
+    QBENCHMARK {
+        manager.generatePeaks(m_files);
+    }
+}
+
+QTEST_MAIN(TestPeakGeneration)
+
+#include "peakgeneration.moc"
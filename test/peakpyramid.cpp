@@ -0,0 +1,186 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/RealTime.h"
+#include "misc/TempDir.h"
+#include "sound/PeakFile.h"
+#include "sound/WAVAudioFile.h"
+#include <QFile>
+#include <QTest>
+
+#include <cmath>
+#include <vector>
+
+using namespace Rosegarden;
+
+// Peak pyramid previews, for aligned and unaligned ranges and for peak
+// files from before the pyramid existed, and preview latency at each
+// zoom level on an hour of audio
+
+class TestPeakPyramid : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testPyramidMatchesPeaks();
+    void testOlderPeakFile();
+
+    void benchmarkPreview_data();
+    void benchmarkPreview();
+
+private:
+    void comparePreviews();
+
+    WAVAudioFile *m_file;
+    QString m_fileName;
+};
+
+// An hour of 16-bit mono at a low rate, to keep the file small while
+// having as many peaks as a long recording
+static const unsigned int sampleRate = 8000;
+static const unsigned int seconds = 3600;
+static const unsigned int blockSize = 256; // PeakFile's default
+static const unsigned int peaks = sampleRate * seconds / blockSize;
+
+void TestPeakPyramid::initTestCase()
+{
+    m_fileName = TempDir::path() + "/rg-test-peakpyramid.wav";
+
+    WAVAudioFile writer(m_fileName, 1, sampleRate, sampleRate * 2, 2, 16);
+    QVERIFY(writer.write());
+
+    // A tone whose level wanders, so that the peaks vary
+    std::vector<short> second(sampleRate);
+    for (unsigned int s = 0; s < seconds; ++s) {
+        double level = 0.5 + 0.45 * sin(s * 0.37) * cos(s * 0.011);
+        for (unsigned int i = 0; i < sampleRate; ++i) {
+            double wobble = 1.0 - 0.3 * ((i * 7919 + s) % 1000) / 1000.0;
+            second[i] = short(32000 * level * wobble * sin(i * 0.05));
+        }
+        writer.appendSamples((const char *)&second[0], sampleRate);
+    }
+    writer.close();
+
+    m_file = new WAVAudioFile(1, "hour", m_fileName);
+    QVERIFY(m_file->open());
+
+    PeakFile peakFile(m_file);
+    QVERIFY(peakFile.write());
+    peakFile.close();
+}
+
+void TestPeakPyramid::cleanupTestCase()
+{
+    QFile::remove(m_file->getPeakFilename());
+    delete m_file;
+    QFile::remove(m_fileName);
+    PeakFile::setUsePyramid(true);
+}
+
+// The middle of a peak, so that rounding can't move it
+static RealTime peakTime(unsigned int peak)
+{
+    return RealTime::frame2RealTime(peak * blockSize + blockSize / 2,
+                                    sampleRate);
+}
+
+void TestPeakPyramid::comparePreviews()
+{
+    // Ranges and widths for which each pixel covers whole entries of
+    // some level of the pyramid, and others for which pixels start and
+    // end part way through entries.  Both ways should give the same.
+    const unsigned int starts[] = { 0, 1024, 4096 * 3, 777 };
+    const int widths[] = { 100, 256, 1000 };
+    const unsigned int perPixel[] = { 4, 16, 64, 1024, 37, 301 };
+
+    for (int s = 0; s < 4; ++s) {
+        for (int w = 0; w < 3; ++w) {
+            for (int p = 0; p < 6; ++p) {
+                unsigned int end = starts[s] + widths[w] * perPixel[p];
+                if (end > peaks) continue;
+
+                for (int minima = 0; minima < 2; ++minima) {
+                    std::vector<float> preview[2];
+                    for (int pyramid = 0; pyramid < 2; ++pyramid) {
+                        // A new PeakFile each time, for a cold cache
+                        PeakFile::setUsePyramid(pyramid);
+                        PeakFile peakFile(m_file);
+                        QVERIFY(peakFile.open());
+                        preview[pyramid] = peakFile.getPreview
+                            (peakTime(starts[s]), peakTime(end),
+                             widths[w], minima);
+                    }
+                    QCOMPARE(preview[0].size(), size_t(widths[w]));
+                    QVERIFY(preview[0] == preview[1]);
+                }
+            }
+        }
+    }
+}
+
+void TestPeakPyramid::testPyramidMatchesPeaks()
+{
+    comparePreviews();
+}
+
+void TestPeakPyramid::testOlderPeakFile()
+{
+    // Make an older peak file of ours: the peak chunk alone, with
+    // nothing in the reserved space
+    QFile file(m_file->getPeakFilename());
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.size() > 128 + peaks * 4);
+    QVERIFY(file.resize(128 + peaks * 4));
+    QVERIFY(file.seek(68));
+    QVERIFY(file.write(QByteArray(12, '\0')) == 12);
+    file.close();
+
+    // Its pyramid is built when it is opened
+    comparePreviews();
+}
+
+void TestPeakPyramid::benchmarkPreview_data()
+{
+    QTest::addColumn<int>("visibleSeconds");
+    QTest::addColumn<bool>("pyramid");
+
+    const int visible[] = { 10, 60, 600, 3600 };
+
+    for (int v = 0; v < 4; ++v) {
+        for (int pyramid = 0; pyramid < 2; ++pyramid) {
+            QString name = QString("%1s %2").arg(visible[v]).
+                arg(pyramid ? "pyramid" : "peaks");
+            QTest::newRow(name.toLocal8Bit().data())
+                << visible[v] << bool(pyramid);
+        }
+    }
+}
+
+void TestPeakPyramid::benchmarkPreview()
+{
+    QFETCH(int, visibleSeconds);
+    QFETCH(bool, pyramid);
+
+    PeakFile::setUsePyramid(pyramid);
+    PeakFile peakFile(m_file);
+    QVERIFY(peakFile.open());
+
+    // A segment a thousand pixels wide, as drawn at each zoom level.
+    // Alternate the start by a millisecond, so that each request
+    // misses the last-preview cache.
+    const int width = 1000;
+    int n = 0;
+
+    QBENCHMARK {
+        RealTime start(0, (n++ % 2) * 1000000);
+        std::vector<float> preview = peakFile.getPreview
+            (start, start + RealTime(visibleSeconds, 0), width, false);
+        QVERIFY(!preview.empty());
+    }
+}
+
+QTEST_MAIN(TestPeakPyramid)
+
+#include "peakpyramid.moc"
@@ -0,0 +1,244 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/RealTime.h"
+#include "misc/TempDir.h"
+#include "sound/PlayableAudioFile.h"
+#include "sound/RingBufferPool.h"
+#include "sound/WAVAudioFile.h"
+#include <QFile>
+#include <QMutex>
+#include <QTest>
+#include <QThread>
+
+#include <set>
+#include <vector>
+
+using namespace Rosegarden;
+
+// Concurrency and background growth of RingBufferPool, including 500
+// segments starting at the same moment
+
+class TestRingBufferPool : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testGetAndReturn();
+    void testGrowsInBackground();
+    void testThreads();
+    void testManySegments();
+};
+
+typedef RingBuffer<RingBufferPool::sample_t> Buffer;
+
+void TestRingBufferPool::testGetAndReturn()
+{
+    RingBufferPool pool(1024);
+    pool.setPoolSize(8);
+    QCOMPARE(pool.getPoolSize(), size_t(8));
+
+    Buffer *buffers[8];
+    QVERIFY(pool.getBuffers(8, buffers));
+
+    std::set<Buffer *> distinct(buffers, buffers + 8);
+    QCOMPARE(distinct.size(), size_t(8));
+    QCOMPARE(buffers[0]->getSize(), size_t(1024));
+
+    RingBufferPool::Stats stats = pool.getStats();
+    QCOMPARE(stats.inUse, size_t(8));
+    QCOMPARE(stats.highWaterMark, size_t(8));
+
+    for (int i = 0; i < 8; ++i) {
+        pool.returnBuffer(buffers[i]);
+    }
+
+    stats = pool.getStats();
+    QCOMPARE(stats.inUse, size_t(0));
+    QCOMPARE(stats.highWaterMark, size_t(8));
+    QVERIFY(stats.available >= 8);
+
+    // Free buffers take a new size at once
+    pool.setBufferSize(2048);
+    QVERIFY(pool.getBuffers(1, buffers));
+    QCOMPARE(buffers[0]->getSize(), size_t(2048));
+    pool.returnBuffer(buffers[0]);
+}
+
+void TestRingBufferPool::testGrowsInBackground()
+{
+    RingBufferPool pool(1024);
+    pool.setPoolSize(4);
+
+    std::vector<Buffer *> taken;
+    Buffer *buffers[2];
+
+    // Take more than the pool has.  Requests that find it short fail,
+    // and are met a little later.
+    for (int i = 0; i < 50; ++i) {
+        int tries = 0;
+        while (!pool.getBuffers(2, buffers)) {
+            QVERIFY(++tries < 1000);
+            QTest::qWait(1);
+        }
+        taken.push_back(buffers[0]);
+        taken.push_back(buffers[1]);
+    }
+
+    RingBufferPool::Stats stats = pool.getStats();
+    QCOMPARE(stats.inUse, size_t(100));
+    QCOMPARE(stats.highWaterMark, size_t(100));
+    QVERIFY(stats.buffers >= 100);
+    QVERIFY(stats.grown >= 96);
+
+    std::set<Buffer *> distinct(taken.begin(), taken.end());
+    QCOMPARE(distinct.size(), size_t(100));
+
+    for (size_t i = 0; i < taken.size(); ++i) {
+        pool.returnBuffer(taken[i]);
+    }
+    QCOMPARE(pool.getStats().inUse, size_t(0));
+
+    // Which can be cut back down again
+    pool.setPoolSize(4);
+    QCOMPARE(pool.getPoolSize(), size_t(4));
+}
+
+namespace
+{
+
+// Buffers currently held by any taker, to catch one handed out twice
+struct Holdings
+{
+    Holdings() : duplicates(0) { }
+    QMutex mutex;
+    std::set<Buffer *> held;
+    int duplicates;
+};
+
+class Taker : public QThread
+{
+public:
+    Taker(RingBufferPool *pool, Holdings *holdings) :
+        m_pool(pool), m_holdings(holdings), m_got(0) { }
+
+    int getGot() const { return m_got; }
+
+protected:
+    virtual void run() {
+        Buffer *buffers[2];
+        const float sample = 0.5f;
+        for (int i = 0; i < 20000; ++i) {
+            if (!m_pool->getBuffers(2, buffers)) continue;
+            ++m_got;
+            m_holdings->mutex.lock();
+            for (int b = 0; b < 2; ++b) {
+                if (!m_holdings->held.insert(buffers[b]).second) {
+                    ++m_holdings->duplicates;
+                }
+            }
+            m_holdings->mutex.unlock();
+            buffers[0]->write(&sample, 1);
+            m_holdings->mutex.lock();
+            m_holdings->held.erase(buffers[0]);
+            m_holdings->held.erase(buffers[1]);
+            m_holdings->mutex.unlock();
+            m_pool->returnBuffer(buffers[0]);
+            m_pool->returnBuffer(buffers[1]);
+        }
+    }
+
+private:
+    RingBufferPool *m_pool;
+    Holdings *m_holdings;
+    int m_got;
+};
+
+}
+
+void TestRingBufferPool::testThreads()
+{
+    RingBufferPool pool(256);
+    pool.setPoolSize(6);
+
+    Holdings holdings;
+    std::vector<Taker *> takers;
+    for (int i = 0; i < 4; ++i) {
+        takers.push_back(new Taker(&pool, &holdings));
+        takers[i]->start();
+    }
+
+    int got = 0;
+    for (int i = 0; i < 4; ++i) {
+        takers[i]->wait();
+        got += takers[i]->getGot();
+        delete takers[i];
+    }
+
+    QCOMPARE(holdings.duplicates, 0);
+    QVERIFY(got > 0);
+
+    RingBufferPool::Stats stats = pool.getStats();
+    QCOMPARE(stats.inUse, size_t(0));
+    QCOMPARE(stats.available, stats.buffers);
+    QVERIFY(stats.highWaterMark <= 8);
+}
+
+// 500 short stereo segments of one file, all starting at once, as the
+// file reader would start them: the pool is sized for them first, so
+// none has to wait for buffers
+void TestRingBufferPool::testManySegments()
+{
+    const unsigned int sampleRate = 48000;
+    const int segments = 500;
+
+    QString name = TempDir::path() + "/rg-test-ringbufferpool.wav";
+    {
+        WAVAudioFile writer(name, 2, sampleRate, sampleRate * 4, 4, 16);
+        QVERIFY(writer.write());
+        std::vector<short> samples(sampleRate * 2, 1000);
+        writer.appendSamples((const char *)&samples[0], sampleRate);
+        writer.close();
+    }
+
+    WAVAudioFile file(1, "hit", name);
+    QVERIFY(file.open());
+
+    const size_t bufferFrames = 4096;
+    PlayableAudioFile::setRingBufferPoolSizes(segments * 2 * 2 + 4,
+                                              bufferFrames);
+    RingBufferPool *pool = PlayableAudioFile::getRingBufferPool();
+    QVERIFY(pool);
+    RingBufferPool::Stats before = pool->getStats();
+
+    // Not small files, so that they are streamed through ring buffers
+    std::vector<PlayableAudioFile *> playing;
+    for (int i = 0; i < segments; ++i) {
+        playing.push_back(new PlayableAudioFile
+                          (i, &file, RealTime::zeroTime,
+                           RealTime(0, (i % 10) * 10000000),
+                           RealTime(0, 100000000),
+                           bufferFrames, 0));
+    }
+
+    for (int i = 0; i < segments; ++i) {
+        QVERIFY(!playing[i]->isSmallFile());
+        playing[i]->fillBuffers(RealTime::zeroTime);
+        QVERIFY(playing[i]->getSampleFramesAvailable() > 0);
+    }
+
+    RingBufferPool::Stats stats = pool->getStats();
+    QCOMPARE(stats.shortfalls, before.shortfalls);
+    QCOMPARE(stats.inUse, size_t(segments * 2));
+    QVERIFY(stats.highWaterMark >= size_t(segments * 2));
+
+    for (int i = 0; i < segments; ++i) {
+        delete playing[i];
+    }
+    QCOMPARE(pool->getStats().inUse, size_t(0));
+
+    QFile::remove(name);
+}
+
+QTEST_MAIN(TestRingBufferPool)
+
+#include "ringbufferpool.moc"
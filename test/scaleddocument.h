@@ -0,0 +1,77 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#ifndef RG_TEST_SCALEDDOCUMENT_H
+#define RG_TEST_SCALEDDOCUMENT_H
+
+// Helpers shared by the document load and snapshot tests
+
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/Segment.h"
+#include "document/RosegardenDocument.h"
+#include <QString>
+
+#include <algorithm>
+#include <vector>
+
+namespace Rosegarden
+{
+
+// Whether two segments have the same events, down to the value of
+// every persistent property
+inline bool sameEvents(const Segment &a, const Segment &b)
+{
+    if (a.size() != b.size()) return false;
+    Segment::const_iterator j = b.begin();
+    for (Segment::const_iterator i = a.begin(); i != a.end(); ++i, ++j) {
+        const Event &ea = **i, &eb = **j;
+        if (ea.getType() != eb.getType() ||
+            ea.getAbsoluteTime() != eb.getAbsoluteTime() ||
+            ea.getDuration() != eb.getDuration() ||
+            ea.getSubOrdering() != eb.getSubOrdering()) {
+            return false;
+        }
+        Event::PropertyNames na = ea.getPersistentPropertyNames();
+        Event::PropertyNames nb = eb.getPersistentPropertyNames();
+        std::sort(na.begin(), na.end());
+        std::sort(nb.begin(), nb.end());
+        if (na != nb) return false;
+        for (size_t n = 0; n < na.size(); ++n) {
+            if (ea.getPropertyType(na[n]) != eb.getPropertyType(na[n]) ||
+                ea.getAsString(na[n]) != eb.getAsString(na[n])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Save input as name with every segment repeated scale times, and with
+// a snapshot if asked for.  Returns whether it could.
+inline bool saveScaled(const QString &input, const QString &name, int scale,
+                       bool withSnapshot)
+{
+    if (input.isEmpty()) return false;
+
+    RosegardenDocument doc(0, 0, true /*skip autoload*/, true, false /*no sound*/);
+    if (!doc.openDocument(input, false, true /*no progress dlg*/)) {
+        return false;
+    }
+
+    Composition &comp = doc.getComposition();
+    std::vector<Segment *> original(comp.begin(), comp.end());
+    for (int i = 1; i < scale; ++i) {
+        for (size_t s = 0; s < original.size(); ++s) {
+            comp.addSegment(original[s]->clone());
+        }
+    }
+
+    QString errMsg;
+    if (!doc.saveDocument(name, errMsg, true)) return false;
+    if (withSnapshot && !doc.saveSnapshot(name)) return false;
+    return true;
+}
+
+}
+
+#endif
@@ -0,0 +1,265 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/MidiTypes.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include "document/RosegardenDocument.h"
+#include "gui/seqmanager/SegmentMapper.h"
+#include "sound/MappedEvent.h"
+#include <QTest>
+
+#include <algorithm>
+#include <cstdlib>
+
+using namespace Rosegarden;
+
+// refreshRange() against a full remap after each kind of edit, with
+// benchmarks of the latency from an edit to the sequencer seeing it
+
+class TestSegmentRemap : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestSegmentRemap()
+        : m_doc(0, 0, true /*skip autoload*/, true, false /*no sound*/),
+          m_segment(0) {}
+
+private Q_SLOTS:
+    void initTestCase();
+    void testRangeMatchesFull();
+    void testControllerEdits();
+    void testEndMarker();
+    void testOverlappingNote();
+
+    void benchmarkEditAndRefresh();
+    void benchmarkEditAndRefreshRange();
+
+private:
+    void editNote(int n);
+    bool sameBuffer(SegmentMapper &a, SegmentMapper &b);
+
+    RosegardenDocument m_doc;
+    Segment *m_segment;
+};
+
+static QString findFile(const QString &fileName) {
+    QString attempt = QFile::decodeName(SRCDIR) + '/' + fileName;
+    if (QFile::exists(attempt))
+        return attempt;
+    qWarning() << fileName << "NOT FOUND";
+    return QString();
+}
+
+static Event *makeNote(timeT time, timeT duration, int pitch)
+{
+    Event *e = new Event(Note::EventType, time, duration);
+    e->set<Int>(BaseProperties::PITCH, pitch);
+    e->set<Int>(BaseProperties::VELOCITY, 100);
+    return e;
+}
+
+void TestSegmentRemap::initTestCase()
+{
+    // Borrow a track (and so an instrument) from an example file, and
+    // put a long, dense segment of our own on it
+    const QString input = findFile("../data/examples/test_selection.rg");
+    QVERIFY(!input.isEmpty());
+    m_doc.openDocument(input, false, true /*no progress dlg*/);
+
+    Composition &comp = m_doc.getComposition();
+    QVERIFY(!comp.getSegments().empty());
+    TrackId track = (*comp.getSegments().begin())->getTrack();
+
+    m_segment = new Segment;
+    m_segment->setTrack(track);
+    srand(7);
+    for (int i = 0; i < 20000; ++i) {
+        // Overlapping notes, so that noteoffs interleave with later
+        // notes, and a controller every few beats.  The notes overlap
+        // within phrases of eight, but all end by the end of their
+        // phrase, so an edit at the start of one can be remapped
+        // alone.
+        const timeT phraseEnd = (i / 8 + 1) * 8 * 120;
+        const timeT longest = std::min(timeT(540), phraseEnd - i * 120);
+        m_segment->insert(makeNote(i * 120, 60 + rand() % (longest - 59),
+                                   36 + rand() % 48));
+        if (i % 16 == 0) {
+            m_segment->insert(Controller(7, rand() % 128).
+                              getAsEvent(i * 120 + 60));
+        }
+    }
+    comp.setEndMarker(20000 * 120 + 3840);
+    comp.addSegment(m_segment);
+}
+
+void TestSegmentRemap::editNote(int n)
+{
+    // Move a note and change its length and pitch, as dragging it in
+    // the matrix editor would
+    Segment::iterator i = m_segment->findTime(n * 120);
+    QVERIFY(i != m_segment->end());
+    while (!(*i)->isa(Note::EventType)) ++i;
+
+    Event *e = new Event(**i, (*i)->getAbsoluteTime() + 500,
+                         (*i)->getDuration() + 300);
+    e->set<Int>(BaseProperties::PITCH, 40 + n % 40);
+    m_segment->erase(i);
+    m_segment->insert(e);
+}
+
+bool TestSegmentRemap::sameBuffer(SegmentMapper &a, SegmentMapper &b)
+{
+    if (a.size() != b.size()) return false;
+
+    for (int i = 0; i < a.size(); ++i) {
+        const MappedEvent &ea = a.getBuffer()[i];
+        const MappedEvent &eb = b.getBuffer()[i];
+        if (ea.getType() != eb.getType() ||
+            ea.getData1() != eb.getData1() ||
+            ea.getData2() != eb.getData2() ||
+            ea.getEventTime() != eb.getEventTime() ||
+            ea.getDuration() != eb.getDuration()) {
+            qWarning() << "buffers differ at" << i << "of" << a.size();
+            return false;
+        }
+    }
+    return true;
+}
+
+void TestSegmentRemap::testRangeMatchesFull()
+{
+    QSharedPointer<SegmentMapper> partial =
+        SegmentMapper::makeMapperForSegment(&m_doc, m_segment);
+    QSharedPointer<SegmentMapper> full =
+        SegmentMapper::makeMapperForSegment(&m_doc, m_segment);
+    QVERIFY(partial && full);
+    QVERIFY(sameBuffer(*partial, *full));
+
+    unsigned int id = m_segment->getNewRefreshStatusId();
+
+    // Edits at the start, in the middle, at the end, and two at once
+    const int notes[] = { 0, 10000, 19999, 500, 501, 7000, 15000 };
+    for (size_t n = 0; n < sizeof(notes) / sizeof(notes[0]); ++n) {
+        editNote(notes[n]);
+        if (n == 3) continue;
+
+        SegmentRefreshStatus &status = m_segment->getRefreshStatus(id);
+        QVERIFY(status.needsRefresh());
+        partial->refreshRange(status.from(), status.to());
+        status.setNeedsRefresh(false);
+        full->refresh();
+
+        QVERIFY(sameBuffer(*partial, *full));
+    }
+}
+
+void TestSegmentRemap::testControllerEdits()
+{
+    QSharedPointer<SegmentMapper> partial =
+        SegmentMapper::makeMapperForSegment(&m_doc, m_segment);
+    QSharedPointer<SegmentMapper> full =
+        SegmentMapper::makeMapperForSegment(&m_doc, m_segment);
+
+    unsigned int id = m_segment->getNewRefreshStatusId();
+
+    // Add and remove controllers, which also refreshes the cache of
+    // latest values
+    m_segment->insert(Controller(10, 64).getAsEvent(3000 * 120 + 30));
+    Segment::iterator i = m_segment->findTime(8000 * 120 + 60);
+    QVERIFY((*i)->isa(Controller::EventType));
+    m_segment->eraseSingle(*i);
+
+    SegmentRefreshStatus &status = m_segment->getRefreshStatus(id);
+    partial->refreshRange(status.from(), status.to());
+    status.setNeedsRefresh(false);
+    full->refresh();
+
+    QVERIFY(sameBuffer(*partial, *full));
+}
+
+void TestSegmentRemap::testEndMarker()
+{
+    QSharedPointer<SegmentMapper> partial =
+        SegmentMapper::makeMapperForSegment(&m_doc, m_segment);
+    QSharedPointer<SegmentMapper> full =
+        SegmentMapper::makeMapperForSegment(&m_doc, m_segment);
+
+    unsigned int id = m_segment->getNewRefreshStatusId();
+
+    // Cut the segment off in the middle of a note, then move the end
+    // marker back out again.  The note's noteoff moves each time,
+    // though the note is outside the range reported.
+    const timeT ends[] = { 12000 * 120 + 100, 20000 * 120 + 3840 };
+    for (size_t n = 0; n < sizeof(ends) / sizeof(ends[0]); ++n) {
+        m_segment->setEndMarkerTime(ends[n]);
+
+        SegmentRefreshStatus &status = m_segment->getRefreshStatus(id);
+        QVERIFY(status.needsRefresh());
+        partial->refreshRange(status.from(), status.to());
+        status.setNeedsRefresh(false);
+        full->refresh();
+
+        QVERIFY(sameBuffer(*partial, *full));
+    }
+}
+
+void TestSegmentRemap::testOverlappingNote()
+{
+    QSharedPointer<SegmentMapper> partial =
+        SegmentMapper::makeMapperForSegment(&m_doc, m_segment);
+    QSharedPointer<SegmentMapper> full =
+        SegmentMapper::makeMapperForSegment(&m_doc, m_segment);
+
+    unsigned int id = m_segment->getNewRefreshStatusId();
+
+    // Lengthen a note in place, reporting only the time it now sounds
+    // into, as an edit of its duration alone would
+    Segment::iterator i = m_segment->findTime(4001 * 120);
+    QVERIFY((*i)->isa(Note::EventType));
+    const timeT oldEnd = (*i)->getAbsoluteTime() + (*i)->getDuration();
+    Event *e = new Event(**i, (*i)->getAbsoluteTime(),
+                         (*i)->getDuration() + 1000);
+    m_segment->erase(i);
+    m_segment->insert(e);
+
+    SegmentRefreshStatus &status = m_segment->getRefreshStatus(id);
+    status.setNeedsRefresh(false);
+    partial->refreshRange(oldEnd, oldEnd + 1000);
+    full->refresh();
+
+    QVERIFY(sameBuffer(*partial, *full));
+}
+
+void TestSegmentRemap::benchmarkEditAndRefresh()
+{
+    QSharedPointer<SegmentMapper> mapper =
+        SegmentMapper::makeMapperForSegment(&m_doc, m_segment);
+    int n = 0;
+
+    QBENCHMARK {
+        editNote(1000 + (n++ % 1000) * 16);
+        mapper->refresh();
+    }
+}
+
+void TestSegmentRemap::benchmarkEditAndRefreshRange()
+{
+    QSharedPointer<SegmentMapper> mapper =
+        SegmentMapper::makeMapperForSegment(&m_doc, m_segment);
+    unsigned int id = m_segment->getNewRefreshStatusId();
+    int n = 0;
+
+    QBENCHMARK {
+        editNote(1000 + (n++ % 1000) * 16);
+        SegmentRefreshStatus &status = m_segment->getRefreshStatus(id);
+        mapper->refreshRange(status.from(), status.to());
+        status.setNeedsRefresh(false);
+    }
+}
+
+QTEST_MAIN(TestSegmentRemap)
+
+#include "segmentremap.moc"
@@ -0,0 +1,180 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/Composition.h"
+#include "base/RealTime.h"
+#include <QTest>
+
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace Rosegarden;
+
+// Tests for the Composition's tempo map: batch conversion against
+// single lookups, and incremental recalculation after edits against
+// a freshly built map.  Also benchmarks lookups with many ramps.
+
+class TestTempoMap : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testBatchMatchesSingle();
+    void testIncrementalUpdate();
+    void testRealTimeToTime();
+
+    void benchmarkSingle();
+    void benchmarkBatch();
+    void benchmarkEditAndQuery();
+};
+
+// A tempo change every beat, alternating between plain changes,
+// ramps to an explicit target, and ramps to the next change
+static void addTempos(Composition &c, int count, int seed)
+{
+    srand(seed);
+    for (int i = 0; i < count; ++i) {
+        tempoT tempo = Composition::getTempoForQpm(60 + rand() % 120);
+        tempoT target = -1;
+        switch (i % 3) {
+        case 1: target = Composition::getTempoForQpm(60 + rand() % 120); break;
+        case 2: target = 0; break;
+        }
+        c.addTempoAtTime(i * 960, tempo, target);
+    }
+    c.setEndMarker(count * 960 + 3840);
+}
+
+static std::vector<timeT> makeTimes(int count, timeT last)
+{
+    std::vector<timeT> times;
+    for (int i = 0; i < count; ++i) {
+        times.push_back(timeT(-1920 + (double(i) / count) * (last + 1920)));
+    }
+    return times;
+}
+
+void TestTempoMap::testBatchMatchesSingle()
+{
+    Composition c;
+    addTempos(c, 500, 1);
+
+    std::vector<timeT> times = makeTimes(20000, 500 * 960 + 5000);
+    std::vector<RealTime> results(times.size());
+
+    c.getElapsedRealTimes(&times[0], &results[0], times.size());
+    for (size_t i = 0; i < times.size(); ++i) {
+        QCOMPARE(results[i], c.getElapsedRealTime(times[i]));
+    }
+
+    // Out of order input
+    std::random_shuffle(times.begin(), times.end());
+    c.getElapsedRealTimes(&times[0], &results[0], times.size());
+    for (size_t i = 0; i < times.size(); ++i) {
+        QCOMPARE(results[i], c.getElapsedRealTime(times[i]));
+    }
+}
+
+void TestTempoMap::testIncrementalUpdate()
+{
+    Composition edited;
+    addTempos(edited, 300, 2);
+
+    std::vector<timeT> times = makeTimes(3000, 300 * 960);
+
+    // Query first, so that later edits have a map to invalidate
+    edited.getElapsedRealTime(1000);
+
+    // Edit in the middle, at the start and at the end, then query
+    // part way through so that only a suffix is valid, then edit
+    // again before the valid part
+    edited.addTempoAtTime(150 * 960 + 480, 1000000, 0);
+    edited.removeTempoChange(100);
+    edited.getElapsedRealTime(200 * 960);
+    edited.addTempoAtTime(0, 2000000, 3000000);
+    edited.addTempoAtTime(50 * 960, 900000);
+    edited.removeTempoChange(edited.getTempoChangeCount() - 1);
+    edited.setEndMarker(400 * 960);
+
+    // Build the same tempo list from scratch
+    Composition fresh;
+    for (int i = 0; i < edited.getTempoChangeCount(); ++i) {
+        std::pair<timeT, tempoT> tc = edited.getTempoChange(i);
+        std::pair<bool, tempoT> ramp = edited.getTempoRamping(i, false);
+        fresh.addTempoAtTime(tc.first, tc.second,
+                             ramp.first ? ramp.second : -1);
+    }
+    fresh.setEndMarker(400 * 960);
+
+    for (size_t i = 0; i < times.size(); ++i) {
+        QCOMPARE(edited.getElapsedRealTime(times[i]),
+                 fresh.getElapsedRealTime(times[i]));
+    }
+
+    // Changing the default tempo affects everything
+    edited.setCompositionDefaultTempo(500000);
+    fresh.setCompositionDefaultTempo(500000);
+    fresh.getElapsedRealTime(0);
+    QCOMPARE(edited.getElapsedRealTime(250 * 960),
+             fresh.getElapsedRealTime(250 * 960));
+}
+
+void TestTempoMap::testRealTimeToTime()
+{
+    Composition c;
+    addTempos(c, 200, 3);
+
+    for (timeT t = 0; t < 200 * 960; t += 337) {
+        RealTime rt = c.getElapsedRealTime(t);
+        timeT back = c.getElapsedTimeForRealTime(rt);
+        QVERIFY(back >= t - 2 && back <= t + 2);
+    }
+}
+
+void TestTempoMap::benchmarkSingle()
+{
+    Composition c;
+    addTempos(c, 5000, 4);
+    std::vector<timeT> times = makeTimes(100000, 5000 * 960);
+    c.getElapsedRealTime(0);
+
+    RealTime total;
+    QBENCHMARK {
+        for (size_t i = 0; i < times.size(); ++i) {
+            total = total + c.getElapsedRealTime(times[i]);
+        }
+    }
+}
+
+void TestTempoMap::benchmarkBatch()
+{
+    Composition c;
+    addTempos(c, 5000, 4);
+    std::vector<timeT> times = makeTimes(100000, 5000 * 960);
+    std::vector<RealTime> results(times.size());
+    c.getElapsedRealTime(0);
+
+    QBENCHMARK {
+        c.getElapsedRealTimes(&times[0], &results[0], times.size());
+    }
+}
+
+void TestTempoMap::benchmarkEditAndQuery()
+{
+    // A tempo edit near the end followed by a query, as when dragging
+    // a tempo change in a long film score
+    Composition c;
+    addTempos(c, 5000, 5);
+    c.getElapsedRealTime(0);
+
+    tempoT tempo = Composition::getTempoForQpm(100);
+    RealTime total;
+    QBENCHMARK {
+        c.addTempoAtTime(4990 * 960, ++tempo, 0);
+        total = total + c.getElapsedRealTime(4995 * 960);
+    }
+}
+
+QTEST_MAIN(TestTempoMap)
+
+#include "tempomap.moc"